@@ -1,6 +1,8 @@
 #include "TrainingConfig.h"
 
 #include <folly/Format.h>
+#include <cmath>
+#include <map>
 #include <sstream>
 
 using namespace std;
@@ -19,9 +21,68 @@ ostream& operator<<(
     ostream& out,
     const LearningRateStrategy& learningRateStrategy) {
   out << "learning rate = " << learningRateStrategy.alpha;
+  if (learningRateStrategy.schedule !=
+      LearningRateStrategy::Schedule::Constant) {
+    out << " " << name(learningRateStrategy.schedule);
+  }
+  if (learningRateStrategy.warmupIterations > 0) {
+    out << " warmup=" << learningRateStrategy.warmupIterations;
+  }
   return out;
 }
 
+const char* name(LearningRateStrategy::Schedule schedule) {
+  switch (schedule) {
+    case LearningRateStrategy::Schedule::Constant:
+      return "constant";
+    case LearningRateStrategy::Schedule::Step:
+      return "step";
+    case LearningRateStrategy::Schedule::Exponential:
+      return "exponential";
+    case LearningRateStrategy::Schedule::Cosine:
+      return "cosine";
+  }
+  return "unknown";
+}
+
+double LearningRateStrategy::at(int iteration, int iterations) const {
+  if (iteration < warmupIterations) {
+    return alpha * (iteration + 1) / warmupIterations;
+  }
+  const int t = iteration - warmupIterations;
+  switch (schedule) {
+    case Schedule::Constant:
+      return alpha;
+    case Schedule::Step:
+      return alpha * pow(decayFactor, t / decayEvery);
+    case Schedule::Exponential:
+      return alpha * pow(decayFactor, static_cast<double>(t) / decayEvery);
+    case Schedule::Cosine: {
+      const int span = max(iterations - warmupIterations, 1);
+      return minAlpha +
+          (alpha - minAlpha) * (1 + cos(M_PI * min(t, span) / span)) / 2;
+    }
+  }
+  SCHECK(false);
+  return alpha;
+}
+
+const char* name(OptimizerConfig::Type type) {
+  switch (type) {
+    case OptimizerConfig::Type::SGD:
+      return "sgd";
+    case OptimizerConfig::Type::Momentum:
+      return "momentum";
+    case OptimizerConfig::Type::AdaGrad:
+      return "adagrad";
+    case OptimizerConfig::Type::Adam:
+      return "adam";
+    case OptimizerConfig::Type::LARS:
+      return "lars";
+  }
+  return "unknown";
+}
+
 ostream& operator<<(ostream& out, const RegularizerConfig& regularizerConfig) {
   if (regularizerConfig.policy == RegularizerConfig::L2) {
     out << folly::format("L2({})", regularizerConfig.lambda);
@@ -31,11 +92,13 @@ ostream& operator<<(ostream& out, const RegularizerConfig& regularizerConfig) {
 
 ostream& operator<<(ostream& out, const TrainingConfig& trainingConfig) {
   out << trainingConfig.modelArch << " " << trainingConfig.learningRateStrategy
-      << " " << trainingConfig.regularizerConfig << " "
+      << " optimizer=" << name(trainingConfig.optimizer.type) << " "
+      << trainingConfig.regularizerConfig << " "
       << folly::format(
-             "iterations={} miniBatch={}",
+             "iterations={} miniBatch={} precision={}",
              trainingConfig.iterations,
-             trainingConfig.miniBatchSize);
+             trainingConfig.miniBatchSize,
+             trainingConfig.precision == Precision::FP32 ? "fp32" : "fp64");
   return out;
 }
 
@@ -74,18 +137,45 @@ TrainingConfig TrainingConfig::read(istream& in) {
       {"modelArch", OP(config.modelArch = ModelArchitecture::read(in);)},
       {"learningRateStrategy",
        OP(config.learningRateStrategy = LearningRateStrategy::read(in);)},
+      {"optimizer", OP(config.optimizer = OptimizerConfig::read(in);)},
       {"regularizerConfig",
        OP(config.regularizerConfig = RegularizerConfig::read(in);)},
       {"diagnosticsConfig",
        OP(config.diagnosticsConfig = DiagnosticsConfig::read(in);)},
       {"evaluationConfig",
        OP(config.evaluationConfig = EvaluationConfig::read(in);)},
+      {"checkpointConfig",
+       OP(config.checkpointConfig = CheckpointConfig::read(in);)},
+      {"servingConfig", OP(config.servingConfig = ServingConfig::read(in);)},
       {"iterations", OP(config.iterations = expect<int>(in);)},
       {"miniBatchSize", OP(config.miniBatchSize = expect<int>(in);)},
       {"evaluationBatchSize",
        OP(config.evaluationBatchSize = expect<int>(in);)},
       {"writeModelTo", OP(config.writeModelTo = readString(in);)},
+      {"modelFormat", OP({
+         auto format = expect<string>(in);
+         if (format == "binary") {
+           config.modelFormat = ModelFormat::Binary;
+         } else if (format == "text") {
+           config.modelFormat = ModelFormat::Text;
+         } else {
+           SCHECK_MSG(
+               false, folly::format("Model format {} not expected", format));
+         }
+       })},
       {"threads", OP(config.threads = expect<int>(in);)},
+      {"precision", OP({
+         auto precision = expect<string>(in);
+         if (precision == "fp32") {
+           config.precision = Precision::FP32;
+         } else if (precision == "fp64") {
+           config.precision = Precision::FP64;
+         } else {
+           SCHECK_MSG(
+               false, folly::format("Precision {} not expected", precision));
+         }
+       })},
+      {"planMemory", OP(config.planMemory = expect<int>(in);)},
   };
   return parseConfig(in, processors);
 }
@@ -96,6 +186,9 @@ TrainingDataConfig TrainingDataConfig::read(istream& in) {
       {"trainLabel", OP(config.trainLabel = readString(in);)},
       {"testInput", OP(config.testInput = readString(in);)},
       {"testLabel", OP(config.testLabel = readString(in);)},
+      {"prefetchBatches", OP(config.prefetchBatches = expect<int>(in);)},
+      {"shuffle", OP(config.shuffle = expect<int>(in);)},
+      {"seed", OP(config.seed = expect<int>(in);)},
   };
   return parseConfig(in, processors);
 }
@@ -143,14 +236,15 @@ FullyConnectedLayer FullyConnectedLayer::read(istream& in) {
   return parseConfig(in, processors);
 }
 
-IOperator FullyConnectedLayer::create(IOperator op) const {
+template <typename T>
+IOperator<T> FullyConnectedLayer::build(IOperator<T> op) const {
   if (op->dims().size() > 1) {
-    op = make_shared<AdapterOperator>(Dims{op->dims().dimSize}, op);
+    op = make_shared<AdapterOperator<T>>(Dims{op->dims().dimSize}, op);
   }
 
   for (auto dim : hiddenLayerDims) {
-    op = make_shared<FCLayerOperator>(dim, op);
-    op = make_shared<ReluOperator>(op);
+    op = make_shared<FCLayerOperator<T>>(dim, op);
+    op = make_shared<ReluOperator<T>>(op);
   }
   return op;
 }
@@ -159,11 +253,29 @@ CNNLayer CNNLayer::read(istream& in) {
   Processors<CNNLayer> processors{
       {"width", OP(config.width = expect<int>(in);)},
       {"channel", OP(config.channel = expect<int>(in);)},
+      {"algorithm", OP({
+         auto algorithm = expect<string>(in);
+         if (algorithm == "direct") {
+           config.algorithm = ConvolutionAlgorithm::Direct;
+         } else if (algorithm == "im2col") {
+           config.algorithm = ConvolutionAlgorithm::Im2col;
+         } else if (algorithm == "winograd") {
+           config.algorithm = ConvolutionAlgorithm::Winograd;
+         } else if (algorithm == "auto") {
+           config.algorithm = ConvolutionAlgorithm::Auto;
+         } else {
+           SCHECK_MSG(
+               false,
+               folly::format(
+                   "Convolution algorithm {} not expected", algorithm));
+         }
+       })},
   };
   return parseConfig(in, processors);
 }
 
-IOperator CNNLayer::create(IOperator op) const {
+template <typename T>
+IOperator<T> CNNLayer::build(IOperator<T> op) const {
   auto dims = op->dims();
   if (dims.size() != 3) {
     SCHECK(dims.size() == 1);
@@ -172,11 +284,11 @@ IOperator CNNLayer::create(IOperator op) const {
     int size = std::sqrt(n);
     SCHECK(size * size == n);
     dims = Dims{1, n / size, n / size};
-    op = make_shared<AdapterOperator>(dims, op);
+    op = make_shared<AdapterOperator<T>>(dims, op);
   }
 
-  op = make_shared<ConvolutionLayerOperator>(channel, width, op);
-  op = make_shared<ReluOperator>(op);
+  op = make_shared<ConvolutionLayerOperator<T>>(channel, width, op, algorithm);
+  op = make_shared<ReluOperator<T>>(op);
 
   return op;
 }
@@ -189,13 +301,69 @@ PoolLayer PoolLayer::read(istream& in) {
   return parseConfig(in, processors);
 }
 
-IOperator PoolLayer::create(IOperator op) const {
-  return make_shared<PoolingOperator>(width, stride, op);
+template <typename T>
+IOperator<T> PoolLayer::build(IOperator<T> op) const {
+  return make_shared<PoolingOperator<T>>(width, stride, op);
 }
 
+#define INSTANTIATE_LAYERS(T)                                           \
+  template IOperator<T> FullyConnectedLayer::build(IOperator<T>) const; \
+  template IOperator<T> CNNLayer::build(IOperator<T>) const;            \
+  template IOperator<T> PoolLayer::build(IOperator<T>) const;
+
+INSTANTIATE_LAYERS(float)
+INSTANTIATE_LAYERS(double)
+
 LearningRateStrategy LearningRateStrategy::read(istream& in) {
   Processors<LearningRateStrategy> processors{
       {"alpha", OP(config.alpha = expect<double>(in);)},
+      {"schedule", OP({
+         auto schedule = expect<string>(in);
+         bool found = false;
+         for (auto s : {Schedule::Constant,
+                        Schedule::Step,
+                        Schedule::Exponential,
+                        Schedule::Cosine}) {
+           if (schedule == name(s)) {
+             config.schedule = s;
+             found = true;
+           }
+         }
+         SCHECK_MSG(
+             found, folly::format("Schedule {} not expected", schedule));
+       })},
+      {"warmupIterations", OP(config.warmupIterations = expect<int>(in);)},
+      {"decayEvery", OP(config.decayEvery = expect<int>(in);)},
+      {"decayFactor", OP(config.decayFactor = expect<double>(in);)},
+      {"minAlpha", OP(config.minAlpha = expect<double>(in);)},
+  };
+  auto config = parseConfig(in, processors);
+  SCHECK(config.decayEvery > 0);
+  return config;
+}
+
+OptimizerConfig OptimizerConfig::read(std::istream& in) {
+  Processors<OptimizerConfig> processors{
+      {"type", OP({
+         auto type = expect<string>(in);
+         bool found = false;
+         for (auto t : {Type::SGD,
+                        Type::Momentum,
+                        Type::AdaGrad,
+                        Type::Adam,
+                        Type::LARS}) {
+           if (type == name(t)) {
+             config.type = t;
+             found = true;
+           }
+         }
+         SCHECK_MSG(found, folly::format("Optimizer {} not expected", type));
+       })},
+      {"momentum", OP(config.momentum = expect<double>(in);)},
+      {"beta1", OP(config.beta1 = expect<double>(in);)},
+      {"beta2", OP(config.beta2 = expect<double>(in);)},
+      {"epsilon", OP(config.epsilon = expect<double>(in);)},
+      {"trustCoefficient", OP(config.trustCoefficient = expect<double>(in);)},
   };
   return parseConfig(in, processors);
 }
@@ -237,6 +405,7 @@ DiagnosticsConfig DiagnosticsConfig::read(std::istream& in) {
       {"verifyGradient", OP(config.verifyGradient = expect<int>(in);)},
       {"gradientVerifyDetails",
        OP(config.gradientVerifyDetails = expect<int>(in);)},
+      {"printMemoryPlan", OP(config.printMemoryPlan = expect<int>(in);)},
       {"learningCurveConfig",
        OP(config.learningCurveConfig = LearningCurveConfig::read(in);)},
   };
@@ -248,6 +417,38 @@ EvaluationConfig EvaluationConfig::read(std::istream& in) {
       {"writeEvaluationDetailsTo",
        OP(config.writeEvaluationDetailsTo = readString(in);)},
       {"writeAll", OP(config.writeAll = expect<int>(in);)},
+      {"calibrationExamples",
+       OP(config.calibrationExamples = expect<int>(in);)},
   };
-  return parseConfig(in, processors);
+  auto config = parseConfig(in, processors);
+  SCHECK(config.calibrationExamples >= 0);
+  return config;
+}
+
+CheckpointConfig CheckpointConfig::read(std::istream& in) {
+  Processors<CheckpointConfig> processors{
+      {"writeTo", OP(config.writeTo = readString(in);)},
+      {"every", OP(config.every = expect<int>(in);)},
+      {"resumeFrom", OP(config.resumeFrom = readString(in);)},
+  };
+  auto config = parseConfig(in, processors);
+  SCHECK(config.every >= 0);
+  SCHECK_MSG(
+      config.every == 0 || config.writeTo != "",
+      "checkpointConfig.every requires writeTo");
+  return config;
+}
+
+ServingConfig ServingConfig::read(std::istream& in) {
+  Processors<ServingConfig> processors{
+      {"model", OP(config.model = readString(in);)},
+      {"socket", OP(config.socket = readString(in);)},
+      {"maxBatch", OP(config.maxBatch = expect<int>(in);)},
+      {"maxWaitUs", OP(config.maxWaitUs = expect<int>(in);)},
+      {"reportEvery", OP(config.reportEvery = expect<int>(in);)},
+  };
+  auto config = parseConfig(in, processors);
+  SCHECK(config.maxBatch > 0 && config.maxWaitUs >= 0);
+  SCHECK(config.reportEvery >= 0);
+  return config;
 }
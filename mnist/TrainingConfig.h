@@ -5,15 +5,29 @@
 
 struct ModelLayer {
   virtual ~ModelLayer() {}
-  virtual IOperator create(IOperator input) const = 0;
+  // One overload per supported precision
+  virtual IOperator<float> create(IOperator<float> input) const = 0;
+  virtual IOperator<double> create(IOperator<double> input) const = 0;
   virtual void output(std::ostream& out) const = 0;
 };
 using IModelLayer = std::shared_ptr<ModelLayer>;
 
-struct FullyConnectedLayer : ModelLayer {
+// Implements create() by forwarding to Layer::build<T>()
+template <typename Layer>
+struct ModelLayerImpl : ModelLayer {
+  IOperator<float> create(IOperator<float> input) const override {
+    return static_cast<const Layer*>(this)->build(input);
+  }
+  IOperator<double> create(IOperator<double> input) const override {
+    return static_cast<const Layer*>(this)->build(input);
+  }
+};
+
+struct FullyConnectedLayer : ModelLayerImpl<FullyConnectedLayer> {
   static FullyConnectedLayer read(std::istream& in);
 
-  IOperator create(IOperator op) const override;
+  template <typename T>
+  IOperator<T> build(IOperator<T> op) const;
 
   void output(std::ostream& out) const {
     out << "FC " << hiddenLayerDims;
@@ -22,10 +36,11 @@ struct FullyConnectedLayer : ModelLayer {
   Dims hiddenLayerDims;
 };
 
-struct CNNLayer : ModelLayer {
+struct CNNLayer : ModelLayerImpl<CNNLayer> {
   static CNNLayer read(std::istream& in);
 
-  IOperator create(IOperator op) const override;
+  template <typename T>
+  IOperator<T> build(IOperator<T> op) const;
 
   void output(std::ostream& out) const {
     out << "CNN " << channel << "," << width;
@@ -33,12 +48,16 @@ struct CNNLayer : ModelLayer {
 
   int channel;
   int width;
+  // auto | direct | im2col | winograd; direct is the reference used to
+  // cross-check gradients, auto picks winograd for width 3
+  ConvolutionAlgorithm algorithm = ConvolutionAlgorithm::Auto;
 };
 
-struct PoolLayer : ModelLayer {
+struct PoolLayer : ModelLayerImpl<PoolLayer> {
   static PoolLayer read(std::istream& in);
 
-  IOperator create(IOperator op) const override;
+  template <typename T>
+  IOperator<T> build(IOperator<T> op) const;
 
   void output(std::ostream& out) const {
     out << "Pool " << width << "," << stride;
@@ -58,9 +77,48 @@ struct ModelArchitecture {
 struct LearningRateStrategy {
   static LearningRateStrategy read(std::istream& in);
 
+  // The learning rate of the given iteration (0 based) out of iterations.
+  // It rises linearly to alpha over warmupIterations, then follows the
+  // schedule:
+  //   constant:    alpha
+  //   step:        alpha * decayFactor ^ floor(t / decayEvery)
+  //   exponential: alpha * decayFactor ^ (t / decayEvery)
+  //   cosine:      from alpha down to minAlpha along half a cosine period
+  //                over the remaining iterations
+  // where t counts the iterations after the warmup.
+  double at(int iteration, int iterations) const;
+
+  enum class Schedule { Constant, Step, Exponential, Cosine };
+
   double alpha;
+  Schedule schedule = Schedule::Constant;
+  int warmupIterations = 0;
+  int decayEvery = 1000;
+  double decayFactor = 0.1;
+  double minAlpha = 0;
+};
+
+const char* name(LearningRateStrategy::Schedule schedule);
+
+// How the gradients update the parameters; see optimizer.h
+struct OptimizerConfig {
+  static OptimizerConfig read(std::istream& in);
+
+  enum class Type { SGD, Momentum, AdaGrad, Adam, LARS };
+  Type type = Type::SGD;
+  // Momentum and LARS
+  double momentum = 0.9;
+  // Adam
+  double beta1 = 0.9;
+  double beta2 = 0.999;
+  // AdaGrad and Adam
+  double epsilon = 1e-8;
+  // LARS: the learning rate of a layer is scaled by trust * |w| / |g|
+  double trustCoefficient = 0.001;
 };
 
+const char* name(OptimizerConfig::Type type);
+
 struct TrainingDataConfig {
   static TrainingDataConfig read(std::istream& in);
 
@@ -68,6 +126,13 @@ struct TrainingDataConfig {
   std::string trainLabel;
   std::string testInput;
   std::string testLabel;
+  // Mini-batches assembled ahead of the training step (see prefetcher.h);
+  // 0 assembles each one when the step needs it
+  int prefetchBatches = 2;
+  // Visit the training examples in a new random order every epoch, drawn
+  // from seed (see sampler.h)
+  bool shuffle = true;
+  int seed = 0;
 };
 
 struct RegularizerConfig {
@@ -92,6 +157,8 @@ struct DiagnosticsConfig {
   int testErrorIterations = 5000;
   bool verifyGradient = false;
   bool gradientVerifyDetails = false;
+  // Print every tensor of the memory plan with its size and lifetime
+  bool printMemoryPlan = false;
   LearningCurveConfig learningCurveConfig;
 };
 
@@ -100,22 +167,69 @@ struct EvaluationConfig {
 
   std::string writeEvaluationDetailsTo;
   bool writeAll = false;
+  // The size of the sample of the training set the int8 model calibrates on
+  // (see inference.h); 0 skips evaluating it
+  int calibrationExamples = 1000;
 };
 
+// Training state written while training runs, to resume from after a crash
+struct CheckpointConfig {
+  static CheckpointConfig read(std::istream& in);
+
+  // Overwritten (atomically) every `every` iterations; 0 never writes
+  std::string writeTo;
+  int every = 0;
+  // A checkpoint written as above to continue training from
+  std::string resumeFrom;
+};
+
+// The inference server (server.cpp) of the trained model
+struct ServingConfig {
+  static ServingConfig read(std::istream& in);
+
+  // The model to serve; writeModelTo when empty
+  std::string model;
+  // The Unix domain socket to listen on; stdin and stdout when empty
+  std::string socket;
+  // Requests are coalesced into batches of up to maxBatch, waiting at most
+  // maxWaitUs for the batch of the oldest one to fill up
+  int maxBatch = 32;
+  int maxWaitUs = 500;
+  // Seconds between reports of the latency and throughput; 0 reports on exit
+  // only
+  int reportEvery = 10;
+};
+
+// The element type the model is trained in. fp64 is the reference; fp32
+// halves the memory traffic and doubles the SIMD width.
+enum class Precision { FP32, FP64 };
+
+// How writeModelTo is written: a binary checkpoint (see checkpoint.h) or the
+// text format, which is easier to debug. readModelFrom takes either.
+enum class ModelFormat { Binary, Text };
+
 struct TrainingConfig {
   static TrainingConfig read(std::istream& in);
 
   TrainingDataConfig trainingData;
   ModelArchitecture modelArch;
   LearningRateStrategy learningRateStrategy;
+  OptimizerConfig optimizer;
   RegularizerConfig regularizerConfig;
   DiagnosticsConfig diagnosticsConfig;
   EvaluationConfig evaluationConfig;
+  CheckpointConfig checkpointConfig;
+  ServingConfig servingConfig;
   int iterations;
   int miniBatchSize;
   int evaluationBatchSize;
   std::string writeModelTo;
+  ModelFormat modelFormat = ModelFormat::Binary;
   int threads;
+  Precision precision = Precision::FP64;
+  // Lay out the tensors of each training shard in one workspace after the
+  // first step (see memory_plan.h)
+  bool planMemory = true;
 };
 
 std::ostream& operator<<(std::ostream& out, const ModelArchitecture& modelArch);
@@ -0,0 +1,163 @@
+#include "allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "common.h"
+
+using namespace std;
+
+namespace {
+
+constexpr size_t kAlignment = 64;
+constexpr size_t kMinBytes = 64;
+constexpr int kMinShift = 6;
+// 4 classes per power of two up to 2^kMaxShift bytes
+constexpr int kMaxShift = 40;
+constexpr int kClasses = (kMaxShift - kMinShift) * 4 + 1;
+// Free buffers a thread keeps per class before handing them to the shared
+// pool
+constexpr size_t kThreadCacheEntries = 16;
+
+struct SizeClass {
+  int index;
+  size_t bytes;
+};
+
+// Class 0 is kMinBytes; above that the classes for (2^k, 2^(k+1)] are
+// 2^k * {1.25, 1.5, 1.75, 2}
+SizeClass sizeClass(size_t bytes) {
+  if (bytes <= kMinBytes) {
+    return SizeClass{0, kMinBytes};
+  }
+  int k = 63 - __builtin_clzl(bytes - 1);
+  SCHECK(k < kMaxShift);
+  const size_t step = size_t{1} << (k - 2);
+  const size_t j = (bytes - 1 - (size_t{1} << k)) / step + 1;
+  return SizeClass{
+      static_cast<int>((k - kMinShift) * 4 + j), (size_t{1} << k) + j * step};
+}
+
+atomic<long> systemAllocations{0};
+atomic<long> poolHits{0};
+atomic<long> bytesInUse{0};
+atomic<long> peakBytesInUse{0};
+atomic<long> bytesCached{0};
+atomic<long> allocateNanos{0};
+
+using FreeLists = array<vector<void*>, kClasses>;
+
+struct SharedPool {
+  mutex lock;
+  FreeLists free;
+};
+
+// Never destroyed: Tensors owned by statics may be released after every
+// other static is gone
+SharedPool& sharedPool() {
+  static auto* pool = new SharedPool;
+  return *pool;
+}
+
+struct ThreadCache {
+  ~ThreadCache() {
+    lock_guard<mutex> g(sharedPool().lock);
+    for (int c = 0; c < kClasses; ++c) {
+      auto& to = sharedPool().free[c];
+      to.insert(to.end(), free[c].begin(), free[c].end());
+    }
+  }
+
+  FreeLists free;
+};
+
+// Null once the calling thread has released its cache at exit
+thread_local ThreadCache* threadCache = nullptr;
+thread_local bool threadExiting = false;
+
+ThreadCache* getThreadCache() {
+  if (!threadCache && !threadExiting) {
+    struct Owner {
+      ~Owner() {
+        threadCache = nullptr;
+        threadExiting = true;
+      }
+      ThreadCache cache;
+    };
+    static thread_local Owner owner;
+    threadCache = &owner.cache;
+  }
+  return threadCache;
+}
+
+void* popFree(ThreadCache* cache, int c) {
+  if (cache && !cache->free[c].empty()) {
+    void* p = cache->free[c].back();
+    cache->free[c].pop_back();
+    return p;
+  }
+  lock_guard<mutex> g(sharedPool().lock);
+  auto& shared = sharedPool().free[c];
+  if (shared.empty()) {
+    return nullptr;
+  }
+  void* p = shared.back();
+  shared.pop_back();
+  return p;
+}
+
+void pushFree(ThreadCache* cache, int c, void* p) {
+  if (cache && cache->free[c].size() < kThreadCacheEntries) {
+    cache->free[c].push_back(p);
+    return;
+  }
+  lock_guard<mutex> g(sharedPool().lock);
+  sharedPool().free[c].push_back(p);
+}
+
+} // namespace
+
+void* TensorAllocator::allocate(size_t bytes) {
+  using Clock = chrono::steady_clock;
+  auto start = Clock::now();
+  auto c = sizeClass(bytes);
+  void* p = popFree(getThreadCache(), c.index);
+  if (p) {
+    ++poolHits;
+    bytesCached -= c.bytes;
+  } else {
+    ++systemAllocations;
+    p = ::operator new(c.bytes, align_val_t{kAlignment});
+  }
+
+  long inUse = bytesInUse += c.bytes;
+  long peak = peakBytesInUse.load(memory_order_relaxed);
+  while (inUse > peak &&
+         !peakBytesInUse.compare_exchange_weak(peak, inUse)) {
+  }
+  allocateNanos += chrono::duration_cast<chrono::nanoseconds>(
+                       Clock::now() - start)
+                       .count();
+  return p;
+}
+
+void TensorAllocator::deallocate(void* p, size_t bytes) {
+  auto c = sizeClass(bytes);
+  bytesInUse -= c.bytes;
+  bytesCached += c.bytes;
+  pushFree(getThreadCache(), c.index, p);
+}
+
+TensorAllocator::Stats TensorAllocator::stats() {
+  return Stats{systemAllocations.load(),
+               poolHits.load(),
+               bytesInUse.load(),
+               peakBytesInUse.load(),
+               bytesCached.load(),
+               allocateNanos.load()};
+}
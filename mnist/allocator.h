@@ -0,0 +1,84 @@
+#pragma once
+
+// Pooled storage for Tensor buffers.
+//
+// Training allocates the same set of shapes every mini-batch (operator
+// outputs, gradients and temporaries such as x * w), so instead of returning
+// buffers to the system they are parked on a free list for their size class
+// and handed out again by the next request of that class. Sizes are rounded
+// up to 4 classes per power of two which bounds the waste to 25%.
+//
+// Each thread keeps a small cache per size class; buffers freed on another
+// thread than the one which allocated them (e.g. gradients merged by the
+// trainer) overflow into a shared pool where the allocating threads pick them
+// up again. Once the working set has been seen the pool stops asking the
+// system for memory.
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+class TensorAllocator {
+ public:
+  struct Stats {
+    // Buffers obtained from the system
+    long systemAllocations;
+    // Requests served from a free list
+    long poolHits;
+    long bytesInUse;
+    long peakBytesInUse;
+    // Bytes parked on the free lists
+    long bytesCached;
+    // Time spent in allocate()
+    long allocateNanos;
+
+    long allocations() const {
+      return systemAllocations + poolHits;
+    }
+  };
+
+  static void* allocate(size_t bytes);
+  static void deallocate(void* p, size_t bytes);
+
+  static Stats stats();
+
+  // Zero filled storage for n elements of T. The shared_ptr control block is
+  // pooled as well.
+  template <typename T>
+  static std::shared_ptr<T> make(size_t n);
+
+  // STL allocator over the pool
+  template <typename U>
+  struct Allocator {
+    using value_type = U;
+
+    Allocator() = default;
+    template <typename V>
+    Allocator(const Allocator<V>&) {}
+
+    U* allocate(size_t n) {
+      return static_cast<U*>(TensorAllocator::allocate(n * sizeof(U)));
+    }
+    void deallocate(U* p, size_t n) {
+      TensorAllocator::deallocate(p, n * sizeof(U));
+    }
+
+    template <typename V>
+    bool operator==(const Allocator<V>&) const {
+      return true;
+    }
+    template <typename V>
+    bool operator!=(const Allocator<V>&) const {
+      return false;
+    }
+  };
+};
+
+template <typename T>
+std::shared_ptr<T> TensorAllocator::make(size_t n) {
+  const size_t bytes = n * sizeof(T);
+  auto* p = static_cast<T*>(allocate(bytes));
+  std::memset(p, 0, bytes);
+  return std::shared_ptr<T>{
+      p, [bytes](T* x) { deallocate(x, bytes); }, Allocator<T>{}};
+}
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "experimental/rockyliu/mnist/scheduler.h"
+#include "experimental/rockyliu/mnist/tensor.h"
+
+using namespace std;
+
+// Times the forward pass and both gradients of a 3x3 convolution with im2col
+// and with Winograd, on the layer shapes of the sample configs and on wider
+// ones, in fp32 and fp64 on one thread. The Winograd filter is cached as in
+// ConvolutionLayerOperator.
+
+namespace {
+
+template <typename F>
+double microseconds(int iterations, F&& f) {
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f();
+  }
+  chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+template <typename T>
+void run(const char* precision) {
+  mt19937 gen(0);
+  uniform_real_distribution<T> dist(-1, 1);
+  auto random = [&](Dims dims) {
+    TensorT<T> t{dims};
+    for (auto& x : t.data()) {
+      x = dist(gen);
+    }
+    return t;
+  };
+
+  // {batch, input channel, output channel, image size}
+  vector<vector<int>> shapes{
+      {32, 1, 4, 28}, {32, 4, 8, 14}, {32, 16, 32, 28}, {32, 64, 64, 14}};
+  for (auto& shape : shapes) {
+    auto x = random(Dims{shape[0], shape[1], shape[3], shape[3]});
+    auto w = random(Dims{shape[2], shape[1], 3, 3});
+    auto g = random(Dims{shape[0], shape[2], shape[3], shape[3]});
+    TensorT<T> out;
+    WinogradFilterT<T> filter;
+    const int iterations = shape[1] * shape[2] > 64 ? 5 : 50;
+
+    for (auto algorithm :
+         {ConvolutionAlgorithm::Im2col, ConvolutionAlgorithm::Winograd}) {
+      auto forward = microseconds(
+          iterations, [&]() { convolve(x, w, out, algorithm, &filter); });
+      auto wGradient = microseconds(iterations, [&]() {
+        convolveWGradient(x, g, w.dims(), out, algorithm);
+      });
+      auto xGradient = microseconds(iterations, [&]() {
+        convolveXGradient(g, w, x.dims(), out, algorithm, &filter);
+      });
+      cout << folly::format(
+                  "{:<6}{:>4}{:>4}{:>4}  {:<10}{:>12.0f}{:>12.0f}{:>12.0f}",
+                  precision,
+                  shape[1],
+                  shape[2],
+                  shape[3],
+                  algorithm == ConvolutionAlgorithm::Im2col ? "im2col"
+                                                            : "winograd",
+                  forward,
+                  wGradient,
+                  xGradient)
+           << endl;
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  TaskRunner::setThreads(1);
+  cout << folly::format(
+              "{:<6}{:>4}{:>4}{:>4}  {:<10}{:>12}{:>12}{:>12}",
+              "",
+              "in",
+              "out",
+              "n",
+              "algorithm",
+              "forward(us)",
+              "W grad(us)",
+              "X grad(us)")
+       << endl;
+  run<float>("fp32");
+  run<double>("fp64");
+}
@@ -0,0 +1,70 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include "experimental/rockyliu/mnist/tensor.h"
+
+using namespace std;
+
+// Compares gemm() against the reference i-j-k loop on the FC layer shapes:
+// x{128, 784} * w{784, 800} in the forward pass, g{128, 800} * w^T for the
+// input gradient and x^T * g for the weight gradient.
+
+namespace {
+
+Tensor random(Dims dims) {
+  static mt19937 gen(0);
+  uniform_real_distribution<> dist(-1, 1);
+  Tensor t{dims};
+  for (auto& x : t.data()) {
+    x = dist(gen);
+  }
+  return t;
+}
+
+template <typename F>
+double seconds(int iterations, F&& f) {
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f();
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+template <typename MX1, typename MX2>
+void run(string layout, const MX1& a, const MX2& b) {
+  const double flops = 2.0 * a.rows() * a.cols() * b.cols();
+
+  Tensor fast, naive;
+  auto tFast = seconds(10, [&]() { fast = a * b; });
+  auto tNaive = seconds(1, [&]() { naive = multiplyNaive(a, b); });
+  SCHECK(fast.equals(naive, 1e-9));
+
+  cout << folly::format(
+              "{} {}x{}x{}: naive {:.2F} GFLOP/s, gemm {:.2F} GFLOP/s "
+              "({:.1F}x)",
+              layout,
+              a.rows(),
+              a.cols(),
+              b.cols(),
+              flops / tNaive / 1e9,
+              flops / tFast / 1e9,
+              tNaive / tFast)
+       << endl;
+}
+
+} // namespace
+
+int main() {
+  const int M = 128, K = 784, N = 800;
+
+  auto x = random(Dims{M, K});
+  auto w = random(Dims{K, N});
+  auto g = random(Dims{M, N});
+  Matrix xm{x}, wm{w}, gm{g};
+
+  run("NN", xm, wm);
+  run("NT", gm, wm.transpose());
+  run("TN", xm.transpose(), gm);
+}
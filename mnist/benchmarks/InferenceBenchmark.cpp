@@ -0,0 +1,106 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include "experimental/rockyliu/mnist/graph.h"
+#include "experimental/rockyliu/mnist/inference.h"
+#include "experimental/rockyliu/mnist/scheduler.h"
+
+using namespace std;
+
+// Compares ForwardPassModel, which runs the training graph, against the
+// InferenceEngine compiled from it, in T and in int8, on the MLP and CNN
+// architectures of the sample configs: the latency of one image and of a
+// batch, and the throughput over 2048 images. The pixels are random; the
+// weights are those of a fresh graph.
+
+namespace {
+
+const int IMAGES = 2048;
+const int BATCH = 64;
+
+template <typename F>
+double microseconds(int iterations, F&& f) {
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f();
+  }
+  chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+} // namespace
+
+int main() {
+  TaskRunner::setThreads(1);
+  const int pixels = Example::rows * Example::cols;
+  mt19937 gen(0);
+  vector<uint8_t> images(IMAGES * pixels);
+  for (auto& x : images) {
+    x = gen() % 256;
+  }
+  ExampleList examples;
+  for (int i = 0; i < IMAGES; ++i) {
+    examples.push_back(Example{images.data() + i * pixels, i % N_CLASS});
+  }
+  const ExampleList first(examples.begin(), examples.begin() + 1);
+  const ExampleList batch(examples.begin(), examples.begin() + BATCH);
+
+  vector<pair<string, string>> archs{
+      {"mlp", "{ fcLayer = { hiddenLayerDims = { 800 } } }"},
+      {"cnn",
+       "{ cnnLayer = { width = 3 channel = 4 } "
+       "poolLayer = { width = 2 stride = 2 } "
+       "fcLayer = { hiddenLayerDims = { 64 } } }"},
+      {"cnn2",
+       "{ cnnLayer = { width = 3 channel = 4 } "
+       "poolLayer = { width = 2 stride = 2 } "
+       "cnnLayer = { width = 3 channel = 8 } "
+       "poolLayer = { width = 2 stride = 2 } "
+       "fcLayer = { hiddenLayerDims = { 64 } } }"},
+  };
+
+  cout << folly::format(
+              "{:<6}{:<8}{:>12}{:>12}{:>14}",
+              "model",
+              "runner",
+              "1 image(us)",
+              "batch(us)",
+              "images/s")
+       << endl;
+  for (auto& arch : archs) {
+    istringstream in(arch.second);
+    auto ops = GraphBuilder::buildMLP<Float>(
+        pixels, N_CLASS, ModelArchitecture::read(in));
+    // The graph runs whole batches only
+    ForwardPassModel<Float> single{ops.first, ops.second, 1};
+    ForwardPassModel<Float> graph{ops.first, ops.second, BATCH};
+    auto engine = InferenceEngine<Float>::compile(graph, BATCH);
+    auto int8 = InferenceEngine<Float>::quantize(graph, BATCH, batch);
+
+    struct Runner {
+      const char* name;
+      const Model& single;
+      const Model& batched;
+    };
+    for (auto& runner : {Runner{"graph", single, graph},
+                         Runner{"engine", *engine, *engine},
+                         Runner{"int8", *int8, *int8}}) {
+      // Warms up the contexts
+      runner.batched.predict(batch);
+      auto one = microseconds(200, [&]() { runner.single.predict(first); });
+      auto many = microseconds(50, [&]() { runner.batched.predict(batch); });
+      auto all = microseconds(5, [&]() { runner.batched.predict(examples); });
+      cout << folly::format(
+                  "{:<6}{:<8}{:>12.1f}{:>12.1f}{:>14.0f}",
+                  arch.first,
+                  runner.name,
+                  one,
+                  many,
+                  IMAGES / all * 1e6)
+           << endl;
+    }
+    cout << int8->describe();
+  }
+}
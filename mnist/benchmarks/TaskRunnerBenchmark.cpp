@@ -0,0 +1,141 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/futures/Future.h>
+
+#include "experimental/rockyliu/mnist/common.h"
+#include "experimental/rockyliu/mnist/scheduler.h"
+
+using namespace std;
+
+// Dispatch latency of the work-stealing TaskRunner against the folly
+// CPUThreadPoolExecutor wrapper it replaced: the time from handing over a
+// set of tasks to having all of them finished, for empty tasks and for tasks
+// about the size of a per-thread slice of an FC layer.
+//
+// Usage: task_runner_benchmark [threads]
+
+namespace {
+
+// TaskRunner as it was written before scheduler.h
+class LegacyTaskRunner {
+ public:
+  explicit LegacyTaskRunner(int n) {
+    auto queue = std::make_unique<folly::LifoSemMPMCQueue<
+        folly::CPUThreadPoolExecutor::CPUTask,
+        folly::QueueBehaviorIfFull::BLOCK>>(n * 10);
+    executor_ = std::make_unique<folly::CPUThreadPoolExecutor>(n, move(queue));
+  }
+
+  void run(const vector<TaskRunner::Task>& tasks) {
+    const int T = tasks.size();
+
+    std::atomic<int> finished{0};
+    folly::Promise<folly::Unit> promise;
+    auto future = promise.getFuture();
+
+    for (int t = 0; t < T; t++) {
+      auto* task = &tasks[t];
+      auto compute = [T, task, &finished, &promise]() -> void {
+        (*task)();
+        if (++finished == T) {
+          promise.setValue();
+        }
+      };
+      if (t < T - 1) {
+        folly::via(executor_.get(), compute);
+      } else {
+        compute();
+      }
+    }
+
+    future.wait();
+  }
+
+ private:
+  std::unique_ptr<folly::Executor> executor_;
+};
+
+template <typename F>
+double microseconds(F&& f) {
+  const int iterations = 2000;
+  // Warm up the threads
+  for (int i = 0; i < 10; ++i) {
+    f();
+  }
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f();
+  }
+  chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+volatile double sink;
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const int threads = argc > 1 ? atoi(argv[1]) : 4;
+  TaskRunner::setThreads(threads);
+  auto& runner = TaskRunner::get();
+  LegacyTaskRunner legacy{threads};
+
+  // 128 x 100 doubles: a 32 example slice of a 400 unit layer
+  vector<double> data(threads * 12800, 1.0);
+  auto work = [&](int i) {
+    auto begin = data.begin() + i * 12800;
+    sink = accumulate(begin, begin + 12800, 0.0);
+  };
+
+  vector<TaskRunner::Task> empty(threads, []() {});
+  vector<TaskRunner::Task> slices;
+  for (int i = 0; i < threads; ++i) {
+    slices.push_back([&work, i]() { work(i); });
+  }
+
+  struct Case {
+    string name;
+    function<void()> legacy;
+    function<void()> current;
+  };
+  vector<Case> cases{
+      {"empty tasks",
+       [&]() { legacy.run(empty); },
+       [&]() { runner.run(empty); }},
+      {"slices",
+       [&]() { legacy.run(slices); },
+       [&]() { runner.run(slices); }},
+      {"parallelFor slices",
+       [&]() { legacy.run(slices); },
+       [&]() {
+         runner.parallelFor(0, threads, 1, [&](int b, int e) {
+           for (int i = b; i < e; ++i) {
+             work(i);
+           }
+         });
+       }},
+  };
+
+  cout << folly::format(
+              "{} threads\n{:<20}{:>14}{:>14}",
+              threads,
+              "case",
+              "folly(us)",
+              "stealing(us)")
+       << endl;
+  for (auto& c : cases) {
+    auto before = microseconds(c.legacy);
+    auto after = microseconds(c.current);
+    cout << folly::format(
+                "{:<20}{:>14.2F}{:>14.2F} ({:.1F}x)",
+                c.name,
+                before,
+                after,
+                before / after)
+         << endl;
+  }
+}
@@ -0,0 +1,289 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#include "mapped_file.h"
+
+using namespace std;
+
+namespace {
+
+constexpr char kMagic[8] = {'M', 'N', 'I', 'S', 'T', 'C', 'K', 'P'};
+// Tells the byte order the file was written in
+constexpr uint32_t kByteOrder = 0x01020304;
+constexpr int kMaxRank = 6;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  // sizeof(T) of the tensors
+  uint32_t elementSize;
+  uint32_t tensors;
+  uint64_t descriptionBytes;
+  uint64_t payloadOffset;
+  uint64_t payloadBytes;
+  uint64_t checksum;
+};
+
+struct TensorEntry {
+  uint32_t rank;
+  int32_t dims[kMaxRank];
+  // Of the elements, from the start of the payload
+  uint64_t offset;
+};
+
+size_t alignUp(size_t x, size_t alignment) {
+  return (x + alignment - 1) / alignment * alignment;
+}
+
+class Fnv1a {
+ public:
+  void add(const void* data, size_t n) {
+    auto p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < n; ++i) {
+      hash_ = (hash_ ^ p[i]) * 0x100000001b3ull;
+    }
+  }
+  uint64_t value() const {
+    return hash_;
+  }
+
+ private:
+  uint64_t hash_ = 0xcbf29ce484222325ull;
+};
+
+// The tensors of a checkpoint written in precision U
+template <typename T, typename U>
+vector<TensorT<T>> loadTensors(
+    const shared_ptr<MappedFile>& file,
+    const uint8_t* payload,
+    const vector<pair<Dims, uint64_t>>& entries) {
+  vector<TensorT<T>> ret;
+  for (auto& e : entries) {
+    SCHECK(e.second % alignof(U) == 0);
+    auto data = reinterpret_cast<U*>(const_cast<uint8_t*>(payload + e.second));
+    // Shares the ownership of the mapping
+    auto t = TensorT<U>::wrap(e.first, shared_ptr<U>(file, data));
+    if constexpr (is_same<T, U>::value) {
+      ret.push_back(move(t));
+    } else {
+      ret.push_back(TensorT<T>::cast(t));
+    }
+  }
+  return ret;
+}
+
+} // namespace
+
+template <typename T>
+void Checkpoint<T>::write(
+    const string& file,
+    const string& description,
+    const vector<const TensorT<T>*>& tensors) {
+  vector<TensorEntry> table(tensors.size());
+  uint64_t payloadBytes = 0;
+  for (size_t i = 0; i < tensors.size(); ++i) {
+    auto dims = tensors[i]->dims();
+    SCHECK(dims.size() <= kMaxRank);
+    auto& e = table[i];
+    memset(&e, 0, sizeof(e));
+    e.rank = dims.size();
+    copy(dims.begin(), dims.end(), e.dims);
+    e.offset = alignUp(payloadBytes, kPayloadAlignment);
+    payloadBytes = e.offset + tensors[i]->total() * sizeof(T);
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byteOrder = kByteOrder;
+  header.elementSize = sizeof(T);
+  header.tensors = tensors.size();
+  header.descriptionBytes = description.size();
+  const size_t tableOffset = alignUp(sizeof(Header) + description.size(), 8);
+  header.payloadOffset = alignUp(
+      tableOffset + table.size() * sizeof(TensorEntry), kPayloadAlignment);
+  header.payloadBytes = payloadBytes;
+
+  // Everything after the header, in file order; once for the checksum and
+  // once into the file
+  auto body = [&](auto&& put) {
+    static const char zeros[kPayloadAlignment] = {};
+    size_t pos = sizeof(Header);
+    auto emit = [&](const void* data, size_t n) {
+      put(data, n);
+      pos += n;
+    };
+    auto padTo = [&](size_t offset) { emit(zeros, offset - pos); };
+
+    emit(description.data(), description.size());
+    padTo(tableOffset);
+    emit(table.data(), table.size() * sizeof(TensorEntry));
+    for (size_t i = 0; i < tensors.size(); ++i) {
+      padTo(header.payloadOffset + table[i].offset);
+      emit(tensors[i]->data().begin(), tensors[i]->total() * sizeof(T));
+    }
+  };
+
+  Fnv1a hash;
+  body([&](const void* data, size_t n) { hash.add(data, n); });
+  header.checksum = hash.value();
+
+  const string tmp = file + ".tmp";
+  {
+    ofstream out(tmp, ios::binary | ios::trunc);
+    SCHECK_MSG(out.good(), folly::format("Cannot write {}", tmp));
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    body([&](const void* data, size_t n) {
+      out.write(static_cast<const char*>(data), n);
+    });
+    SCHECK_MSG(out.good(), folly::format("Cannot write {}", tmp));
+  }
+  SCHECK_MSG(
+      rename(tmp.c_str(), file.c_str()) == 0,
+      folly::format("Cannot rename {} to {}", tmp, file));
+}
+
+template <typename T>
+Checkpoint<T> Checkpoint<T>::read(const string& file) {
+  auto mapping = make_shared<MappedFile>(file, true);
+  const uint8_t* p = mapping->data();
+  const size_t size = mapping->size();
+
+  Header header;
+  SCHECK_MSG(
+      size >= sizeof(header), folly::format("{} is not a checkpoint", file));
+  memcpy(&header, p, sizeof(header));
+  SCHECK_MSG(
+      memcmp(header.magic, kMagic, sizeof(kMagic)) == 0,
+      folly::format("{} is not a checkpoint", file));
+  SCHECK_MSG(
+      header.version == kVersion,
+      folly::format(
+          "{} is of version {}; expected {}", file, header.version, kVersion));
+  SCHECK_MSG(
+      header.byteOrder == kByteOrder,
+      folly::format("{} was written in another byte order", file));
+  SCHECK(header.elementSize == sizeof(float) ||
+         header.elementSize == sizeof(double));
+  const size_t tableOffset =
+      alignUp(sizeof(Header) + header.descriptionBytes, 8);
+  SCHECK(
+      tableOffset + header.tensors * sizeof(TensorEntry) <=
+          header.payloadOffset &&
+      header.payloadOffset % kPayloadAlignment == 0 &&
+      header.payloadOffset + header.payloadBytes <= size);
+
+  Fnv1a hash;
+  hash.add(
+      p + sizeof(Header),
+      header.payloadOffset + header.payloadBytes - sizeof(Header));
+  SCHECK_MSG(
+      hash.value() == header.checksum,
+      folly::format("{} is corrupt: checksum mismatch", file));
+
+  Checkpoint ret;
+  ret.description_.assign(
+      reinterpret_cast<const char*>(p + sizeof(Header)),
+      header.descriptionBytes);
+
+  vector<pair<Dims, uint64_t>> entries;
+  for (uint32_t i = 0; i < header.tensors; ++i) {
+    TensorEntry e;
+    memcpy(&e, p + tableOffset + i * sizeof(TensorEntry), sizeof(e));
+    SCHECK(e.rank <= kMaxRank && e.offset % kPayloadAlignment == 0);
+    Dims dims{vector<Dim>(e.dims, e.dims + e.rank)};
+    SCHECK(
+        e.offset + dimSize(dims) * header.elementSize <= header.payloadBytes);
+    entries.emplace_back(dims, e.offset);
+  }
+
+  const uint8_t* payload = p + header.payloadOffset;
+  ret.tensors_ = header.elementSize == sizeof(float)
+      ? loadTensors<T, float>(mapping, payload, entries)
+      : loadTensors<T, double>(mapping, payload, entries);
+  return ret;
+}
+
+bool isCheckpoint(const string& file) {
+  ifstream in(file, ios::binary);
+  char magic[sizeof(kMagic)];
+  in.read(magic, sizeof(magic));
+  return in.good() && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+template <typename T>
+CheckpointWriter<T>::CheckpointWriter(string file) : file_(move(file)) {
+  thread_ = std::thread([this]() { run(); });
+}
+
+template <typename T>
+CheckpointWriter<T>::~CheckpointWriter() {
+  wait();
+  {
+    lock_guard<mutex> g(lock_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+}
+
+template <typename T>
+void CheckpointWriter<T>::wait() {
+  unique_lock<mutex> l(lock_);
+  changed_.wait(l, [this]() { return !pending_; });
+}
+
+template <typename T>
+void CheckpointWriter<T>::write(
+    string description,
+    const vector<const TensorT<T>*>& tensors) {
+  wait();
+  // The writing thread is idle until pending_ is set
+  description_ = move(description);
+  snapshot_.resize(tensors.size());
+  for (size_t i = 0; i < tensors.size(); ++i) {
+    // Copies into the storage of the previous snapshot when the shapes match
+    snapshot_[i] = *tensors[i];
+  }
+  {
+    lock_guard<mutex> g(lock_);
+    pending_ = true;
+  }
+  changed_.notify_all();
+}
+
+template <typename T>
+void CheckpointWriter<T>::run() {
+  while (true) {
+    {
+      unique_lock<mutex> l(lock_);
+      changed_.wait(l, [this]() { return pending_ || stop_; });
+      if (!pending_) {
+        return;
+      }
+    }
+
+    vector<const TensorT<T>*> tensors;
+    for (auto& t : snapshot_) {
+      tensors.push_back(&t);
+    }
+    Checkpoint<T>::write(file_, description_, tensors);
+
+    {
+      lock_guard<mutex> g(lock_);
+      pending_ = false;
+    }
+    changed_.notify_all();
+  }
+}
+
+template class Checkpoint<float>;
+template class Checkpoint<double>;
+template class CheckpointWriter<float>;
+template class CheckpointWriter<double>;
@@ -0,0 +1,91 @@
+#pragma once
+
+// Binary checkpoints: a description (free text; for a model its
+// architecture) and a list of tensors, stored so that the file can be memory
+// mapped and its tensors used in place.
+//
+// Layout, in the byte order of the machine that wrote it:
+//   Header
+//   description     header.descriptionBytes of text
+//   tensor table    header.tensors entries of TensorEntry
+//   payload         at header.payloadOffset, the elements of every tensor,
+//                   each starting on a kPayloadAlignment boundary
+// header.checksum is the FNV-1a hash of everything after the header.
+//
+// read() maps the file copy-on-write and verifies the checksum; the tensors
+// it returns point into the mapping (unless they are converted to another
+// precision), which stays mapped as long as any of them lives. Writing to
+// them does not change the file.
+//
+// The text format of Model::read() / write() stays for debugging.
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tensor.h"
+
+template <typename T>
+class Checkpoint {
+ public:
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kPayloadAlignment = 64;
+
+  // Writes to file.tmp and renames it, so file is either the previous
+  // checkpoint or the new one
+  static void write(
+      const std::string& file,
+      const std::string& description,
+      const std::vector<const TensorT<T>*>& tensors);
+  static Checkpoint read(const std::string& file);
+
+  const std::string& description() const {
+    return description_;
+  }
+  std::vector<TensorT<T>>& tensors() {
+    return tensors_;
+  }
+
+ private:
+  std::string description_;
+  std::vector<TensorT<T>> tensors_;
+};
+
+// Whether file starts like a checkpoint (rather than a text model)
+bool isCheckpoint(const std::string& file);
+
+// Writes checkpoints of live tensors (e.g. while training keeps updating
+// them) on a background thread. write() copies the tensors into a snapshot,
+// whose buffers are reused from one checkpoint to the next, and returns; the
+// caller only waits if the previous checkpoint is still being written.
+template <typename T>
+class CheckpointWriter {
+ public:
+  explicit CheckpointWriter(std::string file);
+  // Finishes the checkpoint in progress
+  ~CheckpointWriter();
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  void write(
+      std::string description,
+      const std::vector<const TensorT<T>*>& tensors);
+  // Until the checkpoint in progress is on disk
+  void wait();
+
+ private:
+  void run();
+
+  const std::string file_;
+  std::string description_;
+  std::vector<TensorT<T>> snapshot_;
+
+  std::mutex lock_;
+  std::condition_variable changed_;
+  bool pending_ = false;
+  bool stop_ = false;
+  std::thread thread_;
+};
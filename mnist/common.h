@@ -5,15 +5,15 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstdint>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
 
-#include <folly/executors/CPUThreadPoolExecutor.h>
-
 const int N_IMAGE = 28;
 const int N_CLASS = 10;
 using Float = double;
@@ -61,29 +61,22 @@ inline int dimSize(const Dims& dims) {
   return dims.dimSize;
 }
 
+// One image and its label. The pixels are not owned: they are the raw bytes
+// of the image in the dataset it comes from (see dataset.h), row by row.
 struct Example {
-  void normalize();
+  static constexpr int rows = N_IMAGE;
+  static constexpr int cols = N_IMAGE;
+
+  // Pixel i, scaled into [-1, 1]
+  Float pixel(int i) const {
+    return pixels[i] / (255.0 / 2) - 1.0;
+  }
 
-  const int rows = N_IMAGE;
-  const int cols = N_IMAGE;
-  std::array<std::array<Float, N_IMAGE>, N_IMAGE> image;
+  const uint8_t* pixels;
   int label;
 };
 using ExampleList = std::vector<Example>;
 
-class ExampleReader {
- public:
-  ExampleReader(std::string image, std::string label);
-  folly::Optional<Example> read();
-  ExampleList readAll();
-
- private:
-  std::ifstream image_;
-  std::ifstream label_;
-  int numExample_;
-  int cur_{0};
-};
-
 void printStackTrace();
 
 #define SCHECK(f, ...)                                              \
@@ -185,28 +178,6 @@ std::vector<T> operator/(const std::vector<T>& a, const std::vector<T>& b) {
   return ret;
 }
 
-class TaskRunner {
- public:
-  using Task = std::function<void()>;
-
-  static TaskRunner& get();
-  void run(const std::vector<Task>& tasks);
-  void runAsync(const Task& task);
-
-  static void setThreads(int n) {
-    nThreads_ = n;
-  }
-  static int nThreads() {
-    return nThreads_;
-  }
-
- private:
-  TaskRunner();
-
-  static int nThreads_;
-  std::unique_ptr<folly::Executor> executor_;
-};
-
 namespace {
 using std::istream;
 using std::string;
@@ -304,13 +275,27 @@ std::ostream& operator<<(std::ostream& out, const std::array<T, N>& v) {
   return out;
 }
 
+// A run of examples: examples[start], ..., examples[start + size - 1], or
+// with an order, examples[order[start]], ..., examples[order[start + size -
+// 1]] (see EpochSampler). Ranges do not wrap around the end.
 class ExampleRange {
  public:
+  ExampleRange() : v_(nullptr), start_(0), size_(0) {}
   ExampleRange(const ExampleList& examples, int start = 0, int size = 0)
+      : ExampleRange(examples, nullptr, start, size) {}
+  ExampleRange(
+      const ExampleList& examples,
+      std::shared_ptr<const std::vector<int>> order,
+      int start,
+      int size)
       : v_(&examples),
+        order_(std::move(order)),
         start_(start),
-        size_(size == 0 ? examples.size() : size) {
-    SCHECK(start < examples.size());
+        size_(size == 0 ? examples.size() - start : size) {
+    SCHECK(
+        start >= 0 && size_ > 0 &&
+        start + size_ <= static_cast<int>(examples.size()));
+    SCHECK(!order_ || order_->size() == examples.size());
   }
 
   class Iterator {
@@ -351,8 +336,8 @@ class ExampleRange {
   }
 
   const Example& operator[](int i) const {
-    auto x = (start_ + i) % v_->size();
-    return (*v_)[x];
+    auto x = start_ + i;
+    return (*v_)[order_ ? (*order_)[x] : x];
   }
 
   std::vector<ExampleRange> splitToNBatches(int n) const {
@@ -364,23 +349,22 @@ class ExampleRange {
     ret.reserve(n);
 
     for (int i = 0; i < n - 1; ++i) {
-      ret.push_back(ExampleRange(*v_, (start_ + i * b) % v_->size(), b));
+      ret.push_back(ExampleRange(*v_, order_, start_ + i * b, b));
     }
     ret.push_back(ExampleRange(
-        *v_, (start_ + (n - 1) * b) % v_->size(), size() - (n - 1) * b));
+        *v_, order_, start_ + (n - 1) * b, size() - (n - 1) * b));
     return ret;
   }
 
   std::vector<ExampleRange> splitByBatchSize(int batchSize) const {
     SCHECK(batchSize >= 1 && batchSize <= size());
-    SCHECK(start_ + size() <= v_->size()); // ensure does not wrap around
 
     std::vector<ExampleRange> ret;
 
     int start = 0;
     while (start < size()) {
       auto end = std::min(size(), start + batchSize);
-      ret.push_back(ExampleRange(*v_, start_ + start, end - start));
+      ret.push_back(ExampleRange(*v_, order_, start_ + start, end - start));
       start = end;
     }
 
@@ -389,6 +373,7 @@ class ExampleRange {
 
  private:
   const ExampleList* v_;
+  std::shared_ptr<const std::vector<int>> order_;
   int start_;
   int size_;
 };
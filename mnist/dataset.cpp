@@ -0,0 +1,46 @@
+#include "dataset.h"
+
+#include <sys/resource.h>
+
+using namespace std;
+
+namespace {
+
+constexpr uint32_t kImagesMagic = 0x00000803;
+constexpr uint32_t kLabelsMagic = 0x00000801;
+
+// IDX integers are big endian
+uint32_t readInt(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 |
+      static_cast<uint32_t>(p[2]) << 8 | static_cast<uint32_t>(p[3]);
+}
+
+} // namespace
+
+Dataset::Dataset(const string& images, const string& labels)
+    : images_(images), labels_(labels) {
+  SCHECK(images_.size() >= 16 && labels_.size() >= 8);
+  SCHECK(readInt(images_.data()) == kImagesMagic);
+  SCHECK(readInt(labels_.data()) == kLabelsMagic);
+
+  const size_t n = readInt(images_.data() + 4);
+  SCHECK(readInt(labels_.data() + 4) == n);
+  SCHECK(readInt(images_.data() + 8) == Example::rows);
+  SCHECK(readInt(images_.data() + 12) == Example::cols);
+  constexpr size_t pixels = Example::rows * Example::cols;
+  SCHECK(images_.size() >= 16 + n * pixels);
+  SCHECK(labels_.size() >= 8 + n);
+
+  examples_.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    examples_.push_back(
+        Example{images_.data() + 16 + i * pixels, labels_.data()[8 + i]});
+  }
+}
+
+size_t peakResidentBytes() {
+  struct rusage usage;
+  SCHECK(getrusage(RUSAGE_SELF, &usage) == 0);
+  // Linux reports kilobytes
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
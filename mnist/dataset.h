@@ -0,0 +1,37 @@
+#pragma once
+
+// A dataset in the IDX format of MNIST: an images file and a labels file.
+//
+// Both files are memory mapped; the pixels stay in the mapping as they are
+// stored (one byte each) and the examples only point at them. Nothing is
+// parsed or converted when the dataset is opened. Pixels are normalized when
+// a batch is assembled (see TensorT::load()), so the resident memory of a
+// dataset is its file size and pages are read in as training touches them.
+
+#include <string>
+
+#include "common.h"
+#include "mapped_file.h"
+
+class Dataset {
+ public:
+  Dataset(const std::string& images, const std::string& labels);
+  Dataset(const Dataset&) = delete;
+  Dataset& operator=(const Dataset&) = delete;
+
+  // Views into the mapped files; valid for the lifetime of the dataset
+  const ExampleList& examples() const {
+    return examples_;
+  }
+  int size() const {
+    return examples_.size();
+  }
+
+ private:
+  MappedFile images_;
+  MappedFile labels_;
+  ExampleList examples_;
+};
+
+// The high-water mark of the resident memory of this process, in bytes
+size_t peakResidentBytes();
@@ -1,6 +1,7 @@
 #include "evaluator.h"
 
 #include <folly/Optional.h>
+#include <chrono>
 
 using namespace std;
 
@@ -10,6 +11,19 @@ std::ostream& operator<<(std::ostream& out, const EvaluationResult& r) {
   return out;
 }
 
+std::ostream& operator<<(std::ostream& out, const Comparison& c) {
+  out << folly::format(
+      "error rate {}% against {}% ({} points), {:.1f} ms against {:.1f} ms "
+      "({:.2f}x)",
+      c.candidate.errorRate * 100.0,
+      c.baseline.errorRate * 100.0,
+      (c.candidate.errorRate - c.baseline.errorRate) * 100.0,
+      c.candidateMs,
+      c.baselineMs,
+      c.baselineMs / c.candidateMs);
+  return out;
+}
+
 EvaluationResult Evaluator::evaluate(IModel model, ExampleList tests) const {
   unique_ptr<ostream> writeDetails;
   if (writeEvaluationDetailsTo_ != "") {
@@ -43,3 +57,21 @@ EvaluationResult Evaluator::evaluate(IModel model, ExampleList tests) const {
 
   return EvaluationResult{1.0 * error / tests.size(), errors / total};
 }
+
+Comparison Evaluator::compare(
+    IModel baseline,
+    IModel candidate,
+    ExampleList tests) const {
+  Evaluator plain{"", false};
+  auto timed = [&](IModel model, double& ms) {
+    auto start = chrono::steady_clock::now();
+    auto result = plain.evaluate(model, tests);
+    ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+             .count();
+    return result;
+  };
+  Comparison c;
+  c.baseline = timed(baseline, c.baselineMs);
+  c.candidate = timed(candidate, c.candidateMs);
+  return c;
+}
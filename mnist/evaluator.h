@@ -9,12 +9,25 @@ struct EvaluationResult {
 
 std::ostream& operator<<(std::ostream& out, const EvaluationResult&);
 
+// A model against the one it was derived from, e.g. compiled or quantized
+struct Comparison {
+  EvaluationResult baseline;
+  EvaluationResult candidate;
+  double baselineMs;
+  double candidateMs;
+};
+
+std::ostream& operator<<(std::ostream& out, const Comparison&);
+
 class Evaluator {
  public:
   Evaluator(std::string writeEvaluationDetailsTo, bool writeAll)
       : writeEvaluationDetailsTo_(writeEvaluationDetailsTo),
         writeAll_(writeAll) {}
   EvaluationResult evaluate(IModel model, ExampleList tests) const;
+  // Evaluates and times both models; writes no details
+  Comparison compare(IModel baseline, IModel candidate, ExampleList tests)
+      const;
 
   std::string writeEvaluationDetailsTo_;
   bool writeAll_;
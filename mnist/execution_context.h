@@ -0,0 +1,120 @@
+#pragma once
+
+// The state of one pass through a graph: the outputs of the operators and
+// the gradients of their backprop operators for one batch (shard).
+//
+// Operators hold parameters only; compute() and runBackProp() read and write
+// the per-pass state in the context they are given. A shard keeps its
+// context from one mini-batch to the next so that the tensors in it reuse
+// their storage, and any number of passes can be in flight on one thread as
+// long as each has a context of its own.
+
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "tensor.h"
+
+template <typename T>
+class ExecutionContext {
+ public:
+  // The state of one operator. Every Operator has a slot id; its
+  // BackPropOperator shares it.
+  struct Slot {
+    TensorT<T> output;
+    GradientT<T> inputGradient;
+    GradientT<T> parameterGradient;
+    // Intermediate results an operator keeps between compute() and backprop
+    TensorT<T> workspace;
+  };
+
+  // Ids below this are dense: GraphBuilder::topologicalSort() numbers the
+  // operators of a graph from 0, and their slots are indexed in a vector.
+  // Operators outside any sorted graph (the regularizer, unit tests) keep the
+  // process-wide id they were constructed with, from here up, and their slots
+  // live in a map.
+  static constexpr size_t kFirstSparseSlot =
+      std::numeric_limits<size_t>::max() / 2;
+
+  ExecutionContext() = default;
+  ExecutionContext(const ExecutionContext&) = delete;
+  ExecutionContext& operator=(const ExecutionContext&) = delete;
+  ExecutionContext(ExecutionContext&&) = default;
+  ExecutionContext& operator=(ExecutionContext&&) = default;
+
+  // Slots are created on first use. A context serves the operators of one
+  // graph, whose dense ids are distinct, plus any with sparse ids. References
+  // to slots stay valid for the lifetime of the context.
+  Slot& slot(size_t i) {
+    if (i >= kFirstSparseSlot) {
+      return sparse_[i];
+    }
+    if (i >= dense_.size()) {
+      dense_.resize(i + 1);
+    }
+    auto& s = dense_[i];
+    if (!s) {
+      s = std::make_unique<Slot>();
+    }
+    return *s;
+  }
+
+ private:
+  // Allocated one by one, so that growing the vector leaves references valid
+  std::vector<std::unique_ptr<Slot>> dense_;
+  std::unordered_map<size_t, Slot> sparse_;
+};
+
+// Hands out contexts to concurrent passes, e.g. the evaluation batches
+// running on the TaskRunner. A released context goes back to the pool with
+// its buffers, so the next pass on a batch of the same shape does not
+// allocate.
+template <typename T>
+class ExecutionContextPool {
+ public:
+  class Lease {
+   public:
+    Lease(ExecutionContextPool* pool, std::unique_ptr<ExecutionContext<T>> c)
+        : pool_(pool), context_(std::move(c)) {}
+    Lease(Lease&&) = default;
+    ~Lease() {
+      if (context_) {
+        pool_->release(std::move(context_));
+      }
+    }
+
+    ExecutionContext<T>& operator*() const {
+      return *context_;
+    }
+
+   private:
+    ExecutionContextPool* pool_;
+    std::unique_ptr<ExecutionContext<T>> context_;
+  };
+
+  Lease acquire() {
+    std::unique_ptr<ExecutionContext<T>> c;
+    {
+      std::lock_guard<std::mutex> g(lock_);
+      if (!free_.empty()) {
+        c = std::move(free_.back());
+        free_.pop_back();
+      }
+    }
+    if (!c) {
+      c = std::make_unique<ExecutionContext<T>>();
+    }
+    return Lease{this, std::move(c)};
+  }
+
+ private:
+  void release(std::unique_ptr<ExecutionContext<T>> c) {
+    std::lock_guard<std::mutex> g(lock_);
+    free_.push_back(std::move(c));
+  }
+
+  std::mutex lock_;
+  std::vector<std::unique_ptr<ExecutionContext<T>>> free_;
+};
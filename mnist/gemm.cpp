@@ -0,0 +1,385 @@
+#include "gemm.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "common.h"
+#include "kernels.h"
+#include "scheduler.h"
+#include "simd.h"
+
+using namespace std;
+
+namespace {
+
+// Blocking parameters; the micro-kernel keeps an MR x NR tile of C in
+// registers, i.e. MR * NR / W vector accumulators.
+template <int MR_, int NR_, int W_>
+struct Blocking {
+  static constexpr int MR = MR_;
+  static constexpr int NR = NR_;
+  static constexpr int W = W_;
+  static constexpr int MC = 128;
+  static constexpr int KC = 256;
+  static constexpr int NC = 2048;
+};
+
+// op(A)(i, k) for the MC x KC block starting at (i0, k0), packed into
+// micro-panels of MR rows: panel p holds rows [p * MR, p * MR + MR) laid out
+// k-major so the micro-kernel reads MR consecutive values per k.
+template <typename B, typename T>
+ALWAYS_INLINE void packA(
+    bool trans,
+    const T* a,
+    int lda,
+    int i0,
+    int k0,
+    int mc,
+    int kc,
+    T* buf) {
+  constexpr int MR = B::MR;
+  for (int p = 0; p < mc; p += MR) {
+    const int mr = min(MR, mc - p);
+    for (int k = 0; k < kc; ++k) {
+      T* dst = buf + k * MR;
+      if (!trans) {
+        const T* src = a + static_cast<long>(i0 + p) * lda + (k0 + k);
+        for (int i = 0; i < mr; ++i) {
+          dst[i] = src[static_cast<long>(i) * lda];
+        }
+      } else {
+        const T* src = a + static_cast<long>(k0 + k) * lda + (i0 + p);
+        for (int i = 0; i < mr; ++i) {
+          dst[i] = src[i];
+        }
+      }
+      for (int i = mr; i < MR; ++i) {
+        dst[i] = 0;
+      }
+    }
+    buf += kc * MR;
+  }
+}
+
+// op(B)(k, j) for the KC x NC block starting at (k0, j0), packed into
+// micro-panels of NR columns, k-major.
+template <typename B, typename T>
+ALWAYS_INLINE void packB(
+    bool trans,
+    const T* b,
+    int ldb,
+    int k0,
+    int j0,
+    int kc,
+    int nc,
+    T* buf) {
+  constexpr int NR = B::NR;
+  for (int p = 0; p < nc; p += NR) {
+    const int nr = min(NR, nc - p);
+    for (int k = 0; k < kc; ++k) {
+      T* dst = buf + k * NR;
+      if (!trans) {
+        const T* src = b + static_cast<long>(k0 + k) * ldb + (j0 + p);
+        for (int j = 0; j < nr; ++j) {
+          dst[j] = src[j];
+        }
+      } else {
+        const T* src = b + static_cast<long>(j0 + p) * ldb + (k0 + k);
+        for (int j = 0; j < nr; ++j) {
+          dst[j] = src[static_cast<long>(j) * ldb];
+        }
+      }
+      for (int j = nr; j < NR; ++j) {
+        dst[j] = 0;
+      }
+    }
+    buf += kc * NR;
+  }
+}
+
+// Computes an MR x NR tile of C from one packed A micro-panel and one packed
+// B micro-panel. A bias (the tile's columns of it) replaces the old C; relu
+// clamps the result.
+template <typename B, typename T>
+ALWAYS_INLINE void microKernel(
+    int kc,
+    const T* __restrict__ a,
+    const T* __restrict__ b,
+    T* __restrict__ c,
+    int ldc,
+    int mr,
+    int nr,
+    const T* __restrict__ bias,
+    bool relu) {
+  constexpr int MR = B::MR;
+  constexpr int NR = B::NR;
+
+  T tile[MR][NR];
+  if constexpr (B::W > 1) {
+    using S = Simd<T, B::W>;
+    constexpr int NV = NR / B::W;
+
+    typename S::V acc[MR][NV] = {};
+    for (int k = 0; k < kc; ++k) {
+      typename S::V bv[NV];
+      for (int v = 0; v < NV; ++v) {
+        bv[v] = S::load(b + v * B::W);
+      }
+      for (int i = 0; i < MR; ++i) {
+        const auto ai = S::broadcast(a[i]);
+        for (int v = 0; v < NV; ++v) {
+          acc[i][v] += ai * bv[v];
+        }
+      }
+      a += MR;
+      b += NR;
+    }
+    for (int i = 0; i < MR; ++i) {
+      for (int v = 0; v < NV; ++v) {
+        S::store(&tile[i][v * B::W], acc[i][v]);
+      }
+    }
+  } else {
+    for (int i = 0; i < MR; ++i) {
+      for (int j = 0; j < NR; ++j) {
+        tile[i][j] = 0;
+      }
+    }
+    for (int k = 0; k < kc; ++k) {
+      for (int i = 0; i < MR; ++i) {
+        const T ai = a[i];
+        for (int j = 0; j < NR; ++j) {
+          tile[i][j] += ai * b[j];
+        }
+      }
+      a += MR;
+      b += NR;
+    }
+  }
+
+  if (!bias && !relu) {
+    for (int i = 0; i < mr; ++i) {
+      for (int j = 0; j < nr; ++j) {
+        c[static_cast<long>(i) * ldc + j] += tile[i][j];
+      }
+    }
+    return;
+  }
+  for (int i = 0; i < mr; ++i) {
+    T* row = c + static_cast<long>(i) * ldc;
+    for (int j = 0; j < nr; ++j) {
+      const T x = tile[i][j] + (bias ? bias[j] : row[j]);
+      row[j] = relu && x < 0 ? 0 : x;
+    }
+  }
+}
+
+template <typename B, typename T>
+ALWAYS_INLINE void gemmImpl(
+    bool transA,
+    bool transB,
+    int M,
+    int N,
+    int K,
+    const T* a,
+    int lda,
+    const T* b,
+    int ldb,
+    T* c,
+    int ldc,
+    const GemmEpilogue<T>& epilogue) {
+  // Packing buffers are reused across calls on the same thread
+  thread_local vector<T> bufA;
+  thread_local vector<T> bufB;
+  const int maxMc = (min(M, B::MC) + B::MR - 1) / B::MR * B::MR;
+  const int maxNc = (min(N, B::NC) + B::NR - 1) / B::NR * B::NR;
+  const int maxKc = min(K, B::KC);
+  if (bufA.size() < static_cast<size_t>(maxMc) * maxKc) {
+    bufA.resize(static_cast<size_t>(maxMc) * maxKc);
+  }
+  if (bufB.size() < static_cast<size_t>(maxNc) * maxKc) {
+    bufB.resize(static_cast<size_t>(maxNc) * maxKc);
+  }
+
+  for (int jc = 0; jc < N; jc += B::NC) {
+    const int nc = min(B::NC, N - jc);
+    for (int pc = 0; pc < K; pc += B::KC) {
+      const int kc = min(B::KC, K - pc);
+      const T* bias = pc == 0 ? epilogue.bias : nullptr;
+      const bool relu = epilogue.relu && pc + kc == K;
+      packB<B>(transB, b, ldb, pc, jc, kc, nc, bufB.data());
+
+      for (int ic = 0; ic < M; ic += B::MC) {
+        const int mc = min(B::MC, M - ic);
+        packA<B>(transA, a, lda, ic, pc, mc, kc, bufA.data());
+
+        for (int jr = 0; jr < nc; jr += B::NR) {
+          const int nr = min(B::NR, nc - jr);
+          const T* pb =
+              bufB.data() + static_cast<long>(jr / B::NR) * kc * B::NR;
+          for (int ir = 0; ir < mc; ir += B::MR) {
+            const int mr = min(B::MR, mc - ir);
+            const T* pa =
+                bufA.data() + static_cast<long>(ir / B::MR) * kc * B::MR;
+            T* tile = c + static_cast<long>(ic + ir) * ldc + (jc + jr);
+            microKernel<B>(
+                kc,
+                pa,
+                pb,
+                tile,
+                ldc,
+                mr,
+                nr,
+                bias ? bias + jc + jr : nullptr,
+                relu);
+          }
+        }
+      }
+    }
+  }
+}
+
+#define GEMM_ARGS(T)                                                        \
+  bool transA, bool transB, int M, int N, int K, const T *a, int lda,       \
+      const T *b, int ldb, T *c, int ldc, const GemmEpilogue<T> &epilogue
+#define GEMM_FORWARD transA, transB, M, N, K, a, lda, b, ldb, c, ldc, epilogue
+
+// The tile shape for each element type and instruction set
+template <typename T, kernels::Isa isa>
+struct BlockingFor;
+template <>
+struct BlockingFor<float, kernels::Isa::Scalar> : Blocking<4, 8, 1> {};
+template <>
+struct BlockingFor<double, kernels::Isa::Scalar> : Blocking<4, 8, 1> {};
+// 8 ymm accumulators
+template <>
+struct BlockingFor<float, kernels::Isa::Avx2> : Blocking<4, 16, 8> {};
+template <>
+struct BlockingFor<double, kernels::Isa::Avx2> : Blocking<4, 8, 4> {};
+// 8 zmm accumulators
+template <>
+struct BlockingFor<float, kernels::Isa::Avx512> : Blocking<4, 32, 16> {};
+template <>
+struct BlockingFor<double, kernels::Isa::Avx512> : Blocking<4, 16, 8> {};
+
+template <typename T>
+void gemmScalar(GEMM_ARGS(T)) {
+  gemmImpl<BlockingFor<T, kernels::Isa::Scalar>>(GEMM_FORWARD);
+}
+
+#if defined(__x86_64__)
+template <typename T>
+AVX2_TARGET void gemmAvx2(GEMM_ARGS(T)) {
+  gemmImpl<BlockingFor<T, kernels::Isa::Avx2>>(GEMM_FORWARD);
+}
+
+template <typename T>
+AVX512_TARGET void gemmAvx512(GEMM_ARGS(T)) {
+  gemmImpl<BlockingFor<T, kernels::Isa::Avx512>>(GEMM_FORWARD);
+}
+#endif
+
+template <typename T>
+void gemmSerial(GEMM_ARGS(T)) {
+  switch (kernels::isa()) {
+#if defined(__x86_64__)
+    case kernels::Isa::Avx512:
+      return gemmAvx512(GEMM_FORWARD);
+    case kernels::Isa::Avx2:
+      return gemmAvx2(GEMM_FORWARD);
+#endif
+    default:
+      return gemmScalar(GEMM_FORWARD);
+  }
+}
+
+} // namespace
+
+template <typename T>
+void gemm(GEMM_ARGS(T)) {
+  if (M == 0 || N == 0) {
+    return;
+  }
+  if (K == 0) {
+    // Only the epilogue is left
+    if (epilogue.bias || epilogue.relu) {
+      for (int i = 0; i < M; ++i) {
+        T* row = c + static_cast<long>(i) * ldc;
+        for (int j = 0; j < N; ++j) {
+          const T x = epilogue.bias ? epilogue.bias[j] : row[j];
+          row[j] = epilogue.relu && x < 0 ? 0 : x;
+        }
+      }
+    }
+    return;
+  }
+
+  // Multiply-adds below which a panel is not worth a task
+  constexpr long kMinPanelWork = 1 << 18;
+  // Panel boundaries fall on whole micro-tiles of every Blocking
+  constexpr int kPanelAlign = 32;
+
+  // C is cut into panels along its longer side, one per thread of the
+  // budget; each panel is an independent GEMM with its own packing
+  const bool byRows = M >= N;
+  const int extent = byRows ? M : N;
+  const long work = static_cast<long>(M) * N * K;
+  const int panels = min<long>(
+      {static_cast<long>(TaskRunner::threadBudget()),
+       work / kMinPanelWork,
+       (extent + kPanelAlign - 1) / kPanelAlign});
+  if (panels <= 1) {
+    gemmSerial(GEMM_FORWARD);
+    return;
+  }
+
+  int step = (extent + panels - 1) / panels;
+  step = (step + kPanelAlign - 1) / kPanelAlign * kPanelAlign;
+  TaskRunner::get().parallelFor(
+      0,
+      extent,
+      step,
+      [&](int first, int last) {
+        if (byRows) {
+          // Rows of op(A) and C
+          const T* ap = transA ? a + first : a + static_cast<long>(first) * lda;
+          gemmSerial(
+              transA,
+              transB,
+              last - first,
+              N,
+              K,
+              ap,
+              lda,
+              b,
+              ldb,
+              c + static_cast<long>(first) * ldc,
+              ldc,
+              epilogue);
+        } else {
+          // Columns of op(B), C and the bias
+          const T* bp = transB ? b + static_cast<long>(first) * ldb : b + first;
+          auto columns = epilogue;
+          if (columns.bias) {
+            columns.bias += first;
+          }
+          gemmSerial(
+              transA,
+              transB,
+              M,
+              last - first,
+              K,
+              a,
+              lda,
+              bp,
+              ldb,
+              c + first,
+              ldc,
+              columns);
+        }
+      },
+      panels);
+}
+
+template void gemm<float>(GEMM_ARGS(float));
+template void gemm<double>(GEMM_ARGS(double));
@@ -0,0 +1,46 @@
+#pragma once
+
+// Packed, cache-blocked matrix multiplication.
+//
+// All matrices are stored row major. The operands are described by their
+// logical shape after the optional transpose: op(A) is M x K and op(B) is
+// K x N. lda / ldb / ldc are the row strides of the matrices as stored.
+//
+// The implementation follows the usual Goto/BLIS structure: B is packed into
+// KC x NC panels (NR columns wide) and A into MC x KC panels (MR rows high)
+// so that the register-tiled micro-kernel only ever streams through
+// contiguous memory. The transpose of each operand is absorbed by the packing
+// routines which is how the NN, NT and TN layouts share one micro-kernel.
+// The micro-kernel is compiled for every kernels::Isa and dispatched at
+// runtime.
+//
+// Large products are split into panels of C which run in parallel on the
+// TaskRunner, up to the calling thread's TaskRunner::threadBudget().
+//
+// The epilogue is folded into the micro-kernel's write-back of each tile of
+// C, so a bias and ReLU after the product cost no passes of their own: the
+// bias goes in with the first KC block and the ReLU after the last.
+template <typename T>
+struct GemmEpilogue {
+  // N values, one per column of C. With a bias C is overwritten rather than
+  // accumulated into: C = op(A) * op(B) + bias.
+  const T* bias = nullptr;
+  // C = max(0, C) once the product is complete
+  bool relu = false;
+};
+
+// C += op(A) * op(B), followed by the epilogue
+template <typename T>
+void gemm(
+    bool transA,
+    bool transB,
+    int M,
+    int N,
+    int K,
+    const T* a,
+    int lda,
+    const T* b,
+    int ldb,
+    T* c,
+    int ldc,
+    const GemmEpilogue<T>& epilogue = {});
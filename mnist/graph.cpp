@@ -1,25 +1,30 @@
 #include "graph.h"
 
+#include <algorithm>
 #include <functional>
 #include <queue>
+#include <typeinfo>
 #include <unordered_map>
 
 using namespace std;
 
 // static
-OperatorList GraphBuilder::topologicalSort(IOperator input, IOperator output) {
+template <typename T>
+OperatorList<T> GraphBuilder::topologicalSort(
+    IOperator<T> input,
+    IOperator<T> output) {
   struct Entry {
     size_t indegree = 0;
-    OperatorList outgoing;
+    OperatorList<T> outgoing;
   };
 
-  unordered_map<Operator*, Entry> m;
-  function<void(IOperator)> iterator;
+  unordered_map<Operator<T>*, Entry> m;
+  function<void(IOperator<T>)> iterator;
 
-  OperatorList ret;
-  queue<IOperator> q;
+  OperatorList<T> ret;
+  queue<IOperator<T>> q;
 
-  iterator = [&m, &iterator, &q](IOperator op) {
+  iterator = [&m, &iterator, &q](IOperator<T> op) {
     auto size = op->getInputs().size();
     if (size == 0) {
       q.push(op);
@@ -51,26 +56,90 @@ OperatorList GraphBuilder::topologicalSort(IOperator input, IOperator output) {
     }
   }
 
+  // New ids go above those already taken in this graph, e.g. by the model
+  // inside the trainer's graph
+  size_t nextSlot = 0;
+  for (auto& op : ret) {
+    if (op->hasDenseSlot()) {
+      nextSlot = max(nextSlot, op->slotId() + 1);
+    }
+  }
+  for (auto& op : ret) {
+    if (!op->hasDenseSlot()) {
+      op->setSlot(nextSlot++);
+    }
+  }
+
   return ret;
 }
 
 // static
-pair<IInputOperator, IOperator> GraphBuilder::buildMLP(
+template <typename T>
+IOperator<T> GraphBuilder::fuse(IOperator<T> output) {
+  unordered_map<Operator<T>*, int> consumers;
+  function<void(IOperator<T>)> count = [&](IOperator<T> op) {
+    for (auto in : op->getInputs()) {
+      if (consumers[in.get()]++ == 0) {
+        count(in);
+      }
+    }
+  };
+  count(output);
+
+  unordered_map<Operator<T>*, IOperator<T>> rewritten;
+  function<IOperator<T>(IOperator<T>)> rewrite = [&](IOperator<T> op) {
+    auto it = rewritten.find(op.get());
+    if (it != rewritten.end()) {
+      return it->second;
+    }
+    for (auto& in : op->getInputs()) {
+      in = rewrite(in);
+    }
+
+    auto ret = op;
+    if (dynamic_pointer_cast<ReluOperator<T>>(op)) {
+      auto& in = op->getInputs()[0];
+      // Exactly an FC layer, not one of its fused variants
+      if (typeid(*in) == typeid(FCLayerOperator<T>) &&
+          consumers[in.get()] == 1) {
+        ret = make_shared<FCReluLayerOperator<T>>(
+            move(static_cast<FCLayerOperator<T>&>(*in)));
+      }
+    }
+    rewritten[op.get()] = ret;
+    return ret;
+  };
+  return rewrite(output);
+}
+
+// static
+template <typename T>
+pair<IInputOperator<T>, IOperator<T>> GraphBuilder::buildMLP(
     Dim inputDim,
     int nclass,
     const ModelArchitecture& arch) {
-  auto input = make_shared<InputOperator>(Dims{inputDim});
-  IOperator op = input;
+  auto input = make_shared<InputOperator<T>>(Dims{inputDim});
+  IOperator<T> op = input;
 
   for (auto layer : arch.layers) {
     op = layer->create(op);
   }
 
   if (op->dims().size() > 1) {
-    op = make_shared<AdapterOperator>(Dims{op->dims().dimSize}, op);
+    op = make_shared<AdapterOperator<T>>(Dims{op->dims().dimSize}, op);
   }
-  op = make_shared<FCLayerOperator>(nclass, op);
-  op = make_shared<SoftmaxOperator>(op);
+  op = make_shared<FCLayerOperator<T>>(nclass, op);
+  op = make_shared<SoftmaxOperator<T>>(op);
 
-  return make_pair(input, op);
+  return make_pair(input, fuse(op));
 }
+
+#define INSTANTIATE_GRAPH_BUILDER(T)                                          \
+  template OperatorList<T> GraphBuilder::topologicalSort(                     \
+      IOperator<T>, IOperator<T>);                                            \
+  template IOperator<T> GraphBuilder::fuse(IOperator<T>);                     \
+  template pair<IInputOperator<T>, IOperator<T>> GraphBuilder::buildMLP<T>(   \
+      Dim, int, const ModelArchitecture&);
+
+INSTANTIATE_GRAPH_BUILDER(float)
+INSTANTIATE_GRAPH_BUILDER(double)
@@ -5,8 +5,20 @@
 
 class GraphBuilder {
  public:
-  static OperatorList topologicalSort(IOperator output, IOperator input);
-  // return <input, output>
-  static std::pair<IInputOperator, IOperator>
+  // Also gives the operators that have none a dense slot id (see
+  // ExecutionContext), distinct within the graph. Operators shared with a
+  // graph sorted earlier keep theirs. Call it before the operators run.
+  template <typename T>
+  static OperatorList<T> topologicalSort(
+      IOperator<T> output,
+      IOperator<T> input);
+  // Rewrites the graph ending at output in place, replacing each FC layer
+  // whose only consumer is a ReLU by an FCReluLayerOperator. Returns the new
+  // output.
+  template <typename T>
+  static IOperator<T> fuse(IOperator<T> output);
+  // return <input, output>; the graph is fuse()d
+  template <typename T>
+  static std::pair<IInputOperator<T>, IOperator<T>>
   buildMLP(Dim inputDim, int nclass, const ModelArchitecture& arch);
 };
@@ -0,0 +1,654 @@
+#include "inference.h"
+
+#include <folly/Format.h>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "allocator.h"
+#include "gemm.h"
+#include "graph.h"
+#include "kernels.h"
+#include "scheduler.h"
+
+using namespace std;
+
+namespace {
+
+// FC layers with fewer rows than this skip gemm()
+const int kGemmRows = 4;
+
+// Convolutions with shorter patches stay in T: the int8 dot products are 16
+// lanes wide, and lowering and rescaling cost more than they save
+const int kInt8Patch = 16;
+
+// Max pooling as PoolingOperator computes it: windows of width x width every
+// stride pixels, clipped at the border, starting from the smallest positive
+// T
+template <typename T>
+void maxPool(const T* x, const Dims& image, int width, int stride, T* out) {
+  const int rows = image[1];
+  const int cols = image[2];
+  for (int c = 0; c < image[0]; ++c, x += rows * cols) {
+    for (int r = 0; r < rows; r += stride) {
+      for (int k = 0; k < cols; k += stride) {
+        T m = numeric_limits<T>::min();
+        for (int i = r; i < min(r + width, rows); ++i) {
+          for (int j = k; j < min(k + width, cols); ++j) {
+            if (x[i * cols + j] > m) {
+              m = x[i * cols + j];
+            }
+          }
+        }
+        *out++ = m;
+      }
+    }
+  }
+}
+
+// x / scale rounded to the int8 steps, saturating at +-127 so that the int8
+// values stay symmetric
+template <typename T>
+void quantizeTo(int8_t* q, const T* x, T scale, size_t n) {
+  const T inverse = 1 / scale;
+  for (size_t i = 0; i < n; ++i) {
+    q[i] = max<long>(-127, min<long>(127, lround(x[i] * inverse)));
+  }
+}
+
+// w{n} in steps of the scale that maps its largest magnitude to 127; returns
+// the scale
+template <typename T>
+T quantizeChannel(int8_t* q, const T* w, int n, int stride) {
+  T m = 0;
+  for (int i = 0; i < n; ++i) {
+    m = max<T>(m, abs(w[i * stride]));
+  }
+  const T scale = m > 0 ? m / 127 : 1;
+  for (int i = 0; i < n; ++i) {
+    q[i] = lround(w[i * stride] / scale);
+  }
+  return scale;
+}
+
+// The transpose of lowerToColumns() for int8 images: row p holds the patch
+// of pixel p, in the order of the rows of w{wDims}
+void lowerToRows(
+    const Dims& wDims,
+    int rows,
+    int cols,
+    const int8_t* x,
+    int8_t* out) {
+  const int channels = wDims[1], R = wDims[2], C = wDims[3];
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      for (int k = 0; k < channels; ++k) {
+        const int8_t* xk = x + k * rows * cols;
+        for (int r = 0; r < R; ++r) {
+          const int xi = i + r - R / 2;
+          for (int c = 0; c < C; ++c) {
+            const int xj = j + c - C / 2;
+            const bool inside = xi >= 0 && xi < rows && xj >= 0 && xj < cols;
+            *out++ = inside ? xk[xi * cols + xj] : 0;
+          }
+        }
+      }
+    }
+  }
+}
+
+// SoftmaxOperator of one row; out may be in
+template <typename T>
+void softmax(T* out, const T* in, int n) {
+  const T maxi = 1e30f;
+  T sum = 0;
+  for (int j = 0; j < n; ++j) {
+    out[j] = -in[j] > log(maxi) ? maxi : exp(-in[j]);
+    sum += out[j];
+  }
+  for (int j = 0; j < n; ++j) {
+    out[j] /= sum;
+  }
+}
+
+} // namespace
+
+// static
+template <typename T>
+shared_ptr<InferenceEngine<T>> InferenceEngine<T>::compile(
+    const ForwardPassModel<T>& model,
+    int maxBatch) {
+  SCHECK(maxBatch > 0);
+  shared_ptr<InferenceEngine<T>> engine{new InferenceEngine<T>()};
+  auto& e = *engine;
+  e.maxBatch_ = maxBatch;
+  e.inputSize_ = dimSize(model.input()->dims());
+  e.outputSize_ = dimSize(model.output()->dims());
+
+  auto order = GraphBuilder::topologicalSort<T>(model.input(), model.output());
+  unordered_map<const Operator<T>*, vector<Operator<T>*>> consumers;
+  for (auto& op : order) {
+    for (auto& in : op->getInputs()) {
+      consumers[in.get()].push_back(op.get());
+    }
+  }
+  // The consumer of op if it has exactly one
+  auto only = [&consumers](const Operator<T>* op) -> Operator<T>* {
+    auto it = consumers.find(op);
+    return it != consumers.end() && it->second.size() == 1 ? it->second[0]
+                                                            : nullptr;
+  };
+
+  vector<MemoryPlan::Buffer> buffers;
+  auto newBuffer = [&](string name, int size) {
+    const int step = e.program_.size();
+    buffers.push_back(MemoryPlan::Buffer{
+        move(name), static_cast<size_t>(size) * sizeof(T), step, step, 0});
+    return static_cast<int>(buffers.size()) - 1;
+  };
+  auto read = [&](int buffer) {
+    buffers[buffer].last = e.program_.size();
+    return buffer;
+  };
+  auto freeze = [&](const TensorT<T>* w) {
+    e.weights_.push_back(*w);
+    return e.weights_.back().data().begin();
+  };
+  // Sized up front so the frozen weights stay where they are
+  size_t parameters = 0;
+  for (auto& op : order) {
+    parameters += op->getParameterList().size();
+  }
+  e.weights_.reserve(parameters);
+
+  // The buffer each operator's output is in
+  unordered_map<const Operator<T>*, int> value;
+  value[model.input().get()] = newBuffer("input", maxBatch * e.inputSize_);
+  unordered_set<const Operator<T>*> fused;
+  for (auto& op : order) {
+    if (value.count(op.get()) || fused.count(op.get())) {
+      continue;
+    }
+    SCHECK_MSG(
+        !op->getInputs().empty(),
+        folly::format("{} is not the input of the model", op->name()));
+    if (dynamic_cast<AdapterOperator<T>*>(op.get())) {
+      value[op.get()] = value.at(op->getInputs()[0].get());
+      continue;
+    }
+
+    Instruction ins;
+    ins.in = read(value.at(op->getInputs()[0].get()));
+    ins.inSize = dimSize(op->getInputs()[0]->dims());
+    // The last operator the instruction covers
+    Operator<T>* last = op.get();
+    auto fuse = [&](auto* type) {
+      auto* next = only(last);
+      if (!next || !dynamic_cast<decltype(type)>(next)) {
+        return false;
+      }
+      fused.insert(next);
+      last = next;
+      return true;
+    };
+
+    if (dynamic_cast<FCLayerOperator<T>*>(op.get())) {
+      auto w = op->getParameterList();
+      ins.kind = Instruction::Kind::FC;
+      ins.w = freeze(w[0]);
+      ins.b = freeze(w[1]);
+      ins.wDims = w[0]->dims();
+      ins.relu = dynamic_cast<FCReluLayerOperator<T>*>(op.get()) ||
+          fuse(static_cast<ReluOperator<T>*>(nullptr));
+      ins.softmax = fuse(static_cast<SoftmaxOperator<T>*>(nullptr));
+    } else if (dynamic_cast<ConvolutionLayerOperator<T>*>(op.get())) {
+      auto w = op->getParameterList();
+      ins.kind = Instruction::Kind::Convolution;
+      ins.w = freeze(w[0]);
+      ins.b = freeze(w[1]);
+      ins.wDims = w[0]->dims();
+      ins.image = op->getInputs()[0]->dims();
+      ins.relu = fuse(static_cast<ReluOperator<T>*>(nullptr));
+      if (fuse(static_cast<PoolingOperator<T>*>(nullptr))) {
+        auto* pool = static_cast<PoolingOperator<T>*>(last);
+        ins.poolWidth = pool->width();
+        ins.poolStride = pool->stride();
+      }
+      const int pixels = ins.image[1] * ins.image[2];
+      ins.columns = newBuffer(
+          op->name() + " columns", ins.wDims[1] * ins.wDims[2] * ins.wDims[3] *
+              pixels);
+      if (ins.poolWidth > 0) {
+        ins.unpooled =
+            newBuffer(op->name() + " unpooled", ins.wDims[0] * pixels);
+      }
+    } else if (dynamic_cast<ReluOperator<T>*>(op.get())) {
+      ins.kind = Instruction::Kind::Relu;
+    } else if (auto* pool = dynamic_cast<PoolingOperator<T>*>(op.get())) {
+      ins.kind = Instruction::Kind::Pooling;
+      ins.image = op->getInputs()[0]->dims();
+      ins.poolWidth = pool->width();
+      ins.poolStride = pool->stride();
+    } else if (dynamic_cast<SoftmaxOperator<T>*>(op.get())) {
+      ins.kind = Instruction::Kind::Softmax;
+    } else {
+      SCHECK_MSG(false, folly::format("Cannot compile {}", op->name()));
+    }
+
+    ins.outSize = dimSize(last->dims());
+    ins.out = newBuffer(last->name() + " output", maxBatch * ins.outSize);
+    value[last] = ins.out;
+    e.program_.push_back(ins);
+  }
+  SCHECK(!e.program_.empty());
+
+  e.output_ = value.at(model.output().get());
+  buffers[e.output_].last = e.program_.size() - 1;
+  e.plan_ = MemoryPlan::layout(move(buffers));
+  return engine;
+}
+
+template <typename T>
+InferenceEngine<T>::Context::Context(const InferenceEngine<T>& engine)
+    : arena_(TensorAllocator::make<T>(
+          (engine.plan_.peakBytes + sizeof(T) - 1) / sizeof(T))),
+      input_(engine.buffer(arena_.get(), 0)) {}
+
+template <typename T>
+const T* InferenceEngine<T>::run(Context& ctx, int rows) const {
+  SCHECK(rows > 0 && rows <= maxBatch_);
+  T* arena = ctx.arena_.get();
+  for (auto& instruction : program_) {
+    execute(instruction, arena, rows);
+  }
+  return buffer(arena, output_);
+}
+
+template <typename T>
+void InferenceEngine<T>::execute(const Instruction& ins, T* arena, int rows)
+    const {
+  if (ins.int8) {
+    executeInt8(ins, arena, rows);
+    return;
+  }
+  const T* in = buffer(arena, ins.in);
+  T* out = buffer(arena, ins.out);
+  switch (ins.kind) {
+    case Instruction::Kind::FC: {
+      const int n = ins.outSize;
+      const int k = ins.inSize;
+      for (int r = 0; r < rows; ++r) {
+        copy(ins.b, ins.b + n, out + r * n);
+      }
+      if (rows < kGemmRows) {
+        // gemm() would pack all of w for a few rows; streaming it through
+        // once per row is cheaper
+        for (int r = 0; r < rows; ++r) {
+          for (int i = 0; i < k; ++i) {
+            kernels::axpy(out + r * n, in[r * k + i], ins.w + i * n, n);
+          }
+        }
+      } else {
+        gemm(false, false, rows, n, k, in, k, ins.w, n, out, n);
+      }
+      if (ins.relu) {
+        kernels::relu(out, out, static_cast<size_t>(rows) * n);
+      }
+      if (ins.softmax) {
+        for (int r = 0; r < rows; ++r) {
+          softmax(out + r * n, out + r * n, n);
+        }
+      }
+      return;
+    }
+
+    case Instruction::Kind::Convolution: {
+      const int channels = ins.wDims[0];
+      const int pixels = ins.image[1] * ins.image[2];
+      const int patch = ins.wDims[1] * ins.wDims[2] * ins.wDims[3];
+      T* columns = buffer(arena, ins.columns);
+      for (int e = 0; e < rows; ++e) {
+        T* y = ins.poolWidth > 0 ? buffer(arena, ins.unpooled)
+                                 : out + e * ins.outSize;
+        for (int c = 0; c < channels; ++c) {
+          fill(y + c * pixels, y + (c + 1) * pixels, ins.b[c]);
+        }
+        const T* x = in + e * ins.inSize;
+        lowerToColumns(ins.wDims, ins.image[1], ins.image[2], x, columns);
+        gemm(
+            false,
+            false,
+            channels,
+            pixels,
+            patch,
+            ins.w,
+            patch,
+            columns,
+            pixels,
+            y,
+            pixels);
+        if (ins.relu) {
+          kernels::relu(y, y, static_cast<size_t>(channels) * pixels);
+        }
+        if (ins.poolWidth > 0) {
+          maxPool(
+              static_cast<const T*>(y),
+              Dims{channels, ins.image[1], ins.image[2]},
+              ins.poolWidth,
+              ins.poolStride,
+              out + e * ins.outSize);
+        }
+      }
+      return;
+    }
+
+    case Instruction::Kind::Relu:
+      kernels::relu(out, in, static_cast<size_t>(rows) * ins.inSize);
+      return;
+
+    case Instruction::Kind::Pooling:
+      for (int e = 0; e < rows; ++e) {
+        maxPool(
+            in + e * ins.inSize,
+            ins.image,
+            ins.poolWidth,
+            ins.poolStride,
+            out + e * ins.outSize);
+      }
+      return;
+
+    case Instruction::Kind::Softmax:
+      for (int r = 0; r < rows; ++r) {
+        softmax(out + r * ins.outSize, in + r * ins.inSize, ins.outSize);
+      }
+      return;
+  }
+}
+
+template <typename T>
+void InferenceEngine<T>::executeInt8(
+    const Instruction& ins,
+    T* arena,
+    int rows) const {
+  const T* in = buffer(arena, ins.in);
+  T* out = buffer(arena, ins.out);
+  int8_t* q = bufferOf<int8_t>(arena, ins.quantized);
+  int32_t* sums = bufferOf<int32_t>(arena, ins.sums);
+
+  if (ins.kind == Instruction::Kind::FC) {
+    const int n = ins.outSize;
+    const int k = ins.inSize;
+    quantizeTo(q, in, ins.xScale, static_cast<size_t>(rows) * k);
+    kernels::int8Gemm(sums, q, ins.wq, rows, n, k);
+    for (int r = 0; r < rows; ++r) {
+      for (int j = 0; j < n; ++j) {
+        out[r * n + j] =
+            ins.b[j] + sums[r * n + j] * (ins.xScale * ins.wScale[j]);
+      }
+    }
+    if (ins.relu) {
+      kernels::relu(out, out, static_cast<size_t>(rows) * n);
+    }
+    if (ins.softmax) {
+      for (int r = 0; r < rows; ++r) {
+        softmax(out + r * n, out + r * n, n);
+      }
+    }
+    return;
+  }
+
+  SCHECK(ins.kind == Instruction::Kind::Convolution);
+  const int channels = ins.wDims[0];
+  const int pixels = ins.image[1] * ins.image[2];
+  const int patch = ins.wDims[1] * ins.wDims[2] * ins.wDims[3];
+  // The image in int8 goes behind its lowered rows
+  int8_t* image = q + static_cast<size_t>(pixels) * patch;
+  for (int e = 0; e < rows; ++e) {
+    T* y = ins.poolWidth > 0 ? buffer(arena, ins.unpooled)
+                             : out + e * ins.outSize;
+    quantizeTo(image, in + e * ins.inSize, ins.xScale, ins.inSize);
+    lowerToRows(ins.wDims, ins.image[1], ins.image[2], image, q);
+    kernels::int8Gemm(sums, q, ins.wq, pixels, channels, patch);
+    for (int c = 0; c < channels; ++c) {
+      const T scale = ins.xScale * ins.wScale[c];
+      for (int p = 0; p < pixels; ++p) {
+        y[c * pixels + p] = ins.b[c] + sums[p * channels + c] * scale;
+      }
+    }
+    if (ins.relu) {
+      kernels::relu(y, y, static_cast<size_t>(channels) * pixels);
+    }
+    if (ins.poolWidth > 0) {
+      maxPool(
+          static_cast<const T*>(y),
+          Dims{channels, ins.image[1], ins.image[2]},
+          ins.poolWidth,
+          ins.poolStride,
+          out + e * ins.outSize);
+    }
+  }
+}
+
+// static
+template <typename T>
+shared_ptr<InferenceEngine<T>> InferenceEngine<T>::quantize(
+    const ForwardPassModel<T>& model,
+    int maxBatch,
+    const ExampleList& calibration) {
+  SCHECK(!calibration.empty());
+  auto engine = compile(model, maxBatch);
+  engine->quantize(engine->calibrate(calibration));
+  return engine;
+}
+
+template <typename T>
+vector<T> InferenceEngine<T>::calibrate(const ExampleList& examples) const {
+  SCHECK(inputSize_ == Example::rows * Example::cols);
+  vector<T> ranges(program_.size());
+  Context ctx(*this);
+  T* arena = ctx.arena_.get();
+  for (size_t begin = 0; begin < examples.size(); begin += maxBatch_) {
+    const int rows = min<size_t>(maxBatch_, examples.size() - begin);
+    T* x = ctx.input();
+    for (int r = 0; r < rows; ++r) {
+      for (int k = 0; k < inputSize_; ++k) {
+        *x++ = examples[begin + r].pixel(k);
+      }
+    }
+    for (size_t i = 0; i < program_.size(); ++i) {
+      auto& ins = program_[i];
+      const T* in = buffer(arena, ins.in);
+      for (size_t k = 0; k < static_cast<size_t>(rows) * ins.inSize; ++k) {
+        ranges[i] = max<T>(ranges[i], abs(in[k]));
+      }
+      execute(ins, arena, rows);
+    }
+  }
+  return ranges;
+}
+
+template <typename T>
+void InferenceEngine<T>::quantize(const vector<T>& ranges) {
+  auto buffers = plan_.buffers;
+  auto newBuffer = [&buffers](string name, size_t bytes, int step) {
+    buffers.push_back(MemoryPlan::Buffer{move(name), bytes, step, step, 0});
+    return static_cast<int>(buffers.size()) - 1;
+  };
+
+  for (size_t i = 0; i < program_.size(); ++i) {
+    auto& ins = program_[i];
+    const bool fc = ins.kind == Instruction::Kind::FC;
+    if (!fc &&
+        (ins.kind != Instruction::Kind::Convolution ||
+         dimSize(ins.wDims) / ins.wDims[0] < kInt8Patch)) {
+      continue;
+    }
+    ins.int8 = true;
+    ins.xScale = ranges[i] > 0 ? ranges[i] / 127 : 1;
+
+    // Output channels and their weights: w{inputs, outputs} for an FC layer,
+    // w{outputs, patch} for a convolution
+    const int outputs = ins.wDims[0 + fc];
+    const int inputs = dimSize(ins.wDims) / outputs;
+    vector<int8_t> wq(dimSize(ins.wDims));
+    vector<T> scales(outputs);
+    for (int o = 0; o < outputs; ++o) {
+      const T* w = fc ? ins.w + o : ins.w + o * inputs;
+      const int stride = fc ? outputs : 1;
+      scales[o] = quantizeChannel(wq.data() + o * inputs, w, inputs, stride);
+    }
+    ins.wq = wq.data();
+    ins.wScale = scales.data();
+    int8Weights_.push_back(move(wq));
+    scales_.push_back(move(scales));
+
+    // The float columns of a convolution give way to the int8 ones
+    if (fc) {
+      ins.quantized = newBuffer(
+          folly::format("{} int8 input", i).str(),
+          static_cast<size_t>(maxBatch_) * ins.inSize,
+          i);
+      ins.sums = newBuffer(
+          folly::format("{} sums", i).str(),
+          static_cast<size_t>(maxBatch_) * ins.outSize * sizeof(int32_t),
+          i);
+    } else {
+      const int pixels = ins.image[1] * ins.image[2];
+      ins.quantized = ins.columns;
+      buffers[ins.columns].bytes =
+          static_cast<size_t>(pixels) * inputs + ins.inSize;
+      ins.sums = newBuffer(
+          folly::format("{} sums", i).str(),
+          static_cast<size_t>(pixels) * outputs * sizeof(int32_t),
+          i);
+    }
+  }
+  plan_ = MemoryPlan::layout(move(buffers));
+  // Contexts laid out for the float program
+  free_.clear();
+}
+
+template <typename T>
+vector<Prediction> InferenceEngine<T>::predict(
+    const ExampleList& examples) const {
+  SCHECK(inputSize_ == Example::rows * Example::cols);
+  SCHECK(outputSize_ == N_CLASS);
+  vector<Prediction> ret(examples.size());
+  const int n = (examples.size() + maxBatch_ - 1) / maxBatch_;
+
+  TaskRunner::get().parallelFor(0, n, 1, [&](int first, int last) {
+    auto ctx = acquire();
+    for (int i = first; i < last; ++i) {
+      const int begin = i * maxBatch_;
+      const int rows = min<int>(maxBatch_, examples.size() - begin);
+      T* x = ctx->input();
+      for (int r = 0; r < rows; ++r) {
+        auto& example = examples[begin + r];
+        for (int k = 0; k < inputSize_; ++k) {
+          *x++ = example.pixel(k);
+        }
+      }
+      const T* out = run(*ctx, rows);
+      for (int r = 0; r < rows; ++r, out += outputSize_) {
+        copy(out, out + outputSize_, ret[begin + r].prob.begin());
+      }
+    }
+    release(move(ctx));
+  });
+  return ret;
+}
+
+template <typename T>
+unique_ptr<typename InferenceEngine<T>::Context> InferenceEngine<T>::acquire()
+    const {
+  {
+    lock_guard<mutex> g(lock_);
+    if (!free_.empty()) {
+      auto ctx = move(free_.back());
+      free_.pop_back();
+      return ctx;
+    }
+  }
+  return make_unique<Context>(*this);
+}
+
+template <typename T>
+void InferenceEngine<T>::release(unique_ptr<Context> ctx) const {
+  lock_guard<mutex> g(lock_);
+  free_.push_back(move(ctx));
+}
+
+template <typename T>
+string InferenceEngine<T>::Instruction::describe() const {
+  ostringstream out;
+  switch (kind) {
+    case Kind::FC:
+      out << "fc " << wDims << " + bias";
+      break;
+    case Kind::Convolution:
+      out << "convolution " << image << " * " << wDims << " + bias";
+      break;
+    case Kind::Relu:
+      out << "relu";
+      break;
+    case Kind::Pooling:
+      out << "max pooling " << image;
+      break;
+    case Kind::Softmax:
+      out << "softmax";
+      break;
+  }
+  if (kind != Kind::Relu && relu) {
+    out << ", relu";
+  }
+  if (kind != Kind::Pooling && poolWidth > 0) {
+    out << ", max pooling";
+  }
+  if (poolWidth > 0) {
+    out << " w:" << poolWidth << ";s:" << poolStride;
+  }
+  if (kind != Kind::Softmax && softmax) {
+    out << ", softmax";
+  }
+  if (int8) {
+    out << ", int8";
+  }
+  return out.str();
+}
+
+template <typename T>
+string InferenceEngine<T>::describe() const {
+  ostringstream out;
+  for (auto& instruction : program_) {
+    out << instruction.describe() << endl;
+  }
+  out << plan_.summary() << endl;
+  return out.str();
+}
+
+template class InferenceEngine<float>;
+template class InferenceEngine<double>;
+
+IModel compileForInference(const IModel& model, int maxBatch) {
+  if (auto m = dynamic_pointer_cast<ForwardPassModel<float>>(model)) {
+    return InferenceEngine<float>::compile(*m, maxBatch);
+  }
+  if (auto m = dynamic_pointer_cast<ForwardPassModel<double>>(model)) {
+    return InferenceEngine<double>::compile(*m, maxBatch);
+  }
+  return nullptr;
+}
+
+IModel quantizeForInference(
+    const IModel& model,
+    int maxBatch,
+    const ExampleList& calibration) {
+  if (auto m = dynamic_pointer_cast<ForwardPassModel<float>>(model)) {
+    return InferenceEngine<float>::quantize(*m, maxBatch, calibration);
+  }
+  if (auto m = dynamic_pointer_cast<ForwardPassModel<double>>(model)) {
+    return InferenceEngine<double>::quantize(*m, maxBatch, calibration);
+  }
+  return nullptr;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+// A forward only program compiled from a trained model, for serving.
+//
+// ForwardPassModel runs the training graph: a context full of tensors per
+// pass, and a virtual compute() per operator which reshapes its output.
+// compile() walks the graph once instead and
+//  * freezes the weights: the engine keeps copies of the parameters, so
+//    training on does not change what it serves;
+//  * fuses operators: an FC layer with its bias, a ReLU after it and a
+//    softmax after that; a convolution with its bias, a ReLU and a max
+//    pooling after it, one example at a time so the unpooled activations of
+//    the batch never exist; adapters only reshape and disappear;
+//  * lays out every activation and scratch buffer for batches of up to
+//    maxBatch examples in one arena (see memory_plan.h).
+// What is left is a flat list of instructions over offsets into the arena.
+// run() executes them on a Context, the arena of one thread, and allocates
+// nothing.
+//
+// quantize() compiles the same program with post-training int8 quantization
+// of the FC layers and convolutions: symmetric int8 weights with one scale per
+// output channel, and inputs rounded to int8 with one scale per layer, picked
+// from the largest magnitude the layer sees on a calibration sample. The dot
+// products run in kernels::int8Gemm() with int32 sums, which are scaled back
+// to T before the bias, ReLU, pooling and softmax.
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "memory_plan.h"
+#include "model.h"
+
+template <typename T>
+class InferenceEngine : public Model {
+ public:
+  // Fails on operators it has no instruction for
+  static std::shared_ptr<InferenceEngine<T>> compile(
+      const ForwardPassModel<T>& model,
+      int maxBatch);
+  // Calibrates on the examples, which should be a sample of the training set
+  static std::shared_ptr<InferenceEngine<T>> quantize(
+      const ForwardPassModel<T>& model,
+      int maxBatch,
+      const ExampleList& calibration);
+
+  class Context {
+   public:
+    explicit Context(const InferenceEngine<T>& engine);
+
+    // Where run() takes the examples from: {maxBatch(), inputSize()}
+    T* input() {
+      return input_;
+    }
+
+   private:
+    friend class InferenceEngine<T>;
+
+    std::shared_ptr<T> arena_;
+    T* input_;
+  };
+
+  // Runs the first rows examples in ctx.input(). Returns their outputs
+  // {rows, outputSize()}, which stay in ctx until the next run.
+  const T* run(Context& ctx, int rows) const;
+
+  // In batches of maxBatch() spread over the TaskRunner
+  std::vector<Prediction> predict(const ExampleList& examples) const override;
+
+  int maxBatch() const {
+    return maxBatch_;
+  }
+  int inputSize() const {
+    return inputSize_;
+  }
+  int outputSize() const {
+    return outputSize_;
+  }
+  const MemoryPlan& plan() const {
+    return plan_;
+  }
+  // The instructions, one per line, then the memory plan
+  std::string describe() const;
+
+ private:
+  struct Instruction {
+    enum class Kind { FC, Convolution, Relu, Pooling, Softmax };
+
+    std::string describe() const;
+
+    Kind kind;
+    // Buffers of the plan; scratch buffers hold one example
+    int in;
+    int out;
+    int columns = -1;
+    int unpooled = -1;
+    // Per example
+    int inSize;
+    int outSize;
+    // Frozen parameters
+    const T* w = nullptr;
+    const T* b = nullptr;
+    Dims wDims;
+    // The image of a convolution or pooling: {channels, rows, cols}
+    Dims image;
+    bool relu = false;
+    bool softmax = false;
+    // 0 without pooling
+    int poolWidth = 0;
+    int poolStride = 0;
+
+    // Quantized FC layers and convolutions
+    bool int8 = false;
+    // Buffers: the input in int8 (a convolution's lowered to {pixels, patch})
+    // and the int32 sums
+    int quantized = -1;
+    int sums = -1;
+    // The input is quantized in steps of xScale; wq holds output channel o in
+    // row o, in steps of wScale[o]
+    T xScale = 0;
+    const int8_t* wq = nullptr;
+    const T* wScale = nullptr;
+  };
+
+  InferenceEngine() = default;
+
+  void execute(const Instruction& instruction, T* arena, int rows) const;
+  void executeInt8(const Instruction& instruction, T* arena, int rows) const;
+  T* buffer(T* arena, int i) const {
+    return arena + plan_.buffers[i].offset / sizeof(T);
+  }
+  // Buffers of int8 and int32 elements
+  template <typename U>
+  U* bufferOf(T* arena, int i) const {
+    return reinterpret_cast<U*>(
+        reinterpret_cast<char*>(arena) + plan_.buffers[i].offset);
+  }
+
+  // The largest magnitude of the input of each instruction over the examples
+  std::vector<T> calibrate(const ExampleList& examples) const;
+  // Turns the FC layers and convolutions into int8 given the input ranges
+  void quantize(const std::vector<T>& ranges);
+
+  std::unique_ptr<Context> acquire() const;
+  void release(std::unique_ptr<Context> ctx) const;
+
+  int maxBatch_;
+  int inputSize_;
+  int outputSize_;
+  std::vector<TensorT<T>> weights_;
+  std::vector<std::vector<int8_t>> int8Weights_;
+  std::vector<std::vector<T>> scales_;
+  std::vector<Instruction> program_;
+  MemoryPlan plan_;
+  // Buffer 0 is the input
+  int output_;
+
+  mutable std::mutex lock_;
+  mutable std::vector<std::unique_ptr<Context>> free_;
+};
+
+// The compiled form of a ForwardPassModel (in either precision); null for
+// other models
+IModel compileForInference(const IModel& model, int maxBatch);
+// Its int8 form (see InferenceEngine::quantize())
+IModel quantizeForInference(
+    const IModel& model,
+    int maxBatch,
+    const ExampleList& calibration);
@@ -0,0 +1,673 @@
+#include "kernels.h"
+
+#include <atomic>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+#include "simd.h"
+
+using namespace std;
+
+namespace {
+
+// Each kernel is written once for a vector width of W lanes; W == 1 is the
+// scalar implementation. The scalar loops also handle the remainders.
+
+template <typename T, int W>
+ALWAYS_INLINE void addImpl(T* x, const T* y, size_t n) {
+  size_t i = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    for (; i + W <= n; i += W) {
+      S::store(x + i, S::load(x + i) + S::load(y + i));
+    }
+  }
+  for (; i < n; ++i) {
+    x[i] += y[i];
+  }
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void scaleImpl(T* x, T a, size_t n) {
+  size_t i = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    auto av = S::broadcast(a);
+    for (; i + W <= n; i += W) {
+      S::store(x + i, S::load(x + i) * av);
+    }
+  }
+  for (; i < n; ++i) {
+    x[i] *= a;
+  }
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void axpyImpl(T* y, T a, const T* x, size_t n) {
+  size_t i = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    auto av = S::broadcast(a);
+    for (; i + W <= n; i += W) {
+      S::store(y + i, S::load(y + i) + av * S::load(x + i));
+    }
+  }
+  for (; i < n; ++i) {
+    y[i] += a * x[i];
+  }
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void addScalarImpl(T* x, T a, size_t n) {
+  size_t i = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    auto av = S::broadcast(a);
+    for (; i + W <= n; i += W) {
+      S::store(x + i, S::load(x + i) + av);
+    }
+  }
+  for (; i < n; ++i) {
+    x[i] += a;
+  }
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void reluImpl(T* y, const T* x, size_t n) {
+  size_t i = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    typename S::V zero{};
+    for (; i + W <= n; i += W) {
+      auto v = S::load(x + i);
+      S::store(y + i, S::select(v > zero, v));
+    }
+  }
+  for (; i < n; ++i) {
+    y[i] = x[i] < 0 ? 0 : x[i];
+  }
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void reluBackwardImpl(T* g, const T* out, size_t n) {
+  size_t i = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    typename S::V zero{};
+    for (; i + W <= n; i += W) {
+      S::store(g + i, S::select(S::load(out + i) > zero, S::load(g + i)));
+    }
+  }
+  for (; i < n; ++i) {
+    if (out[i] <= 0) {
+      g[i] = 0;
+    }
+  }
+}
+
+// Reductions keep four independent accumulators to hide the add latency
+template <typename T, int W>
+ALWAYS_INLINE T sumImpl(const T* x, size_t n) {
+  size_t i = 0;
+  T s = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    typename S::V a0{}, a1{}, a2{}, a3{};
+    for (; i + 4 * W <= n; i += 4 * W) {
+      a0 += S::load(x + i);
+      a1 += S::load(x + i + W);
+      a2 += S::load(x + i + 2 * W);
+      a3 += S::load(x + i + 3 * W);
+    }
+    for (; i + W <= n; i += W) {
+      a0 += S::load(x + i);
+    }
+    s = S::reduce((a0 + a1) + (a2 + a3));
+  }
+  for (; i < n; ++i) {
+    s += x[i];
+  }
+  return s;
+}
+
+template <typename T, int W>
+ALWAYS_INLINE T l2SumImpl(const T* x, size_t n) {
+  size_t i = 0;
+  T s = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    typename S::V a0{}, a1{}, a2{}, a3{};
+    for (; i + 4 * W <= n; i += 4 * W) {
+      auto v0 = S::load(x + i);
+      auto v1 = S::load(x + i + W);
+      auto v2 = S::load(x + i + 2 * W);
+      auto v3 = S::load(x + i + 3 * W);
+      a0 += v0 * v0;
+      a1 += v1 * v1;
+      a2 += v2 * v2;
+      a3 += v3 * v3;
+    }
+    for (; i + W <= n; i += W) {
+      auto v = S::load(x + i);
+      a0 += v * v;
+    }
+    s = S::reduce((a0 + a1) + (a2 + a3));
+  }
+  for (; i < n; ++i) {
+    s += x[i] * x[i];
+  }
+  return s;
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void sumRowsImpl(T* out, const T* m, int rows, int cols) {
+  for (int i = 0; i < rows; ++i) {
+    addImpl<T, W>(out, m + static_cast<size_t>(i) * cols, cols);
+  }
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void sumColsImpl(T* out, const T* m, int rows, int cols) {
+  for (int i = 0; i < rows; ++i) {
+    out[i] += sumImpl<T, W>(m + static_cast<size_t>(i) * cols, cols);
+  }
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void addRowImpl(T* m, const T* v, int rows, int cols) {
+  for (int i = 0; i < rows; ++i) {
+    addImpl<T, W>(m + static_cast<size_t>(i) * cols, v, cols);
+  }
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void
+momentumUpdateImpl(T* w, T* v, const T* g, T alpha, T mu, size_t n) {
+  size_t i = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    auto av = S::broadcast(alpha);
+    auto muv = S::broadcast(mu);
+    for (; i + W <= n; i += W) {
+      auto vi = muv * S::load(v + i) + av * S::load(g + i);
+      S::store(v + i, vi);
+      S::store(w + i, S::load(w + i) - vi);
+    }
+  }
+  for (; i < n; ++i) {
+    v[i] = mu * v[i] + alpha * g[i];
+    w[i] -= v[i];
+  }
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void
+adagradUpdateImpl(T* w, T* h, const T* g, T alpha, T eps, size_t n) {
+  size_t i = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    auto av = S::broadcast(alpha);
+    auto epsv = S::broadcast(eps);
+    for (; i + W <= n; i += W) {
+      auto gi = S::load(g + i);
+      auto hi = S::load(h + i) + gi * gi;
+      S::store(h + i, hi);
+      S::store(w + i, S::load(w + i) - av * gi / (S::sqrt(hi) + epsv));
+    }
+  }
+  for (; i < n; ++i) {
+    h[i] += g[i] * g[i];
+    w[i] -= alpha * g[i] / (__builtin_sqrt(h[i]) + eps);
+  }
+}
+
+template <typename T, int W>
+ALWAYS_INLINE void adamUpdateImpl(
+    T* w,
+    T* m,
+    T* v,
+    const T* g,
+    T alpha,
+    T b1,
+    T b2,
+    T eps,
+    size_t n) {
+  size_t i = 0;
+  if constexpr (W > 1) {
+    using S = Simd<T, W>;
+    auto av = S::broadcast(alpha);
+    auto b1v = S::broadcast(b1);
+    auto b2v = S::broadcast(b2);
+    auto c1v = S::broadcast(1 - b1);
+    auto c2v = S::broadcast(1 - b2);
+    auto epsv = S::broadcast(eps);
+    for (; i + W <= n; i += W) {
+      auto gi = S::load(g + i);
+      auto mi = b1v * S::load(m + i) + c1v * gi;
+      auto vi = b2v * S::load(v + i) + c2v * gi * gi;
+      S::store(m + i, mi);
+      S::store(v + i, vi);
+      S::store(w + i, S::load(w + i) - av * mi / (S::sqrt(vi) + epsv));
+    }
+  }
+  for (; i < n; ++i) {
+    m[i] = b1 * m[i] + (1 - b1) * g[i];
+    v[i] = b2 * v[i] + (1 - b2) * g[i] * g[i];
+    w[i] -= alpha * m[i] / (__builtin_sqrt(v[i]) + eps);
+  }
+}
+
+// The int8 kernels do not depend on T and have no vector extension form:
+// what makes them fast is pmaddwd, which multiplies int16 lanes and sums the
+// products in pairs into int32 lanes.
+
+void int8GemmScalar(
+    int32_t* out,
+    const int8_t* x,
+    const int8_t* w,
+    int rows,
+    int cols,
+    int k) {
+  for (int r = 0; r < rows; ++r, x += k, out += cols) {
+    for (int c = 0; c < cols; ++c) {
+      const int8_t* wc = w + static_cast<size_t>(c) * k;
+      int32_t s = 0;
+      for (int i = 0; i < k; ++i) {
+        s += x[i] * wc[i];
+      }
+      out[c] = s;
+    }
+  }
+}
+
+#if defined(__x86_64__)
+// 16 int8 lanes widened to the 16 int16 lanes of a register
+AVX2_TARGET ALWAYS_INLINE __m256i widen16(const int8_t* p) {
+  return _mm256_cvtepi8_epi16(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+// The sum of the int32 lanes of a
+AVX2_TARGET ALWAYS_INLINE int32_t reduce8(__m256i a) {
+  __m128i s = _mm_add_epi32(
+      _mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+  return _mm_cvtsi128_si32(s);
+}
+
+// Two rows of x by four rows of w: each widened vector of w serves both rows
+// of x and each of x all four of w. Rows and columns past the end repeat the
+// last one and the results are dropped. Rows of out are ldo apart.
+AVX2_TARGET ALWAYS_INLINE void int8Block(
+    int32_t* out,
+    int ldo,
+    const int8_t* x,
+    const int8_t* w,
+    int rows,
+    int cols,
+    int k,
+    int kv) {
+  const int8_t* x1 = x + (rows > 1 ? k : 0);
+  const int8_t* wj[4];
+  for (int j = 0; j < 4; ++j) {
+    wj[j] = w + min(j, cols - 1) * k;
+  }
+  __m256i a00 = _mm256_setzero_si256(), a01 = a00, a02 = a00, a03 = a00;
+  __m256i a10 = a00, a11 = a00, a12 = a00, a13 = a00;
+  for (int i = 0; i < kv; i += 16) {
+    auto x0v = widen16(x + i);
+    auto x1v = widen16(x1 + i);
+    auto w0 = widen16(wj[0] + i);
+    a00 = _mm256_add_epi32(a00, _mm256_madd_epi16(x0v, w0));
+    a10 = _mm256_add_epi32(a10, _mm256_madd_epi16(x1v, w0));
+    auto w1 = widen16(wj[1] + i);
+    a01 = _mm256_add_epi32(a01, _mm256_madd_epi16(x0v, w1));
+    a11 = _mm256_add_epi32(a11, _mm256_madd_epi16(x1v, w1));
+    auto w2 = widen16(wj[2] + i);
+    a02 = _mm256_add_epi32(a02, _mm256_madd_epi16(x0v, w2));
+    a12 = _mm256_add_epi32(a12, _mm256_madd_epi16(x1v, w2));
+    auto w3 = widen16(wj[3] + i);
+    a03 = _mm256_add_epi32(a03, _mm256_madd_epi16(x0v, w3));
+    a13 = _mm256_add_epi32(a13, _mm256_madd_epi16(x1v, w3));
+  }
+  const __m256i a[2][4] = {{a00, a01, a02, a03}, {a10, a11, a12, a13}};
+  for (int r = 0; r < min(rows, 2); ++r) {
+    const int8_t* xr = r == 0 ? x : x1;
+    for (int j = 0; j < min(cols, 4); ++j) {
+      int32_t s = reduce8(a[r][j]);
+      for (int i = kv; i < k; ++i) {
+        s += xr[i] * wj[j][i];
+      }
+      out[r * ldo + j] = s;
+    }
+  }
+}
+
+AVX2_TARGET void int8GemmAvx2(
+    int32_t* out,
+    const int8_t* x,
+    const int8_t* w,
+    int rows,
+    int cols,
+    int k) {
+  const int kv = k / 16 * 16;
+  for (int r = 0; r < rows; r += 2) {
+    for (int c = 0; c < cols; c += 4) {
+      int8Block(
+          out + static_cast<size_t>(r) * cols + c,
+          cols,
+          x + static_cast<size_t>(r) * k,
+          w + static_cast<size_t>(c) * k,
+          rows - r,
+          cols - c,
+          k,
+          kv);
+    }
+  }
+}
+#endif
+
+template <typename T>
+struct KernelTable {
+  void (*add)(T*, const T*, size_t);
+  void (*scale)(T*, T, size_t);
+  void (*axpy)(T*, T, const T*, size_t);
+  void (*addScalar)(T*, T, size_t);
+  void (*relu)(T*, const T*, size_t);
+  void (*reluBackward)(T*, const T*, size_t);
+  T (*sum)(const T*, size_t);
+  T (*l2Sum)(const T*, size_t);
+  void (*sumRows)(T*, const T*, int, int);
+  void (*sumCols)(T*, const T*, int, int);
+  void (*addRow)(T*, const T*, int, int);
+  void (*momentumUpdate)(T*, T*, const T*, T, T, size_t);
+  void (*adagradUpdate)(T*, T*, const T*, T, T, size_t);
+  void (*adamUpdate)(T*, T*, T*, const T*, T, T, T, T, size_t);
+};
+
+// Stamps out the entry points of every kernel for one instruction set
+#define DEFINE_KERNEL_TABLE(NAME, TARGET, T, W)                            \
+  struct NAME {                                                            \
+    TARGET static void add(T* x, const T* y, size_t n) {                   \
+      addImpl<T, W>(x, y, n);                                              \
+    }                                                                      \
+    TARGET static void scale(T* x, T a, size_t n) {                        \
+      scaleImpl<T, W>(x, a, n);                                            \
+    }                                                                      \
+    TARGET static void axpy(T* y, T a, const T* x, size_t n) {             \
+      axpyImpl<T, W>(y, a, x, n);                                          \
+    }                                                                      \
+    TARGET static void addScalar(T* x, T a, size_t n) {                    \
+      addScalarImpl<T, W>(x, a, n);                                        \
+    }                                                                      \
+    TARGET static void relu(T* y, const T* x, size_t n) {                  \
+      reluImpl<T, W>(y, x, n);                                             \
+    }                                                                      \
+    TARGET static void reluBackward(T* g, const T* out, size_t n) {        \
+      reluBackwardImpl<T, W>(g, out, n);                                   \
+    }                                                                      \
+    TARGET static T sum(const T* x, size_t n) {                            \
+      return sumImpl<T, W>(x, n);                                          \
+    }                                                                      \
+    TARGET static T l2Sum(const T* x, size_t n) {                          \
+      return l2SumImpl<T, W>(x, n);                                        \
+    }                                                                      \
+    TARGET static void sumRows(T* out, const T* m, int rows, int cols) {   \
+      sumRowsImpl<T, W>(out, m, rows, cols);                               \
+    }                                                                      \
+    TARGET static void sumCols(T* out, const T* m, int rows, int cols) {   \
+      sumColsImpl<T, W>(out, m, rows, cols);                               \
+    }                                                                      \
+    TARGET static void addRow(T* m, const T* v, int rows, int cols) {      \
+      addRowImpl<T, W>(m, v, rows, cols);                                  \
+    }                                                                      \
+    TARGET static void momentumUpdate(                                     \
+        T* w, T* v, const T* g, T alpha, T mu, size_t n) {                 \
+      momentumUpdateImpl<T, W>(w, v, g, alpha, mu, n);                     \
+    }                                                                      \
+    TARGET static void adagradUpdate(                                      \
+        T* w, T* h, const T* g, T alpha, T eps, size_t n) {                \
+      adagradUpdateImpl<T, W>(w, h, g, alpha, eps, n);                     \
+    }                                                                      \
+    TARGET static void adamUpdate(                                         \
+        T* w,                                                              \
+        T* m,                                                              \
+        T* v,                                                              \
+        const T* g,                                                        \
+        T alpha,                                                           \
+        T b1,                                                              \
+        T b2,                                                              \
+        T eps,                                                             \
+        size_t n) {                                                        \
+      adamUpdateImpl<T, W>(w, m, v, g, alpha, b1, b2, eps, n);             \
+    }                                                                      \
+    static KernelTable<T> table() {                                        \
+      return KernelTable<T>{&add,                                          \
+                            &scale,                                        \
+                            &axpy,                                         \
+                            &addScalar,                                    \
+                            &relu,                                         \
+                            &reluBackward,                                 \
+                            &sum,                                          \
+                            &l2Sum,                                        \
+                            &sumRows,                                      \
+                            &sumCols,                                      \
+                            &addRow,                                       \
+                            &momentumUpdate,                               \
+                            &adagradUpdate,                                \
+                            &adamUpdate};                                  \
+    }                                                                      \
+  };
+
+#define NO_TARGET
+DEFINE_KERNEL_TABLE(ScalarFloat, NO_TARGET, float, 1)
+DEFINE_KERNEL_TABLE(ScalarDouble, NO_TARGET, double, 1)
+#if defined(__x86_64__)
+DEFINE_KERNEL_TABLE(Avx2Float, AVX2_TARGET, float, 8)
+DEFINE_KERNEL_TABLE(Avx2Double, AVX2_TARGET, double, 4)
+DEFINE_KERNEL_TABLE(Avx512Float, AVX512_TARGET, float, 16)
+DEFINE_KERNEL_TABLE(Avx512Double, AVX512_TARGET, double, 8)
+#endif
+
+template <typename T>
+struct Tables;
+
+template <>
+struct Tables<float> {
+  static const KernelTable<float>& get(kernels::Isa isa) {
+#if defined(__x86_64__)
+    static const KernelTable<float> tables[] = {
+        ScalarFloat::table(), Avx2Float::table(), Avx512Float::table()};
+#else
+    static const KernelTable<float> tables[] = {ScalarFloat::table()};
+#endif
+    return tables[static_cast<int>(isa)];
+  }
+};
+
+template <>
+struct Tables<double> {
+  static const KernelTable<double>& get(kernels::Isa isa) {
+#if defined(__x86_64__)
+    static const KernelTable<double> tables[] = {
+        ScalarDouble::table(), Avx2Double::table(), Avx512Double::table()};
+#else
+    static const KernelTable<double> tables[] = {ScalarDouble::table()};
+#endif
+    return tables[static_cast<int>(isa)];
+  }
+};
+
+atomic<kernels::Isa>& currentIsa() {
+  static atomic<kernels::Isa> isa{kernels::bestIsa()};
+  return isa;
+}
+
+template <typename T>
+const KernelTable<T>& table() {
+  return Tables<T>::get(currentIsa().load(memory_order_relaxed));
+}
+
+using Int8Gemm =
+    void (*)(int32_t*, const int8_t*, const int8_t*, int, int, int);
+
+Int8Gemm int8GemmKernel() {
+#if defined(__x86_64__)
+  // 512-bit int16 arithmetic needs AVX512BW; AVX512F gets the AVX2 kernel
+  static const Int8Gemm kernels[] = {
+      &int8GemmScalar, &int8GemmAvx2, &int8GemmAvx2};
+#else
+  static const Int8Gemm kernels[] = {&int8GemmScalar};
+#endif
+  return kernels[static_cast<int>(currentIsa().load(memory_order_relaxed))];
+}
+
+} // namespace
+
+namespace kernels {
+
+Isa bestIsa() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx512f")) {
+    return Isa::Avx512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return Isa::Avx2;
+  }
+#endif
+  return Isa::Scalar;
+}
+
+Isa isa() {
+  return currentIsa().load(memory_order_relaxed);
+}
+
+void setIsa(Isa isa) {
+  SCHECK(static_cast<int>(isa) <= static_cast<int>(bestIsa()));
+  currentIsa() = isa;
+}
+
+const char* name(Isa isa) {
+  switch (isa) {
+    case Isa::Scalar:
+      return "scalar";
+    case Isa::Avx2:
+      return "avx2";
+    case Isa::Avx512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+template <typename T>
+void add(T* x, const T* y, size_t n) {
+  table<T>().add(x, y, n);
+}
+
+template <typename T>
+void scale(T* x, T a, size_t n) {
+  table<T>().scale(x, a, n);
+}
+
+template <typename T>
+void axpy(T* y, T a, const T* x, size_t n) {
+  table<T>().axpy(y, a, x, n);
+}
+
+template <typename T>
+void addScalar(T* x, T a, size_t n) {
+  table<T>().addScalar(x, a, n);
+}
+
+template <typename T>
+void relu(T* y, const T* x, size_t n) {
+  table<T>().relu(y, x, n);
+}
+
+template <typename T>
+void reluBackward(T* g, const T* out, size_t n) {
+  table<T>().reluBackward(g, out, n);
+}
+
+template <typename T>
+T sum(const T* x, size_t n) {
+  return table<T>().sum(x, n);
+}
+
+template <typename T>
+T l2Sum(const T* x, size_t n) {
+  return table<T>().l2Sum(x, n);
+}
+
+template <typename T>
+void sumRows(T* out, const T* m, int rows, int cols) {
+  table<T>().sumRows(out, m, rows, cols);
+}
+
+template <typename T>
+void sumCols(T* out, const T* m, int rows, int cols) {
+  table<T>().sumCols(out, m, rows, cols);
+}
+
+template <typename T>
+void addRow(T* m, const T* v, int rows, int cols) {
+  table<T>().addRow(m, v, rows, cols);
+}
+
+template <typename T>
+void momentumUpdate(T* w, T* v, const T* g, T alpha, T mu, size_t n) {
+  table<T>().momentumUpdate(w, v, g, alpha, mu, n);
+}
+
+template <typename T>
+void adagradUpdate(T* w, T* h, const T* g, T alpha, T eps, size_t n) {
+  table<T>().adagradUpdate(w, h, g, alpha, eps, n);
+}
+
+template <typename T>
+void adamUpdate(
+    T* w,
+    T* m,
+    T* v,
+    const T* g,
+    T alpha,
+    T b1,
+    T b2,
+    T eps,
+    size_t n) {
+  table<T>().adamUpdate(w, m, v, g, alpha, b1, b2, eps, n);
+}
+
+void int8Gemm(
+    int32_t* out,
+    const int8_t* x,
+    const int8_t* w,
+    int rows,
+    int cols,
+    int k) {
+  int8GemmKernel()(out, x, w, rows, cols, k);
+}
+
+#define INSTANTIATE_KERNELS(T)                                           \
+  template void add<T>(T*, const T*, size_t);                            \
+  template void scale<T>(T*, T, size_t);                                 \
+  template void axpy<T>(T*, T, const T*, size_t);                        \
+  template void addScalar<T>(T*, T, size_t);                             \
+  template void relu<T>(T*, const T*, size_t);                           \
+  template void reluBackward<T>(T*, const T*, size_t);                   \
+  template T sum<T>(const T*, size_t);                                   \
+  template T l2Sum<T>(const T*, size_t);                                 \
+  template void sumRows<T>(T*, const T*, int, int);                      \
+  template void sumCols<T>(T*, const T*, int, int);                      \
+  template void addRow<T>(T*, const T*, int, int);                       \
+  template void momentumUpdate<T>(T*, T*, const T*, T, T, size_t);       \
+  template void adagradUpdate<T>(T*, T*, const T*, T, T, size_t);        \
+  template void adamUpdate<T>(T*, T*, T*, const T*, T, T, T, T, size_t);
+
+INSTANTIATE_KERNELS(float)
+INSTANTIATE_KERNELS(double)
+
+} // namespace kernels
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Element-wise and reduction kernels behind the Tensor arithmetic.
+//
+// Every kernel has a scalar, an AVX2 and an AVX-512 implementation; the best
+// one supported by the CPU is selected the first time a kernel runs. All
+// pointers refer to contiguous storage and need no particular alignment.
+namespace kernels {
+
+enum class Isa { Scalar, Avx2, Avx512 };
+
+// The most capable instruction set supported by this CPU
+Isa bestIsa();
+// The instruction set currently in use
+Isa isa();
+// Overrides the selection (e.g. for benchmarking); must be supported
+void setIsa(Isa isa);
+const char* name(Isa isa);
+
+// x += y
+template <typename T>
+void add(T* x, const T* y, size_t n);
+
+// x *= a
+template <typename T>
+void scale(T* x, T a, size_t n);
+
+// y += a * x
+template <typename T>
+void axpy(T* y, T a, const T* x, size_t n);
+
+// x += a
+template <typename T>
+void addScalar(T* x, T a, size_t n);
+
+// y = max(x, 0); y may be x
+template <typename T>
+void relu(T* y, const T* x, size_t n);
+
+// g = 0 where out <= 0, i.e. the gradient of relu given its output
+template <typename T>
+void reluBackward(T* g, const T* out, size_t n);
+
+template <typename T>
+T sum(const T* x, size_t n);
+
+// The sum of x^2
+template <typename T>
+T l2Sum(const T* x, size_t n);
+
+// out{cols} += the sum of the rows of m{rows, cols}
+template <typename T>
+void sumRows(T* out, const T* m, int rows, int cols);
+
+// out{rows} += the sum of the columns of m{rows, cols}
+template <typename T>
+void sumCols(T* out, const T* m, int rows, int cols);
+
+// Adds v{cols} to every row of m{rows, cols}
+template <typename T>
+void addRow(T* m, const T* v, int rows, int cols);
+
+// Optimizer steps: each updates the parameters w and the optimizer state in
+// one pass over the gradient g (see optimizer.h)
+
+// v = mu * v + alpha * g; w -= v
+template <typename T>
+void momentumUpdate(T* w, T* v, const T* g, T alpha, T mu, size_t n);
+
+// h += g^2; w -= alpha * g / (sqrt(h) + eps)
+template <typename T>
+void adagradUpdate(T* w, T* h, const T* g, T alpha, T eps, size_t n);
+
+// m = b1 * m + (1 - b1) * g; v = b2 * v + (1 - b2) * g^2;
+// w -= alpha * m / (sqrt(v) + eps). The caller folds the bias correction into
+// alpha and eps.
+template <typename T>
+void adamUpdate(
+    T* w,
+    T* m,
+    T* v,
+    const T* g,
+    T alpha,
+    T b1,
+    T b2,
+    T eps,
+    size_t n);
+
+// out{rows, cols} = x{rows, k} * w{cols, k}^T with int32 accumulation: row j
+// of w holds the weights of output j, so that every output is a contiguous
+// dot product. Quantized inference (see inference.h) runs on it.
+void int8Gemm(
+    int32_t* out,
+    const int8_t* x,
+    const int8_t* w,
+    int rows,
+    int cols,
+    int k);
+
+} // namespace kernels
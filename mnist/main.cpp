@@ -1,10 +1,15 @@
 #include <fenv.h>
 #include <folly/Format.h>
+#include <chrono>
 // #include <fstream>
 #include <iostream>
 
 #include "common.h"
+#include "dataset.h"
 #include "evaluator.h"
+#include "inference.h"
+#include "sampler.h"
+#include "scheduler.h"
 #include "trainer.h"
 
 using namespace std;
@@ -24,11 +29,19 @@ int main() {
 
   auto& data = trainingConfig.trainingData;
 
-  ExampleReader trainReader{data.trainInput, data.trainLabel};
-  auto trainSample = trainReader.readAll();
-
-  ExampleReader testReader{data.testInput, data.testLabel};
-  auto testSample = testReader.readAll();
+  auto loadStart = chrono::steady_clock::now();
+  Dataset train{data.trainInput, data.trainLabel};
+  Dataset test{data.testInput, data.testLabel};
+  const auto& trainSample = train.examples();
+  const auto& testSample = test.examples();
+  cout << format(
+              "Loaded {} training and {} test examples in {:.1f} ms",
+              train.size(),
+              test.size(),
+              chrono::duration<double, milli>(
+                  chrono::steady_clock::now() - loadStart)
+                  .count())
+       << endl;
 
   Evaluator evaluator(
       trainingConfig.evaluationConfig.writeEvaluationDetailsTo,
@@ -39,4 +52,25 @@ int main() {
       });
 
   cout << evaluator.evaluate(model, testSample) << endl;
+
+  // The same model compiled for serving, which must agree with the graph,
+  // and its int8 form
+  const int batchSize = trainingConfig.evaluationBatchSize;
+  if (auto engine = compileForInference(model, batchSize)) {
+    cout << "Inference engine: "
+         << evaluator.compare(model, engine, testSample) << endl;
+  }
+  const int calibrationExamples = min<int>(
+      trainingConfig.evaluationConfig.calibrationExamples, train.size());
+  if (calibrationExamples > 0) {
+    EpochSampler sampler(trainSample, calibrationExamples, true, data.seed);
+    ExampleList calibration;
+    for (auto& e : sampler.next()) {
+      calibration.push_back(e);
+    }
+    if (auto int8 = quantizeForInference(model, batchSize, calibration)) {
+      cout << "INT8: " << evaluator.compare(model, int8, testSample) << endl;
+    }
+  }
+  cout << format("Peak RSS: {:.1f} MB", peakResidentBytes() / 1e6) << endl;
 }
@@ -0,0 +1,28 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+
+using namespace std;
+
+MappedFile::MappedFile(const string& file, bool copyOnWrite) {
+  int fd = open(file.c_str(), O_RDONLY);
+  SCHECK_MSG(fd >= 0, folly::format("Cannot open {}", file));
+  struct stat st;
+  SCHECK(fstat(fd, &st) == 0);
+  size_ = st.st_size;
+  SCHECK_MSG(size_ > 0, folly::format("{} is empty", file));
+  const int protection = copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ;
+  void* p = mmap(nullptr, size_, protection, MAP_PRIVATE, fd, 0);
+  close(fd);
+  SCHECK_MSG(p != MAP_FAILED, folly::format("Cannot map {}", file));
+  data_ = static_cast<uint8_t*>(p);
+}
+
+MappedFile::~MappedFile() {
+  munmap(data_, size_);
+}
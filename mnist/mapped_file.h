@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A whole file mapped into memory. Read-only, or copy-on-write: writes then
+// go to private copies of the pages and never reach the file.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& file, bool copyOnWrite = false);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  uint8_t* data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  uint8_t* data_;
+  size_t size_;
+};
@@ -0,0 +1,247 @@
+#include "memory_plan.h"
+
+#include <folly/Format.h>
+#include <numeric>
+#include <ostream>
+#include <unordered_map>
+
+#include "allocator.h"
+
+using namespace std;
+
+namespace {
+
+// Of every buffer in the workspace
+constexpr size_t kAlignment = 64;
+
+size_t aligned(size_t bytes) {
+  return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+bool overlaps(const MemoryPlan::Buffer& a, const MemoryPlan::Buffer& b) {
+  return a.first <= b.last && b.first <= a.last;
+}
+
+} // namespace
+
+// static
+MemoryPlan MemoryPlan::layout(vector<Buffer> buffers) {
+  MemoryPlan plan;
+  vector<size_t> order(buffers.size());
+  iota(order.begin(), order.end(), 0);
+  stable_sort(order.begin(), order.end(), [&buffers](size_t a, size_t b) {
+    return buffers[a].bytes > buffers[b].bytes;
+  });
+
+  vector<const Buffer*> placed;
+  vector<const Buffer*> live;
+  for (auto i : order) {
+    auto& buffer = buffers[i];
+    const size_t bytes = aligned(buffer.bytes);
+    live.clear();
+    for (auto* p : placed) {
+      if (overlaps(*p, buffer)) {
+        live.push_back(p);
+      }
+    }
+    sort(live.begin(), live.end(), [](const Buffer* a, const Buffer* b) {
+      return a->offset < b->offset;
+    });
+    // The first gap between the live buffers that fits
+    size_t offset = 0;
+    for (auto* p : live) {
+      if (offset + bytes <= p->offset) {
+        break;
+      }
+      offset = max(offset, p->offset + aligned(p->bytes));
+    }
+    buffer.offset = offset;
+    plan.peakBytes = max(plan.peakBytes, offset + bytes);
+    placed.push_back(&buffer);
+  }
+
+  int steps = 0;
+  for (auto& b : buffers) {
+    plan.totalBytes += b.bytes;
+    steps = max(steps, b.last + 1);
+  }
+  for (int s = 0; s < steps; ++s) {
+    size_t bytes = 0;
+    for (auto& b : buffers) {
+      if (b.first <= s && s <= b.last) {
+        bytes += b.bytes;
+      }
+    }
+    plan.liveBytes = max(plan.liveBytes, bytes);
+  }
+  plan.buffers = move(buffers);
+  return plan;
+}
+
+string MemoryPlan::summary() const {
+  const double mb = 1 << 20;
+  return folly::format(
+             "{} tensors, {:.1f} MB as tensors of their own, {:.1f} MB planned "
+             "({:.1f} MB live at the fullest step)",
+             buffers.size(),
+             totalBytes / mb,
+             peakBytes / mb,
+             liveBytes / mb)
+      .str();
+}
+
+void MemoryPlan::print(ostream& out) const {
+  out << folly::format(
+      "  {:<44} {:>10} {:>10} {:>10}\n", "tensor", "bytes", "steps", "offset");
+  for (auto& b : buffers) {
+    out << folly::format(
+        "  {:<44} {:>10} {:>10} {:>10}\n",
+        b.name,
+        b.bytes,
+        folly::format("{}-{}", b.first, b.last).str(),
+        b.offset);
+  }
+}
+
+template <typename T>
+MemoryPlanner<T>::MemoryPlanner(
+    OperatorList<T> forward,
+    BackPropOperatorList<T> backward)
+    : forward_(move(forward)), backward_(move(backward)) {
+  SCHECK(backward_.empty() || backward_.size() == forward_.size());
+}
+
+template <typename T>
+vector<typename MemoryPlanner<T>::Traced> MemoryPlanner<T>::trace(
+    ExecutionContext<T>& ctx) const {
+  const bool training = !backward_.empty();
+  const int forwardSteps = forward_.size();
+  const int last = forwardSteps + backward_.size() - 1;
+
+  unordered_map<const Operator<T>*, int> lastConsumer;
+  for (int i = 0; i < forwardSteps; ++i) {
+    for (auto& in : forward_[i]->getInputs()) {
+      lastConsumer[in.get()] = i;
+    }
+  }
+  // The step of the backprop operator of each forward operator
+  unordered_map<const BackPropOperator<T>*, int> backwardStep;
+  for (size_t b = 0; b < backward_.size(); ++b) {
+    backwardStep[backward_[b].get()] = forwardSteps + b;
+  }
+  auto backwardStepOf = [&](const IOperator<T>& op) {
+    auto it = backwardStep.find(op->getBackPropOperator().get());
+    return it == backwardStep.end() ? last : it->second;
+  };
+
+  vector<Traced> ret;
+  // Which buffer owns the storage a tensor points to; views point to that
+  // of the tensor they view
+  unordered_map<const T*, size_t> owners;
+  auto add = [&](TensorT<T>& t, string name, int first, int lastUse) {
+    const T* p = t.data().begin();
+    if (!p || t.total() == 0) {
+      return;
+    }
+    auto it = owners.find(p);
+    if (it != owners.end()) {
+      auto& owner = ret[it->second].buffer;
+      owner.first = min(owner.first, first);
+      owner.last = max(owner.last, lastUse);
+      return;
+    }
+    owners[p] = ret.size();
+    ret.push_back(Traced{
+        &t,
+        MemoryPlan::Buffer{
+            move(name), t.total() * sizeof(T), first, lastUse, 0}});
+  };
+
+  for (int i = 0; i < forwardSteps; ++i) {
+    auto& op = forward_[i];
+    auto consumer = lastConsumer.find(op.get());
+    // Inputs are loaded before the first step
+    add(op->get(ctx),
+        op->name() + " output",
+        op->getInputs().empty() ? 0 : i,
+        training || consumer == lastConsumer.end() ? last : consumer->second);
+    add(op->workspace(ctx),
+        op->name() + " workspace",
+        i,
+        training ? backwardStepOf(op) : i);
+  }
+
+  if (!training) {
+    return ret;
+  }
+  // In backward order, so that gradients come before the views of them
+  unordered_map<const BackPropOperator<T>*, IOperator<T>> forwardOf;
+  for (auto& op : forward_) {
+    forwardOf[op->getBackPropOperator().get()] = op;
+  }
+  for (size_t b = 0; b < backward_.size(); ++b) {
+    auto& back = backward_[b];
+    auto& op = forwardOf.at(back.get());
+    const int step = forwardSteps + b;
+    auto& inputGradient = back->inputGradient(ctx);
+    for (size_t j = 0; j < inputGradient.size(); ++j) {
+      // Read by the backprop operator of the input
+      const int consumed = j < op->getInputs().size()
+          ? backwardStepOf(op->getInputs()[j])
+          : last;
+      add(inputGradient[j],
+          folly::format("{} x{} gradient", op->name(), j).str(),
+          step,
+          max(step, consumed));
+    }
+    auto& parameterGradient = back->parameterGradient(ctx);
+    for (size_t k = 0; k < parameterGradient.size(); ++k) {
+      // Summed across shards and applied after the pass
+      add(parameterGradient[k],
+          folly::format("{} w{} gradient", op->name(), k).str(),
+          step,
+          last);
+    }
+  }
+  // In the order of the steps that write them
+  stable_sort(ret.begin(), ret.end(), [](const Traced& a, const Traced& b) {
+    return a.buffer.first < b.buffer.first;
+  });
+  return ret;
+}
+
+template <typename T>
+MemoryPlan MemoryPlanner<T>::plan(ExecutionContext<T>& ctx) const {
+  vector<MemoryPlan::Buffer> buffers;
+  for (auto& t : trace(ctx)) {
+    buffers.push_back(t.buffer);
+  }
+  return MemoryPlan::layout(move(buffers));
+}
+
+template <typename T>
+MemoryPlan MemoryPlanner<T>::apply(ExecutionContext<T>& ctx) const {
+  auto traced = trace(ctx);
+  vector<MemoryPlan::Buffer> buffers;
+  for (auto& t : traced) {
+    buffers.push_back(t.buffer);
+  }
+  auto plan = MemoryPlan::layout(move(buffers));
+  if (plan.peakBytes == 0) {
+    return plan;
+  }
+
+  // Every tensor shares the ownership of the workspace
+  auto workspace = TensorAllocator::make<T>(plan.peakBytes / sizeof(T));
+  for (size_t i = 0; i < traced.size(); ++i) {
+    auto& t = *traced[i].tensor;
+    t = TensorT<T>::wrap(
+        t.dims(),
+        shared_ptr<T>(
+            workspace, workspace.get() + plan.buffers[i].offset / sizeof(T)));
+  }
+  return plan;
+}
+
+template class MemoryPlanner<float>;
+template class MemoryPlanner<double>;
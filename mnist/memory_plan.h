@@ -0,0 +1,83 @@
+#pragma once
+
+// Static memory planning for the tensors of one pass through the graph.
+//
+// Every operator output, gradient and workspace is a tensor of its own in the
+// ExecutionContext, so a step holds all of them at once although many are
+// needed for a stretch of it only: an input gradient is dead as soon as the
+// backprop operator of the input consumed it. The planner numbers the steps
+// of a pass (the forward operators in topological order, then the backprop
+// operators), derives the steps each tensor is live for from the graph, and
+// packs the tensors into one workspace where tensors whose lifetimes do not
+// overlap share bytes.
+//
+// Plans are made from a context which went through a pass, so that its
+// tensors have their shapes. Views (AdapterOperator) share the storage of the
+// tensor they view, which then stays live for as long as the view is used.
+//
+// In training every output is live until the end of the step because the
+// backward pass and the trainer read them; what is shared are the gradients
+// and workspaces. A forward only plan frees an output after its last
+// consumer, which is what inference needs.
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "operators.h"
+
+struct MemoryPlan {
+  struct Buffer {
+    std::string name;
+    size_t bytes;
+    // The step that writes the buffer and the last step that reads it
+    int first;
+    int last;
+    size_t offset;
+  };
+
+  // Places the buffers, the largest first, at the lowest offset that does
+  // not overlap a placed buffer of overlapping lifetime
+  static MemoryPlan layout(std::vector<Buffer> buffers);
+
+  // In the order the pass writes them
+  std::vector<Buffer> buffers;
+  // The size of the workspace
+  size_t peakBytes = 0;
+  // What the buffers take as tensors of their own
+  size_t totalBytes = 0;
+  // The most bytes live at any one step; no layout gets below it
+  size_t liveBytes = 0;
+
+  // One line: buffers, total, peak
+  std::string summary() const;
+  // Every buffer with its size, lifetime and offset
+  void print(std::ostream& out) const;
+};
+
+template <typename T>
+class MemoryPlanner {
+ public:
+  // backward is the backward pass of forward; empty for a forward only plan
+  MemoryPlanner(
+      OperatorList<T> forward,
+      BackPropOperatorList<T> backward = {});
+
+  MemoryPlan plan(ExecutionContext<T>& ctx) const;
+  // Moves the tensors of ctx into one workspace laid out by plan(ctx). The
+  // operators go on writing into them in place as long as the shapes do not
+  // change; a tensor that is reshaped gets storage of its own again. The
+  // contents are not carried over, so this goes between passes.
+  MemoryPlan apply(ExecutionContext<T>& ctx) const;
+
+ private:
+  struct Traced {
+    TensorT<T>* tensor;
+    MemoryPlan::Buffer buffer;
+  };
+  // The buffers of ctx that own their storage
+  std::vector<Traced> trace(ExecutionContext<T>& ctx) const;
+
+  OperatorList<T> forward_;
+  BackPropOperatorList<T> backward_;
+};
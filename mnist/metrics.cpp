@@ -0,0 +1,115 @@
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include "common.h"
+
+using namespace std;
+
+MetricsRecord::Field& MetricsRecord::field(const char* name, bool isArray) {
+  if (size_ == fields_.size()) {
+    fields_.emplace_back();
+  }
+  auto& f = fields_[size_++];
+  f.name = name;
+  f.isArray = isArray;
+  f.values.clear();
+  return f;
+}
+
+void MetricsRecord::writeJson(string& out) const {
+  ostringstream s;
+  s << "{ ";
+  for (size_t i = 0; i < size_; ++i) {
+    auto& f = fields_[i];
+    s << (i ? ", " : "") << '"' << f.name << "\": ";
+    if (!f.isArray) {
+      s << folly::format("{}", f.value);
+      continue;
+    }
+    s << "[";
+    for (size_t j = 0; j < f.values.size(); ++j) {
+      s << (j ? ", " : "") << folly::format("{}", f.values[j]);
+    }
+    s << "]";
+  }
+  s << " }\n";
+  out += s.str();
+}
+
+MetricsWriter::MetricsWriter(string path, int flushEvery, int capacity)
+    : path_(move(path)), flushEvery_(max(flushEvery, 1)), ring_(capacity) {
+  SCHECK(capacity > 0);
+  fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  SCHECK_MSG(fd_ >= 0, folly::format("Cannot open {}", path_));
+  thread_ = std::thread([this]() { run(); });
+}
+
+MetricsWriter::~MetricsWriter() {
+  {
+    lock_guard<mutex> g(sleepLock_);
+    stop_ = true;
+  }
+  wakeUp_.notify_one();
+  thread_.join();
+  close(fd_);
+}
+
+MetricsRecord& MetricsWriter::begin() {
+  const long head = head_.load(memory_order_relaxed);
+  const long capacity = ring_.size();
+  // Full: the writer is busy formatting and needs no wake up
+  while (head - tail_.load(memory_order_acquire) >= capacity) {
+    this_thread::yield();
+  }
+  auto& record = ring_[head % ring_.size()];
+  record.clear();
+  return record;
+}
+
+void MetricsWriter::commit() {
+  // Pairs with the check of head_ after the writer announced it sleeps
+  head_.fetch_add(1);
+  if (sleeping_.load()) {
+    lock_guard<mutex> g(sleepLock_);
+    wakeUp_.notify_one();
+  }
+}
+
+void MetricsWriter::run() {
+  long written = 0;
+  while (true) {
+    const long tail = tail_.load(memory_order_relaxed);
+    if (tail < head_.load(memory_order_acquire)) {
+      ring_[tail % ring_.size()].writeJson(pending_);
+      tail_.store(tail + 1, memory_order_release);
+      if (++written % flushEvery_ == 0) {
+        flush();
+      }
+      continue;
+    }
+
+    unique_lock<mutex> l(sleepLock_);
+    sleeping_ = true;
+    wakeUp_.wait(l, [this, tail]() { return stop_ || head_.load() > tail; });
+    sleeping_ = false;
+    if (stop_ && head_.load() == tail) {
+      break;
+    }
+  }
+  flush();
+}
+
+void MetricsWriter::flush() {
+  size_t done = 0;
+  while (done < pending_.size()) {
+    auto n = write(fd_, pending_.data() + done, pending_.size() - done);
+    SCHECK_MSG(n > 0, folly::format("Cannot write {}", path_));
+    done += n;
+  }
+  pending_.clear();
+  fdatasync(fd_);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+// Writes the learning curve: one JSON object per line.
+//
+// The training thread only collects the numbers of a record; formatting and
+// file IO happen on a background thread. Records pass through a single
+// producer / single consumer ring of reused slots, so after the first lap
+// neither side allocates or takes a lock (the writer sleeps on a condition
+// variable only once the ring is empty).
+//
+// The file is append-only. Every flushEvery records the writer appends the
+// complete lines formatted so far with one write() and syncs the data, so
+// the file only grows by whole records; a reader racing with an append may
+// see a partial last line and should ignore it.
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Named numbers and arrays of numbers, written in the order they were added.
+// Names must outlive the record (string literals).
+class MetricsRecord {
+ public:
+  void clear() {
+    size_ = 0;
+  }
+  void add(const char* name, double value) {
+    field(name, false).value = value;
+  }
+  // The array to append the values to
+  std::vector<double>& addArray(const char* name) {
+    return field(name, true).values;
+  }
+
+  void writeJson(std::string& out) const;
+
+ private:
+  struct Field {
+    const char* name;
+    bool isArray;
+    double value;
+    std::vector<double> values;
+  };
+
+  Field& field(const char* name, bool isArray);
+
+  // Fields beyond size_ are left over from earlier records; their storage is
+  // reused
+  std::vector<Field> fields_;
+  size_t size_ = 0;
+};
+
+class MetricsWriter {
+ public:
+  MetricsWriter(std::string path, int flushEvery, int capacity = 64);
+  // Writes out the records still in the ring
+  ~MetricsWriter();
+  MetricsWriter(const MetricsWriter&) = delete;
+  MetricsWriter& operator=(const MetricsWriter&) = delete;
+
+  // The producer side: fill in the cleared record begin() returns, then
+  // commit() it. begin() waits while the ring is full.
+  MetricsRecord& begin();
+  void commit();
+
+ private:
+  void run();
+  void flush();
+
+  const std::string path_;
+  const int flushEvery_;
+  int fd_;
+  std::vector<MetricsRecord> ring_;
+
+  // Records committed, and written, so far; each on its own cache line
+  alignas(64) std::atomic<long> head_{0};
+  alignas(64) std::atomic<long> tail_{0};
+
+  std::atomic<bool> sleeping_{false};
+  std::atomic<bool> stop_{false};
+  std::mutex sleepLock_;
+  std::condition_variable wakeUp_;
+
+  // Formatted lines not yet in the file; the writer thread's own
+  std::string pending_;
+  std::thread thread_;
+};
@@ -0,0 +1,151 @@
+#include "model.h"
+
+#include <folly/Format.h>
+#include <fstream>
+
+#include "checkpoint.h"
+#include "graph.h"
+#include "scheduler.h"
+
+using namespace std;
+
+template <typename T>
+ForwardPassModel<T>::ForwardPassModel(
+    IInputOperator<T> input,
+    IOperator<T> output,
+    int batchSize)
+    : input_(input), output_(output), batchSize_(batchSize) {
+  // Sort the operators topologically
+  forwardOrder_ = GraphBuilder::topologicalSort<T>(input, output);
+  // for (auto op : forwardOrder_) {
+  //   cout << op->name() << endl;
+  // }
+}
+
+template <typename T>
+vector<Prediction> ForwardPassModel<T>::predict(
+    const ExampleList& examples) const {
+  vector<Prediction> ret(examples.size());
+
+  auto batches = ExampleRange{examples}.splitByBatchSize(batchSize_);
+  int n = batches.size();
+
+  TaskRunner::get().parallelFor(0, n, 1, [&](int first, int last) {
+    auto ctx = contexts_.acquire();
+    for (int i = first; i < last; ++i) {
+      input_->load(*ctx, batches[i]);
+      for (auto op : forwardOrder_) {
+        op->compute(*ctx);
+      }
+      auto& out = output_->get(*ctx);
+      // cout << "out dim: " << out << endl;
+
+      MatrixT<T> m{out};
+
+      auto begin = i * batches[0].size();
+      for (int e = 0; e < m.rows(); ++e) {
+        auto& pred = ret[begin + e];
+        for (int k = 0; k < m.cols(); k++) {
+          // I want a row view
+          pred.prob[k] = m(e, k);
+        }
+      }
+    }
+  });
+
+  return ret;
+}
+
+template <typename T>
+void ForwardPassModel<T>::read(istream& in) {
+  for (auto op : forwardOrder_) {
+    op->read(in);
+  }
+}
+
+template <typename T>
+void ForwardPassModel<T>::write(ostream& out) const {
+  for (auto op : forwardOrder_) {
+    op->write(out);
+  }
+}
+
+template <typename T>
+void ForwardPassModel<T>::readCheckpoint(const string& file) {
+  auto checkpoint = Checkpoint<T>::read(file);
+  SCHECK_MSG(
+      checkpoint.description() == architecture(),
+      folly::format(
+          "{} is a model of\n{}not of\n{}",
+          file,
+          checkpoint.description(),
+          architecture()));
+  auto& tensors = checkpoint.tensors();
+  size_t i = 0;
+  for (auto op : forwardOrder_) {
+    for (auto* w : op->parameters()) {
+      SCHECK(i < tensors.size() && tensors[i].dims() == w->dims());
+      *w = move(tensors[i++]);
+    }
+  }
+  SCHECK(i == tensors.size());
+}
+
+template <typename T>
+void ForwardPassModel<T>::load(const string& file) {
+  if (isCheckpoint(file)) {
+    readCheckpoint(file);
+  } else {
+    ifstream in(file);
+    SCHECK_MSG(!in.fail(), folly::format("Cannot read {}", file));
+    read(in);
+  }
+}
+
+template <typename T>
+void ForwardPassModel<T>::writeCheckpoint(const string& file) const {
+  vector<const TensorT<T>*> tensors;
+  for (auto op : forwardOrder_) {
+    for (auto* w : op->getParameterList()) {
+      tensors.push_back(w);
+    }
+  }
+  Checkpoint<T>::write(file, architecture(), tensors);
+}
+
+template <typename T>
+string ForwardPassModel<T>::architecture() const {
+  ostringstream out;
+  for (auto op : forwardOrder_) {
+    out << op->name() << endl;
+  }
+  return out.str();
+}
+
+template class ForwardPassModel<float>;
+template class ForwardPassModel<double>;
+
+namespace {
+
+template <typename T>
+IModel loadIn(const TrainingConfig& config, const string& file) {
+  auto ops = GraphBuilder::buildMLP<T>(
+      Example::rows * Example::cols, N_CLASS, config.modelArch);
+  auto model = make_shared<ForwardPassModel<T>>(
+      ops.first, ops.second, config.evaluationBatchSize);
+  model->load(file);
+  return model;
+}
+
+} // namespace
+
+IModel loadModel(const TrainingConfig& config, const string& file) {
+  switch (config.precision) {
+    case Precision::FP32:
+      return loadIn<float>(config, file);
+    case Precision::FP64:
+      return loadIn<double>(config, file);
+  }
+  SCHECK(false);
+  return nullptr;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// A trained graph as a Model: predict() runs the operators of the training
+// graph in topological order, a batch of evaluationBatchSize examples at a
+// time. InferenceEngine (see inference.h) compiles it into a forward only
+// program for serving.
+
+#include <string>
+
+#include "execution_context.h"
+#include "operators.h"
+
+template <typename T>
+class ForwardPassModel : public Model {
+ public:
+  ForwardPassModel(IInputOperator<T> input, IOperator<T> output, int batchSize);
+
+  std::vector<Prediction> predict(const ExampleList& examples) const override;
+
+  void read(std::istream& in) override;
+  void write(std::ostream& out) const override;
+
+  // Binary checkpoints of the parameters, described by the architecture. The
+  // parameters read stay in the mapped file until training writes them.
+  void readCheckpoint(const std::string& file);
+  void writeCheckpoint(const std::string& file) const;
+  // Either format: a checkpoint or the text of write()
+  void load(const std::string& file);
+
+  const IInputOperator<T>& input() const {
+    return input_;
+  }
+  const IOperator<T>& output() const {
+    return output_;
+  }
+  int batchSize() const {
+    return batchSize_;
+  }
+
+ private:
+  // One operator name per line
+  std::string architecture() const;
+
+  IInputOperator<T> input_;
+  IOperator<T> output_;
+  OperatorList<T> forwardOrder_;
+  int batchSize_;
+  mutable ExecutionContextPool<T> contexts_;
+};
+
+struct TrainingConfig;
+
+// A model of the architecture and precision of config with the parameters in
+// file (see ForwardPassModel::load())
+IModel loadModel(const TrainingConfig& config, const std::string& file);
@@ -1,27 +1,46 @@
 #include "operators.h"
 
+#include "optimizer.h"
+
 #include <folly/Format.h>
 #include <cmath>
 
 using namespace std;
 
-IBackPropOperator Operator::getBackPropOperator() {
+template <typename T>
+std::atomic<size_t> Operator<T>::nextSlot_{0};
+
+template <typename T>
+IBackPropOperator<T> Operator<T>::getBackPropOperator() {
   if (backPropOp_) {
     return backPropOp_;
   }
-  backPropOp_ = make_shared<BackPropOperator>(
+  backPropOp_ = make_shared<BackPropOperator<T>>(
       name() + "_grad",
-      [this](BackPropOperator* op) { return gradientFunc(op); });
+      slot_,
+      [this](BackPropOperator<T>* op, ExecutionContext<T>& ctx) {
+        gradientFunc(op, ctx);
+      });
   return backPropOp_;
 }
 
-Gradient Operator::computeGradientDebug(const std::function<double()>& loss) {
+template <typename T>
+void Operator<T>::setSlot(size_t slot) {
+  slot_ = slot;
+  if (backPropOp_) {
+    backPropOp_->slot_ = slot;
+  }
+}
+
+template <typename T>
+GradientT<T> Operator<T>::computeGradientDebug(
+    const std::function<double()>& loss) {
   const double eps = 1e-3;
-  Gradient gs;
+  GradientT<T> gs;
 
   auto f = getParameters();
   while (auto* w = f()) {
-    Tensor g{w->dims()};
+    TensorT<T> g{w->dims()};
     for (size_t i = 0; i < w->data().size(); ++i) {
       auto cur = w->data()[i];
 
@@ -34,7 +53,7 @@ Gradient Operator::computeGradientDebug(const std::function<double()>& loss) {
       auto loss2 = loss();
 
       g.data()[i] = (loss1 - loss2) / (2 * eps);
-      // if (dynamic_cast<RegularizerOperator*>(this)) {
+      // if (dynamic_cast<RegularizerOperator<T>*>(this)) {
       //   if (i == 0) {
       //     cout << "i=" << i << " " << cur << " " << loss1 << " " << loss2
       //          << " diff: " << (loss1 - loss2) << " g=" << g.data()[i] <<
@@ -52,8 +71,9 @@ Gradient Operator::computeGradientDebug(const std::function<double()>& loss) {
 
 // This requires knowing the dimension of the input before building the graph
 // which needs to be changed (because # rows can be changed)
-FCLayerOperator::FCLayerOperator(int width, IOperator input)
-    : Operator(Dims{width}, {input}),
+template <typename T>
+FCLayerOperator<T>::FCLayerOperator(int width, IOperator<T> input)
+    : Operator<T>(Dims{width}, {input}),
       w_(Dims{input->dims()[0], width},
          UniformInitScheme{-1.0 / (input->dims()[0] + width),
                            1.0 / (input->dims()[0] + width)}),
@@ -61,24 +81,28 @@ FCLayerOperator::FCLayerOperator(int width, IOperator input)
   SCHECK(input->dims().size() == 1);
 }
 
-Tensor& FCLayerOperator::compute() {
-  Matrix w{w_};
-  Vector b{b_};
-  Matrix x{inputs_[0]->get()};
-  // cout << "x: " << inputs_[0]->get() << endl;
-  // cout << "FC " << w_.dims() << " " << inputs_[0]->get().dims() << endl;
+template <typename T>
+TensorT<T>& FCLayerOperator<T>::compute(ExecutionContext<T>& ctx) {
+  MatrixT<T> w{w_};
+  VectorT<T> b{b_};
+  MatrixT<T> x{this->inputs_[0]->get(ctx)};
+  // cout << "x: " << inputs_[0]->get(ctx) << endl;
+  // cout << "FC " << w_.dims() << " " << inputs_[0]->get(ctx).dims() << endl;
   // cout << "FC w(3, 0): " << w(3, 0) << " " << "x(0, 3): " << x(0, 3) << endl;
 
-  // Allow rvalue conversion to Matrix
-  auto product = x * w;
-  get() = Matrix{product} + b;
+  auto& ret = this->get(ctx);
+  ret.reset(Dims{x.rows(), w.cols()});
+  MatrixT<T> out{ret};
+  kernels::addRow(out.raw(), b.raw(), out.rows(), out.cols());
+  addProduct(out, x, w);
   // cout << "FC output: " << get() << endl;
-  return get();
+  return ret;
 }
 
-std::function<Tensor*()> FCLayerOperator::getParameters() {
+template <typename T>
+std::function<TensorT<T>*()> FCLayerOperator<T>::getParameters() {
   int state = 0;
-  return [this, state]() mutable -> Tensor* {
+  return [this, state]() mutable -> TensorT<T>* {
     auto s = state++;
     switch (s) {
       case 0:
@@ -91,104 +115,241 @@ std::function<Tensor*()> FCLayerOperator::getParameters() {
   };
 }
 
-void FCLayerOperator::applyGradient(const Gradient& g) {
+template <typename T>
+void FCLayerOperator<T>::applyGradient(
+    const GradientT<T>& g,
+    Optimizer<T>& optimizer) {
   SCHECK(g.size() == 2);
 
-  if (diagnostics()) {
+  if (this->diagnostics()) {
+    const T alpha = optimizer.learningRate();
     cout << folly::format(
         "{} W gradient ratio: {:.2F}({:.2F}%); "
         "B gradient ratio: {:.2F}({:.2F}%)\n",
-        name(),
+        this->name(),
         w_.l2Norm(),
-        g[0].l2Norm() / w_.l2Norm() * 100,
+        alpha * g[0].l2Norm() / w_.l2Norm() * 100,
         b_.l2Norm(),
-        g[1].l2Norm() / b_.l2Norm() * 100);
-    setDiagnostics(false);
+        alpha * g[1].l2Norm() / b_.l2Norm() * 100);
+    this->setDiagnostics(false);
   }
 
-  w_ += g[0];
-  b_ += g[1];
+  optimizer.update(w_, g[0]);
+  optimizer.update(b_, g[1]);
 }
 
-GradientPair FCLayerOperator::gradientFunc(BackPropOperator* op) {
+template <typename T>
+void FCLayerOperator<T>::gradientFunc(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx) {
   // input gradient = parent gradient * W^T
   auto& parents = op->parents();
   // Can make this more generic by iterating over the parents
   SCHECK(parents.size() == 1);
-  Matrix parentGradient{parents[0].op->inputGradient()[parents[0].inputIndex]};
-  auto inputGradient = parentGradient * Matrix{w_}.transpose();
+  MatrixT<T> parentGradient{
+      parents[0].op->inputGradient(ctx)[parents[0].inputIndex]};
+  gemmGradients(op, ctx, parentGradient);
+
+  // b' = h' sum over rows
+  auto& bg = op->parameterGradientBuffer(ctx, 1);
+  bg.reset(b_.dims());
+  kernels::sumRows(
+      bg.data().begin(),
+      parentGradient.raw(),
+      parentGradient.rows(),
+      parentGradient.cols());
+}
+
+template <typename T>
+void FCLayerOperator<T>::gemmGradients(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx,
+    const MatrixT<T>& parentGradient) {
+  MatrixT<T> w{w_};
+  auto& xg = op->inputGradientBuffer(ctx, 0);
+  xg.reset(Dims{parentGradient.rows(), w.rows()});
+  MatrixT<T> inputGradient{xg};
+  addProduct(inputGradient, parentGradient, w.transpose());
 
   // cout << "input gradient: " << inputGradient << endl;
 
   // w'(i, j) = x(i) * h'(j) and average over all examples
   // w' = X^T * h'
-  Matrix x{inputs_[0]->get()};
+  MatrixT<T> x{this->inputs_[0]->get(ctx)};
   // This is also the reason why we cannot fuse over all the per example
   // gradients for the parent, because we need a per example fuse with the input
-  auto wGradient = x.transpose() * parentGradient;
-
-  // b' = h' sum over rows
-  auto bGradient = parentGradient.rowSum();
-
-  return make_pair(
-      Gradient{move(inputGradient)},
-      Gradient{move(wGradient), move(bGradient)});
+  auto& wg = op->parameterGradientBuffer(ctx, 0);
+  wg.reset(w_.dims());
+  MatrixT<T> wGradient{wg};
+  addProduct(wGradient, x.transpose(), parentGradient);
 }
 
-void FCLayerOperator::attachRegularizer(RegularizerOperator& regularizer) {
+template <typename T>
+void FCLayerOperator<T>::attachRegularizer(
+    RegularizerOperator<T>& regularizer) {
   regularizer.addParameter(&w_);
 }
 
-void FCLayerOperator::read(std::istream& in) {
-  Operator::read(in);
+template <typename T>
+void FCLayerOperator<T>::read(std::istream& in) {
+  Operator<T>::read(in);
+  readParameters(in);
+}
 
+template <typename T>
+void FCLayerOperator<T>::write(std::ostream& out) const {
+  Operator<T>::write(out);
+  writeParameters(out);
+}
+
+template <typename T>
+void FCLayerOperator<T>::readParameters(std::istream& in) {
   expectToken(in, "W");
   expectToken(in, "=");
-  w_ = Tensor::read(in);
+  w_ = TensorT<T>::read(in);
 
   expectToken(in, "B");
   expectToken(in, "=");
-  b_ = Tensor::read(in);
+  b_ = TensorT<T>::read(in);
 }
 
-void FCLayerOperator::write(std::ostream& out) const {
-  Operator::write(out);
+template <typename T>
+void FCLayerOperator<T>::writeParameters(std::ostream& out) const {
   out << "W = ";
-  Tensor::write(out, w_);
+  TensorT<T>::write(out, w_);
   out << "B = ";
-  Tensor::write(out, b_);
+  TensorT<T>::write(out, b_);
+}
+
+template <typename T>
+FCLayerOperator<T>::FCLayerOperator(FCLayerOperator<T>&& fc)
+    : Operator<T>(fc.dims(), fc.getInputs()),
+      w_(move(fc.w_)),
+      b_(move(fc.b_)) {}
+
+template <typename T>
+FCReluLayerOperator<T>::FCReluLayerOperator(FCLayerOperator<T>&& fc)
+    : FCLayerOperator<T>(move(fc)) {}
+
+template <typename T>
+TensorT<T>& FCReluLayerOperator<T>::compute(ExecutionContext<T>& ctx) {
+  MatrixT<T> w{this->w_};
+  VectorT<T> b{this->b_};
+  MatrixT<T> x{this->inputs_[0]->get(ctx)};
+
+  auto& ret = this->get(ctx);
+  // Every element is written below
+  ret.resize(Dims{x.rows(), w.cols()});
+  MatrixT<T> out{ret};
+  const int cols = out.cols();
+
+  // One GEMM over the whole batch, so W is packed once and the GEMM has all
+  // the rows to split over the threads. The bias and the ReLU go in as each
+  // tile of the output is written.
+  gemm(
+      false,
+      false,
+      x.rows(),
+      cols,
+      x.cols(),
+      x.raw(),
+      x.cols(),
+      w.raw(),
+      cols,
+      out.raw(),
+      cols,
+      {b.raw(), true});
+
+  return ret;
+}
+
+template <typename T>
+void FCReluLayerOperator<T>::gradientFunc(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx) {
+  auto& parents = op->parents();
+  SCHECK(parents.size() == 1);
+
+  auto& parentG = parents[0].op->inputGradient(ctx)[parents[0].inputIndex];
+  auto& output = this->get(ctx);
+  SCHECK(parentG.dims() == output.dims());
+
+  // Mask the parent gradient row by row and sum it into b' while the row is
+  // still in cache
+  auto& g = this->slot(ctx).workspace;
+  g.resize(output.dims());
+  auto& bg = op->parameterGradientBuffer(ctx, 1);
+  bg.reset(this->b_.dims());
+
+  MatrixT<T> gm{g};
+  const int cols = gm.cols();
+  const T* src = parentG.data().begin();
+  const T* out = output.data().begin();
+  T* dst = gm.raw();
+  for (int i = 0; i < gm.rows(); ++i) {
+    copy(src, src + cols, dst);
+    kernels::reluBackward(dst, out, cols);
+    kernels::add(bg.data().begin(), dst, cols);
+    src += cols;
+    out += cols;
+    dst += cols;
+  }
+
+  this->gemmGradients(op, ctx, gm);
+}
+
+template <typename T>
+void FCReluLayerOperator<T>::read(std::istream& in) {
+  expectLine(in, FCLayerOperator<T>::name());
+  this->readParameters(in);
+  expectLine(in, "relu");
+}
+
+template <typename T>
+void FCReluLayerOperator<T>::write(std::ostream& out) const {
+  out << FCLayerOperator<T>::name() << endl;
+  this->writeParameters(out);
+  out << "relu" << endl;
 }
 
-GradientPair AdapterOperator::gradientFunc(BackPropOperator* op) {
+template <typename T>
+void AdapterOperator<T>::gradientFunc(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx) {
   auto& parents = op->parents();
   SCHECK(parents.size() == 1);
 
-  auto& parentG = parents[0].op->inputGradient()[parents[0].inputIndex];
-  Tensor g{inputs_[0]->dims().addFront(parentG.dims()[0]), parentG};
-  return make_pair(Gradient{move(g)}, Gradient{});
+  // A view of the parent gradient; no storage of its own
+  auto& parentG = parents[0].op->inputGradient(ctx)[parents[0].inputIndex];
+  op->inputGradientBuffer(ctx, 0) = TensorT<T>{
+      this->inputs_[0]->dims().addFront(parentG.dims()[0]), parentG};
 }
 
-ConvolutionLayerOperator::ConvolutionLayerOperator(
+template <typename T>
+ConvolutionLayerOperator<T>::ConvolutionLayerOperator(
     int channel,
     int width,
-    IOperator input)
-    : Operator(computeOutputDims(input->dims(), channel, width), {input}),
+    IOperator<T> input,
+    ConvolutionAlgorithm algorithm)
+    : Operator<T>(computeOutputDims(input->dims(), channel, width), {input}),
       w_(computeWDims(input->dims(), channel, width), UniformInitScheme{}),
-      b_(Dims{channel}, UniformInitScheme{}) {
+      b_(Dims{channel}, UniformInitScheme{}),
+      algorithm_(algorithm) {
   SCHECK(input->dims()[1] >= w_.dims()[2] && input->dims()[2] >= w_.dims()[3]);
 }
 
-Tensor& ConvolutionLayerOperator::compute() {
-  get() = convolve(inputs_[0]->get(), w_);
+template <typename T>
+TensorT<T>& ConvolutionLayerOperator<T>::compute(ExecutionContext<T>& ctx) {
+  auto& ret = this->get(ctx);
+  convolve(this->inputs_[0]->get(ctx), w_, ret, algorithm_, &filter_);
 
-  auto& ret = get();
-  Vector bv{b_};
+  VectorT<T> bv{b_};
   // TODO: iterator view
   for (int i = 0; i < ret.dims()[0]; ++i) {
     auto example = ret[i];
     for (int j = 0; j < example.dims()[0]; ++j) {
       auto channel = example[j].flatten();
-      Vector v{channel};
+      VectorT<T> v{channel};
       // cout << v.n() << " vs " << bv.n() << endl;
       v += bv(j);
     }
@@ -197,28 +358,33 @@ Tensor& ConvolutionLayerOperator::compute() {
   return ret;
 }
 
-void ConvolutionLayerOperator::applyGradient(const Gradient& g) {
+template <typename T>
+void ConvolutionLayerOperator<T>::applyGradient(
+    const GradientT<T>& g,
+    Optimizer<T>& optimizer) {
   SCHECK(g.size() == 2);
 
-  if (diagnostics()) {
+  if (this->diagnostics()) {
+    const T alpha = optimizer.learningRate();
     cout << folly::format(
         "{} W gradient ratio: {:.2F}({:.2F}%); "
         "B gradient ratio: {:.2F}({:.2F}%)\n",
-        name(),
+        this->name(),
         w_.l2Norm(),
-        g[0].l2Norm() / w_.l2Norm() * 100,
+        alpha * g[0].l2Norm() / w_.l2Norm() * 100,
         b_.l2Norm(),
-        g[1].l2Norm() / b_.l2Norm() * 100);
-    setDiagnostics(false);
+        alpha * g[1].l2Norm() / b_.l2Norm() * 100);
+    this->setDiagnostics(false);
   }
 
-  w_ += g[0];
-  b_ += g[1];
+  optimizer.update(w_, g[0]);
+  optimizer.update(b_, g[1]);
 }
 
-std::function<Tensor*()> ConvolutionLayerOperator::getParameters() {
+template <typename T>
+std::function<TensorT<T>*()> ConvolutionLayerOperator<T>::getParameters() {
   int state = 0;
-  return [this, state]() mutable -> Tensor* {
+  return [this, state]() mutable -> TensorT<T>* {
     auto s = state++;
     switch (s) {
       case 0:
@@ -231,142 +397,82 @@ std::function<Tensor*()> ConvolutionLayerOperator::getParameters() {
   };
 }
 
-void ConvolutionLayerOperator::attachRegularizer(
-    RegularizerOperator& regularizer) {
+template <typename T>
+void ConvolutionLayerOperator<T>::attachRegularizer(
+    RegularizerOperator<T>& regularizer) {
   regularizer.addParameter(&w_);
 }
 
-GradientPair ConvolutionLayerOperator::gradientFunc(BackPropOperator* op) {
+template <typename T>
+void ConvolutionLayerOperator<T>::gradientFunc(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx) {
   auto& parents = op->parents();
   SCHECK(parents.size() == 1);
 
-  // w'(0, 0) = g . x(-offset, -offset): for g(i, j), what was the x(,) that's
-  // used for the w(,)
-
-  Tensor wg{w_.dims()};
-
-  auto& g = parents[0].op->inputGradient()[parents[0].inputIndex];
-  auto& x = inputs_[0]->get();
+  auto& g = parents[0].op->inputGradient(ctx)[parents[0].inputIndex];
+  auto& x = this->inputs_[0]->get(ctx);
   SCHECK(g.dims()[0] == x.dims()[0]);
 
-  for (int e = 0; e < g.dims()[0]; ++e) {
-    auto ge = g[e];
-    auto xe = x[e];
-
-    for (int o = 0; o < ge.dims()[0]; ++o) {
-      auto go = ge[o];
-      auto wo = wg[o];
-      Matrix gm{go};
-
-      for (int i = 0; i < xe.dims()[0]; ++i) {
-        auto xi = xe[i];
-        auto woi = wo[i];
-        Matrix wm{woi};
-        Matrix xm{xi};
-        SCHECK(xm.rows() == gm.rows() && xm.cols() == gm.cols());
-
-        // cout << "gm: " << go << endl;
-        // cout << "xm: " << xi << endl;
-
-        for (int r = 0; r < wm.rows(); ++r) {
-          for (int c = 0; c < wm.cols(); ++c) {
-            wm(r, c) +=
-                dot(MatrixPatch(gm, 0, 0, gm.rows(), gm.cols()),
-                    MatrixPatch(
-                        xm,
-                        r - wm.rows() / 2,
-                        c - wm.cols() / 2,
-                        xm.rows(),
-                        xm.cols()));
-            // cout << "wm(r, c) = " << wm(r, c) << endl;
-          }
-        }
-      }
-    }
-  }
+  convolveWGradient(
+      x, g, w_.dims(), op->parameterGradientBuffer(ctx, 0), algorithm_);
 
   // b
-  Tensor bg{b_.dims()};
-  Vector bm{bg};
+  auto& bg = op->parameterGradientBuffer(ctx, 1);
+  bg.reset(b_.dims());
+  VectorT<T> bm{bg};
   for (int e = 0; e < g.dims()[0]; ++e) {
     auto ge = g[e];
     for (int o = 0; o < bm.n(); ++o) {
       auto go = ge[o];
-      bm(o) += Matrix{go}.sum();
+      bm(o) += MatrixT<T>{go}.sum();
     }
   }
 
   // x
-  Tensor xg{x.dims()};
-  for (int e = 0; e < g.dims()[0]; ++e) {
-    auto ge = g[e];
-    auto xe = xg[e];
-
-    for (int o = 0; o < ge.dims()[0]; ++o) {
-      auto go = ge[o];
-      auto wo = w_[o];
-      Matrix gm{go};
-
-      for (int i = 0; i < xe.dims()[0]; ++i) {
-        auto xi = xe[i];
-        auto woi = wo[i];
-        Matrix xm{xi};
-        Matrix wm{woi};
-        int R = wm.rows(), C = wm.cols();
-
-        for (int r = 0; r < xm.rows(); ++r) {
-          for (int c = 0; c < xm.cols(); ++c) {
-            // Determine the w(,) that is applied to x(r,c) to produce g(0,0)
-            int r1 = R / 2 + r;
-            int c1 = C / 2 + c;
-
-            // Determine the w(,) that is applied to x(r,c) to produce g(n - 1,
-            // m - 1)
-            // int r2 = R / 2 - (gm.rows() - 1) + r;
-            // int c2 = C / 2 - (gm.cols() - 1) + c;
-
-            xm(r, c) +=
-                dot(MatrixPatch(gm, 0, 0, gm.rows(), gm.cols()),
-                    MatrixPatch(wm, r1, c1, gm.rows(), gm.cols(), true));
-          }
-        }
-      }
-    }
-  }
-
-  return GradientPair{Gradient{move(xg)}, Gradient{move(wg), move(bg)}};
+  convolveXGradient(
+      g,
+      w_,
+      x.dims(),
+      op->inputGradientBuffer(ctx, 0),
+      algorithm_,
+      &filter_);
 }
 
-void ConvolutionLayerOperator::read(std::istream& in) {
-  Operator::read(in);
+template <typename T>
+void ConvolutionLayerOperator<T>::read(std::istream& in) {
+  Operator<T>::read(in);
 
   expectToken(in, "W");
   expectToken(in, "=");
-  w_ = Tensor::read(in);
+  w_ = TensorT<T>::read(in);
 
   expectToken(in, "B");
   expectToken(in, "=");
-  b_ = Tensor::read(in);
+  b_ = TensorT<T>::read(in);
 }
 
-void ConvolutionLayerOperator::write(std::ostream& out) const {
-  Operator::write(out);
+template <typename T>
+void ConvolutionLayerOperator<T>::write(std::ostream& out) const {
+  Operator<T>::write(out);
   out << "W = ";
-  Tensor::write(out, w_);
+  TensorT<T>::write(out, w_);
   out << "B = ";
-  Tensor::write(out, b_);
+  TensorT<T>::write(out, b_);
 }
 
-PoolingOperator::PoolingOperator(int width, int stride, IOperator input)
-    : Operator(computeOutputDims(input->dims(), width, stride), {input}),
+template <typename T>
+PoolingOperator<T>::PoolingOperator(int width, int stride, IOperator<T> input)
+    : Operator<T>(computeOutputDims(input->dims(), width, stride), {input}),
       width_(width),
       stride_(stride) {}
 
-Tensor& PoolingOperator::compute() {
-  auto& x = inputs_[0]->get();
-  auto d = dims().addFront(x.dims()[0]);
-  get() = Tensor{d};
-  auto& ret = get();
+template <typename T>
+TensorT<T>& PoolingOperator<T>::compute(ExecutionContext<T>& ctx) {
+  auto& x = this->inputs_[0]->get(ctx);
+  auto& ret = this->get(ctx);
+  // Every element is written below
+  ret.resize(this->dims().addFront(x.dims()[0]));
 
   SCHECK(ret.dims()[0] == x.dims()[0] && ret.dims()[1] == x.dims()[1]);
 
@@ -376,14 +482,15 @@ Tensor& PoolingOperator::compute() {
     for (int channel = 0; channel < x.dims()[1]; ++channel) {
       auto xc = xe[channel];
       auto rc = re[channel];
-      Matrix xm{xc};
-      Matrix rm{rc};
+      MatrixT<T> xm{xc};
+      MatrixT<T> rm{rc};
 
       // TODO: make it symmetric. But finish the gradient for the current form
       // first
       for (int r = 0, i = 0; r < xm.rows(); r += stride_, ++i) {
         for (int c = 0, j = 0; c < xm.cols(); c += stride_, ++j) {
-          rm(i, j) = std::get<0>(MatrixPatch{xm, r, c, width_, width_}.max());
+          rm(i, j) =
+              std::get<0>(MatrixPatchT<T>{xm, r, c, width_, width_}.max());
         }
       }
     }
@@ -392,13 +499,17 @@ Tensor& PoolingOperator::compute() {
   return ret;
 }
 
-GradientPair PoolingOperator::gradientFunc(BackPropOperator* op) {
+template <typename T>
+void PoolingOperator<T>::gradientFunc(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx) {
   auto& parents = op->parents();
   SCHECK(parents.size() == 1);
 
-  auto& parentG = parents[0].op->inputGradient()[parents[0].inputIndex];
-  auto& x = inputs_[0]->get();
-  Tensor g{x.dims()};
+  auto& parentG = parents[0].op->inputGradient(ctx)[parents[0].inputIndex];
+  auto& x = this->inputs_[0]->get(ctx);
+  auto& g = op->inputGradientBuffer(ctx, 0);
+  g.reset(x.dims());
 
   for (int e = 0; e < x.dims()[0]; e++) {
     auto xe = x[e];
@@ -408,15 +519,15 @@ GradientPair PoolingOperator::gradientFunc(BackPropOperator* op) {
       auto xc = xe[channel];
       auto gc = ge[channel];
       auto pgc = pge[channel];
-      Matrix xm{xc};
-      Matrix gm{gc};
-      Matrix pgm{pgc};
+      MatrixT<T> xm{xc};
+      MatrixT<T> gm{gc};
+      MatrixT<T> pgm{pgc};
 
       for (int r = 0, i = 0; r < xm.rows(); r += stride_, ++i) {
         for (int c = 0, j = 0; c < xm.cols(); c += stride_, ++j) {
-          Float max;
+          T max;
           int R, C;
-          tie(max, R, C) = MatrixPatch{xm, r, c, width_, width_}.max();
+          tie(max, R, C) = MatrixPatchT<T>{xm, r, c, width_, width_}.max();
           if (R >= 0 && R < gm.rows() && C >= 0 && C < gm.cols()) {
             gm(R, C) += pgm(i, j);
           }
@@ -424,72 +535,74 @@ GradientPair PoolingOperator::gradientFunc(BackPropOperator* op) {
       }
     }
   }
-
-  return make_pair(Gradient{move(g)}, Gradient{});
 }
 
-ReluOperator::ReluOperator(IOperator input) : Operator(input->dims(), {input}) {
+template <typename T>
+ReluOperator<T>::ReluOperator(IOperator<T> input)
+    : Operator<T>(input->dims(), {input}) {
   SCHECK(input->dims().size() >= 1);
 }
 
-Tensor& ReluOperator::compute() {
-  get() = inputs_[0]->get();
-  auto& ret = get();
-  for (auto& x : ret.data()) {
-    if (x < 0) {
-      x = 0;
-    }
-  }
+template <typename T>
+TensorT<T>& ReluOperator<T>::compute(ExecutionContext<T>& ctx) {
+  auto& x = this->inputs_[0]->get(ctx);
+  auto& ret = this->get(ctx);
+  ret.resize(x.dims());
+  kernels::relu(ret.data().begin(), x.data().begin(), x.total());
   return ret;
 }
 
-GradientPair ReluOperator::gradientFunc(BackPropOperator* op) {
+template <typename T>
+void ReluOperator<T>::gradientFunc(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx) {
   auto& parents = op->parents();
   // I can make this more generic (the ReLu output is consumed by multiple
   // operators), but let's simplify for now
   SCHECK(parents.size() == 1);
 
-  auto g = parents[0].op->inputGradient()[parents[0].inputIndex];
-  auto& output = get();
-  SCHECK(g.dims() == output.dims());
-  for (size_t i = 0; i < g.data().size(); ++i) {
-    if (output.data()[i] <= 0) {
-      g.data()[i] = 0;
-    }
-  }
-
-  return make_pair(Gradient{move(g)}, Gradient{});
+  auto& parentG = parents[0].op->inputGradient(ctx)[parents[0].inputIndex];
+  auto& output = this->get(ctx);
+  SCHECK(parentG.dims() == output.dims());
+  auto& g = op->inputGradientBuffer(ctx, 0);
+  // Not g = parentG: a planned buffer is shared with the workspace, so the
+  // assignment would give g storage of its own
+  g.resize(parentG.dims());
+  copy(parentG.data().begin(), parentG.data().end(), g.data().begin());
+  kernels::reluBackward(g.data().begin(), output.data().begin(), g.total());
 }
 
-SoftmaxOperator::SoftmaxOperator(IOperator input)
-    : Operator(input->dims(), {input}) {
+template <typename T>
+SoftmaxOperator<T>::SoftmaxOperator(IOperator<T> input)
+    : Operator<T>(input->dims(), {input}) {
   SCHECK(input->dims().size() == 1);
 }
 
-Tensor& SoftmaxOperator::compute() {
-  get() = Tensor{inputs_[0]->get().dims()};
+template <typename T>
+TensorT<T>& SoftmaxOperator<T>::compute(ExecutionContext<T>& ctx) {
+  // Every element is written below
+  this->get(ctx).resize(this->inputs_[0]->get(ctx).dims());
   // cout << get().dims() << endl;
-  Matrix m{get()};
+  MatrixT<T> m{this->get(ctx)};
 
-  Matrix in{inputs_[0]->get()};
+  MatrixT<T> in{this->inputs_[0]->get(ctx)};
 
   for (int i = 0; i < m.rows(); i++) {
-    // It would be good if I have a row view
-    vector<Float> e(in.cols());
-    Float sum = 0;
-    for (size_t j = 0; j < e.size(); j++) {
-      const Float maxi = 1e30f;
+    // The exponentials go into the output row, then get normalized
+    T sum = 0;
+    for (int j = 0; j < m.cols(); j++) {
+      const T maxi = 1e30f;
       if (-in(i, j) > log(maxi)) {
-        e[j] = maxi;
+        m(i, j) = maxi;
       } else {
-        e[j] = exp(-in(i, j));
+        m(i, j) = exp(-in(i, j));
       }
       // e[j] = min(exp(-in(i, j)), maxi);
 
-      sum += e[j];
+      sum += m(i, j);
     }
-    for (size_t j = 0; j < e.size(); j++) {
-      m(i, j) = e[j] / sum;
+    for (int j = 0; j < m.cols(); j++) {
+      m(i, j) /= sum;
       // if (m(i, j) < 1e-40) {
       //   cout << folly::format(
       //               "i={} j={} in={} e={} sum={}", i, j, in(i, j), e[j], sum)
@@ -497,18 +610,23 @@ Tensor& SoftmaxOperator::compute() {
       // }
     }
   }
-  return get();
+  return this->get(ctx);
 }
 
-GradientPair SoftmaxOperator::gradientFunc(BackPropOperator* op) {
+template <typename T>
+void SoftmaxOperator<T>::gradientFunc(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx) {
   auto& parents = op->parents();
   SCHECK(parents.size() == 1);
-  auto& parentG = parents[0].op->inputGradient()[parents[0].inputIndex];
-  Matrix parentM{parentG};
+  auto& parentG = parents[0].op->inputGradient(ctx)[parents[0].inputIndex];
+  MatrixT<T> parentM{parentG};
 
-  Tensor g{inputs_[0]->get().dims()};
-  Matrix m{g};
-  Matrix out{get()};
+  // Every element is written below
+  auto& g = op->inputGradientBuffer(ctx, 0);
+  g.resize(this->inputs_[0]->get(ctx).dims());
+  MatrixT<T> m{g};
+  MatrixT<T> out{this->get(ctx)};
 
   SCHECK(make_pair(m.rows(), m.cols()) == make_pair(out.rows(), out.cols()));
   SCHECK(
@@ -547,86 +665,97 @@ GradientPair SoftmaxOperator::gradientFunc(BackPropOperator* op) {
       // }
     }
   }
-
-  return make_pair(Gradient{move(g)}, Gradient{});
 }
 
-LossOperator::LossOperator(IOperator input, IOperator label)
-    : Operator(Dims{}, {input, label}) {
+template <typename T>
+LossOperator<T>::LossOperator(IOperator<T> input, IOperator<T> label)
+    : Operator<T>(Dims{}, {input, label}) {
   SCHECK(input->dims().size() == 1);
   SCHECK(label->dims().size() == 0);
 }
 
-Tensor& LossOperator::compute() {
-  SCHECK(inputs_[0]->get().dims()[0] == inputs_[1]->get().dims()[0]);
+template <typename T>
+TensorT<T>& LossOperator<T>::compute(ExecutionContext<T>& ctx) {
+  auto& x = this->inputs_[0]->get(ctx);
+  auto& y = this->inputs_[1]->get(ctx);
+  SCHECK(x.dims()[0] == y.dims()[0]);
 
-  Matrix in{inputs_[0]->get()};
-  Vector label{inputs_[1]->get()};
+  MatrixT<T> in{x};
+  VectorT<T> label{y};
 
   SCHECK(in.rows() == label.n());
 
-  Float s = 0;
+  T s = 0;
   for (int i = 0; i < label.n(); i++) {
     auto x = label(i);
     SCHECK(x < in.cols());
 
-    Float y = max(in(i, x), static_cast<Float>(1e-30f));
+    T y = max(in(i, x), static_cast<T>(1e-30f));
 
-    s += -log(y) * weight();
+    s += -log(y) * this->weight();
   }
   // cout << "weight=" << weight() << endl;
 
-  Tensor ret{Dims{1}};
-  Vector{ret}(0) = s;
-  get() = ret;
+  auto& ret = this->get(ctx);
+  ret.resize(Dims{1});
+  VectorT<T>{ret}(0) = s;
 
-  return get();
+  return ret;
 }
 
-GradientPair LossOperator::gradientFunc(BackPropOperator* op) {
-  Tensor g{inputs_[0]->get().dims()};
-  Matrix m{g};
-  Matrix in{inputs_[0]->get()};
-  Vector label{inputs_[1]->get()};
+template <typename T>
+void LossOperator<T>::gradientFunc(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx) {
+  auto& g = op->inputGradientBuffer(ctx, 0);
+  g.reset(this->inputs_[0]->get(ctx).dims());
+  MatrixT<T> m{g};
+  MatrixT<T> in{this->inputs_[0]->get(ctx)};
+  VectorT<T> label{this->inputs_[1]->get(ctx)};
   for (int i = 0; i < m.rows(); ++i) {
     SCHECK(label(i) < m.cols());
     // Note here we are already applying the 1/m scaling operation needed to
     // compute the averaged loss (same pattern as the forward pass)
 
-    m(i, label(i)) = -1 / in(i, label(i)) * weight();
+    m(i, label(i)) = -1 / in(i, label(i)) * this->weight();
     // if (isinf(m(i, label(i)))) {
     //   cout << folly::format("in={};i={};label={}", in(i, label(i)), i,
     //   label(i))
     //        << endl;
     // }
   }
-
-  return make_pair(Gradient{move(g)}, Gradient{});
 }
 
-SoftmaxLossOperator::SoftmaxLossOperator(
-    ISoftmaxOperator softmaxOp,
-    ILossOperator lossOp)
-    : LossOperator(
+template <typename T>
+SoftmaxLossOperator<T>::SoftmaxLossOperator(
+    ISoftmaxOperator<T> softmaxOp,
+    ILossOperator<T> lossOp)
+    : LossOperator<T>(
           lossOp->dims(),
           softmaxOp->getInputs() + lossOp->getInputs() -
-              OperatorList{softmaxOp}),
+              OperatorList<T>{softmaxOp}),
       softmaxOp_(softmaxOp),
       lossOp_(lossOp) {}
 
-Tensor& SoftmaxLossOperator::compute() {
-  softmaxOp_->compute();
-  lossOp_->compute();
-  return get();
+template <typename T>
+TensorT<T>& SoftmaxLossOperator<T>::compute(ExecutionContext<T>& ctx) {
+  softmaxOp_->compute(ctx);
+  lossOp_->compute(ctx);
+  return this->get(ctx);
 }
 
-GradientPair SoftmaxLossOperator::gradientFunc(BackPropOperator* op) {
+template <typename T>
+void SoftmaxLossOperator<T>::gradientFunc(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx) {
   SCHECK(op->parents().empty());
 
-  Tensor g{softmaxOp_->getInputs()[0]->get().dims()};
-  Matrix m{g};
-  Matrix softmax{softmaxOp_->get()};
-  Vector label{lossOp_->getInputs()[1]->get()};
+  // Every element is written below
+  auto& g = op->inputGradientBuffer(ctx, 0);
+  g.resize(softmaxOp_->getInputs()[0]->get(ctx).dims());
+  MatrixT<T> m{g};
+  MatrixT<T> softmax{softmaxOp_->get(ctx)};
+  VectorT<T> label{lossOp_->getInputs()[1]->get(ctx)};
 
   SCHECK(
       make_pair(m.rows(), m.cols()) ==
@@ -637,76 +766,67 @@ GradientPair SoftmaxLossOperator::gradientFunc(BackPropOperator* op) {
 
     for (int j = 0; j < m.cols(); ++j) {
       if (j == label(i)) {
-        m(i, j) = (1.0 - softmax(i, j)) * weight();
+        m(i, j) = (1.0 - softmax(i, j)) * this->weight();
       } else {
-        m(i, j) = -softmax(i, j) * weight();
+        m(i, j) = -softmax(i, j) * this->weight();
       }
     }
   }
-
-  return make_pair(Gradient{move(g)}, Gradient{});
 }
 
-Tensor& L2RegularizerOperator::compute() {
-  Float s = 0;
-  for (auto* w : parameters_) {
-    s += lambda_ * w->l2Sum();
+template <typename T>
+TensorT<T>& L2RegularizerOperator<T>::compute(ExecutionContext<T>& ctx) {
+  T s = 0;
+  for (auto* w : this->parameters_) {
+    s += this->lambda_ * w->l2Sum();
   }
 
-  Tensor ret{Dims{1}};
-  Vector{ret}(0) = s;
-  get() = ret;
-
-  return get();
-}
-
-void L2RegularizerOperator::applyGradient(const Gradient& g) {
-  SCHECK_MSG(
-      parameters_.size() == g.size(),
-      folly::format("{}  vs {}", parameters_.size(), g.size()).str());
+  auto& ret = this->get(ctx);
+  ret.resize(Dims{1});
+  VectorT<T>{ret}(0) = s;
 
-  if (diagnostics()) {
-    cout << name() << " gradient ratio:";
-    for (size_t i = 0; i < g.size(); ++i) {
-      auto& w = *parameters_[i];
-      cout << folly::format(
-          " {:.2F}({:.2F}%)", w.l2Norm(), g[i].l2Norm() / w.l2Norm() * 100);
-    }
-    cout << endl;
-    setDiagnostics(false);
-  }
-
-  for (size_t i = 0; i < g.size(); ++i) {
-    (*parameters_[i]) += g[i];
-  }
+  return ret;
 }
 
-GradientPair L2RegularizerOperator::gradientFunc(BackPropOperator*) {
-  // cout << "L2RegularizerOperator::gradientFunc" << endl;
+template <typename T>
+void L2RegularizerOperator<T>::gradientFunc(
+    BackPropOperator<T>* op,
+    ExecutionContext<T>& ctx) {
+  // cout << "L2RegularizerOperator<T>::gradientFunc" << endl;
 
-  Gradient g;
-  g.reserve(parameters_.size());
-  for (const auto* w : parameters_) {
-    Tensor t{w->dims()};
-    for (size_t i = 0; i < t.data().size(); ++i) {
-      t.data()[i] = lambda_ * w->data()[i] * 2;
-      // if (i == 0) {
-      //   cout << w->data()[i] << " " << t.data()[i] << endl;
-      // }
-    }
-
-    g.push_back(move(t));
+  for (size_t i = 0; i < this->parameters_.size(); ++i) {
+    const auto* w = this->parameters_[i];
+    auto& t = op->parameterGradientBuffer(ctx, i);
+    t.reset(w->dims());
+    kernels::axpy(
+        t.data().begin(), this->lambda_ * 2, w->data().begin(), t.total());
   }
-  return make_pair(Gradient{}, Gradient{move(g)});
 }
 
-std::function<Tensor*()> L2RegularizerOperator::getParameters() {
+template <typename T>
+std::function<TensorT<T>*()> L2RegularizerOperator<T>::getParameters() {
   size_t state = 0;
-  return [this, state]() mutable -> Tensor* {
-    if (state >= parameters_.size()) {
+  return [this, state]() mutable -> TensorT<T>* {
+    if (state >= this->parameters_.size()) {
       return nullptr;
     } else {
-      return parameters_[state++];
+      return this->parameters_[state++];
     }
   };
 }
+
+#define INSTANTIATE_OPERATORS(T)              \
+  template class Operator<T>;                 \
+  template class AdapterOperator<T>;          \
+  template class FCLayerOperator<T>;          \
+  template class FCReluLayerOperator<T>;      \
+  template class ConvolutionLayerOperator<T>; \
+  template class PoolingOperator<T>;          \
+  template class ReluOperator<T>;             \
+  template class SoftmaxOperator<T>;          \
+  template class LossOperator<T>;             \
+  template class SoftmaxLossOperator<T>;      \
+  template class L2RegularizerOperator<T>;
+
+INSTANTIATE_OPERATORS(float)
+INSTANTIATE_OPERATORS(double)
@@ -1,49 +1,71 @@
 #pragma once
 
+#include "execution_context.h"
 #include "tensor.h"
 
-#include <folly/ThreadLocal.h>
+#include <atomic>
 #include <functional>
 
+// Operators are templated on the element type T (float or double). The graph
+// is built for one precision; see TrainingConfig::precision.
+//
+// Outputs and gradients live in an ExecutionContext which is passed to every
+// compute(), get() and runBackProp(); the operators themselves only hold the
+// parameters.
+template <typename T>
 class Operator;
-using IOperator = std::shared_ptr<Operator>;
-using OperatorList = std::vector<IOperator>;
+template <typename T>
+using IOperator = std::shared_ptr<Operator<T>>;
+template <typename T>
+using OperatorList = std::vector<IOperator<T>>;
 
+template <typename T>
 class BackPropOperator;
-using IBackPropOperator = std::shared_ptr<BackPropOperator>;
+template <typename T>
+using IBackPropOperator = std::shared_ptr<BackPropOperator<T>>;
 
+template <typename T>
 class RegularizerOperator;
 
+template <typename T>
+class Optimizer;
+
+template <typename T>
 class Operator {
  public:
-  Operator(Dims dims, OperatorList inputs) : dims_(dims), inputs_(inputs) {}
+  Operator(Dims dims, OperatorList<T> inputs)
+      : dims_(dims), inputs_(inputs), slot_(newSlot()) {}
   virtual ~Operator() {}
   virtual std::string name() const = 0;
   virtual const Dims& dims() const {
     return dims_;
   }
-  virtual Tensor& compute() = 0;
-  virtual const Tensor& get() const {
-    return *output_;
+  virtual TensorT<T>& compute(ExecutionContext<T>& ctx) = 0;
+  // The output of the last compute() in ctx. compute() writes into it in
+  // place (TensorT::reset() / resize()) so that the storage is reused from one
+  // mini-batch to the next.
+  virtual TensorT<T>& get(ExecutionContext<T>& ctx) const {
+    return ctx.slot(slot_).output;
   }
-  // fix the const protection
-  virtual Tensor& get() {
-    return *output_;
+  // Intermediate results the operator keeps between compute() and backprop
+  TensorT<T>& workspace(ExecutionContext<T>& ctx) const {
+    return ctx.slot(slot_).workspace;
   }
 
-  const OperatorList& getInputs() const {
+  const OperatorList<T>& getInputs() const {
     return inputs_;
   }
-  OperatorList& getInputs() {
+  OperatorList<T>& getInputs() {
     return inputs_;
   }
 
   // Use the brute force way to compute gradient for debugging purposes
-  Gradient computeGradientDebug(const std::function<double()>& loss);
+  GradientT<T> computeGradientDebug(const std::function<double()>& loss);
 
-  virtual void applyGradient(const Gradient& g) {}
+  // Passes each parameter with its gradient to optimizer.update()
+  virtual void applyGradient(const GradientT<T>& g, Optimizer<T>& optimizer) {}
 
-  IBackPropOperator getBackPropOperator();
+  IBackPropOperator<T> getBackPropOperator();
 
   void setDiagnostics(bool value) {
     diagnostics_ = value;
@@ -52,7 +74,22 @@ class Operator {
     return diagnostics_;
   }
 
-  virtual void attachRegularizer(RegularizerOperator& regularizer) {}
+  virtual void attachRegularizer(RegularizerOperator<T>& regularizer) {}
+
+  // A sparse slot id no other operator uses
+  static size_t newSlot() {
+    return ExecutionContext<T>::kFirstSparseSlot + nextSlot_++;
+  }
+
+  // See ExecutionContext::kFirstSparseSlot. Set by GraphBuilder before the
+  // operator runs; the BackPropOperator follows.
+  size_t slotId() const {
+    return slot_;
+  }
+  bool hasDenseSlot() const {
+    return slot_ < ExecutionContext<T>::kFirstSparseSlot;
+  }
+  void setSlot(size_t slot);
 
   virtual void read(std::istream& in) {
     expectLine(in, name());
@@ -62,7 +99,15 @@ class Operator {
   }
 
   auto getParameterList() {
-    std::vector<const Tensor*> ret;
+    std::vector<const TensorT<T>*> ret;
+    for (auto* w : parameters()) {
+      ret.push_back(w);
+    }
+    return ret;
+  }
+  // The same, for loading parameters into
+  std::vector<TensorT<T>*> parameters() {
+    std::vector<TensorT<T>*> ret;
     auto getter = getParameters();
     while (auto w = getter()) {
       ret.push_back(w);
@@ -71,30 +116,38 @@ class Operator {
   }
 
  protected:
+  typename ExecutionContext<T>::Slot& slot(ExecutionContext<T>& ctx) const {
+    return ctx.slot(slot_);
+  }
+
   // The first dimension is implicit: it is the # of examples
   // Think of dim size as the size of one single example
   Dims dims_;
-  OperatorList inputs_;
-  folly::ThreadLocal<Tensor> output_;
+  OperatorList<T> inputs_;
 
  private:
-  virtual std::function<Tensor*()> getParameters() {
+  virtual std::function<TensorT<T>*()> getParameters() {
     return []() { return nullptr; };
   }
 
+  // Writes the gradients into the buffers of the BackPropOperator
   // TODO: add back the const modifier
-  virtual GradientPair gradientFunc(BackPropOperator*) = 0;
+  virtual void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) = 0;
 
-  IBackPropOperator backPropOp_ = nullptr;
+  static std::atomic<size_t> nextSlot_;
+  // Where the state of this operator lives in an ExecutionContext
+  size_t slot_;
+  IBackPropOperator<T> backPropOp_ = nullptr;
 
   bool diagnostics_ = false;
 };
 
+template <typename T>
 class BackPropOperator {
  public:
   // A parent consumes the output of this operator in the forward pass
   struct Parent {
-    IBackPropOperator op;
+    IBackPropOperator<T> op;
     int inputIndex; // The index of this operator in the inputs_ of the parent
   };
   using ParentList = std::vector<Parent>;
@@ -105,26 +158,38 @@ class BackPropOperator {
   // Idea: use T& construct and use perfect forwarding; let compiler deduce
   // const
 
-  using RunBackProp = std::function<GradientPair(BackPropOperator*)>;
-  BackPropOperator(std::string name, const RunBackProp& run)
-      : name_(name), run_(run) {}
+  using RunBackProp =
+      std::function<void(BackPropOperator<T>*, ExecutionContext<T>&)>;
+  BackPropOperator(std::string name, size_t slot, const RunBackProp& run)
+      : name_(name), slot_(slot), run_(run) {}
 
   std::string name() const {
     return name_;
   }
-  void addParent(IBackPropOperator op, int inputIndex) {
+  void addParent(IBackPropOperator<T> op, int inputIndex) {
     parents_.push_back(Parent{op, inputIndex});
   }
 
-  void runBackProp() {
-    std::tie(*inputGradient_, *parameterGradient_) = run_(this);
+  void runBackProp(ExecutionContext<T>& ctx) {
+    run_(this, ctx);
   }
   // TODO: add back the const modifier
-  Gradient& inputGradient() {
-    return *inputGradient_;
+  GradientT<T>& inputGradient(ExecutionContext<T>& ctx) const {
+    return ctx.slot(slot_).inputGradient;
+  }
+  GradientT<T>& parameterGradient(ExecutionContext<T>& ctx) const {
+    return ctx.slot(slot_).parameterGradient;
+  }
+
+  // The i-th gradient, kept across passes; the caller reset()s or resize()s it
+  // to the shape of the current pass so that its storage is reused as long as
+  // the batch shape does not change
+  TensorT<T>& inputGradientBuffer(ExecutionContext<T>& ctx, size_t i) const {
+    return buffer(inputGradient(ctx), i);
   }
-  Gradient& parameterGradient() {
-    return *parameterGradient_;
+  TensorT<T>& parameterGradientBuffer(ExecutionContext<T>& ctx, size_t i)
+      const {
+    return buffer(parameterGradient(ctx), i);
   }
 
   const ParentList& parents() const {
@@ -132,13 +197,23 @@ class BackPropOperator {
   }
 
  private:
+  friend class Operator<T>;
+
+  static TensorT<T>& buffer(GradientT<T>& g, size_t i) {
+    if (g.size() <= i) {
+      g.resize(i + 1);
+    }
+    return g[i];
+  }
+
   std::string name_;
+  // The slot of the forward operator
+  size_t slot_;
   RunBackProp run_;
-  folly::ThreadLocal<Gradient> parameterGradient_;
-  folly::ThreadLocal<Gradient> inputGradient_;
   ParentList parents_;
 };
-using BackPropOperatorList = std::vector<IBackPropOperator>;
+template <typename T>
+using BackPropOperatorList = std::vector<IBackPropOperator<T>>;
 
 class NameMaker {
  public:
@@ -156,84 +231,140 @@ class NameMaker {
   std::ostringstream out;
 };
 
-class InputOperator : public Operator {
+template <typename T>
+class InputOperator : public Operator<T> {
  public:
-  InputOperator(Dims inputDims) : Operator(inputDims, {}) {}
+  InputOperator(Dims inputDims) : Operator<T>(inputDims, {}) {}
   std::string name() const override {
-    return NameMaker{} << "input " << dims();
+    return NameMaker{} << "input " << this->dims();
+  }
+  void load(
+      ExecutionContext<T>& ctx,
+      const ExampleRange& examples,
+      bool label = false) {
+    this->get(ctx).load(examples, label);
   }
-  void load(const ExampleRange& examples, bool label = false) {
-    get() = Tensor{examples, label};
+  // Examples [begin, end) of a batch assembled ahead of time
+  void load(
+      ExecutionContext<T>& ctx,
+      const TensorT<T>& batch,
+      int begin,
+      int end) {
+    this->get(ctx).loadRows(batch, begin, end);
   }
-  Tensor& compute() override {
-    return get();
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override {
+    return this->get(ctx);
   }
 
  private:
-  GradientPair gradientFunc(BackPropOperator*) override {
-    return std::make_pair(Gradient{}, Gradient{});
-  }
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override {}
 };
-using IInputOperator = std::shared_ptr<InputOperator>;
+template <typename T>
+using IInputOperator = std::shared_ptr<InputOperator<T>>;
 
 // Adapts the shape of the input tensor
-class AdapterOperator : public Operator {
+template <typename T>
+class AdapterOperator : public Operator<T> {
  public:
-  AdapterOperator(Dims outputDims, IOperator input)
-      : Operator(outputDims, {input}) {
+  AdapterOperator(Dims outputDims, IOperator<T> input)
+      : Operator<T>(outputDims, {input}) {
     SCHECK(dimSize(outputDims) == dimSize(input->dims()));
   }
 
   std::string name() const override {
-    return NameMaker{} << "adapter " << dims();
+    return NameMaker{} << "adapter " << this->dims();
   }
 
-  Tensor& compute() override {
-    get() =
-        Tensor(dims().addFront(inputs_[0]->get().dims()[0]), inputs_[0]->get());
-    return get();
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override {
+    auto& x = this->inputs_[0]->get(ctx);
+    auto& ret = this->get(ctx);
+    ret = TensorT<T>(this->dims().addFront(x.dims()[0]), x);
+    return ret;
   }
 
  private:
-  GradientPair gradientFunc(BackPropOperator*) override;
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override;
 };
 
-class FCLayerOperator : public Operator {
+template <typename T>
+class FCLayerOperator : public Operator<T> {
  public:
-  FCLayerOperator(int width, IOperator input);
+  FCLayerOperator(int width, IOperator<T> input);
   std::string name() const override {
-    return NameMaker{} << "fc-layer " << dims();
+    return NameMaker{} << "fc-layer " << this->dims();
   }
-  Tensor& compute() override;
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override;
 
-  void applyGradient(const Gradient& g) override;
+  void applyGradient(const GradientT<T>& g, Optimizer<T>& optimizer) override;
 
-  void attachRegularizer(RegularizerOperator& regularizer) override;
+  void attachRegularizer(RegularizerOperator<T>& regularizer) override;
 
   void read(std::istream& in) override;
   void write(std::ostream& out) const override;
 
+ protected:
+  // Takes over the parameters and input of fc; for the fused variants
+  explicit FCLayerOperator(FCLayerOperator<T>&& fc);
+
+  // The input gradient g * W^T and the W gradient x^T * g for the gradient g
+  // of x * w
+  void gemmGradients(
+      BackPropOperator<T>* op,
+      ExecutionContext<T>& ctx,
+      const MatrixT<T>& g);
+
+  void readParameters(std::istream& in);
+  void writeParameters(std::ostream& out) const;
+
+  TensorT<T> w_;
+  TensorT<T> b_;
+
  private:
-  std::function<Tensor*()> getParameters() override;
-  GradientPair gradientFunc(BackPropOperator*) override;
+  std::function<TensorT<T>*()> getParameters() override;
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override;
+};
+
+// relu(x * w + b) in one operator: the bias and the ReLU are the epilogue of
+// the GEMM, and the backward pass applies the ReLU mask while summing the bias
+// gradient.
+// GraphBuilder::fuse() substitutes it for an FC layer followed by a ReLU. The
+// model text format is that of the unfused pair.
+template <typename T>
+class FCReluLayerOperator : public FCLayerOperator<T> {
+ public:
+  explicit FCReluLayerOperator(FCLayerOperator<T>&& fc);
+  std::string name() const override {
+    return NameMaker{} << "fc-relu-layer " << this->dims();
+  }
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override;
+
+  void read(std::istream& in) override;
+  void write(std::ostream& out) const override;
 
-  Tensor w_;
-  Tensor b_;
+ private:
+  // The output gradient with the ReLU mask applied goes into the workspace
+  // of the slot
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override;
 };
 
 /// Do padding to keep output size the same as input size
-class ConvolutionLayerOperator : public Operator {
+template <typename T>
+class ConvolutionLayerOperator : public Operator<T> {
  public:
-  ConvolutionLayerOperator(int channel, int width, IOperator input);
+  ConvolutionLayerOperator(
+      int channel,
+      int width,
+      IOperator<T> input,
+      ConvolutionAlgorithm algorithm = ConvolutionAlgorithm::Auto);
   std::string name() const override {
-    return NameMaker{} << "cnn-layer " << dims();
+    return NameMaker{} << "cnn-layer " << this->dims();
   }
 
-  Tensor& compute() override;
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override;
 
-  void applyGradient(const Gradient& g) override;
+  void applyGradient(const GradientT<T>& g, Optimizer<T>& optimizer) override;
 
-  void attachRegularizer(RegularizerOperator& regularizer) override;
+  void attachRegularizer(RegularizerOperator<T>& regularizer) override;
 
  private:
   // So that I may introduce different padding schemes in the future
@@ -246,26 +377,37 @@ class ConvolutionLayerOperator : public Operator {
     return Dims{channel, inputDims[0], width, width};
   }
 
-  GradientPair gradientFunc(BackPropOperator*) override;
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override;
 
-  std::function<Tensor*()> getParameters() override;
+  std::function<TensorT<T>*()> getParameters() override;
 
   void read(std::istream& in) override;
   void write(std::ostream& out) const override;
 
-  Tensor w_;
-  Tensor b_;
+  TensorT<T> w_;
+  TensorT<T> b_;
+  ConvolutionAlgorithm algorithm_;
+  // w_ transformed for Winograd, shared by the forward and the x gradient
+  WinogradFilterT<T> filter_;
 };
 
-class PoolingOperator : public Operator {
+template <typename T>
+class PoolingOperator : public Operator<T> {
  public:
   // TODO: verify size
-  PoolingOperator(int width, int stride, IOperator input);
+  PoolingOperator(int width, int stride, IOperator<T> input);
   std::string name() const override {
-    return NameMaker{} << "pooling-layer " << dims() << " w:" << width_
+    return NameMaker{} << "pooling-layer " << this->dims() << " w:" << width_
                        << ";s:" << stride_;
   }
-  Tensor& compute() override;
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override;
+
+  int width() const {
+    return width_;
+  }
+  int stride() const {
+    return stride_;
+  }
 
  private:
   static Dim roundUp(Dim x, Dim y) {
@@ -279,110 +421,115 @@ class PoolingOperator : public Operator {
                 roundUp(inputDims[2], stride)};
   }
 
-  GradientPair gradientFunc(BackPropOperator*) override;
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override;
 
   int width_;
   int stride_;
 };
 
-class ReluOperator : public Operator {
+template <typename T>
+class ReluOperator : public Operator<T> {
  public:
-  ReluOperator(IOperator input);
+  ReluOperator(IOperator<T> input);
   std::string name() const override {
     return "relu";
   }
-  Tensor& compute() override;
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override;
 
  private:
-  GradientPair gradientFunc(BackPropOperator*) override;
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override;
 };
 
-class SoftmaxOperator : public Operator {
+template <typename T>
+class SoftmaxOperator : public Operator<T> {
  public:
-  SoftmaxOperator(IOperator input);
+  SoftmaxOperator(IOperator<T> input);
   std::string name() const override {
     return "softmax";
   }
-  Tensor& compute() override;
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override;
 
  private:
-  GradientPair gradientFunc(BackPropOperator*) override;
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override;
 };
-using ISoftmaxOperator = std::shared_ptr<SoftmaxOperator>;
+template <typename T>
+using ISoftmaxOperator = std::shared_ptr<SoftmaxOperator<T>>;
 
-class LossOperator : public Operator {
+template <typename T>
+class LossOperator : public Operator<T> {
  public:
-  using Operator::Operator;
-  LossOperator(IOperator input, IOperator label);
+  using Operator<T>::Operator;
+  LossOperator(IOperator<T> input, IOperator<T> label);
   std::string name() const override {
     return "loss";
   }
-  Tensor& compute() override;
-  virtual void setWeight(Float w) {
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override;
+  virtual void setWeight(T w) {
     weight_ = w;
   }
-  Float weight() const {
+  T weight() const {
     return weight_;
   }
 
  private:
-  GradientPair gradientFunc(BackPropOperator*) override;
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override;
   // Weight to be applied to each example in loss and gradient computation
   // We don't automatically infer because of parallel execution
-  Float weight_ = 1.0;
+  T weight_ = 1.0;
 };
-using ILossOperator = std::shared_ptr<LossOperator>;
+template <typename T>
+using ILossOperator = std::shared_ptr<LossOperator<T>>;
 
 // Fuse softmax + loss to avoid numeric instability because of the division
-class SoftmaxLossOperator : public LossOperator {
+template <typename T>
+class SoftmaxLossOperator : public LossOperator<T> {
  public:
-  SoftmaxLossOperator(ISoftmaxOperator softmaxOp, ILossOperator lossOp);
+  SoftmaxLossOperator(ISoftmaxOperator<T> softmaxOp, ILossOperator<T> lossOp);
   std::string name() const override {
     return "softmax_loss";
   }
-  Tensor& compute() override;
-  const Tensor& get() const override {
-    return lossOp_->get();
-  }
-  Tensor& get() override {
-    return lossOp_->get();
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override;
+  TensorT<T>& get(ExecutionContext<T>& ctx) const override {
+    return lossOp_->get(ctx);
   }
-  void setWeight(Float w) override {
-    LossOperator::setWeight(w);
+  void setWeight(T w) override {
+    LossOperator<T>::setWeight(w);
     lossOp_->setWeight(w);
   }
 
  private:
-  GradientPair gradientFunc(BackPropOperator*) override;
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override;
 
-  ISoftmaxOperator softmaxOp_;
-  ILossOperator lossOp_;
+  ISoftmaxOperator<T> softmaxOp_;
+  ILossOperator<T> lossOp_;
 };
 
-class RegularizerOperator : public Operator {
+template <typename T>
+class RegularizerOperator : public Operator<T> {
  public:
-  RegularizerOperator(Float lambda) : Operator(Dims{}, {}), lambda_(lambda){};
-  void addParameter(Tensor* w) {
+  RegularizerOperator(T lambda) : Operator<T>(Dims{}, {}), lambda_(lambda){};
+  void addParameter(TensorT<T>* w) {
     parameters_.push_back(w);
   }
 
  protected:
-  std::vector<Tensor*> parameters_;
-  Float lambda_;
+  std::vector<TensorT<T>*> parameters_;
+  T lambda_;
 };
 
-using IRegularizerOperator = std::shared_ptr<RegularizerOperator>;
+template <typename T>
+using IRegularizerOperator = std::shared_ptr<RegularizerOperator<T>>;
 
-class L2RegularizerOperator : public RegularizerOperator {
+template <typename T>
+class L2RegularizerOperator : public RegularizerOperator<T> {
  public:
-  using RegularizerOperator::RegularizerOperator;
+  using RegularizerOperator<T>::RegularizerOperator;
   std::string name() const override {
     return "l2_regularizer";
   }
-  Tensor& compute() override;
-  void applyGradient(const Gradient& g) override;
+  TensorT<T>& compute(ExecutionContext<T>& ctx) override;
 
  private:
-  std::function<Tensor*()> getParameters() override;
-  GradientPair gradientFunc(BackPropOperator*) override;
+  std::function<TensorT<T>*()> getParameters() override;
+  void gradientFunc(BackPropOperator<T>*, ExecutionContext<T>&) override;
 };
@@ -0,0 +1,187 @@
+#include "optimizer.h"
+
+#include <cmath>
+
+using namespace std;
+
+template <typename T>
+void Optimizer<T>::update(TensorT<T>& w, const TensorT<T>& g) {
+  SCHECK(w.dims() == g.dims());
+  auto& s = state(w);
+  step(w, g, s);
+  ++s.steps;
+}
+
+template <typename T>
+typename Optimizer<T>::State& Optimizer<T>::state(const TensorT<T>& w) {
+  auto& state = states_[&w];
+  if (state.tensors.empty() && stateSize() > 0) {
+    state.tensors.resize(stateSize());
+    for (auto& t : state.tensors) {
+      t.reset(w.dims());
+    }
+  }
+  return state;
+}
+
+namespace {
+
+// w -= alpha * g
+template <typename T>
+class SGD : public Optimizer<T> {
+  int stateSize() const override {
+    return 0;
+  }
+  void step(TensorT<T>& w, const TensorT<T>& g, typename Optimizer<T>::State&)
+      override {
+    addScaled(w, -this->learningRate(), g);
+  }
+};
+
+// v = mu * v + alpha * g; w -= v
+template <typename T>
+class Momentum : public Optimizer<T> {
+ public:
+  explicit Momentum(const OptimizerConfig& config) : mu_(config.momentum) {}
+
+ private:
+  int stateSize() const override {
+    return 1;
+  }
+  void step(
+      TensorT<T>& w,
+      const TensorT<T>& g,
+      typename Optimizer<T>::State& state) override {
+    kernels::momentumUpdate(
+        w.data().begin(),
+        state.tensors[0].data().begin(),
+        g.data().begin(),
+        this->learningRate(),
+        mu_,
+        w.total());
+  }
+
+  T mu_;
+};
+
+// Duchi et al.: every element gets a learning rate of its own which decays
+// with the sum of its squared gradients
+template <typename T>
+class AdaGrad : public Optimizer<T> {
+ public:
+  explicit AdaGrad(const OptimizerConfig& config) : eps_(config.epsilon) {}
+
+ private:
+  int stateSize() const override {
+    return 1;
+  }
+  void step(
+      TensorT<T>& w,
+      const TensorT<T>& g,
+      typename Optimizer<T>::State& state) override {
+    kernels::adagradUpdate(
+        w.data().begin(),
+        state.tensors[0].data().begin(),
+        g.data().begin(),
+        this->learningRate(),
+        eps_,
+        w.total());
+  }
+
+  T eps_;
+};
+
+// Kingma & Ba, with the bias correction folded into the step size
+template <typename T>
+class Adam : public Optimizer<T> {
+ public:
+  explicit Adam(const OptimizerConfig& config)
+      : b1_(config.beta1), b2_(config.beta2), eps_(config.epsilon) {}
+
+ private:
+  int stateSize() const override {
+    return 2;
+  }
+  void step(
+      TensorT<T>& w,
+      const TensorT<T>& g,
+      typename Optimizer<T>::State& state) override {
+    const double t = state.steps + 1;
+    const double c1 = 1 - pow(static_cast<double>(b1_), t);
+    const double c2 = sqrt(1 - pow(static_cast<double>(b2_), t));
+    kernels::adamUpdate(
+        w.data().begin(),
+        state.tensors[0].data().begin(),
+        state.tensors[1].data().begin(),
+        g.data().begin(),
+        static_cast<T>(this->learningRate() * c2 / c1),
+        b1_,
+        b2_,
+        static_cast<T>(eps_ * c2),
+        w.total());
+  }
+
+  T b1_;
+  T b2_;
+  T eps_;
+};
+
+// You et al., layer-wise adaptive rate scaling: momentum SGD where the
+// learning rate of each parameter tensor is scaled by trust * |w| / |g|, so
+// that every layer moves by a similar fraction of its weights. The velocity
+// accumulates the scaled steps.
+template <typename T>
+class LARS : public Optimizer<T> {
+ public:
+  explicit LARS(const OptimizerConfig& config)
+      : mu_(config.momentum), trust_(config.trustCoefficient) {}
+
+ private:
+  int stateSize() const override {
+    return 1;
+  }
+  void step(
+      TensorT<T>& w,
+      const TensorT<T>& g,
+      typename Optimizer<T>::State& state) override {
+    const T wNorm = sqrt(w.l2Sum());
+    const T gNorm = sqrt(g.l2Sum());
+    // Fresh (zero) parameters and vanishing gradients fall back to plain
+    // momentum
+    const T local = wNorm > 0 && gNorm > 0 ? trust_ * wNorm / gNorm : 1;
+    kernels::momentumUpdate(
+        w.data().begin(),
+        state.tensors[0].data().begin(),
+        g.data().begin(),
+        this->learningRate() * local,
+        mu_,
+        w.total());
+  }
+
+  T mu_;
+  T trust_;
+};
+
+} // namespace
+
+// static
+template <typename T>
+unique_ptr<Optimizer<T>> Optimizer<T>::create(const OptimizerConfig& config) {
+  switch (config.type) {
+    case OptimizerConfig::Type::SGD:
+      return make_unique<SGD<T>>();
+    case OptimizerConfig::Type::Momentum:
+      return make_unique<Momentum<T>>(config);
+    case OptimizerConfig::Type::AdaGrad:
+      return make_unique<AdaGrad<T>>(config);
+    case OptimizerConfig::Type::Adam:
+      return make_unique<Adam<T>>(config);
+    case OptimizerConfig::Type::LARS:
+      return make_unique<LARS<T>>(config);
+  }
+  SCHECK(false);
+  return nullptr;
+}
+
+template class Optimizer<float>;
+template class Optimizer<double>;
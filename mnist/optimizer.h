@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+
+#include "TrainingConfig.h"
+#include "tensor.h"
+
+// Turns gradients into parameter updates. Operators hand each of their
+// parameters with its gradient to update() (see Operator::applyGradient()).
+//
+// Stateful optimizers keep their state tensors per parameter, keyed by the
+// parameter's address; a parameter must therefore be updated once per step
+// with its whole gradient (the trainer folds the regularizer gradient into
+// that of the operator first). Every step is a single fused kernel over the
+// parameter, its gradient and its state (see kernels.h).
+template <typename T>
+class Optimizer {
+ public:
+  static std::unique_ptr<Optimizer<T>> create(const OptimizerConfig& config);
+
+  virtual ~Optimizer() {}
+
+  void setLearningRate(T alpha) {
+    alpha_ = alpha;
+  }
+  T learningRate() const {
+    return alpha_;
+  }
+
+  // w -= the step for the gradient g
+  void update(TensorT<T>& w, const TensorT<T>& g);
+
+  struct State {
+    // Zero initialized tensors of the dims of the parameter
+    GradientT<T> tensors;
+    // Steps taken on the parameter so far, not counting the current one
+    long steps = 0;
+  };
+  // The state of parameter w, created on first use; checkpoints save and
+  // restore it
+  State& state(const TensorT<T>& w);
+
+ private:
+  // The number of state tensors per parameter
+  virtual int stateSize() const = 0;
+  virtual void step(TensorT<T>& w, const TensorT<T>& g, State& state) = 0;
+
+  T alpha_ = 0;
+  std::unordered_map<const TensorT<T>*, State> states_;
+};
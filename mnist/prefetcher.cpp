@@ -0,0 +1,79 @@
+#include "prefetcher.h"
+
+using namespace std;
+
+template <typename T>
+BatchPrefetcher<T>::BatchPrefetcher(Source source, int depth)
+    : source_(move(source)) {
+  SCHECK(depth >= 0);
+  for (int i = 0; i < depth + 1; ++i) {
+    slots_.push_back(make_unique<Batch>());
+  }
+  if (depth > 0) {
+    thread_ = std::thread([this]() { run(); });
+  }
+}
+
+template <typename T>
+BatchPrefetcher<T>::~BatchPrefetcher() {
+  {
+    lock_guard<mutex> g(lock_);
+    stop_ = true;
+  }
+  space_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+template <typename T>
+void BatchPrefetcher<T>::fill(Batch& batch) {
+  batch.examples = source_();
+  batch.input.load(batch.examples, false);
+  batch.label.load(batch.examples, true);
+}
+
+template <typename T>
+const typename BatchPrefetcher<T>::Batch& BatchPrefetcher<T>::next() {
+  const long slots = slots_.size();
+  if (!thread_.joinable()) {
+    auto& batch = *slots_[0];
+    fill(batch);
+    return batch;
+  }
+
+  unique_lock<mutex> l(lock_);
+  ready_.wait(l, [this]() { return produced_ > taken_; });
+  auto& batch = *slots_[taken_ % slots];
+  // Frees the slot of the previous batch
+  ++taken_;
+  l.unlock();
+  space_.notify_one();
+  return batch;
+}
+
+template <typename T>
+void BatchPrefetcher<T>::run() {
+  const long slots = slots_.size();
+  while (true) {
+    unique_lock<mutex> l(lock_);
+    // Batch taken_ - 1 is in use
+    space_.wait(
+        l, [&]() { return stop_ || produced_ < taken_ - 1 + slots; });
+    if (stop_) {
+      return;
+    }
+    auto& batch = *slots_[produced_ % slots];
+    l.unlock();
+
+    fill(batch);
+
+    l.lock();
+    ++produced_;
+    l.unlock();
+    ready_.notify_one();
+  }
+}
+
+template class BatchPrefetcher<float>;
+template class BatchPrefetcher<double>;
@@ -0,0 +1,59 @@
+#pragma once
+
+// The input stage of training. A background thread assembles the next
+// mini-batches (the normalized images in one contiguous tensor, and the
+// labels) while the current step runs, so the compute threads only copy the
+// rows of their shard out of a finished batch.
+//
+// Batches live in a ring of depth + 1 slots that are reused from one
+// mini-batch to the next, so once the ring has gone around the input stage
+// does not allocate. The thread runs at most depth batches ahead of the one
+// in use; with a depth of 0 there is no thread and next() assembles the batch
+// itself.
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "tensor.h"
+
+template <typename T>
+class BatchPrefetcher {
+ public:
+  struct Batch {
+    ExampleRange examples;
+    // {examples, pixels} and {examples}; see TensorT::load()
+    TensorT<T> input;
+    TensorT<T> label;
+  };
+  // Called on the prefetching thread, once per batch and in order
+  using Source = std::function<ExampleRange()>;
+
+  BatchPrefetcher(Source source, int depth);
+  ~BatchPrefetcher();
+  BatchPrefetcher(const BatchPrefetcher&) = delete;
+  BatchPrefetcher& operator=(const BatchPrefetcher&) = delete;
+
+  // The next batch; blocks until it is assembled. It stays valid until the
+  // following call.
+  const Batch& next();
+
+ private:
+  void fill(Batch& batch);
+  void run();
+
+  Source source_;
+  std::vector<std::unique_ptr<Batch>> slots_;
+
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::condition_variable space_;
+  // Batches assembled, and handed out by next(), so far
+  long produced_ = 0;
+  long taken_ = 0;
+  bool stop_ = false;
+  std::thread thread_;
+};
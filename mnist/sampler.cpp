@@ -0,0 +1,46 @@
+#include "sampler.h"
+
+#include <numeric>
+
+using namespace std;
+
+EpochSampler::EpochSampler(
+    const ExampleList& examples,
+    int batchSize,
+    bool shuffle,
+    uint64_t seed)
+    : examples_(examples),
+      batchSize_(batchSize),
+      shuffle_(shuffle),
+      gen_(seed) {
+  SCHECK(batchSize_ >= 1 && batchSize_ <= static_cast<int>(examples_.size()));
+  startEpoch();
+}
+
+void EpochSampler::startEpoch() {
+  next_ = 0;
+  ++epochs_;
+  if (!shuffle_) {
+    return;
+  }
+  if (!order_ || order_.use_count() > 1) {
+    order_ = make_shared<vector<int>>(examples_.size());
+  }
+  auto& order = *order_;
+  iota(order.begin(), order.end(), 0);
+  // Fisher-Yates. std::shuffle and the std distributions are implementation
+  // defined; this yields the same permutation everywhere.
+  for (int i = order.size() - 1; i > 0; --i) {
+    swap(order[i], order[gen_() % (i + 1)]);
+  }
+}
+
+ExampleRange EpochSampler::next() {
+  if (next_ + batchSize_ > static_cast<int>(examples_.size())) {
+    startEpoch();
+  }
+  ExampleRange ret = order_ ? ExampleRange(examples_, order_, next_, batchSize_)
+                            : ExampleRange(examples_, next_, batchSize_);
+  next_ += batchSize_;
+  return ret;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// Cuts the training set into mini-batches, epoch by epoch. Every epoch walks
+// the examples in a fresh random permutation; the examples left over at the
+// end of an epoch, fewer than a batch, sit that epoch out, so a batch never
+// wraps around and ExampleRange indexes without a modulo.
+//
+// The permutations are drawn from a generator seeded with the given seed:
+// the same seed yields the same sequence of batches, on any platform. The
+// sampler runs on the prefetching thread (see prefetcher.h), which thereby
+// knows the upcoming batches ahead of the step that uses them.
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "common.h"
+
+class EpochSampler {
+ public:
+  // Without shuffle every epoch goes through the examples in order
+  EpochSampler(
+      const ExampleList& examples,
+      int batchSize,
+      bool shuffle,
+      uint64_t seed);
+
+  ExampleRange next();
+
+  // Epochs started so far
+  long epochs() const {
+    return epochs_;
+  }
+
+ private:
+  void startEpoch();
+
+  const ExampleList& examples_;
+  const int batchSize_;
+  const bool shuffle_;
+  std::mt19937_64 gen_;
+  // The permutation of the current epoch; batches of it still in flight keep
+  // it alive when the next epoch starts
+  std::shared_ptr<std::vector<int>> order_;
+  int next_ = 0;
+  long epochs_ = 0;
+};
@@ -0,0 +1,205 @@
+#include "scheduler.h"
+
+#include <deque>
+#include <thread>
+
+#include "common.h"
+
+using namespace std;
+
+namespace {
+
+// Spins before a waiting thread yields or an idle worker goes to sleep
+constexpr int kSpins = 2000;
+
+// The worker the calling thread owns; threads outside the pool share 0
+thread_local int workerIndex = 0;
+// See TaskRunner::threadBudget(); 0 until a ThreadBudget sets it
+thread_local int budget = 0;
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+} // namespace
+
+struct TaskRunner::Worker {
+  struct Item {
+    Task task;
+    TaskGroup* group;
+  };
+
+  // On its own cache line; the owner and the thieves contend on it
+  alignas(64) mutex lock;
+  deque<Item> tasks;
+  std::thread handle;
+};
+
+int TaskRunner::nThreads_{0};
+
+TaskRunner& TaskRunner::get() {
+  static TaskRunner runner;
+  return runner;
+}
+
+TaskRunner::TaskRunner() {
+  SCHECK(nThreads() > 0);
+  // Spinning only pays off when every worker has a core of its own;
+  // otherwise it takes the CPU away from the thread doing the work
+  spins_ = nThreads() <= static_cast<int>(std::thread::hardware_concurrency())
+      ? kSpins
+      : 0;
+  for (int i = 0; i < nThreads(); ++i) {
+    workers_.push_back(make_unique<Worker>());
+  }
+  // Worker 0 is the submitting thread
+  for (int i = 1; i < nThreads(); ++i) {
+    workers_[i]->handle = std::thread([this, i]() { workerLoop(i); });
+  }
+}
+
+TaskRunner::~TaskRunner() {
+  {
+    lock_guard<mutex> g(sleepLock_);
+    stop_ = true;
+  }
+  wakeUp_.notify_all();
+  for (auto& w : workers_) {
+    if (w->handle.joinable()) {
+      w->handle.join();
+    }
+  }
+}
+
+void TaskRunner::push(Task task, TaskGroup* group) {
+  auto& w = *workers_[workerIndex];
+  {
+    lock_guard<mutex> g(w.lock);
+    w.tasks.push_back(Worker::Item{move(task), group});
+  }
+  // Pairs with the check of queued_ after a worker announced it sleeps
+  queued_.fetch_add(1);
+  if (sleepers_.load() > 0) {
+    lock_guard<mutex> g(sleepLock_);
+    wakeUp_.notify_one();
+  }
+}
+
+bool TaskRunner::runOne(int self, TaskGroup* group) {
+  auto matches = [group](const Worker::Item& item) {
+    return !group || item.group == group;
+  };
+
+  Worker::Item item;
+  bool found = false;
+  const int n = workers_.size();
+  for (int k = 0; k < n && !found; ++k) {
+    auto& w = *workers_[(self + k) % n];
+    lock_guard<mutex> g(w.lock);
+    if (k == 0) {
+      // Own deque: newest first
+      auto it = find_if(w.tasks.rbegin(), w.tasks.rend(), matches);
+      if (it != w.tasks.rend()) {
+        item = move(*it);
+        w.tasks.erase(next(it).base());
+        found = true;
+      }
+    } else {
+      // Steal the oldest
+      auto it = find_if(w.tasks.begin(), w.tasks.end(), matches);
+      if (it != w.tasks.end()) {
+        item = move(*it);
+        w.tasks.erase(it);
+        found = true;
+      }
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  queued_.fetch_sub(1);
+  item.task();
+  if (item.group) {
+    item.group->pending_.fetch_sub(1, memory_order_acq_rel);
+  }
+  return true;
+}
+
+void TaskRunner::workerLoop(int self) {
+  workerIndex = self;
+  while (true) {
+    if (runOne(self, nullptr)) {
+      continue;
+    }
+
+    bool work = false;
+    for (int i = 0; i < spins_ && !work; ++i) {
+      cpuRelax();
+      work = queued_.load(memory_order_relaxed) > 0;
+    }
+    if (work) {
+      continue;
+    }
+
+    unique_lock<mutex> l(sleepLock_);
+    ++sleepers_;
+    wakeUp_.wait(l, [this]() { return stop_ || queued_.load() > 0; });
+    --sleepers_;
+    if (stop_) {
+      return;
+    }
+  }
+}
+
+void TaskRunner::run(const vector<TaskRunner::Task>& tasks) {
+  SCHECK(tasks.size() >= 1);
+  const int T = tasks.size();
+
+  TaskGroup group;
+  for (int t = 0; t < T - 1; ++t) {
+    group.spawn([&tasks, t]() { tasks[t](); });
+  }
+  tasks[T - 1]();
+  group.wait();
+}
+
+int TaskRunner::threadBudget() {
+  return budget > 0 ? budget : max(nThreads(), 1);
+}
+
+TaskRunner::ThreadBudget::ThreadBudget(int threads) : saved_(budget) {
+  budget = max(threads, 1);
+}
+
+TaskRunner::ThreadBudget::~ThreadBudget() {
+  budget = saved_;
+}
+
+TaskRunner::Plan TaskRunner::plan(int items, int minPerShard) {
+  const int threads = max(nThreads(), 1);
+  const int shards = min(max(items / max(minPerShard, 1), 1), threads);
+  return Plan{shards, max(threads / shards, 1)};
+}
+
+TaskGroup::TaskGroup() : runner_(TaskRunner::get()) {}
+
+void TaskGroup::spawn(Task task) {
+  pending_.fetch_add(1, memory_order_relaxed);
+  runner_.push(move(task), this);
+}
+
+void TaskGroup::wait() {
+  int spins = 0;
+  while (pending_.load(memory_order_acquire) > 0) {
+    if (runner_.runOne(workerIndex, this)) {
+      spins = 0;
+    } else if (++spins < runner_.spins_) {
+      cpuRelax();
+    } else {
+      this_thread::yield();
+    }
+  }
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+// Work-stealing scheduler for the data parallel parts of training and
+// evaluation.
+//
+// There is one task deque per worker. Worker 0 is whichever thread submits
+// work from outside the pool (the main thread); it does not sit idle while
+// its work runs but executes tasks itself. A thread spawns onto its own deque
+// and pops from the back, so recently spawned (cache warm) work runs first.
+// Idle workers steal from the front of the other deques, then spin briefly
+// and finally sleep until new work is pushed.
+//
+// TaskGroup::wait() only helps with tasks of its own group. Operator outputs
+// and gradients live in each shard's ExecutionContext, but the GEMM packing
+// buffers and the convolution column buffers are per thread and stay in use
+// while their owner waits for its sub-tasks, so a waiting thread must not
+// pick up another shard's work that would overwrite them.
+//
+// Parallelism nests through a per-thread budget: the number of threads the
+// code running on a thread may fan out to. It starts at nThreads(), is 1
+// inside parallelFor() bodies, and a ThreadBudget raises or lowers it for a
+// scope. The trainer uses this to split threads between the shards of a
+// mini-batch and the GEMMs / convolutions inside each shard (see plan()).
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class TaskRunner;
+
+// Fork-join: spawn() any number of tasks, then wait() for all of them. The
+// destructor waits as well.
+class TaskGroup {
+ public:
+  using Task = std::function<void()>;
+
+  TaskGroup();
+  ~TaskGroup() {
+    wait();
+  }
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  void spawn(Task task);
+  void wait();
+
+ private:
+  friend class TaskRunner;
+
+  TaskRunner& runner_;
+  std::atomic<int> pending_{0};
+};
+
+class TaskRunner {
+ public:
+  using Task = std::function<void()>;
+
+  static TaskRunner& get();
+
+  // Runs the tasks in parallel and returns once all of them finished. The
+  // calling thread runs the last one.
+  void run(const std::vector<Task>& tasks);
+
+  // Calls f(b, e) on consecutive subranges [b, e) of [begin, end) which are
+  // grain long (the last one may be shorter). Up to maxThreads (default
+  // nThreads()) threads take subranges off a shared counter until the range
+  // is exhausted. f runs with a thread budget of 1.
+  template <typename F>
+  void parallelFor(int begin, int end, int grain, F&& f, int maxThreads = 0);
+
+  // See the comment at the top
+  static int threadBudget();
+  class ThreadBudget {
+   public:
+    explicit ThreadBudget(int threads);
+    ~ThreadBudget();
+
+   private:
+    int saved_;
+  };
+
+  // Spreads `items` independent pieces of work (e.g. the examples of a
+  // mini-batch) over the threads: as many shards as there are threads as
+  // long as each shard keeps at least minPerShard items, with the threads
+  // left over going to the parallelism inside each shard
+  struct Plan {
+    int shards;
+    int threadsPerShard;
+  };
+  static Plan plan(int items, int minPerShard);
+
+  static void setThreads(int n) {
+    nThreads_ = n;
+  }
+  static int nThreads() {
+    return nThreads_;
+  }
+
+  ~TaskRunner();
+
+ private:
+  friend class TaskGroup;
+  struct Worker;
+
+  TaskRunner();
+
+  void push(Task task, TaskGroup* group);
+  // Runs one queued task of group (any group if null); false if there is none
+  bool runOne(int self, TaskGroup* group);
+  void workerLoop(int self);
+
+  static int nThreads_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // Tasks sitting in any of the deques
+  std::atomic<int> queued_{0};
+  std::atomic<int> sleepers_{0};
+  std::atomic<bool> stop_{false};
+  int spins_;
+  std::mutex sleepLock_;
+  std::condition_variable wakeUp_;
+};
+
+template <typename F>
+void TaskRunner::parallelFor(
+    int begin,
+    int end,
+    int grain,
+    F&& f,
+    int maxThreads) {
+  if (begin >= end) {
+    return;
+  }
+  grain = std::max(grain, 1);
+  const int chunks = (end - begin + grain - 1) / grain;
+  const int threads =
+      maxThreads > 0 ? std::min(maxThreads, nThreads()) : nThreads();
+  const int helpers = std::min(chunks, threads) - 1;
+  if (helpers <= 0) {
+    ThreadBudget serial{1};
+    f(begin, end);
+    return;
+  }
+
+  struct Range {
+    std::atomic<int> next;
+    int grain;
+    int end;
+  };
+  Range range{{begin}, grain, end};
+  // Small enough for std::function to store inline
+  auto loop = [&range, &f]() {
+    ThreadBudget serial{1};
+    int b;
+    while ((b = range.next.fetch_add(
+                range.grain, std::memory_order_relaxed)) < range.end) {
+      f(b, std::min(b + range.grain, range.end));
+    }
+  };
+
+  TaskGroup group;
+  for (int i = 0; i < helpers; ++i) {
+    group.spawn(loop);
+  }
+  loop();
+  group.wait();
+}
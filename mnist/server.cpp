@@ -0,0 +1,244 @@
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "TrainingConfig.h"
+#include "common.h"
+#include "inference.h"
+#include "model.h"
+#include "scheduler.h"
+#include "serving.h"
+
+using namespace std;
+using namespace folly;
+
+// Serves the model of training.config (servingConfig) until interrupted or,
+// reading stdin, until end of file. See serving.h for the frames.
+
+namespace {
+
+atomic<bool> interrupted{false};
+// Readable once interrupted, so that blocked readers and the accept loop wake
+// up
+int wakeup[2];
+
+// One client. Responses go out in the order of the requests, since the
+// batcher serves them in order. They are written by a thread of the
+// connection, so that a slow client holds up only itself and not the batcher.
+class Connection {
+ public:
+  Connection(int in, int out) : in_(in), out_(out) {}
+  ~Connection() {
+    if (in_ > STDOUT_FILENO) {
+      close(in_);
+    }
+  }
+
+  // Until the client hangs up and every response is written
+  void serve(DynamicBatcher& batcher) {
+    thread writer([this]() { write(); });
+    uint8_t request[kRequestBytes];
+    while (readFully(in_, request, kRequestBytes, wakeup[0])) {
+      {
+        lock_guard<mutex> g(lock_);
+        ++outstanding_;
+      }
+      batcher.submit(request, [this](const Prediction& prediction) {
+        array<uint8_t, kResponseBytes> response;
+        encodeResponse(prediction, response.data());
+        lock_guard<mutex> g(lock_);
+        responses_.push_back(response);
+        ready_.notify_one();
+      });
+    }
+    {
+      lock_guard<mutex> g(lock_);
+      closing_ = true;
+      ready_.notify_one();
+    }
+    writer.join();
+  }
+
+ private:
+  void write() {
+    // Once the client is gone the responses are dropped
+    bool open = true;
+    unique_lock<mutex> g(lock_);
+    while (true) {
+      ready_.wait(g, [&]() {
+        return !responses_.empty() || (closing_ && outstanding_ == 0);
+      });
+      if (responses_.empty()) {
+        return;
+      }
+      auto response = responses_.front();
+      responses_.pop_front();
+      g.unlock();
+      open = open && writeFully(out_, response.data(), kResponseBytes);
+      g.lock();
+      --outstanding_;
+    }
+  }
+
+  const int in_;
+  const int out_;
+  mutex lock_;
+  condition_variable ready_;
+  deque<array<uint8_t, kResponseBytes>> responses_;
+  // Submitted and not written yet
+  long outstanding_ = 0;
+  // No more requests
+  bool closing_ = false;
+};
+
+int listenOn(const string& path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  SCHECK(fd >= 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  SCHECK_MSG(
+      path.size() < sizeof(address.sun_path),
+      format("Socket path {} is too long", path));
+  path.copy(address.sun_path, path.size());
+  unlink(path.c_str());
+  SCHECK_MSG(
+      ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0,
+      format("Cannot bind {}", path));
+  SCHECK(listen(fd, 128) == 0);
+  return fd;
+}
+
+} // namespace
+
+int main() {
+  // Blocked in every thread (they inherit the mask) and taken by sigwait()
+  // below, so no read is left waiting when they arrive
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+  SCHECK(pipe(wakeup) == 0);
+  thread signalWaiter([&]() {
+    int number;
+    sigwait(&signals, &number);
+    interrupted = true;
+    char c = 0;
+    SCHECK(write(wakeup[1], &c, 1) == 1);
+  });
+
+  ifstream configFile("training.config");
+  SCHECK(configFile.good());
+  auto config = TrainingConfig::read(configFile);
+  TaskRunner::setThreads(config.threads);
+  auto& serving = config.servingConfig;
+
+  auto file = serving.model != "" ? serving.model : config.writeModelTo;
+  auto model = loadModel(config, file);
+  if (auto engine = compileForInference(model, serving.maxBatch)) {
+    model = engine;
+  }
+  DynamicBatcher batcher{
+      model, serving.maxBatch, chrono::microseconds(serving.maxWaitUs)};
+  cerr << format(
+              "Serving {} on {}, batches of up to {} within {} us",
+              file,
+              serving.socket != "" ? serving.socket : "stdin",
+              serving.maxBatch,
+              serving.maxWaitUs)
+       << endl;
+
+  // Stdout may be the response stream; reports go to stderr
+  thread reporter;
+  if (serving.reportEvery > 0) {
+    reporter = thread([&]() {
+      auto next = chrono::steady_clock::now();
+      while (!interrupted) {
+        next += chrono::seconds(serving.reportEvery);
+        while (!interrupted && chrono::steady_clock::now() < next) {
+          this_thread::sleep_for(chrono::milliseconds(100));
+        }
+        // The final report takes the rest
+        if (!interrupted) {
+          cerr << batcher.stats() << endl;
+        }
+      }
+    });
+  }
+
+  auto start = chrono::steady_clock::now();
+  if (serving.socket == "") {
+    Connection(STDIN_FILENO, STDOUT_FILENO).serve(batcher);
+  } else {
+    int listener = listenOn(serving.socket);
+    // The connections being served, by id. Only this thread touches them;
+    // a connection that is done reports its id, and its thread is joined by
+    // the next round of the loop.
+    unordered_map<long, thread> clients;
+    long nextClient = 0;
+    mutex finishedLock;
+    vector<long> finished;
+    auto joinFinished = [&]() {
+      vector<long> ids;
+      {
+        lock_guard<mutex> g(finishedLock);
+        ids.swap(finished);
+      }
+      for (auto id : ids) {
+        clients[id].join();
+        clients.erase(id);
+      }
+    };
+    pollfd p[] = {{listener, POLLIN, 0}, {wakeup[0], POLLIN, 0}};
+    while (!interrupted) {
+      joinFinished();
+      // Wakes up now and then to join the connections that have hung up
+      if (poll(p, 2, 1000) <= 0 || p[0].revents == 0) {
+        continue;
+      }
+      int fd = accept(listener, nullptr, nullptr);
+      if (fd < 0) {
+        continue;
+      }
+      auto id = nextClient++;
+      clients.emplace(id, thread([&, fd, id]() {
+                        Connection(fd, fd).serve(batcher);
+                        lock_guard<mutex> g(finishedLock);
+                        finished.push_back(id);
+                      }));
+    }
+    close(listener);
+    unlink(serving.socket.c_str());
+    // The readers have woken up as well; the sockets close with their last
+    // response
+    for (auto& client : clients) {
+      client.second.join();
+    }
+  }
+  batcher.drain();
+
+  // The input may have ended on its own
+  pthread_kill(signalWaiter.native_handle(), SIGTERM);
+  signalWaiter.join();
+  if (reporter.joinable()) {
+    reporter.join();
+  }
+  cerr << format(
+              "Served for {:.1f} s; since the last report: ",
+              chrono::duration<double>(chrono::steady_clock::now() - start)
+                  .count())
+       << batcher.stats() << endl;
+}
@@ -0,0 +1,194 @@
+#include "serving.h"
+
+#include <folly/Format.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+
+void encodeResponse(const Prediction& prediction, uint8_t* out) {
+  out[0] = prediction.getClass();
+  for (int k = 0; k < N_CLASS; ++k) {
+    float p = prediction.prob[k];
+    memcpy(out + 1 + k * sizeof(float), &p, sizeof(float));
+  }
+}
+
+bool readFully(int fd, void* buffer, size_t n, int cancel) {
+  auto* p = static_cast<char*>(buffer);
+  // poll() skips negative descriptors
+  pollfd fds[] = {{fd, POLLIN, 0}, {cancel, POLLIN, 0}};
+  while (n > 0) {
+    if (cancel >= 0) {
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      if (fds[1].revents != 0) {
+        return false;
+      }
+    }
+    auto r = ::read(fd, p, n);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    n -= r;
+  }
+  return true;
+}
+
+bool writeFully(int fd, const void* buffer, size_t n) {
+  auto* p = static_cast<const char*>(buffer);
+  while (n > 0) {
+    auto r = ::write(fd, p, n);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    n -= r;
+  }
+  return true;
+}
+
+double percentile(vector<double>& samples, double p) {
+  if (samples.empty()) {
+    return 0;
+  }
+  auto nth = samples.begin() + min<size_t>(
+                                   samples.size() - 1,
+                                   static_cast<size_t>(p * samples.size()));
+  nth_element(samples.begin(), nth, samples.end());
+  return *nth;
+}
+
+DynamicBatcher::DynamicBatcher(
+    IModel model,
+    int maxBatch,
+    chrono::microseconds maxWait)
+    : model_(move(model)),
+      maxBatch_(maxBatch),
+      maxWait_(maxWait),
+      since_(Clock::now()) {
+  SCHECK(maxBatch_ > 0);
+  thread_ = thread([this]() { run(); });
+}
+
+DynamicBatcher::~DynamicBatcher() {
+  {
+    lock_guard<mutex> g(lock_);
+    stop_ = true;
+  }
+  arrived_.notify_one();
+  thread_.join();
+}
+
+void DynamicBatcher::submit(const uint8_t* pixels, Callback done) {
+  {
+    lock_guard<mutex> g(lock_);
+    queue_.emplace_back();
+    auto& request = queue_.back();
+    copy(pixels, pixels + kRequestBytes, request.pixels.begin());
+    request.done = move(done);
+    request.submitted = Clock::now();
+    ++submitted_;
+  }
+  arrived_.notify_one();
+}
+
+void DynamicBatcher::drain() {
+  unique_lock<mutex> g(lock_);
+  const long target = submitted_;
+  drained_.wait(g, [&]() { return answered_ >= target; });
+}
+
+void DynamicBatcher::run() {
+  vector<Request> batch;
+  ExampleList examples;
+  while (true) {
+    batch.clear();
+    {
+      unique_lock<mutex> g(lock_);
+      arrived_.wait(g, [this]() { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      // The oldest request waits for company until its deadline
+      auto deadline = queue_.front().submitted + maxWait_;
+      arrived_.wait_until(g, deadline, [this]() {
+        return stop_ || queue_.size() >= static_cast<size_t>(maxBatch_);
+      });
+      const int n = min<size_t>(maxBatch_, queue_.size());
+      for (int i = 0; i < n; ++i) {
+        batch.push_back(move(queue_.front()));
+        queue_.pop_front();
+      }
+    }
+
+    examples.clear();
+    for (auto& request : batch) {
+      examples.push_back(Example{request.pixels.data(), 0});
+    }
+    auto predictions = model_->predict(examples);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i].done(predictions[i]);
+    }
+
+    auto now = Clock::now();
+    {
+      lock_guard<mutex> g(statsLock_);
+      for (auto& request : batch) {
+        latencies_.push_back(
+            chrono::duration<double, micro>(now - request.submitted).count());
+      }
+      ++batches_;
+    }
+    {
+      lock_guard<mutex> g(lock_);
+      answered_ += batch.size();
+    }
+    drained_.notify_all();
+  }
+}
+
+DynamicBatcher::Stats DynamicBatcher::stats() {
+  vector<double> latencies;
+  Stats s;
+  {
+    lock_guard<mutex> g(statsLock_);
+    latencies.swap(latencies_);
+    s.batches = batches_;
+    batches_ = 0;
+    auto now = Clock::now();
+    s.seconds = chrono::duration<double>(now - since_).count();
+    since_ = now;
+  }
+  s.requests = latencies.size();
+  s.p50Us = percentile(latencies, 0.5);
+  s.p99Us = percentile(latencies, 0.99);
+  return s;
+}
+
+ostream& operator<<(ostream& out, const DynamicBatcher::Stats& s) {
+  out << folly::format(
+      "{} requests in {:.1f} s ({:.0f}/s), {:.1f} per batch, "
+      "latency p50 {:.0f} us p99 {:.0f} us",
+      s.requests,
+      s.seconds,
+      s.requests / max(s.seconds, 1e-9),
+      s.batches > 0 ? 1.0 * s.requests / s.batches : 0.0,
+      s.p50Us,
+      s.p99Us);
+  return out;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+// Serving single images with a model that is fastest on batches.
+//
+// Clients submit one image at a time; a batching thread coalesces whatever
+// is waiting into one predict() of up to maxBatch images. A batch starts as
+// soon as it is full, or once its oldest request has waited maxWait: under
+// load batches fill up and the cost per image drops, and a lone request is
+// delayed by at most maxWait. While a batch runs the next one accumulates.
+//
+// The server (server.cpp) and its load generator (tools/LoadGenerator.cpp)
+// talk in fixed size frames, so that no framing other than the byte stream
+// is needed: a request is the pixels of one image, a byte each as in the IDX
+// files; the response is the predicted class in one byte followed by the
+// N_CLASS probabilities as float32 in host byte order.
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+
+constexpr int kRequestBytes = Example::rows * Example::cols;
+constexpr int kResponseBytes = 1 + N_CLASS * sizeof(float);
+
+// The response frame of a prediction
+void encodeResponse(const Prediction& prediction, uint8_t* out);
+
+// Reads or writes exactly n bytes, retrying short transfers; false on end of
+// file or error. A read also gives up once cancel (a descriptor) is readable.
+bool readFully(int fd, void* buffer, size_t n, int cancel = -1);
+bool writeFully(int fd, const void* buffer, size_t n);
+
+// The p-th percentile (p in [0, 1]) of the samples, which it reorders
+double percentile(std::vector<double>& samples, double p);
+
+class DynamicBatcher {
+ public:
+  // Called on the batching thread
+  using Callback = std::function<void(const Prediction&)>;
+
+  struct Stats {
+    long requests;
+    long batches;
+    double seconds;
+    // From submit() to the callback
+    double p50Us;
+    double p99Us;
+  };
+
+  DynamicBatcher(IModel model, int maxBatch, std::chrono::microseconds maxWait);
+  // Serves the requests already submitted, then stops
+  ~DynamicBatcher();
+  DynamicBatcher(const DynamicBatcher&) = delete;
+  DynamicBatcher& operator=(const DynamicBatcher&) = delete;
+
+  // Copies the kRequestBytes pixels
+  void submit(const uint8_t* pixels, Callback done);
+  // Blocks until every request submitted so far has been answered
+  void drain();
+
+  // Since the previous call (or the start)
+  Stats stats();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Request {
+    std::array<uint8_t, kRequestBytes> pixels;
+    Callback done;
+    Clock::time_point submitted;
+  };
+
+  void run();
+
+  IModel model_;
+  const int maxBatch_;
+  const std::chrono::microseconds maxWait_;
+
+  std::mutex lock_;
+  std::condition_variable arrived_;
+  std::deque<Request> queue_;
+  bool stop_ = false;
+  long submitted_ = 0;
+  long answered_ = 0;
+  std::condition_variable drained_;
+
+  // Added to by the batching thread and reset by stats()
+  std::mutex statsLock_;
+  std::vector<double> latencies_;
+  long batches_ = 0;
+  Clock::time_point since_;
+
+  std::thread thread_;
+};
+
+std::ostream& operator<<(std::ostream& out, const DynamicBatcher::Stats& s);
@@ -0,0 +1,63 @@
+#pragma once
+
+// Building blocks shared by the vectorized kernels (kernels.cpp, gemm.cpp).
+//
+// Kernel bodies are written once as ALWAYS_INLINE templates over the vector
+// width W using the GCC/Clang vector extensions. They are then instantiated
+// inside thin entry points carrying AVX2_TARGET / AVX512_TARGET so the same
+// source is compiled for every instruction set, and the entry point is
+// picked at runtime (see kernels::isa()).
+
+#include <cstring>
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+// Kernel templates pass vectors by value but are always inlined into a
+// targeted entry point, so the calling convention never matters. Only the
+// kernel translation units include this header.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// W lanes of T
+template <typename T, int W>
+struct Simd {
+  typedef T V __attribute__((vector_size(sizeof(T) * W)));
+  // The result type of a lane-wise comparison: all bits set or clear
+  using Mask = decltype(V{} > V{});
+
+  static ALWAYS_INLINE V load(const T* p) {
+    V v;
+    std::memcpy(&v, p, sizeof(V));
+    return v;
+  }
+
+  static ALWAYS_INLINE void store(T* p, V v) {
+    std::memcpy(p, &v, sizeof(V));
+  }
+
+  static ALWAYS_INLINE V broadcast(T x) {
+    return V{} + x;
+  }
+
+  // Lanes of v where mask is clear become 0
+  static ALWAYS_INLINE V select(Mask mask, V v) {
+    return (V)((Mask)v & mask);
+  }
+
+  // Lane by lane; the vector extensions have no square root
+  static ALWAYS_INLINE V sqrt(V v) {
+    for (int i = 0; i < W; ++i) {
+      v[i] = __builtin_sqrt(v[i]);
+    }
+    return v;
+  }
+
+  static ALWAYS_INLINE T reduce(V v) {
+    T s = 0;
+    for (int i = 0; i < W; ++i) {
+      s += v[i];
+    }
+    return s;
+  }
+};
@@ -2,87 +2,110 @@
 
 #include <cmath>
 #include <cstring>
+#include <numeric>
+#include "allocator.h"
 #include "common.h"
+#include "scheduler.h"
 
 using namespace std;
 
-atomic<long> nTensors{0};
-atomic<long> tensorBytesCreated{0};
-atomic<long> tensorBytesTotal{0};
-
 void printTensorStats() {
-  cout << "nTensors = " << nTensors << endl;
-  cout << "avg Tensor size = " << tensorBytesCreated / nTensors << endl;
-  cout << "total Tensor size = " << tensorBytesTotal / 1024.0 / 1024.0 << " M"
+  auto stats = TensorAllocator::stats();
+  auto requests = stats.allocations();
+  auto mb = [](long bytes) { return bytes / 1024.0 / 1024.0; };
+  cout << "Tensor allocations = " << requests
+       << " (system = " << stats.systemAllocations
+       << ", pool hit rate = "
+       << (requests ? 100.0 * stats.poolHits / requests : 0.0) << "%)"
        << endl;
+  cout << "Tensor storage in use = " << mb(stats.bytesInUse) << " M (peak "
+       << mb(stats.peakBytesInUse) << " M), pooled = "
+       << mb(stats.bytesCached) << " M" << endl;
 }
 
-void UniformInitScheme::init(Tensor& t) {
-  uniform_real_distribution<> dist(a_, b_);
-  for (auto& x : t.data()) {
-    x = dist(gen());
-  }
-}
-
-void Tensor::createStorage() {
-  int n = dimSize(dims_);
-
-// Zero-init is required
-#if 1
-  data_ = shared_ptr<Float>{new Float[n](), std::default_delete<Float[]>{}};
-#else
-  ++nTensors;
-  auto* p = new Float[n]();
-  tensorBytesCreated += n * sizeof(Float);
-  tensorBytesTotal += n * sizeof(Float);
-  data_ = shared_ptr<Float>{p, [n](Float* x) {
-                              --nTensors;
-                              tensorBytesTotal -= n * sizeof(Float);
-                              delete[] x;
-                            }};
-#endif
-  // data_ = vector<Float>(n);
-  // cout << "createStorage: " << dims_ << " " << n << " " << data().size() << endl;
+template <typename T>
+void TensorT<T>::createStorage() {
+  // Zero-init is required
+  data_ = TensorAllocator::make<T>(dimSize(dims_));
+  // data_ = vector<T>(n);
 }
 
-Tensor::Tensor(const Tensor& t) : dims_(t.dims_) {
+template <typename T>
+TensorT<T>::TensorT(const TensorT<T>& t) : dims_(t.dims_) {
   // A copy is requested. Let's copy content of the Tensor.
   createStorage();
   copy(t.data().begin(), t.data().end(), data().begin());
 }
 
-Tensor::Tensor(Tensor&& t) : dims_(t.dims_), data_(std::move(t.data_)) {
+template <typename T>
+TensorT<T>::TensorT(TensorT<T>&& t)
+    : dims_(t.dims_), data_(std::move(t.data_)) {
   // So we can catch unintended move
   t.data_ = nullptr;
 }
 
-Tensor& Tensor::operator=(const Tensor& t) {
-  dims_ = t.dims_;
-  createStorage();
+template <typename T>
+TensorT<T>& TensorT<T>::operator=(const TensorT<T>& t) {
+  // Views share data_ so use_count() also accounts for them
+  if (!(data_ && data_.use_count() == 1 && reuseStorage(t.dims_))) {
+    dims_ = t.dims_;
+    createStorage();
+  }
   copy(t.data().begin(), t.data().end(), data().begin());
   return *this;
 }
 
-Tensor& Tensor::operator=(Tensor&& t) {
+template <typename T>
+TensorT<T>& TensorT<T>::operator=(TensorT<T>&& t) {
   dims_ = t.dims_;
   data_ = move(t.data_);
   t.data_ = nullptr;
   return *this;
 }
 
-Tensor::Tensor(Dims dims, InitScheme&& scheme) : dims_(dims) {
+template <typename T>
+bool TensorT<T>::reuseStorage(const Dims& dims) {
+  if (!data_ || dimSize(dims) != total()) {
+    return false;
+  }
+  dims_ = dims;
+  return true;
+}
+
+template <typename T>
+void TensorT<T>::reset(const Dims& dims) {
+  if (reuseStorage(dims)) {
+    fill(data().begin(), data().end(), T{});
+  } else {
+    dims_ = dims;
+    createStorage();
+  }
+}
+
+template <typename T>
+void TensorT<T>::resize(const Dims& dims) {
+  if (!reuseStorage(dims)) {
+    dims_ = dims;
+    createStorage();
+  }
+}
+
+template <typename T>
+TensorT<T>::TensorT(Dims dims, InitScheme&& scheme) : dims_(dims) {
   createStorage();
-  scheme.init(*this);
+  scheme.init(data().begin(), total());
 }
 
-Tensor Tensor::from(const vector<Float>& v) {
+template <typename T>
+TensorT<T> TensorT<T>::from(const vector<T>& v) {
   int n = v.size();
-  Tensor ret{Dims{n}};
+  TensorT<T> ret{Dims{n}};
   copy(v.begin(), v.end(), ret.data().begin());
   return ret;
 }
 
-Tensor Tensor::from(const vector<Tensor>& v) {
+template <typename T>
+TensorT<T> TensorT<T>::from(const vector<TensorT<T>>& v) {
   SCHECK(v.size() > 0);
   for (auto& x : v) {
     SCHECK(x.dims() == v[0].dims());
@@ -91,7 +114,7 @@ Tensor Tensor::from(const vector<Tensor>& v) {
   vector<Dim> dims = v[0].dims();
   dims.insert(dims.begin(), v.size());
 
-  Tensor ret{Dims{dims.begin(), dims.end()}};
+  TensorT<T> ret{Dims{dims.begin(), dims.end()}};
   int i = 0;
   for (auto& x : v) {
     std::copy(
@@ -104,8 +127,14 @@ Tensor Tensor::from(const vector<Tensor>& v) {
   return ret;
 }
 
+template <typename T>
+TensorT<T>::TensorT(const ExampleRange& es, bool label) {
+  load(es, label);
+}
+
 // Produce a two dimensional tensor for now
-Tensor::Tensor(const ExampleRange& es, bool label) {
+template <typename T>
+void TensorT<T>::load(const ExampleRange& es, bool label) {
   SCHECK(es.size() > 0);
 
   if (label) {
@@ -113,28 +142,36 @@ Tensor::Tensor(const ExampleRange& es, bool label) {
     return;
   }
 
-  for (auto& e : es) {
-    SCHECK(e.rows == es[0].rows);
-    SCHECK(e.cols == es[0].cols);
-  }
-
-  auto n = es[0].rows * es[0].cols;
-  dims_ = Dims{static_cast<Dim>(es.size()), n};
-  createStorage();
+  // Examples keep their raw pixels; they are normalized here, straight into
+  // the batch
+  const int n = Example::rows * Example::cols;
+  resize(Dims{static_cast<Dim>(es.size()), n});
 
-  int i = 0;
+  T* dst = data().begin();
   for (auto& e : es) {
-    for (auto& row : e.image) {
-      for (auto c : row) {
-        data()[i++] = c;
-      }
+    for (int i = 0; i < n; ++i) {
+      *dst++ = e.pixel(i);
     }
   }
 }
 
-void Tensor::loadLabel(const ExampleRange& es) {
-  dims_ = Dims{static_cast<Dim>(es.size())};
-  createStorage();
+template <typename T>
+void TensorT<T>::loadRows(const TensorT& batch, Dim begin, Dim end) {
+  auto dims = batch.dims();
+  SCHECK(0 <= begin && begin < end && end <= dims[0]);
+  const size_t row = batch.total() / dims[0];
+  dims[0] = end - begin;
+  dims.computeDimSize();
+  resize(dims);
+  copy(
+      batch.data().begin() + begin * row,
+      batch.data().begin() + end * row,
+      data().begin());
+}
+
+template <typename T>
+void TensorT<T>::loadLabel(const ExampleRange& es) {
+  resize(Dims{static_cast<Dim>(es.size())});
 
   int i = 0;
   for (auto& e : es) {
@@ -162,15 +199,16 @@ Tensor::Tensor(const vector<Tensor> tensors) {
 }
 */
 
-Tensor Tensor::operator[](Dim x) const {
+template <typename T>
+TensorT<T> TensorT<T>::operator[](Dim x) const {
   SCHECK(dims_.size() > 1);
   SCHECK(x < dims_[0]);
 
   // Avoid the excessive vector creation?
   Dims dims{dims_.begin() + 1, dims_.end()};
 
-  return Tensor{dims,
-                shared_ptr<Float>{data_, data().begin() + x * dimSize(dims)}};
+  return TensorT<T>{
+      dims, shared_ptr<T>{data_, data().begin() + x * dimSize(dims)}};
 
   // Tensor ret{Dims{dims_.begin() + 1, dims_.end()}};
   // copy(
@@ -180,26 +218,26 @@ Tensor Tensor::operator[](Dim x) const {
   // return ret;
 }
 
-Tensor Tensor::flatten() const {
-  return Tensor{Dims{dimSize(dims())}, *this};
+template <typename T>
+TensorT<T> TensorT<T>::flatten() const {
+  return TensorT<T>{Dims{dimSize(dims())}, *this};
   // Tensor ret{Dims{dimSize(dims())}};
   // copy(data().begin(), data().end(), ret.data().begin());
   // return ret;
 }
 
-Float Tensor::l2Norm() const {
+template <typename T>
+T TensorT<T>::l2Norm() const {
   return sqrt(l2Sum());
 }
 
-Float Tensor::l2Sum() const {
-  Float squaredSum = 0;
-  for (auto x : data()) {
-    squaredSum += x * x;
-  }
-  return squaredSum;
+template <typename T>
+T TensorT<T>::l2Sum() const {
+  return kernels::l2Sum(data().begin(), total());
 }
 
-bool Tensor::equals(const Tensor& other, double eps) const {
+template <typename T>
+bool TensorT<T>::equals(const TensorT<T>& other, double eps) const {
   if (dims() != other.dims()) {
     return false;
   }
@@ -211,47 +249,40 @@ bool Tensor::equals(const Tensor& other, double eps) const {
   return true;
 }
 
-void print(ostream& out, const Tensor& tensor, string tab) {
+template <typename T>
+void TensorT<T>::print(ostream& out, string tab) const {
   out << tab << "{" << endl;
 
-  if (tensor.dims_.size() == 1) {
+  if (dims_.size() == 1) {
     out << tab << "\t";
-    for (auto x : tensor.data()) {
+    for (auto x : data()) {
       out << x << ", ";
     }
     out << endl;
   } else {
-    for (int i = 0; i < tensor.dims_[0]; ++i) {
-      print(out, tensor[i], tab + "\t");
+    for (int i = 0; i < dims_[0]; ++i) {
+      (*this)[i].print(out, tab + "\t");
     }
   }
 
   out << tab << "}" << endl;
 }
 
-ostream& operator<<(ostream& out, const Tensor& tensor) {
-  print(out, tensor, "");
-  return out;
-}
-
-ostream& operator<<(ostream& out, Tensor::Array v) {
-  out << "[ ";
-  for (auto x : v) {
-    out << x << " ";
-  }
-  out << "]";
-
+template <typename T>
+ostream& operator<<(ostream& out, const TensorT<T>& tensor) {
+  tensor.print(out, "");
   return out;
 }
 
-Tensor Tensor::read(std::istream& in) {
+template <typename T>
+TensorT<T> TensorT<T>::read(std::istream& in) {
   expectToken(in, "{");
 
   Dims dims;
   in >> dims;
-  Tensor ret{dims};
+  TensorT<T> ret{dims};
 
-  std::vector<Float> x;
+  std::vector<T> x;
   in >> x;
 
   SCHECK(ret.data().size() == x.size());
@@ -262,7 +293,8 @@ Tensor Tensor::read(std::istream& in) {
   return ret;
 }
 
-void Tensor::write(std::ostream& out, const Tensor& tensor) {
+template <typename T>
+void TensorT<T>::write(std::ostream& out, const TensorT<T>& tensor) {
   out << "{" << endl;
 
   out << tensor.dims() << endl;
@@ -271,97 +303,92 @@ void Tensor::write(std::ostream& out, const Tensor& tensor) {
   out << "}" << endl;
 }
 
-Vector::Vector(Tensor& tensor) : tensor_(&tensor) {
+template <typename T>
+VectorT<T>::VectorT(TensorT<T>& tensor) : tensor_(&tensor) {
   // cout << tensor.dims_ << endl;
   SCHECK(tensor.dims_.size() == 1);
 }
 
-Matrix::Matrix(Tensor& tensor) : tensor_(&tensor) {
+template <typename T>
+MatrixT<T>::MatrixT(TensorT<T>& tensor) : tensor_(&tensor) {
   SCHECK(tensor_->dims_.size() == 2);
 }
 
-TransposedMatrix Matrix::transpose() {
-  return TransposedMatrix{this};
+template <typename T>
+TransposedMatrixT<T> MatrixT<T>::transpose() {
+  return TransposedMatrixT<T>{this};
 }
 
-Tensor operator+(const Matrix& a, const Matrix& b) {
+template <typename T>
+TensorT<T> operator+(const MatrixT<T>& a, const MatrixT<T>& b) {
   SCHECK(a.rows() == b.rows());
   SCHECK(a.cols() == b.cols());
 
   Dims dims{a.rows(), a.cols()};
-  Tensor ret{dims};
-  Matrix m{ret};
+  TensorT<T> ret{dims};
+  MatrixT<T> m{ret};
 
-  for (int i = 0; i < a.rows(); i++) {
-    for (int j = 0; j < a.cols(); j++) {
-      m(i, j) = a(i, j) + b(i, j);
-    }
-  }
+  const int n = a.rows() * a.cols();
+  copy(a.raw(), a.raw() + n, m.raw());
+  kernels::add(m.raw(), b.raw(), n);
 
   return ret;
 }
 
-Tensor operator+(const Matrix& a, const Vector& b) {
+template <typename T>
+TensorT<T> operator+(const MatrixT<T>& a, const VectorT<T>& b) {
   SCHECK(a.cols() == b.n());
 
   Dims dims{a.rows(), a.cols()};
-  Tensor ret{dims};
-  Matrix m{ret};
+  TensorT<T> ret{dims};
+  MatrixT<T> m{ret};
 
-  for (int i = 0; i < a.rows(); i++) {
-    for (int j = 0; j < a.cols(); j++) {
-      m(i, j) = a(i, j) + b(j);
-    }
-  }
+  copy(a.raw(), a.raw() + a.rows() * a.cols(), m.raw());
+  kernels::addRow(m.raw(), b.raw(), a.rows(), a.cols());
 
   return ret;
 }
 
-Tensor operator+(const Vector& a, const Vector& b) {
-  Tensor ret{Dims{a.n()}};
-  Vector r{ret};
+template <typename T>
+TensorT<T> operator+(const VectorT<T>& a, const VectorT<T>& b) {
+  TensorT<T> ret{Dims{a.n()}};
+  VectorT<T> r{ret};
 
   SCHECK(a.n() == b.n());
-  for (int i = 0; i < a.n(); ++i) {
-    r(i) = a(i) + b(i);
-  }
+  copy(a.raw(), a.raw() + a.n(), r.raw());
+  kernels::add(r.raw(), b.raw(), a.n());
   return ret;
 }
 
-Vector& operator+=(Vector& a, const Vector& b) {
+template <typename T>
+VectorT<T>& operator+=(VectorT<T>& a, const VectorT<T>& b) {
   SCHECK(a.n() == b.n());
-  for (int i = 0; i < a.n(); ++i) {
-    a(i) += b(i);
-  }
+  kernels::add(a.raw(), b.raw(), a.n());
   return a;
 }
 
-Vector& operator+=(Vector& a, Float x) {
-  for (int i = 0; i < a.n(); ++i) {
-    a(i) += x;
-  }
+template <typename T>
+VectorT<T>& operator+=(VectorT<T>& a, T x) {
+  kernels::addScalar(a.raw(), x, a.n());
   return a;
 }
 
-Tensor Matrix::rowSum() const {
-  Tensor ret{Dims{cols()}};
-  Vector v{ret};
-  for (int j = 0; j < cols(); ++j) {
-    for (int i = 0; i < rows(); ++i) {
-      v(j) += (*this)(i, j);
-    }
-  }
+template <typename T>
+TensorT<T> MatrixT<T>::rowSum() const {
+  TensorT<T> ret{Dims{cols()}};
+  VectorT<T> v{ret};
+  kernels::sumRows(v.raw(), raw(), rows(), cols());
   return ret;
 }
 
-Tensor convolve(const Tensor& x, const Tensor& w) {
+namespace {
+
+// The implementations accumulate into ret, which the caller zero fills with
+// the result shape
+template <typename T>
+void convolveDirect(const TensorT<T>& x, const TensorT<T>& w, TensorT<T>& ret) {
   // x: {batch, input channel, row, column}
   // w: {output channel, input channel, row, column}
-
-  SCHECK(x.dims().size() == 4);
-  SCHECK(w.dims().size() == 4);
-
-  Tensor ret{Dims{x.dims()[0], w.dims()[0], x.dims()[2], x.dims()[3]}};
   const Dim R = w.dims()[2];
   const Dim C = w.dims()[3];
 
@@ -371,27 +398,993 @@ Tensor convolve(const Tensor& x, const Tensor& w) {
 
     for (Dim c = 0; c < ret.dims()[1]; ++c) {
       auto channel = example[c];
-      Matrix out{channel};
+      MatrixT<T> out{channel};
       auto wc = w[c];
 
       for (Dim k = 0; k < x.dims()[1]; ++k) {
         // cout << "input dim: " << k << endl;
         auto xk = xe[k];
-        Matrix xm{xk};
+        MatrixT<T> xm{xk};
 
         auto wck = wc[k];
-        Matrix wm{wck};
+        MatrixT<T> wm{wck};
 
         for (Dim i = 0; i < out.rows(); ++i) {
           for (Dim j = 0; j < out.cols(); ++j) {
             out(i, j) +=
-                dot(MatrixPatch(xm, i - R / 2, j - C / 2, R, C),
-                    MatrixPatch(wm, 0, 0, R, C));
+                dot(MatrixPatchT<T>(xm, i - R / 2, j - C / 2, R, C),
+                    MatrixPatchT<T>(wm, 0, 0, R, C));
           }
         }
       }
     }
   }
+}
+
+template <typename T>
+void convolveWGradientDirect(
+    const TensorT<T>& x,
+    const TensorT<T>& g,
+    TensorT<T>& wg) {
+  // w'(0, 0) = g . x(-offset, -offset): for g(i, j), what was the x(,) that's
+  // used for the w(,)
+
+  for (int e = 0; e < g.dims()[0]; ++e) {
+    auto ge = g[e];
+    auto xe = x[e];
+
+    for (int o = 0; o < ge.dims()[0]; ++o) {
+      auto go = ge[o];
+      auto wo = wg[o];
+      MatrixT<T> gm{go};
+
+      for (int i = 0; i < xe.dims()[0]; ++i) {
+        auto xi = xe[i];
+        auto woi = wo[i];
+        MatrixT<T> wm{woi};
+        MatrixT<T> xm{xi};
+        SCHECK(xm.rows() == gm.rows() && xm.cols() == gm.cols());
+
+        for (int r = 0; r < wm.rows(); ++r) {
+          for (int c = 0; c < wm.cols(); ++c) {
+            wm(r, c) +=
+                dot(MatrixPatchT<T>(gm, 0, 0, gm.rows(), gm.cols()),
+                    MatrixPatchT<T>(
+                        xm,
+                        r - wm.rows() / 2,
+                        c - wm.cols() / 2,
+                        xm.rows(),
+                        xm.cols()));
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+void convolveXGradientDirect(
+    const TensorT<T>& g,
+    const TensorT<T>& w,
+    TensorT<T>& xg) {
+  for (int e = 0; e < g.dims()[0]; ++e) {
+    auto ge = g[e];
+    auto xe = xg[e];
+
+    for (int o = 0; o < ge.dims()[0]; ++o) {
+      auto go = ge[o];
+      auto wo = w[o];
+      MatrixT<T> gm{go};
+
+      for (int i = 0; i < xe.dims()[0]; ++i) {
+        auto xi = xe[i];
+        auto woi = wo[i];
+        MatrixT<T> xm{xi};
+        MatrixT<T> wm{woi};
+        int R = wm.rows(), C = wm.cols();
+
+        for (int r = 0; r < xm.rows(); ++r) {
+          for (int c = 0; c < xm.cols(); ++c) {
+            // Determine the w(,) that is applied to x(r,c) to produce g(0,0)
+            int r1 = R / 2 + r;
+            int c1 = C / 2 + c;
+
+            xm(r, c) +=
+                dot(MatrixPatchT<T>(gm, 0, 0, gm.rows(), gm.cols()),
+                    MatrixPatchT<T>(wm, r1, c1, gm.rows(), gm.cols(), true));
+          }
+        }
+      }
+    }
+  }
+}
+
+// Shape of the lowered problem for one example
+struct Im2colShape {
+  Im2colShape(const Dims& xDims, const Dims& wDims)
+      : channels(xDims[1]),
+        rows(xDims[2]),
+        cols(xDims[3]),
+        R(wDims[2]),
+        C(wDims[3]),
+        outChannels(wDims[0]) {
+    SCHECK(wDims[1] == channels);
+  }
+
+  // The column matrix is {patch(), pixels()}
+  int patch() const {
+    return channels * R * C;
+  }
+  int pixels() const {
+    return rows * cols;
+  }
+
+  int channels;
+  int rows;
+  int cols;
+  int R;
+  int C;
+  int outChannels;
+};
+
+// col(k * R * C + r * C + c, i * cols + j) = x(k, i + r - R / 2, j + c - C / 2)
+// with zero padding outside of the image
+template <typename T>
+void im2col(const Im2colShape& s, const T* x, T* col) {
+  for (int k = 0; k < s.channels; ++k) {
+    const T* xk = x + k * s.pixels();
+    for (int r = 0; r < s.R; ++r) {
+      for (int c = 0; c < s.C; ++c) {
+        const int dr = r - s.R / 2;
+        const int dc = c - s.C / 2;
+        // Columns j for which j + dc falls inside the image
+        const int j1 = max(0, -dc);
+        const int j2 = min(s.cols, s.cols - dc);
+
+        for (int i = 0; i < s.rows; ++i, col += s.cols) {
+          const int xi = i + dr;
+          if (xi < 0 || xi >= s.rows || j1 >= j2) {
+            fill(col, col + s.cols, 0.0);
+            continue;
+          }
+          const T* src = xk + xi * s.cols;
+          fill(col, col + j1, 0.0);
+          copy(src + j1 + dc, src + j2 + dc, col + j1);
+          fill(col + j2, col + s.cols, 0.0);
+        }
+      }
+    }
+  }
+}
+
+// The adjoint of im2col(): scatter-adds col back into x
+template <typename T>
+void col2im(const Im2colShape& s, const T* col, T* x) {
+  for (int k = 0; k < s.channels; ++k) {
+    T* xk = x + k * s.pixels();
+    for (int r = 0; r < s.R; ++r) {
+      for (int c = 0; c < s.C; ++c) {
+        const int dr = r - s.R / 2;
+        const int dc = c - s.C / 2;
+        const int j1 = max(0, -dc);
+        const int j2 = min(s.cols, s.cols - dc);
+
+        for (int i = 0; i < s.rows; ++i, col += s.cols) {
+          const int xi = i + dr;
+          if (xi < 0 || xi >= s.rows) {
+            continue;
+          }
+          T* dst = xk + xi * s.cols;
+          for (int j = j1; j < j2; ++j) {
+            dst[j + dc] += col[j];
+          }
+        }
+      }
+    }
+  }
+}
+
+// Per thread scratch space for the column matrix
+template <typename T>
+T* colBuffer(size_t n) {
+  thread_local vector<T> buffer;
+  if (buffer.size() < n) {
+    buffer.resize(n);
+  }
+  return buffer.data();
+}
+
+// With at least as many examples as the thread budget, the examples of a
+// convolution are spread over the threads in ranges of this size; otherwise
+// they run in order (a single range) and the GEMMs inside get the budget.
+int exampleGrain(int n) {
+  const int threads = TaskRunner::threadBudget();
+  return threads > 1 && n >= threads ? (n + threads - 1) / threads : n;
+}
+
+// Calls f(first, last) on the exampleGrain(n) long ranges of the n examples
+template <typename F>
+void forExamples(int n, F&& f) {
+  const int grain = exampleGrain(n);
+  if (grain < n) {
+    TaskRunner::get().parallelFor(0, n, grain, f, TaskRunner::threadBudget());
+  } else {
+    f(0, n);
+  }
+}
+
+template <typename T>
+void convolveIm2col(const TensorT<T>& x, const TensorT<T>& w, TensorT<T>& ret) {
+  Im2colShape s{x.dims(), w.dims()};
+
+  forExamples(x.dims()[0], [&](int first, int last) {
+    T* col = colBuffer<T>(static_cast<size_t>(s.patch()) * s.pixels());
+    for (Dim e = first; e < last; ++e) {
+      im2col(s, x[e].data().begin(), col);
+      // out{outChannels, pixels} = w{outChannels, patch} * col{patch, pixels}
+      gemm(
+          false,
+          false,
+          s.outChannels,
+          s.pixels(),
+          s.patch(),
+          w.data().begin(),
+          s.patch(),
+          col,
+          s.pixels(),
+          ret[e].data().begin(),
+          s.pixels());
+    }
+  });
+}
+
+template <typename T>
+void convolveWGradientIm2col(
+    const TensorT<T>& x,
+    const TensorT<T>& g,
+    TensorT<T>& wg) {
+  Im2colShape s{x.dims(), wg.dims()};
+  const int n = x.dims()[0];
+  // The examples all accumulate into wg: each range of examples gets a
+  // partial sum of its own which are added up at the end
+  const int grain = exampleGrain(n);
+  vector<TensorT<T>> partial((n + grain - 1) / grain);
+
+  forExamples(n, [&](int first, int last) {
+    auto& out = first == 0 ? wg : partial[first / grain];
+    if (first > 0) {
+      out.reset(wg.dims());
+    }
+    T* col = colBuffer<T>(static_cast<size_t>(s.patch()) * s.pixels());
+    for (Dim e = first; e < last; ++e) {
+      im2col(s, x[e].data().begin(), col);
+      // wg{outChannels, patch} += g{outChannels, pixels} * col^T
+      gemm(
+          false,
+          true,
+          s.outChannels,
+          s.patch(),
+          s.pixels(),
+          g[e].data().begin(),
+          s.pixels(),
+          col,
+          s.pixels(),
+          out.data().begin(),
+          s.patch());
+    }
+  });
+
+  for (size_t i = 1; i < partial.size(); ++i) {
+    kernels::add(wg.data().begin(), partial[i].data().begin(), wg.total());
+  }
+}
+
+template <typename T>
+void convolveXGradientIm2col(
+    const TensorT<T>& g,
+    const TensorT<T>& w,
+    TensorT<T>& xg) {
+  Im2colShape s{xg.dims(), w.dims()};
+  const size_t n = static_cast<size_t>(s.patch()) * s.pixels();
+
+  forExamples(xg.dims()[0], [&](int first, int last) {
+    T* col = colBuffer<T>(n);
+    for (Dim e = first; e < last; ++e) {
+      fill(col, col + n, 0.0);
+      // col{patch, pixels} = w^T * g{outChannels, pixels}
+      gemm(
+          true,
+          false,
+          s.patch(),
+          s.pixels(),
+          s.outChannels,
+          w.data().begin(),
+          s.patch(),
+          g[e].data().begin(),
+          s.pixels(),
+          col,
+          s.pixels());
+      col2im(s, col, xg[e].data().begin());
+    }
+  });
+}
+
+// Winograd F(2x2, 3x3) (Lavin and Gray). The 2x2 output tile at (2i, 2j) is
+// A^T [U . V] A, where U = G w G^T is the transformed filter and V = B^T d B
+// is the transformed 4x4 input tile d at (2i - 1, 2j - 1), zero padded.
+// Summed over the input channels, the elementwise products for one of the 16
+// elements of the tile are a GEMM: M{outChannels, tiles} = U{outChannels,
+// channels} * V{channels, tiles}. The gradients run the same transforms
+// adjoint.
+constexpr int kWinogradTile = 16;
+
+// The 1-D transforms y = f(x) over vectors with strides s and t, and their
+// adjoints: B^T, A^T, G
+struct InputTransform {
+  template <typename T>
+  void operator()(const T* x, int s, T* y, int t) const {
+    y[0] = x[0] - x[2 * s];
+    y[t] = x[s] + x[2 * s];
+    y[2 * t] = x[2 * s] - x[s];
+    y[3 * t] = x[s] - x[3 * s];
+  }
+};
+
+struct InputTransformAdjoint {
+  template <typename T>
+  void operator()(const T* x, int s, T* y, int t) const {
+    y[0] = x[0];
+    y[t] = x[s] - x[2 * s] + x[3 * s];
+    y[2 * t] = x[s] + x[2 * s] - x[0];
+    y[3 * t] = -x[3 * s];
+  }
+};
 
+struct OutputTransform {
+  template <typename T>
+  void operator()(const T* x, int s, T* y, int t) const {
+    y[0] = x[0] + x[s] + x[2 * s];
+    y[t] = x[s] - x[2 * s] - x[3 * s];
+  }
+};
+
+struct OutputTransformAdjoint {
+  template <typename T>
+  void operator()(const T* x, int s, T* y, int t) const {
+    y[0] = x[0];
+    y[t] = x[0] + x[s];
+    y[2 * t] = x[0] - x[s];
+    y[3 * t] = -x[s];
+  }
+};
+
+struct FilterTransform {
+  template <typename T>
+  void operator()(const T* x, int s, T* y, int t) const {
+    y[0] = x[0];
+    y[t] = (x[0] + x[s] + x[2 * s]) / 2;
+    y[2 * t] = (x[0] - x[s] + x[2 * s]) / 2;
+    y[3 * t] = x[2 * s];
+  }
+};
+
+struct FilterTransformAdjoint {
+  template <typename T>
+  void operator()(const T* x, int s, T* y, int t) const {
+    y[0] = x[0] + (x[s] + x[2 * s]) / 2;
+    y[t] = (x[s] - x[2 * s]) / 2;
+    y[2 * t] = (x[s] + x[2 * s]) / 2 + x[3 * s];
+  }
+};
+
+// y{M, M} = f x f^T for x{N, N}, where f maps N long vectors to M long ones.
+// y is written with a stride of ys between elements.
+template <int N, int M, typename T, typename F>
+void transform2d(const T* x, T* y, int ys, F f) {
+  T t[M * N];
+  for (int j = 0; j < N; ++j) {
+    f(x + j, N, t + j, N);
+  }
+  for (int i = 0; i < M; ++i) {
+    f(t + i * N, 1, y + i * M * ys, ys);
+  }
+}
+
+// Examples are transformed in groups of at least this many tiles, so that
+// the GEMMs are wide enough to run at speed
+constexpr int kWinogradColumns = 256;
+
+struct WinogradShape {
+  WinogradShape(const Dims& xDims, const Dims& wDims)
+      : channels(xDims[1]),
+        rows(xDims[2]),
+        cols(xDims[3]),
+        outChannels(wDims[0]),
+        tileRows((rows + 1) / 2),
+        tileCols((cols + 1) / 2) {
+    SCHECK(wDims[1] == channels && wDims[2] == 3 && wDims[3] == 3);
+  }
+
+  int tiles() const {
+    return tileRows * tileCols;
+  }
+  // Examples per group
+  int group() const {
+    return (kWinogradColumns + tiles() - 1) / tiles();
+  }
+  // The transformed tiles of n channels of a group, {16, n, group * tiles}
+  size_t size(int n) const {
+    return static_cast<size_t>(kWinogradTile) * n * group() * tiles();
+  }
+  // Scratch for the rows of one row of tiles in the transforms
+  size_t scratch() const {
+    return 8 * (2 * tileCols + 2);
+  }
+
+  int channels;
+  int rows;
+  int cols;
+  int outChannels;
+  int tileRows;
+  int tileCols;
+};
+
+// The transformed tiles of a group are {16, channels, ld}, with the tiles of
+// an example in consecutive columns; v and m point at the first column of the
+// example. The transforms run a row of tiles at a time: the columns of the
+// rows it covers first, then each tile along the rows.
+
+// v = B^T d B for the input tiles d of x{channels, rows, cols}
+template <typename T>
+void winogradInput(
+    const WinogradShape& s,
+    const T* x,
+    T* v,
+    int ld,
+    T* scratch) {
+  const size_t stride = static_cast<size_t>(s.channels) * ld;
+  // The 4 rows of a row of tiles, with a zero column on either side
+  const int W = 2 * s.tileCols + 2;
+  T* d = scratch;
+  T* t = scratch + 4 * W;
+  for (int k = 0; k < s.channels; ++k) {
+    const T* xk = x + k * s.rows * s.cols;
+    for (int ti = 0; ti < s.tileRows; ++ti) {
+      for (int r = 0; r < 4; ++r) {
+        const int xr = 2 * ti - 1 + r;
+        T* row = d + r * W;
+        fill(row, row + W, 0.0);
+        if (xr >= 0 && xr < s.rows) {
+          copy(xk + xr * s.cols, xk + (xr + 1) * s.cols, row + 1);
+        }
+      }
+      for (int c = 0; c < W; ++c) {
+        InputTransform{}(d + c, W, t + c, W);
+      }
+      T* out = v + k * ld + ti * s.tileCols;
+      for (int r = 0; r < 4; ++r) {
+        for (int tj = 0; tj < s.tileCols; ++tj) {
+          InputTransform{}(
+              t + r * W + 2 * tj, 1, out + 4 * r * stride + tj, stride);
+        }
+      }
+    }
+  }
+}
+
+// The adjoint of winogradInput(): adds B v B^T into the input tiles of x
+template <typename T>
+void winogradInputAdjoint(
+    const WinogradShape& s,
+    const T* v,
+    int ld,
+    T* x,
+    T* scratch) {
+  const size_t stride = static_cast<size_t>(s.channels) * ld;
+  const int W = 2 * s.tileCols + 2;
+  T* d = scratch;
+  T* t = scratch + 4 * W;
+  for (int k = 0; k < s.channels; ++k) {
+    T* xk = x + k * s.rows * s.cols;
+    for (int ti = 0; ti < s.tileRows; ++ti) {
+      // Neighboring tiles overlap by two columns
+      fill(t, t + 4 * W, 0.0);
+      const T* in = v + k * ld + ti * s.tileCols;
+      for (int r = 0; r < 4; ++r) {
+        for (int tj = 0; tj < s.tileCols; ++tj) {
+          T y[4];
+          InputTransformAdjoint{}(in + 4 * r * stride + tj, stride, y, 1);
+          T* row = t + r * W + 2 * tj;
+          for (int c = 0; c < 4; ++c) {
+            row[c] += y[c];
+          }
+        }
+      }
+      for (int c = 0; c < W; ++c) {
+        InputTransformAdjoint{}(t + c, W, d + c, W);
+      }
+      for (int r = 0; r < 4; ++r) {
+        const int xr = 2 * ti - 1 + r;
+        if (xr >= 0 && xr < s.rows) {
+          kernels::add(xk + xr * s.cols, d + r * W + 1, s.cols);
+        }
+      }
+    }
+  }
+}
+
+// Adds A^T m A into the output tiles of y{outChannels, rows, cols}
+template <typename T>
+void winogradOutput(
+    const WinogradShape& s,
+    const T* m,
+    int ld,
+    T* y,
+    T* scratch) {
+  const size_t stride = static_cast<size_t>(s.outChannels) * ld;
+  // The 2 rows of a row of tiles
+  const int W = 2 * s.tileCols;
+  T* d = scratch;
+  T* t = scratch + 2 * W;
+  for (int o = 0; o < s.outChannels; ++o) {
+    T* yo = y + o * s.rows * s.cols;
+    for (int ti = 0; ti < s.tileRows; ++ti) {
+      const T* in = m + o * ld + ti * s.tileCols;
+      for (int r = 0; r < 4; ++r) {
+        for (int tj = 0; tj < s.tileCols; ++tj) {
+          OutputTransform{}(
+              in + 4 * r * stride + tj, stride, t + r * W + 2 * tj, 1);
+        }
+      }
+      for (int c = 0; c < W; ++c) {
+        OutputTransform{}(t + c, W, d + c, W);
+      }
+      for (int r = 0; r < 2 && 2 * ti + r < s.rows; ++r) {
+        kernels::add(yo + (2 * ti + r) * s.cols, d + r * W, s.cols);
+      }
+    }
+  }
+}
+
+// The adjoint of winogradOutput(): m = A g A^T for the output tiles of
+// g{outChannels, rows, cols}
+template <typename T>
+void winogradOutputAdjoint(
+    const WinogradShape& s,
+    const T* g,
+    T* m,
+    int ld,
+    T* scratch) {
+  const size_t stride = static_cast<size_t>(s.outChannels) * ld;
+  const int W = 2 * s.tileCols;
+  T* d = scratch;
+  T* t = scratch + 2 * W;
+  for (int o = 0; o < s.outChannels; ++o) {
+    const T* go = g + o * s.rows * s.cols;
+    for (int ti = 0; ti < s.tileRows; ++ti) {
+      for (int r = 0; r < 2; ++r) {
+        const int gr = 2 * ti + r;
+        T* row = d + r * W;
+        fill(row, row + W, 0.0);
+        if (gr < s.rows) {
+          copy(go + gr * s.cols, go + (gr + 1) * s.cols, row);
+        }
+      }
+      for (int c = 0; c < W; ++c) {
+        OutputTransformAdjoint{}(d + c, W, t + c, W);
+      }
+      T* out = m + o * ld + ti * s.tileCols;
+      for (int r = 0; r < 4; ++r) {
+        for (int tj = 0; tj < s.tileCols; ++tj) {
+          OutputTransformAdjoint{}(
+              t + r * W + 2 * tj, 1, out + 4 * r * stride + tj, stride);
+        }
+      }
+    }
+  }
+}
+
+// Products with fewer channels than this skip gemm()
+constexpr int kWinogradGemm = 16;
+
+// c{m, n} += op(a) * op(b) for the products of a group. With few channels
+// gemm() spends more on packing than on multiplying, so those products run
+// as axpy() or dot products over the long rows instead.
+template <typename T>
+void winogradGemm(
+    bool transA,
+    bool transB,
+    int m,
+    int n,
+    int k,
+    const T* a,
+    int lda,
+    const T* b,
+    int ldb,
+    T* c,
+    int ldc) {
+  if (min(m, transB ? n : k) >= kWinogradGemm) {
+    gemm(transA, transB, m, n, k, a, lda, b, ldb, c, ldc);
+    return;
+  }
+  if (!transB) {
+    for (int r = 0; r < m; ++r) {
+      for (int q = 0; q < k; ++q) {
+        const T x = transA ? a[q * lda + r] : a[r * lda + q];
+        kernels::axpy(c + r * ldc, x, b + q * ldb, n);
+      }
+    }
+    return;
+  }
+  SCHECK(!transA);
+  for (int r = 0; r < m; ++r) {
+    for (int q = 0; q < n; ++q) {
+      const T* x = a + r * lda;
+      const T* y = b + q * ldb;
+      // Independent partial sums, which vectorize
+      T sums[8] = {};
+      int i = 0;
+      for (; i + 8 <= k; i += 8) {
+        for (int j = 0; j < 8; ++j) {
+          sums[j] += x[i + j] * y[i + j];
+        }
+      }
+      for (; i < k; ++i) {
+        sums[0] += x[i] * y[i];
+      }
+      c[r * ldc + q] += accumulate(sums, sums + 8, T(0));
+    }
+  }
+}
+
+// Calls f(first, last, ld) for the groups of the examples [first, last)
+template <typename F>
+void forGroups(const WinogradShape& s, int first, int last, F&& f) {
+  for (int e = first; e < last; e += s.group()) {
+    const int end = min(last, e + s.group());
+    f(e, end, (end - e) * s.tiles());
+  }
+}
+
+template <typename T>
+void convolveWinograd(
+    const TensorT<T>& x,
+    const TensorT<T>& w,
+    TensorT<T>& ret,
+    WinogradFilterT<T>* filter) {
+  WinogradShape s{x.dims(), w.dims()};
+  WinogradFilterT<T> local;
+  const T* u = (filter ? filter : &local)->transform(w);
+  const int O = s.outChannels, K = s.channels, P = s.tiles();
+
+  forExamples(x.dims()[0], [&](int first, int last) {
+    T* v = colBuffer<T>(s.size(K) + s.size(O) + s.scratch());
+    T* m = v + s.size(K);
+    T* scratch = m + s.size(O);
+    forGroups(s, first, last, [&](int begin, int end, int ld) {
+      for (int e = begin; e < end; ++e) {
+        winogradInput(
+            s, x[e].data().begin(), v + (e - begin) * P, ld, scratch);
+      }
+      fill(m, m + kWinogradTile * O * ld, 0.0);
+      for (int i = 0; i < kWinogradTile; ++i) {
+        // m{outChannels, ld} = u{outChannels, channels} * v{channels, ld}
+        winogradGemm(
+            false,
+            false,
+            O,
+            ld,
+            K,
+            u + i * O * K,
+            K,
+            v + i * K * ld,
+            ld,
+            m + i * O * ld,
+            ld);
+      }
+      for (int e = begin; e < end; ++e) {
+        winogradOutput(
+            s, m + (e - begin) * P, ld, ret[e].data().begin(), scratch);
+      }
+    });
+  });
+}
+
+template <typename T>
+void convolveWGradientWinograd(
+    const TensorT<T>& x,
+    const TensorT<T>& g,
+    TensorT<T>& wg) {
+  WinogradShape s{x.dims(), wg.dims()};
+  const int O = s.outChannels, K = s.channels, P = s.tiles();
+  const int n = x.dims()[0];
+  // The gradient of U, {16, outChannels, channels}, summed per range of
+  // examples as in convolveWGradientIm2col()
+  const int grain = exampleGrain(n);
+  vector<vector<T>> partial((n + grain - 1) / grain);
+
+  forExamples(n, [&](int first, int last) {
+    auto& du = partial[first / grain];
+    du.assign(kWinogradTile * O * K, 0);
+    T* v = colBuffer<T>(s.size(K) + s.size(O) + s.scratch());
+    T* m = v + s.size(K);
+    T* scratch = m + s.size(O);
+    forGroups(s, first, last, [&](int begin, int end, int ld) {
+      for (int e = begin; e < end; ++e) {
+        winogradInput(
+            s, x[e].data().begin(), v + (e - begin) * P, ld, scratch);
+        winogradOutputAdjoint(
+            s, g[e].data().begin(), m + (e - begin) * P, ld, scratch);
+      }
+      for (int i = 0; i < kWinogradTile; ++i) {
+        // du{outChannels, channels} += m{outChannels, ld} * v^T
+        winogradGemm(
+            false,
+            true,
+            O,
+            K,
+            ld,
+            m + i * O * ld,
+            ld,
+            v + i * K * ld,
+            ld,
+            du.data() + i * O * K,
+            K);
+      }
+    });
+  });
+
+  for (size_t i = 1; i < partial.size(); ++i) {
+    kernels::add(partial[0].data(), partial[i].data(), partial[0].size());
+  }
+  // wg = G^T du G
+  const T* du = partial[0].data();
+  T* out = wg.data().begin();
+  for (int f = 0; f < O * K; ++f) {
+    T tile[16];
+    for (int i = 0; i < kWinogradTile; ++i) {
+      tile[i] = du[i * O * K + f];
+    }
+    transform2d<4, 3>(tile, out + f * 9, 1, FilterTransformAdjoint{});
+  }
+}
+
+template <typename T>
+void convolveXGradientWinograd(
+    const TensorT<T>& g,
+    const TensorT<T>& w,
+    TensorT<T>& xg,
+    WinogradFilterT<T>* filter) {
+  WinogradShape s{xg.dims(), w.dims()};
+  WinogradFilterT<T> local;
+  const T* u = (filter ? filter : &local)->transform(w);
+  const int O = s.outChannels, K = s.channels, P = s.tiles();
+
+  forExamples(xg.dims()[0], [&](int first, int last) {
+    T* v = colBuffer<T>(s.size(K) + s.size(O) + s.scratch());
+    T* m = v + s.size(K);
+    T* scratch = m + s.size(O);
+    forGroups(s, first, last, [&](int begin, int end, int ld) {
+      for (int e = begin; e < end; ++e) {
+        winogradOutputAdjoint(
+            s, g[e].data().begin(), m + (e - begin) * P, ld, scratch);
+      }
+      fill(v, v + kWinogradTile * K * ld, 0.0);
+      for (int i = 0; i < kWinogradTile; ++i) {
+        // v{channels, ld} = u^T * m{outChannels, ld}
+        winogradGemm(
+            true,
+            false,
+            K,
+            ld,
+            O,
+            u + i * O * K,
+            K,
+            m + i * O * ld,
+            ld,
+            v + i * K * ld,
+            ld);
+      }
+      for (int e = begin; e < end; ++e) {
+        winogradInputAdjoint(
+            s, v + (e - begin) * P, ld, xg[e].data().begin(), scratch);
+      }
+    });
+  });
+}
+
+// The algorithm to run for filters of wDims
+ConvolutionAlgorithm resolve(
+    ConvolutionAlgorithm algorithm,
+    const Dims& wDims) {
+  const bool winograd = wDims[2] == 3 && wDims[3] == 3;
+  if (algorithm == ConvolutionAlgorithm::Auto) {
+    return winograd ? ConvolutionAlgorithm::Winograd
+                    : ConvolutionAlgorithm::Im2col;
+  }
+  SCHECK_MSG(
+      algorithm != ConvolutionAlgorithm::Winograd || winograd,
+      "Winograd convolution takes 3x3 filters only");
+  return algorithm;
+}
+
+} // namespace
+
+template <typename T>
+const T* WinogradFilterT<T>::transform(const TensorT<T>& w) {
+  SCHECK(w.dims().size() == 4 && w.dims()[2] == 3 && w.dims()[3] == 3);
+  const T* begin = w.data().begin();
+  const T* end = begin + w.total();
+  lock_guard<mutex> g(lock_);
+  if (static_cast<int>(w_.size()) == w.total() &&
+      equal(begin, end, w_.begin())) {
+    return u_.data();
+  }
+  w_.assign(begin, end);
+  const int filters = w.dims()[0] * w.dims()[1];
+  u_.resize(kWinogradTile * filters);
+  for (int f = 0; f < filters; ++f) {
+    transform2d<3, 4>(begin + f * 9, u_.data() + f, filters, FilterTransform{});
+  }
+  return u_.data();
+}
+
+template <typename T>
+void convolve(
+    const TensorT<T>& x,
+    const TensorT<T>& w,
+    TensorT<T>& out,
+    ConvolutionAlgorithm algorithm,
+    WinogradFilterT<T>* filter) {
+  SCHECK(x.dims().size() == 4);
+  SCHECK(w.dims().size() == 4);
+  out.reset(Dims{x.dims()[0], w.dims()[0], x.dims()[2], x.dims()[3]});
+  switch (resolve(algorithm, w.dims())) {
+    case ConvolutionAlgorithm::Direct:
+      convolveDirect(x, w, out);
+      return;
+    case ConvolutionAlgorithm::Im2col:
+      convolveIm2col(x, w, out);
+      return;
+    case ConvolutionAlgorithm::Winograd:
+      convolveWinograd(x, w, out, filter);
+      return;
+    case ConvolutionAlgorithm::Auto:
+      break;
+  }
+  SCHECK(false);
+}
+
+template <typename T>
+void convolveWGradient(
+    const TensorT<T>& x,
+    const TensorT<T>& g,
+    const Dims& wDims,
+    TensorT<T>& out,
+    ConvolutionAlgorithm algorithm) {
+  SCHECK(g.dims()[0] == x.dims()[0]);
+  out.reset(wDims);
+  switch (resolve(algorithm, wDims)) {
+    case ConvolutionAlgorithm::Direct:
+      convolveWGradientDirect(x, g, out);
+      return;
+    case ConvolutionAlgorithm::Im2col:
+      convolveWGradientIm2col(x, g, out);
+      return;
+    case ConvolutionAlgorithm::Winograd:
+      convolveWGradientWinograd(x, g, out);
+      return;
+    case ConvolutionAlgorithm::Auto:
+      break;
+  }
+  SCHECK(false);
+}
+
+template <typename T>
+void convolveXGradient(
+    const TensorT<T>& g,
+    const TensorT<T>& w,
+    const Dims& xDims,
+    TensorT<T>& out,
+    ConvolutionAlgorithm algorithm,
+    WinogradFilterT<T>* filter) {
+  out.reset(xDims);
+  switch (resolve(algorithm, w.dims())) {
+    case ConvolutionAlgorithm::Direct:
+      convolveXGradientDirect(g, w, out);
+      return;
+    case ConvolutionAlgorithm::Im2col:
+      convolveXGradientIm2col(g, w, out);
+      return;
+    case ConvolutionAlgorithm::Winograd:
+      convolveXGradientWinograd(g, w, out, filter);
+      return;
+    case ConvolutionAlgorithm::Auto:
+      break;
+  }
+  SCHECK(false);
+}
+
+template <typename T>
+TensorT<T> convolve(
+    const TensorT<T>& x,
+    const TensorT<T>& w,
+    ConvolutionAlgorithm algorithm) {
+  TensorT<T> ret;
+  convolve(x, w, ret, algorithm);
+  return ret;
+}
+
+template <typename T>
+TensorT<T> convolveWGradient(
+    const TensorT<T>& x,
+    const TensorT<T>& g,
+    const Dims& wDims,
+    ConvolutionAlgorithm algorithm) {
+  TensorT<T> ret;
+  convolveWGradient(x, g, wDims, ret, algorithm);
+  return ret;
+}
+
+template <typename T>
+TensorT<T> convolveXGradient(
+    const TensorT<T>& g,
+    const TensorT<T>& w,
+    const Dims& xDims,
+    ConvolutionAlgorithm algorithm) {
+  TensorT<T> ret;
+  convolveXGradient(g, w, xDims, ret, algorithm);
   return ret;
 }
+
+template <typename T>
+void lowerToColumns(const Dims& wDims, int rows, int cols, const T* x, T* col) {
+  im2col(Im2colShape{Dims{1, wDims[1], rows, cols}, wDims}, x, col);
+}
+
+#define INSTANTIATE_TENSOR(T)                                                \
+  template class TensorT<T>;                                                 \
+  template class VectorT<T>;                                                 \
+  template class MatrixT<T>;                                                 \
+  template ostream& operator<<(ostream&, const TensorT<T>&);                 \
+  template TensorT<T> operator+(const MatrixT<T>&, const MatrixT<T>&);       \
+  template TensorT<T> operator+(const MatrixT<T>&, const VectorT<T>&);       \
+  template TensorT<T> operator+(const VectorT<T>&, const VectorT<T>&);       \
+  template VectorT<T>& operator+=(VectorT<T>&, const VectorT<T>&);           \
+  template VectorT<T>& operator+=(VectorT<T>&, T);                           \
+  template TensorT<T> convolve(                                              \
+      const TensorT<T>&, const TensorT<T>&, ConvolutionAlgorithm);           \
+  template TensorT<T> convolveWGradient(                                     \
+      const TensorT<T>&,                                                     \
+      const TensorT<T>&,                                                     \
+      const Dims&,                                                           \
+      ConvolutionAlgorithm);                                                 \
+  template TensorT<T> convolveXGradient(                                     \
+      const TensorT<T>&,                                                     \
+      const TensorT<T>&,                                                     \
+      const Dims&,                                                           \
+      ConvolutionAlgorithm);                                                 \
+  template class WinogradFilterT<T>;                                          \
+  template void convolve(                                                    \
+      const TensorT<T>&,                                                     \
+      const TensorT<T>&,                                                     \
+      TensorT<T>&,                                                           \
+      ConvolutionAlgorithm,                                                  \
+      WinogradFilterT<T>*);                                                  \
+  template void convolveWGradient(                                           \
+      const TensorT<T>&,                                                     \
+      const TensorT<T>&,                                                     \
+      const Dims&,                                                           \
+      TensorT<T>&,                                                           \
+      ConvolutionAlgorithm);                                                 \
+  template void convolveXGradient(                                           \
+      const TensorT<T>&,                                                     \
+      const TensorT<T>&,                                                     \
+      const Dims&,                                                           \
+      TensorT<T>&,                                                           \
+      ConvolutionAlgorithm,                                                  \
+      WinogradFilterT<T>*);                                                  \
+  template void lowerToColumns(const Dims&, int, int, const T*, T*);
+
+INSTANTIATE_TENSOR(float)
+INSTANTIATE_TENSOR(double)
@@ -1,17 +1,24 @@
+#pragma once
+
 #include "common.h"
+#include "gemm.h"
+#include "kernels.h"
 
-#include <folly/futures/Promise.h>
 #include <atomic>
 #include <limits>
+#include <mutex>
 #include <random>
+#include <tuple>
+#include <type_traits>
 
 struct Example;
 
-class Tensor;
 class InitScheme {
  public:
   InitScheme() {}
-  virtual void init(Tensor& t) = 0;
+  // Fills freshly zeroed storage
+  virtual void init(float* data, size_t n) = 0;
+  virtual void init(double* data, size_t n) = 0;
   virtual ~InitScheme() {}
 
  protected:
@@ -26,44 +33,66 @@ class InitScheme {
 
 class ZeroInitScheme : public InitScheme {
  public:
-  void init(Tensor& t) override {}
+  void init(float*, size_t) override {}
+  void init(double*, size_t) override {}
 };
 
 class UniformInitScheme : public InitScheme {
  public:
   UniformInitScheme(Float a = -1, Float b = 1) : a_(a), b_(b) {}
-  void init(Tensor& t) override;
+  void init(float* data, size_t n) override {
+    fill(data, n);
+  }
+  void init(double* data, size_t n) override {
+    fill(data, n);
+  }
 
  private:
+  // Samples in double so both precisions see the same distribution
+  template <typename T>
+  void fill(T* data, size_t n) {
+    std::uniform_real_distribution<> dist(a_, b_);
+    for (size_t i = 0; i < n; ++i) {
+      data[i] = dist(gen());
+    }
+  }
+
   Float a_, b_;
 };
 
-class Tensor {
+template <typename T>
+class VectorT;
+template <typename T>
+class MatrixT;
+
+// T is the element type: float or double
+template <typename T>
+class TensorT {
  public:
   // A view object
   struct Array {
-    // Array(Float* d, int n, std::vector<Float>* v) : d_(d), n_(n), v_(v) {}
-    Array(Float* d, int n) : d_(d), n_(n) {}
+    // Array(T* d, int n, std::vector<Float>* v) : d_(d), n_(n), v_(v) {}
+    Array(T* d, int n) : d_(d), n_(n) {}
 
-    Float& operator[](size_t x) {
+    T& operator[](size_t x) {
       return d_[x];
       // return (*v_)[x];
     }
-    // Float operator[](size_t x) const {
+    // T operator[](size_t x) const {
     //   return d_[x];
     // }
-    Float* begin() {
+    T* begin() {
       return d_;
       // return &(*v_)[0];
     }
-    Float* end() {
+    T* end() {
       // return &(*v_)[0] + v_->size();
       return d_ + n_;
     }
-    // const Float* begin() const {
+    // const T* begin() const {
     //   return d_;
     // }
-    // const Float* end() const {
+    // const T* end() const {
     //   return d_ + n_;
     // }
     size_t size() {
@@ -71,39 +100,81 @@ class Tensor {
       return n_;
     }
 
+    friend std::ostream& operator<<(std::ostream& out, Array v) {
+      out << "[ ";
+      for (auto x : v) {
+        out << x << " ";
+      }
+      out << "]";
+
+      return out;
+    }
+
    private:
-    Float* d_;
+    T* d_;
     size_t n_;
     // std::vector<Float>* v_;
   };
 
-  static Tensor from(const std::vector<Float>& v);
+  using Element = T;
 
-  template <typename T>
-  static Tensor from(const std::vector<T>& v) {
-    std::vector<Tensor> vt;
+  static TensorT from(const std::vector<T>& v);
+
+  template <typename U>
+  static TensorT from(const std::vector<U>& v) {
+    std::vector<TensorT> vt;
     for (auto& x : v) {
-      vt.push_back(Tensor::from(x));
+      vt.push_back(TensorT::from(x));
     }
     return from(vt);
   }
 
-  static Tensor from(const std::vector<Tensor>& v);
+  static TensorT from(const std::vector<TensorT>& v);
 
-  Tensor() : dims_({}), data_() {}
-  Tensor(Dims dims, InitScheme&& scheme = ZeroInitScheme{});
-  Tensor(const ExampleRange& es, bool label);
+  // Converts between precisions
+  template <typename U>
+  static TensorT cast(const TensorT<U>& t) {
+    TensorT ret{t.dims()};
+    std::copy(t.data().begin(), t.data().end(), ret.data().begin());
+    return ret;
+  }
+
+  TensorT() : dims_({}), data_() {}
+  TensorT(Dims dims, InitScheme&& scheme = ZeroInitScheme{});
+  TensorT(const ExampleRange& es, bool label);
+
+  // A tensor over storage it did not allocate, e.g. in a memory mapped
+  // checkpoint; data keeps the storage alive
+  static TensorT wrap(Dims dims, std::shared_ptr<T> data) {
+    return TensorT(dims, std::move(data));
+  }
 
   // Adapts the Tensor to a different shape
-  Tensor(Dims dims, const Tensor& tensor) : dims_(dims), data_(tensor.data_) {
+  TensorT(Dims dims, const TensorT& tensor)
+      : dims_(dims), data_(tensor.data_) {
     // std::cout << dims << " " << tensor.data().size() << std::endl;
     SCHECK(dimSize(dims) == tensor.data().size());
   }
 
-  Tensor(const Tensor&);
-  Tensor(Tensor&&);
-  Tensor& operator=(const Tensor&);
-  Tensor& operator=(Tensor&&);
+  TensorT(const TensorT&);
+  TensorT(TensorT&&);
+  // Copies into the current storage when the shapes match and nobody else
+  // refers to it
+  TensorT& operator=(const TensorT&);
+  TensorT& operator=(TensorT&&);
+
+  // Reshapes to dims and zero fills. The storage of the previous contents is
+  // reused when the element count is unchanged, which is what lets operators
+  // keep their outputs and gradients across mini-batches; views of the old
+  // contents observe the new ones.
+  void reset(const Dims& dims);
+  // Like reset() but leaves reused storage as is; for callers that overwrite
+  // every element
+  void resize(const Dims& dims);
+  // Loads images ({examples, pixels}) or labels ({examples}); see reset()
+  void load(const ExampleRange& es, bool label);
+  // Loads the examples [begin, end) of a batch loaded by load()
+  void loadRows(const TensorT& batch, Dim begin, Dim end);
 
   Dim total() const {
     return data().size();
@@ -129,13 +200,13 @@ class Tensor {
   // const std::vector<Float>& data() const { return data_; }
   // std::vector<Float>& data() { return data_; }
 
-  Tensor operator[](Dim x) const;
-  Tensor flatten() const;
+  TensorT operator[](Dim x) const;
+  TensorT flatten() const;
 
-  Float l2Norm() const;
-  Float l2Sum() const;
+  T l2Norm() const;
+  T l2Sum() const;
 
-  bool operator==(const Tensor& other) const {
+  bool operator==(const TensorT& other) const {
     if (dims_ != other.dims_) {
       return false;
     }
@@ -145,129 +216,155 @@ class Tensor {
     return true;
   }
 
-  bool equals(const Tensor& other, double eps) const;
+  bool equals(const TensorT& other, double eps) const;
 
-  static Tensor read(std::istream& in);
-  static void write(std::ostream& out, const Tensor& tensor);
+  static TensorT read(std::istream& in);
+  static void write(std::ostream& out, const TensorT& tensor);
 
-  friend void print(std::ostream& out, const Tensor& tensor, std::string tab);
+  void print(std::ostream& out, std::string tab) const;
 
  private:
-  Tensor(Dims dims, std::shared_ptr<Float> data) : dims_(dims), data_(data) {}
+  TensorT(Dims dims, std::shared_ptr<T> data) : dims_(dims), data_(data) {}
 
   void createStorage();
+  bool reuseStorage(const Dims& dims);
   void loadLabel(const ExampleRange& es);
 
-  friend class Vector;
-  friend class Matrix;
+  friend class VectorT<T>;
+  friend class MatrixT<T>;
 
   Dims dims_;
-  std::shared_ptr<Float> data_;
+  std::shared_ptr<T> data_;
   // std::vector<Float> data_;
 };
 
-std::ostream& operator<<(std::ostream&, const Tensor& tensor);
+template <typename T>
+std::ostream& operator<<(std::ostream&, const TensorT<T>& tensor);
 
-std::ostream& operator<<(std::ostream&, Tensor::Array x);
 
-inline Tensor& operator+=(Tensor& x, const Tensor& y) {
+template <typename T>
+TensorT<T>& operator+=(TensorT<T>& x, const TensorT<T>& y) {
   SCHECK(x.dims() == y.dims());
-  for (size_t k = 0; k < x.data().size(); ++k) {
-    x.data()[k] += y.data()[k];
-  }
+  kernels::add(x.data().begin(), y.data().begin(), x.total());
   return x;
 }
 
-inline Tensor& operator*=(Tensor& x, double y) {
-  for (auto& e : x.data()) {
-    e *= y;
-  }
+template <typename T>
+TensorT<T>& operator*=(TensorT<T>& x, double y) {
+  kernels::scale(x.data().begin(), static_cast<T>(y), x.total());
+  return x;
+}
+
+// x += a * y in one pass
+template <typename T>
+TensorT<T>& addScaled(TensorT<T>& x, T a, const TensorT<T>& y) {
+  SCHECK(x.dims() == y.dims());
+  kernels::axpy(x.data().begin(), a, y.data().begin(), x.total());
   return x;
 }
 
 // A view on top of the general tensor
-class Vector {
+template <typename T>
+class VectorT {
  public:
-  Vector(Tensor& tensor);
+  using Element = T;
+
+  VectorT(TensorT<T>& tensor);
   Dim n() const {
     return tensor_->dims_[0];
   }
-  Float operator()(Dim i) const {
+  T operator()(Dim i) const {
     return tensor_->data()[i];
   }
-  Float& operator()(Dim i) {
+  T& operator()(Dim i) {
     return tensor_->data()[i];
   }
+  T* raw() const {
+    return tensor_->data_.get();
+  }
 
  private:
-  Tensor* tensor_;
+  TensorT<T>* tensor_;
 };
 
-class TransposedMatrix;
+template <typename T>
+class TransposedMatrixT;
 // A view on top of the general tensor
 // Consider disabling copy
-class Matrix {
+template <typename T>
+class MatrixT {
  public:
-  Matrix(Tensor& tensor);
+  using Element = T;
+
+  MatrixT(TensorT<T>& tensor);
   Dim rows() const {
     return tensor_->dims_[0];
   }
   Dim cols() const {
     return tensor_->dims_[1];
   }
-  Float operator()(Dim i, Dim j) const {
+  T operator()(Dim i, Dim j) const {
     return tensor_->data()[i * cols() + j];
   }
-  Float& operator()(Dim i, Dim j) {
+  T& operator()(Dim i, Dim j) {
     return tensor_->data()[i * cols() + j];
   }
+  // Row major storage with a row stride of cols()
+  T* raw() const {
+    return tensor_->data_.get();
+  }
 
-  Tensor rowSum() const;
-  Float sum() const {
-    Float ret = 0;
-    for (auto x : tensor_->data()) {
-      ret += x;
-    }
-    return ret;
+  TensorT<T> rowSum() const;
+  T sum() const {
+    return kernels::sum(raw(), rows() * cols());
   }
 
-  TransposedMatrix transpose();
+  TransposedMatrixT<T> transpose();
 
  private:
-  Tensor* tensor_;
+  TensorT<T>* tensor_;
 };
 
-class TransposedMatrix {
+template <typename T>
+class TransposedMatrixT {
  public:
-  TransposedMatrix(Matrix* m) : m_(m) {}
+  using Element = T;
+
+  TransposedMatrixT(MatrixT<T>* m) : m_(m) {}
   Dim rows() const {
     return m_->cols();
   }
   Dim cols() const {
     return m_->rows();
   }
-  Float operator()(Dim i, Dim j) const {
+  T operator()(Dim i, Dim j) const {
     return (*m_)(j, i);
   }
-  Float& operator()(Dim i, Dim j) {
+  T& operator()(Dim i, Dim j) {
     return (*m_)(j, i);
   }
+  const MatrixT<T>& base() const {
+    return *m_;
+  }
 
  private:
-  Matrix* m_;
+  MatrixT<T>* m_;
 };
 
-class MatrixPatch {
+struct PatchBox {
+  Dim r1;
+  Dim c1;
+  Dim r2;
+  Dim c2;
+};
+
+template <typename T>
+class MatrixPatchT {
  public:
-  struct Box {
-    Dim r1;
-    Dim c1;
-    Dim r2;
-    Dim c2;
-  };
+  using Box = PatchBox;
 
-  MatrixPatch(
-      Matrix& m,
+  MatrixPatchT(
+      MatrixT<T>& m,
       Dim ro,
       Dim co,
       Dim rows,
@@ -297,7 +394,7 @@ class MatrixPatch {
   }
 
   // TODO: make the range checks optional
-  Float operator()(Dim i, Dim j) const {
+  T operator()(Dim i, Dim j) const {
     SCHECK(i >= 0 && i < rows_ && j >= 0 && j < cols_);
 
     auto r = targetR(i);
@@ -309,8 +406,8 @@ class MatrixPatch {
     return (*m_)(r, c);
   }
 
-  std::tuple<Float, int, int> max() const {
-    auto ret = std::numeric_limits<Float>::min();
+  std::tuple<T, int, int> max() const {
+    auto ret = std::numeric_limits<T>::min();
     int maxI = -1, maxJ = -1;
     for (int i = 0; i < rows(); ++i) {
       for (int j = 0; j < cols(); ++j) {
@@ -345,9 +442,9 @@ class MatrixPatch {
     return box;
   }
 
-  MatrixPatch applyBoundingBox(const Box& x) const {
+  MatrixPatchT applyBoundingBox(const Box& x) const {
     if (!reverse()) {
-      return MatrixPatch(
+      return MatrixPatchT(
           *m_,
           ro_ + x.r1,
           co_ + x.c1,
@@ -355,7 +452,7 @@ class MatrixPatch {
           cols_ - (x.c1 + x.c2),
           false);
     } else {
-      return MatrixPatch(
+      return MatrixPatchT(
           *m_,
           ro_ - x.r1,
           co_ - x.c1,
@@ -371,7 +468,7 @@ class MatrixPatch {
   Dim co() const {
     return co_;
   }
-  Matrix& m() const {
+  MatrixT<T>& m() const {
     return *m_;
   }
 
@@ -384,7 +481,7 @@ class MatrixPatch {
     return co_ + direction_ * c;
   }
 
-  Matrix* m_;
+  MatrixT<T>* m_;
   Dim ro_;
   Dim co_;
   Dim rows_;
@@ -392,16 +489,15 @@ class MatrixPatch {
   int direction_;
 };
 
-inline MatrixPatch::Box max(
-    const MatrixPatch::Box& a,
-    const MatrixPatch::Box& b) {
-  return MatrixPatch::Box{std::max(a.r1, b.r1),
-                          std::max(a.c1, b.c1),
-                          std::max(a.r2, b.r2),
-                          std::max(a.c2, b.c2)};
+inline PatchBox max(const PatchBox& a, const PatchBox& b) {
+  return PatchBox{std::max(a.r1, b.r1),
+                  std::max(a.c1, b.c1),
+                  std::max(a.r2, b.r2),
+                  std::max(a.c2, b.c2)};
 }
 
-inline std::ostream& operator<<(std::ostream& out, const MatrixPatch& m) {
+template <typename T>
+std::ostream& operator<<(std::ostream& out, const MatrixPatchT<T>& m) {
   out << "[";
   for (int r = 0; r < m.rows(); ++r) {
     for (int c = 0; c < m.cols(); ++c) {
@@ -416,9 +512,10 @@ inline std::ostream& operator<<(std::ostream& out, const MatrixPatch& m) {
 
 // TODO: skip lopping through the areas that have value 0.
 // (and directly operate in the target coordinate space)
-inline Float dotDirect(const MatrixPatch& a, const MatrixPatch& b) {
+template <typename T>
+T dotDirect(const MatrixPatchT<T>& a, const MatrixPatchT<T>& b) {
   // std::cout << "dot " << a << " . " << b << ": ";
-  Float s = 0;
+  T s = 0;
   for (Dim i = 0; i < a.rows(); ++i) {
     for (Dim j = 0; j < a.cols(); ++j) {
       // if (a(i, j) * b(i, j) != 0) {
@@ -431,9 +528,10 @@ inline Float dotDirect(const MatrixPatch& a, const MatrixPatch& b) {
   return s;
 }
 
-inline Float dotUnrolledForward(const MatrixPatch& a, const MatrixPatch& b) {
+template <typename T>
+T dotUnrolledForward(const MatrixPatchT<T>& a, const MatrixPatchT<T>& b) {
   // SCHECK(a.rows() == b.rows() && a.cols() == b.cols());
-  Float s = 0;
+  T s = 0;
   for (auto ra = a.ro(), rb = b.ro(), i = 0; i < a.rows(); ++i, ++ra, ++rb) {
     for (auto ca = a.co(), cb = b.co(), j = 0; j < a.cols(); ++j, ++ca, ++cb) {
       // std::cout << " + " << a.m()(ra, ca) * b.m()(rb, cb);
@@ -444,9 +542,10 @@ inline Float dotUnrolledForward(const MatrixPatch& a, const MatrixPatch& b) {
   return s;
 }
 
-inline Float dotUnrolledBackward(const MatrixPatch& a, const MatrixPatch& b) {
+template <typename T>
+T dotUnrolledBackward(const MatrixPatchT<T>& a, const MatrixPatchT<T>& b) {
   // SCHECK(a.rows() == b.rows() && a.cols() == b.cols());
-  Float s = 0;
+  T s = 0;
   for (auto ra = a.ro(), rb = b.ro(), i = 0; i < a.rows(); ++i, ++ra, --rb) {
     for (auto ca = a.co(), cb = b.co(), j = 0; j < a.cols(); ++j, ++ca, --cb) {
       s += a.m()(ra, ca) * b.m()(rb, cb);
@@ -455,7 +554,8 @@ inline Float dotUnrolledBackward(const MatrixPatch& a, const MatrixPatch& b) {
   return s;
 }
 
-inline Float dotUnrolled(MatrixPatch a, MatrixPatch b) {
+template <typename T>
+T dotUnrolled(MatrixPatchT<T> a, MatrixPatchT<T> b) {
   // std::cout << a.ro() << " " << a.co() << " " << a.rows() << " " << a.cols()
   //           << " " << a.m().rows() << " " << a.m().cols() << std::endl;
   // std::cout << b.ro() << " " << b.co() << " " << b.rows() << " " << b.cols()
@@ -479,7 +579,8 @@ inline Float dotUnrolled(MatrixPatch a, MatrixPatch b) {
   }
 }
 
-inline Float dot(const MatrixPatch& a, const MatrixPatch& b) {
+template <typename T>
+T dot(const MatrixPatchT<T>& a, const MatrixPatchT<T>& b) {
   SCHECK(a.rows() == b.rows() && a.cols() == b.cols());
 // auto s1 = dotDirect(a, b);
 // auto s2 = dotUnrolled(a, b);
@@ -492,109 +593,206 @@ inline Float dot(const MatrixPatch& a, const MatrixPatch& b) {
 #endif
 }
 
-template <typename T1, typename T2>
-constexpr bool is_same_v = std::is_same<T1, T2>::value;
-#define REQUIRES(T, T1, T2)                                                  \
-  typename = typename std::enable_if < is_same_v<T, T1> || is_same_v<T, T2>, \
-  void > ::type
+// True for the matrix views accepted by operator*
+template <typename MX>
+struct IsMatrixView : std::false_type {};
+template <typename T>
+struct IsMatrixView<MatrixT<T>> : std::true_type {};
+template <typename T>
+struct IsMatrixView<TransposedMatrixT<T>> : std::true_type {};
+
+#define REQUIRES_MATRIX(MX) \
+  typename = typename std::enable_if<IsMatrixView<MX>::value, void>::type
+
+// Describes a Matrix or TransposedMatrix operand as seen by gemm()
+template <typename T>
+struct GemmOperand {
+  const T* data;
+  int ld;
+  bool trans;
+};
+
+template <typename T>
+GemmOperand<T> gemmOperand(const MatrixT<T>& m) {
+  return GemmOperand<T>{m.raw(), m.cols(), false};
+}
 
+template <typename T>
+GemmOperand<T> gemmOperand(const TransposedMatrixT<T>& m) {
+  return GemmOperand<T>{m.base().raw(), m.base().cols(), true};
+}
+
+// c += a * b
 template <
     typename MX1,
     typename MX2,
-    REQUIRES(MX1, Matrix, TransposedMatrix),
-    REQUIRES(MX2, Matrix, TransposedMatrix)>
-Tensor operator*(const MX1& a, const MX2& b) {
+    REQUIRES_MATRIX(MX1),
+    REQUIRES_MATRIX(MX2)>
+void addProduct(MatrixT<typename MX1::Element>& c, const MX1& a, const MX2& b) {
   SCHECK(a.cols() == b.rows());
+  SCHECK(c.rows() == a.rows() && c.cols() == b.cols());
+
+  auto x = gemmOperand(a);
+  auto y = gemmOperand(b);
+  gemm(
+      x.trans,
+      y.trans,
+      a.rows(),
+      b.cols(),
+      a.cols(),
+      x.data,
+      x.ld,
+      y.data,
+      y.ld,
+      c.raw(),
+      c.cols());
+}
 
-  Dims dims{a.rows(), b.cols()};
-  Tensor ret{dims};
-  Matrix m{ret};
+template <
+    typename MX1,
+    typename MX2,
+    REQUIRES_MATRIX(MX1),
+    REQUIRES_MATRIX(MX2)>
+TensorT<typename MX1::Element> operator*(const MX1& a, const MX2& b) {
+  using T = typename MX1::Element;
+  TensorT<T> ret{Dims{a.rows(), b.cols()}};
+  MatrixT<T> m{ret};
+  addProduct(m, a, b);
+  return ret;
+}
 
-#if 0
-  // Distribute the work across K cores
-
-  const int T = TaskRunner::get().nThreads();
-  SCHECK(T >= 1);
-
-  std::vector<TaskRunner::Task> tasks;
-  tasks.reserve(T);
-  for (int t = 0; t < T; t++) {
-    int batch = (a.rows() + T - 1) / T;
-    int start = t * batch;
-    int end = std::min((t + 1) * batch, a.rows());
-    auto compute = [start, end, &a, &b, &m]() {
-      for (int i = start; i < end; i++) {
-        for (int j = 0; j < b.cols(); j++) {
-          for (int k = 0; k < a.cols(); k++) {
-            m(i, j) += a(i, k) * b(k, j);
-          }
-        }
-      }
-    };
-    tasks.push_back(compute);
-  }
-
-  TaskRunner::get().run(tasks);
-#elif 0
-  const int T = TaskRunner::get().nThreads();
-  SCHECK(T >= 1);
-
-  std::atomic<int> finished{0};
-  folly::Promise<folly::Unit> promise;
-  auto future = promise.getFuture();
-
-  for (int t = 0; t < T; t++) {
-    int batch = (a.rows() + T - 1) / T;
-    int start = t * batch;
-    int end = std::min((t + 1) * batch, a.rows());
-    auto compute =
-        [start, end, t, T, &a, &b, &m, &finished, &promise]() -> void {
-      for (int i = start; i < end; i++) {
-        for (int j = 0; j < b.cols(); j++) {
-          for (int k = 0; k < a.cols(); k++) {
-            m(i, j) += a(i, k) * b(k, j);
-            // auto target = m(i, j) + a(i, k) * b(k, j);
-            // target = std::max(std::min(target, 1e15f), -1e15f);
-            // m(i, j) = target;
-          }
-        }
-      }
-      if (++finished == T) {
-        promise.setValue();
-      }
-    };
-    if (t < T - 1) {
-      TaskRunner::get().runAsync(compute);
-    } else {
-      compute();
-    }
-  }
+// The reference i-j-k loop; kept for testing and benchmarking gemm()
+template <
+    typename MX1,
+    typename MX2,
+    REQUIRES_MATRIX(MX1),
+    REQUIRES_MATRIX(MX2)>
+TensorT<typename MX1::Element> multiplyNaive(const MX1& a, const MX2& b) {
+  using T = typename MX1::Element;
+  SCHECK(a.cols() == b.rows());
+
+  Dims dims{a.rows(), b.cols()};
+  TensorT<T> ret{dims};
+  MatrixT<T> m{ret};
 
-  future.wait();
-#else
   for (int i = 0; i < a.rows(); i++) {
     for (int j = 0; j < b.cols(); j++) {
       for (int k = 0; k < a.cols(); k++) {
         m(i, j) += a(i, k) * b(k, j);
       }
-      // std::cout << i << "," << j << "=" << m(i, j) << std::endl;
     }
   }
-#endif
 
-  // std::cout << ret << std::endl;
   return ret;
 }
 
-Tensor operator+(const Matrix& a, const Matrix& b);
+template <typename T>
+TensorT<T> operator+(const MatrixT<T>& a, const MatrixT<T>& b);
 // Row wise addition
-Tensor operator+(const Matrix& a, const Vector& b);
-Tensor operator+(const Vector& a, const Vector& b);
-Vector& operator+=(Vector& a, const Vector& b);
-Vector& operator+=(Vector& a, Float x);
+template <typename T>
+TensorT<T> operator+(const MatrixT<T>& a, const VectorT<T>& b);
+template <typename T>
+TensorT<T> operator+(const VectorT<T>& a, const VectorT<T>& b);
+template <typename T>
+VectorT<T>& operator+=(VectorT<T>& a, const VectorT<T>& b);
+template <typename T>
+VectorT<T>& operator+=(VectorT<T>& a, T x);
+
+// Same-padded convolution; see ConvolutionLayerOperator.
+// Direct evaluates every output with MatrixPatch dot products and is kept as
+// the reference implementation. Im2col lowers each example into a
+// {input channel * R * C, rows * columns} matrix and runs gemm(). Winograd
+// computes 3x3 filters in 2x2 output tiles with F(2x2, 3x3) minimal
+// filtering, 16 multiplications per tile instead of 36. Auto is Winograd
+// for 3x3 filters and Im2col otherwise.
+enum class ConvolutionAlgorithm { Direct, Im2col, Winograd, Auto };
+
+// The filter of a Winograd convolution in the transformed domain. It is
+// transformed again only when the values of w change, so the forward pass
+// and the x gradient of a step share one transform, and so do all the
+// evaluations between two steps.
+template <typename T>
+class WinogradFilterT {
+ public:
+  // G w G^T for every filter of w, {16, output channel, input channel}
+  const T* transform(const TensorT<T>& w);
 
-Tensor convolve(const Tensor& x, const Tensor& w);
+ private:
+  std::mutex lock_;
+  // The values u_ was transformed from
+  std::vector<T> w_;
+  std::vector<T> u_;
+};
 
-using Gradient = std::vector<Tensor>;
-using GradientList = std::vector<Gradient>;
-using GradientPair = std::pair<Gradient, Gradient>;
+// x: {batch, input channel, row, column}
+// w: {output channel, input channel, R, C}
+template <typename T>
+TensorT<T> convolve(
+    const TensorT<T>& x,
+    const TensorT<T>& w,
+    ConvolutionAlgorithm algorithm = ConvolutionAlgorithm::Auto);
+// Gradient with respect to w given g, the gradient of the convolve() output
+template <typename T>
+TensorT<T> convolveWGradient(
+    const TensorT<T>& x,
+    const TensorT<T>& g,
+    const Dims& wDims,
+    ConvolutionAlgorithm algorithm = ConvolutionAlgorithm::Auto);
+// Gradient with respect to x given g, the gradient of the convolve() output
+template <typename T>
+TensorT<T> convolveXGradient(
+    const TensorT<T>& g,
+    const TensorT<T>& w,
+    const Dims& xDims,
+    ConvolutionAlgorithm algorithm = ConvolutionAlgorithm::Auto);
+
+// The same computations into an existing Tensor, which is reset() to the
+// result shape so its storage is reused across calls. A Winograd convolution
+// takes its transformed filter from filter when given.
+template <typename T>
+void convolve(
+    const TensorT<T>& x,
+    const TensorT<T>& w,
+    TensorT<T>& out,
+    ConvolutionAlgorithm algorithm = ConvolutionAlgorithm::Auto,
+    WinogradFilterT<T>* filter = nullptr);
+template <typename T>
+void convolveWGradient(
+    const TensorT<T>& x,
+    const TensorT<T>& g,
+    const Dims& wDims,
+    TensorT<T>& out,
+    ConvolutionAlgorithm algorithm = ConvolutionAlgorithm::Auto);
+template <typename T>
+void convolveXGradient(
+    const TensorT<T>& g,
+    const TensorT<T>& w,
+    const Dims& xDims,
+    TensorT<T>& out,
+    ConvolutionAlgorithm algorithm = ConvolutionAlgorithm::Auto,
+    WinogradFilterT<T>* filter = nullptr);
+
+// The column matrix convolve() multiplies w{wDims} with for one example
+// x{input channel, rows, cols}: {input channel * R * C, rows * cols}, zero
+// padded
+template <typename T>
+void lowerToColumns(const Dims& wDims, int rows, int cols, const T* x, T* col);
+
+template <typename T>
+using GradientT = std::vector<TensorT<T>>;
+template <typename T>
+using GradientListT = std::vector<GradientT<T>>;
+template <typename T>
+using GradientPairT = std::pair<GradientT<T>, GradientT<T>>;
+
+// The default precision; also what gradient verification and the unit tests
+// run in
+using Tensor = TensorT<Float>;
+using Vector = VectorT<Float>;
+using Matrix = MatrixT<Float>;
+using TransposedMatrix = TransposedMatrixT<Float>;
+using MatrixPatch = MatrixPatchT<Float>;
+using Gradient = GradientT<Float>;
+using GradientList = GradientListT<Float>;
+using GradientPair = GradientPairT<Float>;
+using WinogradFilter = WinogradFilterT<Float>;
@@ -1,5 +1,18 @@
 #include <gtest/gtest.h>
 
+#include "experimental/rockyliu/mnist/allocator.h"
+#include "experimental/rockyliu/mnist/checkpoint.h"
+#include "experimental/rockyliu/mnist/dataset.h"
+#include "experimental/rockyliu/mnist/gemm.h"
+#include "experimental/rockyliu/mnist/graph.h"
+#include "experimental/rockyliu/mnist/inference.h"
+#include "experimental/rockyliu/mnist/memory_plan.h"
+#include "experimental/rockyliu/mnist/metrics.h"
+#include "experimental/rockyliu/mnist/optimizer.h"
+#include "experimental/rockyliu/mnist/prefetcher.h"
+#include "experimental/rockyliu/mnist/sampler.h"
+#include "experimental/rockyliu/mnist/scheduler.h"
+#include "experimental/rockyliu/mnist/serving.h"
 #include "experimental/rockyliu/mnist/tensor.h"
 
 using namespace std;
@@ -9,6 +22,45 @@ using VV = vector<V>;
 using VVV = vector<VV>;
 using VVVV = vector<VVV>;
 
+namespace {
+
+Tensor operator*(const Tensor& x, Float y) {
+  Tensor ret = x;
+  for (auto& e : ret.data()) {
+    e *= y;
+  }
+  return ret;
+}
+
+Tensor getMask(int x) {
+  Tensor ret{Dims{3, 3}};
+  Matrix m{ret};
+
+  Float target = 10000;
+  if (x % 3 == 0) {
+    target = 1;
+  } else if (x % 3 == 1) {
+    target = -1;
+  } else {
+    target = 0.5;
+  }
+
+  m(x / 3, x % 3) = target;
+  return ret;
+}
+
+// Uniform in [-1, 1)
+Tensor randomTensor(std::mt19937& gen, Dims dims) {
+  std::uniform_real_distribution<> dist(-1, 1);
+  Tensor t{dims};
+  for (auto& x : t.data()) {
+    x = dist(gen);
+  }
+  return t;
+}
+
+} // namespace
+
 TEST(TensorTest, matrix) {
   auto a = Tensor::from(VV{{1, 2, 3}, {4, 5, 6}});
   auto b = Tensor::from(VV{{1, 2}, {3, 4}, {5, 6}});
@@ -19,6 +71,198 @@ TEST(TensorTest, matrix) {
   ASSERT_EQ((Tensor{Dims{2, 3}}), Matrix{a} + Matrix{d});
 }
 
+TEST(TensorTest, gemm) {
+  std::mt19937 gen(0);
+
+  // Odd shapes exercise the partial micro-tiles; 300 crosses the KC block
+  using Shape = array<int, 3>;
+  for (auto shape : vector<Shape>{{1, 1, 1}, {7, 13, 5}, {33, 300, 17}}) {
+    int M = shape[0], K = shape[1], N = shape[2];
+
+    auto a = randomTensor(gen, Dims{M, K});
+    auto b = randomTensor(gen, Dims{K, N});
+    auto at = randomTensor(gen, Dims{K, M});
+    auto bt = randomTensor(gen, Dims{N, K});
+    Matrix am{a}, bm{b}, atm{at}, btm{bt};
+
+    // NN, NT, TN
+    ASSERT_TRUE((am * bm).equals(multiplyNaive(am, bm), 1e-9));
+    auto btT = btm.transpose();
+    ASSERT_TRUE((am * btT).equals(multiplyNaive(am, btT), 1e-9));
+    auto atT = atm.transpose();
+    ASSERT_TRUE((atT * bm).equals(multiplyNaive(atT, bm), 1e-9));
+  }
+
+  // Bias and ReLU epilogue; the last shape is split into column panels
+  TaskRunner::setThreads(4);
+  for (auto shape : vector<Shape>{{7, 13, 5}, {33, 300, 17}, {16, 64, 4096}}) {
+    int M = shape[0], K = shape[1], N = shape[2];
+
+    auto a = randomTensor(gen, Dims{M, K});
+    auto b = randomTensor(gen, Dims{K, N});
+    auto bias = randomTensor(gen, Dims{N});
+    Matrix am{a}, bm{b};
+    auto expected = multiplyNaive(am, bm);
+    Matrix em{expected};
+    for (int i = 0; i < M; ++i) {
+      for (int j = 0; j < N; ++j) {
+        em(i, j) = max<Float>(0, em(i, j) + bias.data()[j]);
+      }
+    }
+
+    // The bias replaces what C held
+    auto c = randomTensor(gen, Dims{M, N});
+    gemm(
+        false,
+        false,
+        M,
+        N,
+        K,
+        am.raw(),
+        K,
+        bm.raw(),
+        N,
+        Matrix{c}.raw(),
+        N,
+        {bias.data().begin(), true});
+    ASSERT_TRUE(c.equals(expected, 1e-9));
+  }
+}
+
+TEST(TensorTest, kernels) {
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<> dist(-1, 1);
+  // Not a multiple of any vector width
+  const int rows = 7, cols = 37, n = rows * cols;
+  vector<Float> x(n), y(n);
+  for (int i = 0; i < n; ++i) {
+    x[i] = dist(gen);
+    y[i] = dist(gen);
+  }
+
+  auto run = [&](kernels::Isa isa) {
+    kernels::setIsa(isa);
+    vector<vector<Float>> ret;
+    auto out = x;
+    kernels::add(out.data(), y.data(), n);
+    kernels::scale(out.data(), 0.5, n);
+    kernels::axpy(out.data(), -3.0, y.data(), n);
+    kernels::addScalar(out.data(), 0.25, n);
+    ret.push_back(out);
+
+    vector<Float> r(n);
+    kernels::relu(r.data(), out.data(), n);
+    ret.push_back(r);
+    auto g = y;
+    kernels::reluBackward(g.data(), r.data(), n);
+    ret.push_back(g);
+
+    vector<Float> rowSum(cols), colSum(rows);
+    kernels::sumRows(rowSum.data(), x.data(), rows, cols);
+    kernels::sumCols(colSum.data(), x.data(), rows, cols);
+    kernels::addRow(g.data(), rowSum.data(), rows, cols);
+    ret.push_back(rowSum);
+    ret.push_back(colSum);
+    ret.push_back(g);
+    ret.push_back(
+        {kernels::sum(x.data(), n), kernels::l2Sum(x.data(), n)});
+
+    // Two steps so that the optimizer state feeds back
+    auto w = x;
+    vector<Float> v(n), h(n), m(n), s(n);
+    for (int step = 0; step < 2; ++step) {
+      kernels::momentumUpdate(w.data(), v.data(), y.data(), 0.1, 0.9, n);
+      kernels::adagradUpdate(w.data(), h.data(), y.data(), 0.1, 1e-8, n);
+      kernels::adamUpdate(
+          w.data(), m.data(), s.data(), y.data(), 0.1, 0.9, 0.999, 1e-8, n);
+    }
+    ret.push_back(w);
+
+    // x{rows, cols} * y{rows, cols}^T
+    vector<int8_t> xq(n), yq(n);
+    for (int i = 0; i < n; ++i) {
+      xq[i] = lround(x[i] * 127);
+      yq[i] = lround(y[i] * 127);
+    }
+    vector<int32_t> product(rows * rows);
+    kernels::int8Gemm(product.data(), xq.data(), yq.data(), rows, rows, cols);
+    ret.emplace_back(product.begin(), product.end());
+    return ret;
+  };
+
+  auto best = kernels::bestIsa();
+  auto expected = run(kernels::Isa::Scalar);
+  for (auto isa : {kernels::Isa::Avx2, kernels::Isa::Avx512}) {
+    if (static_cast<int>(isa) > static_cast<int>(best)) {
+      continue;
+    }
+    auto actual = run(isa);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ASSERT_TRUE(Tensor::from(expected[i]).equals(
+          Tensor::from(actual[i]), 1e-12))
+          << kernels::name(isa) << " #" << i;
+    }
+  }
+  kernels::setIsa(best);
+}
+
+TEST(TensorTest, optimizers) {
+  auto w0 = Tensor::from({1, -2});
+  auto g = Tensor::from({0.5, -0.25});
+  auto step = [&](OptimizerConfig::Type type, int steps) {
+    OptimizerConfig config;
+    config.type = type;
+    auto optimizer = Optimizer<Float>::create(config);
+    optimizer->setLearningRate(0.1);
+    auto w = w0;
+    for (int i = 0; i < steps; ++i) {
+      optimizer->update(w, g);
+    }
+    return w;
+  };
+  auto expect = [&](double a, double b) { return Tensor::from({a, b}); };
+
+  using Type = OptimizerConfig::Type;
+  ASSERT_TRUE(step(Type::SGD, 1).equals(expect(0.95, -1.975), 1e-12));
+  // g, then 0.9 g + g
+  ASSERT_TRUE(step(Type::Momentum, 2).equals(expect(0.855, -1.9275), 1e-12));
+  // The first step of AdaGrad and Adam is alpha * sign(g)
+  ASSERT_TRUE(step(Type::AdaGrad, 1).equals(expect(0.9, -1.9), 1e-6));
+  ASSERT_TRUE(step(Type::Adam, 1).equals(expect(0.9, -1.9), 1e-6));
+  // alpha * 0.001 * |w| / |g| * g
+  const double lars = 0.1 * 0.001 * sqrt(5.0) / sqrt(0.3125);
+  ASSERT_TRUE(step(Type::LARS, 1).equals(
+      expect(1 - lars * 0.5, -2 + lars * 0.25), 1e-12));
+}
+
+TEST(TensorTest, learningRateSchedule) {
+  LearningRateStrategy s;
+  s.alpha = 0.1;
+  s.warmupIterations = 10;
+  s.decayEvery = 20;
+  s.decayFactor = 0.5;
+
+  EXPECT_DOUBLE_EQ(0.01, s.at(0, 100));
+  EXPECT_DOUBLE_EQ(0.1, s.at(9, 100));
+  EXPECT_DOUBLE_EQ(0.1, s.at(90, 100));
+
+  s.schedule = LearningRateStrategy::Schedule::Step;
+  EXPECT_DOUBLE_EQ(0.1, s.at(29, 100));
+  EXPECT_DOUBLE_EQ(0.05, s.at(30, 100));
+  EXPECT_DOUBLE_EQ(0.025, s.at(50, 100));
+
+  s.schedule = LearningRateStrategy::Schedule::Exponential;
+  EXPECT_DOUBLE_EQ(0.1 * sqrt(0.5), s.at(20, 100));
+  EXPECT_DOUBLE_EQ(0.05, s.at(30, 100));
+
+  s.schedule = LearningRateStrategy::Schedule::Cosine;
+  s.minAlpha = 0.02;
+  EXPECT_DOUBLE_EQ(0.1, s.at(10, 110));
+  EXPECT_DOUBLE_EQ(0.06, s.at(60, 110));
+  EXPECT_DOUBLE_EQ(0.02, s.at(110, 110));
+}
+
 TEST(TensorTest, vector) {
   auto a = Tensor::from({1, 2, 1});
   auto b = Tensor::from({0, -2, 0});
@@ -53,35 +297,6 @@ TEST(TensorTest, view) {
   ASSERT_EQ(d, a);
 }
 
-namespace {
-
-Tensor operator*(const Tensor& x, Float y) {
-  Tensor ret = x;
-  for (auto& e : ret.data()) {
-    e *= y;
-  }
-  return ret;
-}
-
-Tensor getMask(int x) {
-  Tensor ret{Dims{3, 3}};
-  Matrix m{ret};
-
-  Float target = 10000;
-  if (x % 3 == 0) {
-    target = 1;
-  } else if (x % 3 == 1) {
-    target = -1;
-  } else {
-    target = 0.5;
-  }
-
-  m(x / 3, x % 3) = target;
-  return ret;
-}
-
-} // namespace
-
 // TODO: Contain different sizes for R and C
 TEST(TensorTest, convolve) {
   Tensor x{Dims{4, 4}};
@@ -141,7 +356,415 @@ TEST(TensorTest, convolve) {
   });
   r = Tensor::from({r, r * 10, r * 100});
 
-  ASSERT_EQ(r, convolve(x, w));
+  ASSERT_EQ(r, convolve(x, w, ConvolutionAlgorithm::Direct));
+  ASSERT_EQ(r, convolve(x, w, ConvolutionAlgorithm::Im2col));
+}
+
+TEST(TensorTest, convolveIm2col) {
+  std::mt19937 gen(0);
+
+  // Non-square image and filter
+  auto x = randomTensor(gen, Dims{2, 3, 7, 6});
+  auto w = randomTensor(gen, Dims{4, 3, 3, 5});
+  auto g = randomTensor(gen, Dims{2, 4, 7, 6});
+
+  const auto direct = ConvolutionAlgorithm::Direct;
+  const auto im2col = ConvolutionAlgorithm::Im2col;
+  ASSERT_TRUE(convolve(x, w, im2col).equals(convolve(x, w, direct), 1e-9));
+  ASSERT_TRUE(convolveWGradient(x, g, w.dims(), im2col)
+                  .equals(convolveWGradient(x, g, w.dims(), direct), 1e-9));
+  ASSERT_TRUE(convolveXGradient(g, w, x.dims(), im2col)
+                  .equals(convolveXGradient(g, w, x.dims(), direct), 1e-9));
+}
+
+// Odd sizes leave partial tiles on the bottom and right edges
+TEST(TensorTest, convolveWinograd) {
+  std::mt19937 gen(0);
+
+  const auto direct = ConvolutionAlgorithm::Direct;
+  const auto winograd = ConvolutionAlgorithm::Winograd;
+  for (auto dims : {Dims{2, 3, 8, 6}, Dims{3, 2, 7, 5}, Dims{1, 2, 3, 5}}) {
+    auto x = randomTensor(gen, dims);
+    auto w = randomTensor(gen, Dims{4, dims[1], 3, 3});
+    auto g = randomTensor(gen, Dims{dims[0], 4, dims[2], dims[3]});
+    ASSERT_TRUE(convolve(x, w, winograd).equals(convolve(x, w, direct), 1e-9));
+    ASSERT_TRUE(convolveWGradient(x, g, w.dims(), winograd)
+                    .equals(convolveWGradient(x, g, w.dims(), direct), 1e-9));
+    ASSERT_TRUE(convolveXGradient(g, w, x.dims(), winograd)
+                    .equals(convolveXGradient(g, w, x.dims(), direct), 1e-9));
+  }
+
+  // The cached transform follows the values of w
+  auto x = randomTensor(gen, Dims{2, 3, 6, 6});
+  auto w = randomTensor(gen, Dims{4, 3, 3, 3});
+  WinogradFilter filter;
+  Tensor out;
+  convolve(x, w, out, winograd, &filter);
+  ASSERT_TRUE(out.equals(convolve(x, w, direct), 1e-9));
+  w.data()[5] += 1;
+  convolve(x, w, out, winograd, &filter);
+  ASSERT_TRUE(out.equals(convolve(x, w, direct), 1e-9));
+}
+
+// fp32 results stay within single precision rounding of the fp64 ones
+TEST(TensorTest, fp32) {
+  std::mt19937 gen(0);
+  auto toFloat = [](const Tensor& t) { return TensorT<float>::cast(t); };
+
+  auto a = randomTensor(gen, Dims{33, 300});
+  auto b = randomTensor(gen, Dims{300, 17});
+  auto af = toFloat(a), bf = toFloat(b);
+  auto c = Matrix{a} * Matrix{b};
+  auto cf = MatrixT<float>{af} * MatrixT<float>{bf};
+  ASSERT_TRUE(Tensor::cast(cf).equals(c, 1e-4));
+
+  auto x = randomTensor(gen, Dims{2, 3, 7, 6});
+  auto w = randomTensor(gen, Dims{4, 3, 3, 5});
+  auto xf = toFloat(x), wf = toFloat(w);
+  ASSERT_TRUE(Tensor::cast(convolve(xf, wf)).equals(convolve(x, w), 1e-4));
+
+  auto y = Tensor::from({-1.5, 0.0, 2.25});
+  auto yf = toFloat(y);
+  yf *= 2;
+  ASSERT_TRUE(Tensor::cast(yf) == Tensor::from({-3, 0, 4.5}));
+}
+
+TEST(TensorTest, allocator) {
+  {
+    Tensor t{Dims{100, 30}};
+    t.data()[7] = 1;
+  }
+  auto before = TensorAllocator::stats();
+  {
+    // Same size class: recycled, and zeroed again
+    Tensor t{Dims{3000}};
+    for (auto x : t.data()) {
+      ASSERT_EQ(0, x);
+    }
+  }
+  auto after = TensorAllocator::stats();
+  ASSERT_EQ(before.systemAllocations, after.systemAllocations);
+  ASSERT_GT(after.poolHits, before.poolHits);
+  ASSERT_EQ(before.bytesInUse, after.bytesInUse);
+}
+
+TEST(TensorTest, reuse) {
+  auto a = Tensor::from(VV{{1, 2}, {3, 4}});
+  const auto* storage = a.data().begin();
+  a.reset(Dims{4});
+  ASSERT_EQ(storage, a.data().begin());
+  ASSERT_EQ(Tensor{Dims{4}}, a);
+  a.reset(Dims{3});
+  ASSERT_NE(storage, a.data().begin());
+
+  // Copy assignment keeps unshared storage of the same size
+  auto b = Tensor::from(VV{{1, 2}, {3, 4}});
+  auto c = Tensor::from(VV{{5, 6}, {7, 8}});
+  storage = b.data().begin();
+  b = c;
+  ASSERT_EQ(storage, b.data().begin());
+  ASSERT_EQ(c, b);
+  // ... but not storage a view refers to
+  Tensor view = b[0];
+  auto d = Tensor::from(VV{{9, 9}, {9, 9}});
+  b = d;
+  ASSERT_EQ(d, b);
+  ASSERT_EQ(Tensor::from({5, 6}), view);
+
+  // Convolving into a buffer of the result shape reuses it
+  Tensor x{Dims{2, 3, 5, 5}}, w{Dims{4, 3, 3, 3}};
+  x.data()[7] = 1;
+  w.data()[13] = 1;
+  Tensor out{Dims{2, 4, 5, 5}};
+  storage = out.data().begin();
+  convolve(x, w, out);
+  ASSERT_EQ(storage, out.data().begin());
+  ASSERT_EQ(convolve(x, w), out);
+}
+
+// The fused FC + ReLU matches the two operators it replaces
+TEST(TensorTest, fcRelu) {
+  std::mt19937 gen(0);
+
+  ExecutionContext<Float> ctx;
+  auto input = make_shared<InputOperator<Float>>(Dims{20});
+  input->get(ctx) = randomTensor(gen, Dims{9, 20});
+  auto fc = make_shared<FCLayerOperator<Float>>(13, input);
+  IOperator<Float> relu = make_shared<ReluOperator<Float>>(fc);
+
+  // Stands in for the consumer of the ReLU output
+  auto g = randomTensor(gen, Dims{9, 13});
+  auto parent = make_shared<BackPropOperator<Float>>(
+      "parent",
+      Operator<Float>::newSlot(),
+      [](BackPropOperator<Float>*, ExecutionContext<Float>&) {});
+  parent->inputGradientBuffer(ctx, 0) = g;
+
+  fc->compute(ctx);
+  auto expected = relu->compute(ctx);
+  relu->getBackPropOperator()->addParent(parent, 0);
+  fc->getBackPropOperator()->addParent(relu->getBackPropOperator(), 0);
+  relu->getBackPropOperator()->runBackProp(ctx);
+  fc->getBackPropOperator()->runBackProp(ctx);
+  auto expectedX = fc->getBackPropOperator()->inputGradient(ctx);
+  auto expectedW = fc->getBackPropOperator()->parameterGradient(ctx);
+
+  auto fused = GraphBuilder::fuse<Float>(relu);
+  ASSERT_TRUE(dynamic_pointer_cast<FCReluLayerOperator<Float>>(fused));
+  ASSERT_TRUE(fused->compute(ctx).equals(expected, 1e-12));
+  fused->getBackPropOperator()->addParent(parent, 0);
+  fused->getBackPropOperator()->runBackProp(ctx);
+  auto& x = fused->getBackPropOperator()->inputGradient(ctx);
+  auto& w = fused->getBackPropOperator()->parameterGradient(ctx);
+  ASSERT_TRUE(x[0].equals(expectedX[0], 1e-12));
+  ASSERT_EQ(2, w.size());
+  ASSERT_TRUE(w[0].equals(expectedW[0], 1e-12));
+  ASSERT_TRUE(w[1].equals(expectedW[1], 1e-12));
+
+  // A second pass in a context of its own leaves the first one alone
+  ExecutionContext<Float> other;
+  input->get(other) = randomTensor(gen, Dims{3, 20});
+  ASSERT_EQ((Dims{3, 13}), fused->compute(other).dims());
+  ASSERT_TRUE(fused->get(ctx).equals(expected, 1e-12));
+}
+
+TEST(TensorTest, memoryPlan) {
+  // b shares the bytes of a, which is dead by then; c overlaps both
+  auto layout = MemoryPlan::layout({
+      {"a", 100, 0, 1, 0},
+      {"b", 128, 2, 3, 0},
+      {"c", 64, 1, 2, 0},
+  });
+  EXPECT_EQ(0, layout.buffers[0].offset);
+  EXPECT_EQ(0, layout.buffers[1].offset);
+  EXPECT_EQ(128, layout.buffers[2].offset);
+  EXPECT_EQ(192, layout.peakBytes);
+  EXPECT_EQ(292, layout.totalBytes);
+  EXPECT_EQ(192, layout.liveBytes);
+
+  std::mt19937 gen(0);
+
+  auto input = make_shared<InputOperator<Float>>(Dims{20});
+  IOperator<Float> fc1 = make_shared<FCLayerOperator<Float>>(13, input);
+  IOperator<Float> relu1 = make_shared<ReluOperator<Float>>(fc1);
+  IOperator<Float> fc2 = make_shared<FCLayerOperator<Float>>(7, relu1);
+  IOperator<Float> relu2 = make_shared<ReluOperator<Float>>(fc2);
+  OperatorList<Float> forward{input, fc1, relu1, fc2, relu2};
+  BackPropOperatorList<Float> backward;
+  for (int i = forward.size() - 1; i >= 0; --i) {
+    backward.push_back(forward[i]->getBackPropOperator());
+    if (i > 0) {
+      forward[i - 1]->getBackPropOperator()->addParent(backward.back(), 0);
+    }
+  }
+  // Stands in for the consumer of the last ReLU
+  auto parent = make_shared<BackPropOperator<Float>>(
+      "parent",
+      Operator<Float>::newSlot(),
+      [](BackPropOperator<Float>*, ExecutionContext<Float>&) {});
+  relu2->getBackPropOperator()->addParent(parent, 0);
+
+  ExecutionContext<Float> ctx;
+  auto x = randomTensor(gen, Dims{9, 20});
+  parent->inputGradientBuffer(ctx, 0) = randomTensor(gen, Dims{9, 7});
+  auto pass = [&]() {
+    input->get(ctx).resize(x.dims());
+    copy(x.data().begin(), x.data().end(), input->get(ctx).data().begin());
+    for (auto& op : forward) {
+      op->compute(ctx);
+    }
+    for (auto& op : backward) {
+      op->runBackProp(ctx);
+    }
+  };
+  pass();
+  auto out = relu2->get(ctx);
+  auto w1 = fc1->getBackPropOperator()->parameterGradient(ctx);
+  auto w2 = fc2->getBackPropOperator()->parameterGradient(ctx);
+
+  MemoryPlanner<Float> planner(forward, backward);
+  auto plan = planner.apply(ctx);
+  // The input gradients of the ReLUs and FC layers take turns
+  EXPECT_LT(plan.peakBytes, plan.totalBytes);
+  EXPECT_GE(plan.peakBytes, plan.liveBytes);
+  EXPECT_LT(
+      MemoryPlanner<Float>(forward).plan(ctx).peakBytes, plan.peakBytes);
+
+  // Every buffer of the plan keeps its storage across a full pass
+  auto storage = [&]() {
+    vector<const Float*> ptrs;
+    for (auto& op : forward) {
+      ptrs.push_back(op->get(ctx).data().begin());
+    }
+    for (auto& op : backward) {
+      for (auto& g : op->inputGradient(ctx)) {
+        ptrs.push_back(g.data().begin());
+      }
+      for (auto& g : op->parameterGradient(ctx)) {
+        ptrs.push_back(g.data().begin());
+      }
+    }
+    return ptrs;
+  };
+  auto planned = storage();
+  auto before = TensorAllocator::stats();
+  pass();
+  EXPECT_EQ(before.allocations(), TensorAllocator::stats().allocations());
+  EXPECT_EQ(planned, storage());
+  EXPECT_EQ(out, relu2->get(ctx));
+  EXPECT_EQ(w1, fc1->getBackPropOperator()->parameterGradient(ctx));
+  EXPECT_EQ(w2, fc2->getBackPropOperator()->parameterGradient(ctx));
+}
+
+TEST(TensorTest, slots) {
+  auto input = make_shared<InputOperator<Float>>(Dims{4});
+  IOperator<Float> fc = make_shared<FCLayerOperator<Float>>(3, input);
+  IOperator<Float> relu = make_shared<ReluOperator<Float>>(fc);
+  auto backprop = fc->getBackPropOperator();
+  EXPECT_FALSE(fc->hasDenseSlot());
+
+  auto order = GraphBuilder::topologicalSort<Float>(input, fc);
+  vector<size_t> ids;
+  for (auto& op : order) {
+    ASSERT_TRUE(op->hasDenseSlot());
+    ids.push_back(op->slotId());
+  }
+  sort(ids.begin(), ids.end());
+  EXPECT_EQ((vector<size_t>{0, 1}), ids);
+  EXPECT_FALSE(relu->hasDenseSlot());
+
+  // A graph sorted later numbers only its new operators, above the others
+  auto id = fc->slotId();
+  GraphBuilder::topologicalSort<Float>(input, relu);
+  EXPECT_EQ(id, fc->slotId());
+  EXPECT_EQ(2, relu->slotId());
+
+  // The backprop operator follows its operator, and references to slots
+  // survive the context growing
+  ExecutionContext<Float> ctx;
+  auto* g = &ctx.slot(fc->slotId()).inputGradient;
+  EXPECT_EQ(g, &backprop->inputGradient(ctx));
+  ctx.slot(100);
+  EXPECT_EQ(g, &backprop->inputGradient(ctx));
+}
+
+TEST(TensorTest, inferenceEngine) {
+  TaskRunner::setThreads(4);
+  const int n = 35;
+  const int pixels = N_IMAGE * N_IMAGE;
+  std::mt19937 gen(0);
+  vector<uint8_t> images(n * pixels);
+  for (auto& x : images) {
+    x = gen() % 256;
+  }
+  ExampleList examples;
+  for (int i = 0; i < n; ++i) {
+    examples.push_back(Example{images.data() + i * pixels, i % N_CLASS});
+  }
+
+  for (string arch :
+       {"{ fcLayer = { hiddenLayerDims = { 32 16 } } }",
+        "{ cnnLayer = { width = 3 channel = 4 } "
+        "poolLayer = { width = 2 stride = 2 } "
+        "cnnLayer = { width = 3 channel = 4 } "
+        "fcLayer = { hiddenLayerDims = { 16 } } }"}) {
+    istringstream in(arch);
+    auto ops = GraphBuilder::buildMLP<Float>(
+        pixels, N_CLASS, ModelArchitecture::read(in));
+    // Batches of 8 leave 3 examples, which take the path without gemm()
+    ForwardPassModel<Float> model{ops.first, ops.second, 8};
+    auto engine = InferenceEngine<Float>::compile(model, 8);
+    auto expected = model.predict(examples);
+    auto actual = engine->predict(examples);
+    ASSERT_EQ(n, actual.size());
+    for (int i = 0; i < n; ++i) {
+      for (int k = 0; k < N_CLASS; ++k) {
+        EXPECT_NEAR(expected[i].prob[k], actual[i].prob[k], 1e-9) << arch;
+      }
+    }
+    // Scratch buffers and activations share the arena
+    EXPECT_LT(engine->plan().peakBytes, engine->plan().totalBytes);
+
+    // Calibrated on the examples themselves, int8 stays within a rounding
+    // error of the float program
+    auto int8 = InferenceEngine<Float>::quantize(model, 8, examples);
+    auto quantized = int8->predict(examples);
+    for (int i = 0; i < n; ++i) {
+      for (int k = 0; k < N_CLASS; ++k) {
+        EXPECT_NEAR(expected[i].prob[k], quantized[i].prob[k], 1e-3) << arch;
+      }
+    }
+  }
+}
+
+TEST(TensorTest, taskRunner) {
+  TaskRunner::setThreads(4);
+  auto& runner = TaskRunner::get();
+
+  // Every index exactly once, including a partial last chunk
+  vector<atomic<int>> hits(1003);
+  runner.parallelFor(0, hits.size(), 10, [&](int b, int e) {
+    ASSERT_LE(e - b, 10);
+    for (int i = b; i < e; ++i) {
+      ++hits[i];
+    }
+  });
+  for (auto& h : hits) {
+    ASSERT_EQ(1, h.load());
+  }
+
+  // Nested fork-join
+  atomic<int> sum{0};
+  TaskGroup group;
+  for (int i = 0; i < 8; ++i) {
+    group.spawn([&runner, &sum]() {
+      runner.parallelFor(0, 100, 7, [&](int b, int e) { sum += e - b; });
+    });
+  }
+  group.wait();
+  ASSERT_EQ(800, sum.load());
+}
+
+// GEMM panels and convolution examples spread over the thread budget give the
+// same results as running on one thread
+TEST(TensorTest, parallelOperators) {
+  TaskRunner::setThreads(4);
+  std::mt19937 gen(0);
+
+  // Split by rows (M >= N) and by columns
+  auto a = randomTensor(gen, Dims{200, 300});
+  auto b = randomTensor(gen, Dims{300, 150});
+  auto bt = randomTensor(gen, Dims{40, 200});
+  auto x = randomTensor(gen, Dims{5, 3, 9, 8});
+  auto w = randomTensor(gen, Dims{4, 3, 3, 3});
+  auto g = randomTensor(gen, Dims{5, 4, 9, 8});
+  const auto im2col = ConvolutionAlgorithm::Im2col;
+  const auto winograd = ConvolutionAlgorithm::Winograd;
+
+  auto run = [&](int threads) {
+    TaskRunner::ThreadBudget budget{threads};
+    return vector<Tensor>{
+        Matrix{a} * Matrix{b},
+        Matrix{bt} * Matrix{a},
+        convolve(x, w, im2col),
+        convolveWGradient(x, g, w.dims(), im2col),
+        convolveXGradient(g, w, x.dims(), im2col),
+        convolve(x, w, winograd),
+        convolveWGradient(x, g, w.dims(), winograd),
+        convolveXGradient(g, w, x.dims(), winograd)};
+  };
+  auto serial = run(1);
+  auto parallel = run(4);
+  for (size_t i = 0; i < serial.size(); ++i) {
+    ASSERT_TRUE(parallel[i].equals(serial[i], 1e-9)) << i;
+  }
+
+  auto plan = TaskRunner::plan(100, 16);
+  ASSERT_EQ(4, plan.shards);
+  ASSERT_EQ(1, plan.threadsPerShard);
+  plan = TaskRunner::plan(20, 16);
+  ASSERT_EQ(1, plan.shards);
+  ASSERT_EQ(4, plan.threadsPerShard);
 }
 
 // Mimic the +b operator in CNN
@@ -213,3 +836,257 @@ TEST(TensorTest, flatten2) {
 
   ASSERT_EQ(f, a);
 }
+
+TEST(TensorTest, dataset) {
+  auto writeInt = [](ofstream& out, uint32_t x) {
+    char b[4] = {static_cast<char>(x >> 24),
+                 static_cast<char>(x >> 16),
+                 static_cast<char>(x >> 8),
+                 static_cast<char>(x)};
+    out.write(b, 4);
+  };
+  const int n = 3;
+  const int pixels = N_IMAGE * N_IMAGE;
+  auto dir = testing::TempDir();
+  {
+    ofstream images(dir + "images", ios::binary);
+    writeInt(images, 0x803);
+    writeInt(images, n);
+    writeInt(images, N_IMAGE);
+    writeInt(images, N_IMAGE);
+    for (int i = 0; i < n * pixels; ++i) {
+      images.put(static_cast<char>(i % 256));
+    }
+    ofstream labels(dir + "labels", ios::binary);
+    writeInt(labels, 0x801);
+    writeInt(labels, n);
+    for (int i = 0; i < n; ++i) {
+      labels.put(static_cast<char>(7 - i));
+    }
+  }
+
+  Dataset dataset{dir + "images", dir + "labels"};
+  ASSERT_EQ(n, dataset.size());
+  auto& examples = dataset.examples();
+  EXPECT_EQ(6, examples[1].label);
+  EXPECT_DOUBLE_EQ(-1.0, examples[0].pixel(0));
+  EXPECT_DOUBLE_EQ(1.0, examples[0].pixel(255));
+
+  Tensor batch{ExampleRange{examples, 1, 2}, false};
+  ASSERT_EQ((Dims{2, pixels}), batch.dims());
+  for (int i = 0; i < 2 * pixels; ++i) {
+    EXPECT_DOUBLE_EQ((pixels + i) % 256 / 127.5 - 1.0, batch.data()[i]);
+  }
+  Tensor label{ExampleRange{examples, 1, 2}, true};
+  EXPECT_EQ(6, label.data()[0]);
+  EXPECT_EQ(5, label.data()[1]);
+}
+
+TEST(TensorTest, prefetcher) {
+  const int n = 12;
+  const int pixels = N_IMAGE * N_IMAGE;
+  vector<uint8_t> images(n * pixels);
+  ExampleList examples;
+  for (int i = 0; i < n; ++i) {
+    fill(&images[i * pixels], &images[(i + 1) * pixels], i * 20);
+    examples.push_back(Example{&images[i * pixels], i % N_CLASS});
+  }
+
+  for (int depth : {0, 1, 3}) {
+    int start = 0;
+    BatchPrefetcher<float> prefetcher(
+        [&]() {
+          ExampleRange r{examples, start, 4};
+          start = (start + 4) % n;
+          return r;
+        },
+        depth);
+    for (int k = 0; k < 8; ++k) {
+      auto& batch = prefetcher.next();
+      ExampleRange expected{examples, k * 4 % n, 4};
+      EXPECT_EQ((TensorT<float>{expected, false}), batch.input);
+      EXPECT_EQ((TensorT<float>{expected, true}), batch.label);
+
+      TensorT<float> rows;
+      rows.loadRows(batch.input, 1, 3);
+      EXPECT_EQ((Dims{2, pixels}), rows.dims());
+      EXPECT_EQ(batch.input[1], rows[0]);
+      EXPECT_EQ(batch.input[2], rows[1]);
+    }
+  }
+}
+
+TEST(TensorTest, sampler) {
+  const int n = 10;
+  ExampleList examples;
+  for (int i = 0; i < n; ++i) {
+    examples.push_back(Example{nullptr, i});
+  }
+  auto labels = [](const ExampleRange& r) {
+    vector<int> ret;
+    for (auto& e : r) {
+      ret.push_back(e.label);
+    }
+    return ret;
+  };
+
+  // In order, leaving out the 2 examples which do not fill a batch
+  EpochSampler inOrder(examples, 4, false, 0);
+  EXPECT_EQ((vector<int>{0, 1, 2, 3}), labels(inOrder.next()));
+  EXPECT_EQ((vector<int>{4, 5, 6, 7}), labels(inOrder.next()));
+  EXPECT_EQ((vector<int>{0, 1, 2, 3}), labels(inOrder.next()));
+  EXPECT_EQ(2, inOrder.epochs());
+
+  EpochSampler a(examples, 3, true, 7), b(examples, 3, true, 7);
+  EpochSampler c(examples, 3, true, 8);
+  bool differs = false;
+  for (int epoch = 0; epoch < 5; ++epoch) {
+    vector<int> seen;
+    for (int k = 0; k < 3; ++k) {
+      auto batch = a.next();
+      auto x = labels(batch);
+      EXPECT_EQ(x, labels(b.next()));
+      differs |= x != labels(c.next());
+      seen.insert(seen.end(), x.begin(), x.end());
+
+      // Batches are gathered through the permutation
+      auto halves = batch.splitToNBatches(2);
+      EXPECT_EQ(vector<int>(x.begin(), x.begin() + 1), labels(halves[0]));
+      EXPECT_EQ(vector<int>(x.begin() + 1, x.end()), labels(halves[1]));
+    }
+    // No example twice within an epoch
+    sort(seen.begin(), seen.end());
+    EXPECT_EQ(seen.end(), unique(seen.begin(), seen.end()));
+  }
+  EXPECT_EQ(5, a.epochs());
+  EXPECT_TRUE(differs);
+}
+
+TEST(TensorTest, checkpoint) {
+  Tensor w{Dims{3, 5}, UniformInitScheme{}};
+  Tensor b{Dims{5}, UniformInitScheme{}};
+  Tensor k{Dims{2, 1, 3, 3}, UniformInitScheme{}};
+  auto file = testing::TempDir() + "checkpoint";
+  Checkpoint<Float>::write(file, "fc\nconv\n", {&w, &b, &k});
+  EXPECT_TRUE(isCheckpoint(file));
+
+  auto c = Checkpoint<Float>::read(file);
+  EXPECT_EQ("fc\nconv\n", c.description());
+  auto& t = c.tensors();
+  ASSERT_EQ(3, t.size());
+  EXPECT_EQ(w, t[0]);
+  EXPECT_EQ(b, t[1]);
+  EXPECT_EQ(k, t[2]);
+  for (auto& x : t) {
+    // In place in the mapping
+    EXPECT_EQ(
+        0,
+        reinterpret_cast<uintptr_t>(x.data().begin()) %
+            Checkpoint<Float>::kPayloadAlignment);
+  }
+  // Copy on write: the file keeps its contents
+  t[0].data()[0] += 1;
+  EXPECT_EQ(w, Checkpoint<Float>::read(file).tensors()[0]);
+
+  // Across precisions
+  auto f = Checkpoint<float>::read(file);
+  EXPECT_EQ(TensorT<float>::cast(k), f.tensors()[2]);
+
+  ofstream text(file);
+  text << "fc-layer" << endl;
+  text.close();
+  EXPECT_FALSE(isCheckpoint(file));
+}
+
+TEST(TensorTest, checkpointWriter) {
+  Tensor w{Dims{64, 32}, UniformInitScheme{}};
+  auto file = testing::TempDir() + "snapshot";
+  CheckpointWriter<Float> writer(file);
+  for (int i = 0; i < 3; ++i) {
+    auto expected = w;
+    writer.write(to_string(i), {&w});
+    // Training goes on while the snapshot is written
+    w.data()[0] += 1;
+    writer.wait();
+
+    auto c = Checkpoint<Float>::read(file);
+    EXPECT_EQ(to_string(i), c.description());
+    EXPECT_EQ(expected, c.tensors()[0]);
+  }
+}
+
+TEST(TensorTest, metricsWriter) {
+  auto file = testing::TempDir() + "metrics";
+  const int n = 1000;
+  {
+    // A ring much shorter than the records makes the producer wait
+    MetricsWriter writer(file, 7, 4);
+    for (int i = 0; i < n; ++i) {
+      auto& record = writer.begin();
+      record.add("i", i);
+      auto& a = record.addArray("a");
+      for (int j = 0; j < i % 3; ++j) {
+        a.push_back(j + 0.5);
+      }
+      writer.commit();
+    }
+  }
+
+  const vector<string> arrays = {"[]", "[0.5]", "[0.5, 1.5]"};
+  ifstream in(file);
+  string line;
+  int i = 0;
+  while (getline(in, line)) {
+    EXPECT_EQ(
+        folly::format("{{ \"i\": {}, \"a\": {} }}", i, arrays[i % 3]).str(),
+        line);
+    ++i;
+  }
+  EXPECT_EQ(n, i);
+}
+
+TEST(TensorTest, dynamicBatcher) {
+  // Predicts the first pixel as the class
+  struct FirstPixel : Model {
+    vector<Prediction> predict(const ExampleList& examples) const override {
+      batches.push_back(examples.size());
+      vector<Prediction> ret(examples.size());
+      for (size_t i = 0; i < examples.size(); ++i) {
+        ret[i].prob[examples[i].pixels[0]] = 1;
+      }
+      return ret;
+    }
+    mutable vector<int> batches;
+  };
+  auto model = make_shared<FirstPixel>();
+
+  const int n = 10;
+  vector<int> answers(n, -1);
+  {
+    // Long enough a wait that the requests below coalesce
+    DynamicBatcher batcher{model, 4, chrono::milliseconds(50)};
+    for (int i = 0; i < n; ++i) {
+      uint8_t pixels[kRequestBytes] = {static_cast<uint8_t>(i % N_CLASS)};
+      batcher.submit(pixels, [&answers, i](const Prediction& p) {
+        uint8_t response[kResponseBytes];
+        encodeResponse(p, response);
+        answers[i] = response[0];
+      });
+    }
+    batcher.drain();
+    auto stats = batcher.stats();
+    EXPECT_EQ(n, stats.requests);
+    EXPECT_EQ(model->batches.size(), stats.batches);
+  }
+
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(i % N_CLASS, answers[i]);
+  }
+  int total = 0;
+  for (int size : model->batches) {
+    EXPECT_LE(size, 4);
+    total += size;
+  }
+  EXPECT_EQ(n, total);
+  EXPECT_LT(model->batches.size(), n);
+}
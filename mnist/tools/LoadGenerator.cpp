@@ -0,0 +1,104 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "experimental/rockyliu/mnist/dataset.h"
+#include "experimental/rockyliu/mnist/serving.h"
+
+using namespace std;
+
+// Drives the inference server (server.cpp) with the images of an IDX
+// dataset: each connection sends one image, waits for its response and sends
+// the next, so the server sees as many concurrent requests as there are
+// connections. Reports the throughput, the latency seen by the clients and
+// the accuracy of the responses.
+//
+//   load_generator <socket> <images> <labels> [connections] [requests]
+//
+// requests is per connection and defaults to the size of the dataset.
+
+namespace {
+
+int connectTo(const string& path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  SCHECK(fd >= 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  SCHECK(path.size() < sizeof(address.sun_path));
+  path.copy(address.sun_path, path.size());
+  SCHECK_MSG(
+      connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) ==
+          0,
+      folly::format("Cannot connect to {}", path));
+  return fd;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    cerr << "Usage: " << argv[0]
+         << " <socket> <images> <labels> [connections] [requests]" << endl;
+    return 1;
+  }
+  const string socketPath = argv[1];
+  Dataset dataset{argv[2], argv[3]};
+  const auto& examples = dataset.examples();
+  const int connections = argc > 4 ? stoi(argv[4]) : 8;
+  const int requests = argc > 5 ? stoi(argv[5]) : dataset.size();
+  SCHECK(connections > 0 && requests > 0);
+
+  vector<vector<double>> latencies(connections);
+  atomic<long> correct{0};
+  vector<thread> clients;
+  auto start = chrono::steady_clock::now();
+  for (int c = 0; c < connections; ++c) {
+    clients.emplace_back([&, c]() {
+      int fd = connectTo(socketPath);
+      uint8_t response[kResponseBytes];
+      auto& mine = latencies[c];
+      mine.reserve(requests);
+      for (int i = 0; i < requests; ++i) {
+        // The connections start at different images
+        auto& e = examples[(c * 7919L + i) % examples.size()];
+        auto sent = chrono::steady_clock::now();
+        if (!writeFully(fd, e.pixels, kRequestBytes) ||
+            !readFully(fd, response, kResponseBytes)) {
+          cerr << "Connection " << c << " lost" << endl;
+          break;
+        }
+        mine.push_back(chrono::duration<double, micro>(
+                           chrono::steady_clock::now() - sent)
+                           .count());
+        correct += response[0] == e.label;
+      }
+      close(fd);
+    });
+  }
+  for (auto& t : clients) {
+    t.join();
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  vector<double> all;
+  for (auto& l : latencies) {
+    all.insert(all.end(), l.begin(), l.end());
+  }
+  cout << folly::format(
+              "{} requests over {} connections in {:.2f} s: {:.0f}/s, "
+              "latency p50 {:.0f} us p99 {:.0f} us, error rate {:.2f}%",
+              all.size(),
+              connections,
+              elapsed.count(),
+              all.size() / elapsed.count(),
+              percentile(all, 0.5),
+              percentile(all, 0.99),
+              100.0 - 100.0 * correct / max<size_t>(all.size(), 1))
+       << endl;
+}
@@ -1,78 +1,23 @@
 #include <folly/Format.h>
 #include <atomic>
-#include <cstdlib>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 
+#include "allocator.h"
+#include "checkpoint.h"
 #include "graph.h"
+#include "memory_plan.h"
+#include "metrics.h"
+#include "model.h"
+#include "optimizer.h"
+#include "prefetcher.h"
+#include "sampler.h"
+#include "scheduler.h"
 #include "trainer.h"
 
 using namespace std;
 
-class ForwardPassModel : public Model {
- public:
-  ForwardPassModel(IInputOperator input, IOperator output, int batchSize)
-      : input_(input), output_(output), batchSize_(batchSize) {
-    // Sort the operators topologically
-    forwardOrder_ = GraphBuilder::topologicalSort(input, output);
-    // for (auto op : forwardOrder_) {
-    //   cout << op->name() << endl;
-    // }
-  }
-
-  vector<Prediction> predict(const ExampleList& examples) const override {
-    vector<Prediction> ret(examples.size());
-
-    auto batches = ExampleRange{examples}.splitByBatchSize(batchSize_);
-    int T = batches.size();
-
-    vector<TaskRunner::Task> tasks;
-    for (int i = 0; i < T; ++i) {
-      tasks.push_back([this, i, &batches, &ret]() {
-        input_->load(batches[i]);
-        for (auto op : forwardOrder_) {
-          op->compute();
-        }
-        auto& out = output_->get();
-        // cout << "out dim: " << out << endl;
-
-        Matrix m{out};
-
-        auto begin = i * batches[0].size();
-        for (int e = 0; e < m.rows(); ++e) {
-          auto& pred = ret[begin + e];
-          for (int k = 0; k < m.cols(); k++) {
-            // I want a row view
-            pred.prob[k] = m(e, k);
-          }
-        }
-      });
-    }
-
-    TaskRunner::get().run(tasks);
-
-    return ret;
-  }
-
-  void read(istream& in) {
-    for (auto op : forwardOrder_) {
-      op->read(in);
-    }
-  }
-
-  void write(ostream& out) const {
-    for (auto op : forwardOrder_) {
-      op->write(out);
-    }
-  }
-
- private:
-  IInputOperator input_;
-  IOperator output_;
-  OperatorList forwardOrder_;
-  int batchSize_;
-};
-
 struct Loss {
   Float total() const {
     return trainingLoss + regularizerLoss;
@@ -90,85 +35,23 @@ ostream& operator<<(ostream& out, Loss loss) {
   return out;
 }
 
-// Maintain an OutputFile abstraction that allows appending while allowing
-// another program to read from it.
-class OutputFile {
- public:
-  using OstreamPtr = unique_ptr<ostream, function<void(ostream*)>>;
-
-  OutputFile(string path, int cacheOstreamFor)
-      : path_(path), cacheOstreamFor_(cacheOstreamFor) {
-    runCommand("rm -f {}", path_);
-  }
-
-  ostream& openForAppend() {
-    if (cachedOstreamAccessed_ >= cacheOstreamFor_) {
-      cachedOstream_ = nullptr;
-      cachedOstreamAccessed_ = 0;
-    }
-
-    if (!cachedOstream_) {
-      runCommand("touch {}", path_);
-      runCommand("cp {} {}", path_, tmpPath());
-
-      cachedOstream_ = OstreamPtr(
-          new ofstream(tmpPath(), ios_base::out | std::ios_base::app),
-          [this](ostream* out) {
-            delete out;
-            runCommand("mv {} {}", tmpPath(), path_);
-          });
-    }
-
-    ++cachedOstreamAccessed_;
-    return *cachedOstream_;
-  }
-
- private:
-  template <typename... Args>
-  static void runCommand(string fmt, Args&&... args) {
-    auto ret =
-        system(folly::format(fmt, std::forward<Args>(args)...).str().c_str());
-    SCHECK(ret == 0);
-  }
-
-  string tmpPath() const {
-    return path_ + ".tmp";
-  }
-
-  const string path_;
-  const int cacheOstreamFor_;
-  OstreamPtr cachedOstream_;
-  int cachedOstreamAccessed_ = 0;
-};
-
 namespace {
-class JsonArrayWriter {
- public:
-  JsonArrayWriter(string name, ostream& out) : out_(out) {
-    out_ << '"' << name << '"' << ": [";
-  }
-  template <typename T>
-  void write(const T& x) {
-    out_ << sep << x;
-    sep = ", ";
-  }
-  ~JsonArrayWriter() {
-    out_ << "]";
-  }
-
- private:
-  const char* sep = "";
-  ostream& out_;
-};
+// Fewest examples computeGradient() gives a thread of its own
+constexpr int kMinShardExamples = 16;
 } // namespace
 
 void printTensorStats();
 
+template <typename T>
 class SGDTrainer {
  public:
+  // The gradients of the operators, in place
+  using GradientRefs = vector<GradientT<T>*>;
+  using Batch = typename BatchPrefetcher<T>::Batch;
+
   SGDTrainer(
-      IInputOperator input,
-      IOperator output,
+      IInputOperator<T> input,
+      IOperator<T> output,
       ExampleList examples,
       TrainingConfig trainingConfig,
       TestEvaluator evaluator)
@@ -181,15 +64,15 @@ class SGDTrainer {
             learningCurveConfig().writeTo,
             learningCurveConfig().flushEvery /
                 learningCurveConfig().writeOutEvery) {}
-  pair<IInputOperator, IOperator> train() {
-    label_ = make_shared<InputOperator>(Dims{});
-    auto lossOp = make_shared<LossOperator>(output_, label_);
+  pair<IInputOperator<T>, IOperator<T>> train() {
+    label_ = make_shared<InputOperator<T>>(Dims{});
+    auto lossOp = make_shared<LossOperator<T>>(output_, label_);
 
     // fuse softmax and loss
-    lossOp_ = make_shared<SoftmaxLossOperator>(
-        dynamic_pointer_cast<SoftmaxOperator>(output_), lossOp);
+    lossOp_ = make_shared<SoftmaxLossOperator<T>>(
+        dynamic_pointer_cast<SoftmaxOperator<T>>(output_), lossOp);
 
-    forwardPass_ = GraphBuilder::topologicalSort(input_, lossOp_);
+    forwardPass_ = GraphBuilder::topologicalSort<T>(input_, lossOp_);
     for (auto op : forwardPass_) {
       cout << op->name() << endl;
     }
@@ -213,115 +96,278 @@ class SGDTrainer {
     addRegularizer();
     backwardPass_ = buildBackwardPass(forwardPass_);
 
-    const double alpha = trainingConfig_.learningRateStrategy.alpha;
-    int exampleIndex = 0;
+    optimizer_ = Optimizer<T>::create(trainingConfig_.optimizer);
+    auto& checkpoints = trainingConfig_.checkpointConfig;
+    int start = 0;
+    if (checkpoints.resumeFrom != "") {
+      start = resume(checkpoints.resumeFrom);
+      cout << "Resuming at iteration " << start << endl;
+    }
+    unique_ptr<CheckpointWriter<T>> checkpointWriter;
+    if (checkpoints.every > 0) {
+      checkpointWriter = make_unique<CheckpointWriter<T>>(checkpoints.writeTo);
+    }
+
+    auto& data = trainingConfig_.trainingData;
+    EpochSampler sampler(
+        examples_, trainingConfig_.miniBatchSize, data.shuffle, data.seed);
+    // A resumed run goes on with the batches the first one would have seen
+    for (int i = 0; i < start; ++i) {
+      sampler.next();
+    }
+    BatchPrefetcher<T> prefetcher(
+        [&sampler]() { return sampler.next(); }, data.prefetchBatches);
+    trainStart_ = chrono::steady_clock::now();
+
+    for (int i = start; i < trainingConfig_.iterations; ++i) {
+      optimizer_->setLearningRate(trainingConfig_.learningRateStrategy.at(
+          i, trainingConfig_.iterations));
 
-    for (int i = 0; i < trainingConfig_.iterations; ++i) {
       printTotalLoss(i);
-      // printTensorStats();
 
       printEvaluationResult(i);
 
-      auto batch = prepareMiniBatch(exampleIndex);
-      auto g = computeGradient(batch);
+      auto& batch = prefetcher.next();
+      stepStart_ = TensorAllocator::stats();
+      auto g = computeGradient(batch, writesLearningCurve(i));
+      stepEnd_ = TensorAllocator::stats();
 
       if (trainingConfig_.diagnosticsConfig.verifyGradient) {
-        verifyGradient(batch, g);
+        verifyGradient(batch.examples, g);
       }
 
       // At this point we have done the forward pass
       writeLearningCurve(i);
 
       SCHECK(forwardPass_.size() + 1 == g.size());
+      addRegularizerGradient(g);
       for (size_t k = 0; k < forwardPass_.size(); ++k) {
-        // TODO: look into this copy
-        forwardPass_[k]->applyGradient(g[k] * -alpha);
+        forwardPass_[k]->applyGradient(*g[k], *optimizer_);
+      }
+
+      if (checkpointWriter && (i + 1) % checkpoints.every == 0) {
+        writeCheckpoint(*checkpointWriter, i + 1);
+      }
+
+      // The shard contexts now hold the tensors of a step in their shapes
+      if (i == start && trainingConfig_.planMemory) {
+        planMemory();
       }
-      regularizer_->applyGradient(g[forwardPass_.size()] * -alpha);
     }
   }
 
-  ExampleRange prepareMiniBatch(int& start) {
-    const int K = trainingConfig_.miniBatchSize;
-    const int N = examples_.size();
+  // Lays out the tensors of each shard (worker) in a workspace of its own;
+  // see memory_plan.h
+  void planMemory() const {
+    // Before the training plans are applied, which leave the views (adapter
+    // outputs) on the storage they had until the next pass
+    auto forwardOnly = MemoryPlanner<T>(forwardPass_).plan(shardContexts_[0]);
+
+    MemoryPlanner<T> planner(forwardPass_, backwardPass_);
+    for (size_t i = 0; i < shardContexts_.size(); ++i) {
+      auto plan = planner.apply(shardContexts_[i]);
+      cout << "Memory plan of shard " << i << ": " << plan.summary() << endl;
+      if (i == 0 && trainingConfig_.diagnosticsConfig.printMemoryPlan) {
+        plan.print(cout);
+      }
+    }
+    cout << "Forward only: " << forwardOnly.summary() << endl;
+  }
 
-    auto ret = ExampleRange(examples_, start, K);
+  // Training checkpoints hold the parameters followed by the optimizer state
+  // tensors of each parameter. The description reads
+  //   training checkpoint
+  //   iteration <the next iteration to run>
+  //   optimizer <type>
+  //   steps <the optimizer steps taken, per parameter>
+  // followed by the names of the operators of the forward pass.
+  void writeCheckpoint(CheckpointWriter<T>& writer, int iteration) const {
+    auto parameters = trainedParameters();
+    ostringstream description;
+    description << "training checkpoint\n"
+                << "iteration " << iteration << "\n"
+                << "optimizer " << name(trainingConfig_.optimizer.type) << "\n"
+                << "steps";
+    vector<const TensorT<T>*> tensors(parameters.begin(), parameters.end());
+    for (auto* w : parameters) {
+      auto& state = optimizer_->state(*w);
+      description << " " << state.steps;
+      for (auto& t : state.tensors) {
+        tensors.push_back(&t);
+      }
+    }
+    description << "\n" << architecture();
+    writer.write(description.str(), tensors);
+  }
 
-    start = (start + K) % N;
+  // Loads the parameters and the optimizer state of a training checkpoint;
+  // returns the iteration to continue from
+  int resume(const string& file) {
+    auto checkpoint = Checkpoint<T>::read(file);
+    auto parameters = trainedParameters();
+
+    istringstream in(checkpoint.description());
+    expectToken(in, "training");
+    expectToken(in, "checkpoint");
+    expectToken(in, "iteration");
+    const int iteration = expect<int>(in);
+    expectToken(in, "optimizer");
+    auto optimizer = expect<string>(in);
+    SCHECK_MSG(
+        optimizer == name(trainingConfig_.optimizer.type),
+        folly::format("{} was trained with {}", file, optimizer));
+    expectToken(in, "steps");
+    vector<long> steps;
+    for (size_t i = 0; i < parameters.size(); ++i) {
+      steps.push_back(expect<long>(in));
+    }
+    SCHECK(in.get() == '\n');
+    const string trainedArchitecture{istreambuf_iterator<char>(in), {}};
+    SCHECK_MSG(
+        trainedArchitecture == architecture(),
+        folly::format(
+            "{} is a training checkpoint of\n{}not of\n{}",
+            file,
+            trainedArchitecture,
+            architecture()));
+
+    auto& tensors = checkpoint.tensors();
+    size_t k = 0;
+    auto load = [&](TensorT<T>& t) {
+      SCHECK(k < tensors.size() && tensors[k].dims() == t.dims());
+      t = move(tensors[k++]);
+    };
+    for (auto* w : parameters) {
+      load(*w);
+    }
+    for (size_t i = 0; i < parameters.size(); ++i) {
+      auto& state = optimizer_->state(*parameters[i]);
+      state.steps = steps[i];
+      for (auto& t : state.tensors) {
+        load(t);
+      }
+    }
+    SCHECK(k == tensors.size());
+    return iteration;
+  }
+
+  vector<TensorT<T>*> trainedParameters() const {
+    vector<TensorT<T>*> ret;
+    for (auto op : forwardPass_) {
+      for (auto* w : op->parameters()) {
+        ret.push_back(w);
+      }
+    }
     return ret;
   }
 
-  void loadBatch(const ExampleRange& batch) const {
-    input_->load(batch, false);
-    label_->load(batch, true);
+  string architecture() const {
+    ostringstream out;
+    for (auto op : forwardPass_) {
+      out << op->name() << endl;
+    }
+    return out.str();
   }
 
-  // TODO: this would not be completely correct after we perform multithreaded
-  // execution
-  void writeLearningCurve(int iteration) {
-    if (iteration %
-            trainingConfig_.diagnosticsConfig.learningCurveConfig
-                .writeOutEvery !=
-        0) {
-      return;
+  // The optimizer keeps one state per parameter, so it has to see a single
+  // gradient for it: adds the gradient of the regularizer (the last entry of
+  // g) into that of the operator owning each regularized parameter
+  void addRegularizerGradient(const GradientRefs& g) const {
+    auto& rg = *g.back();
+    auto regularized = regularizer_->getParameterList();
+    SCHECK(rg.size() == regularized.size());
+    for (size_t k = 0; k + 1 < g.size(); ++k) {
+      auto parameters = forwardPass_[k]->getParameterList();
+      for (size_t j = 0; j < parameters.size(); ++j) {
+        auto it = find(regularized.begin(), regularized.end(), parameters[j]);
+        if (it != regularized.end()) {
+          (*g[k])[j] += rg[it - regularized.begin()];
+        }
+      }
     }
+  }
 
-    auto& out = learningCurveOutput_.openForAppend();
+  void loadBatch(ExecutionContext<T>& ctx, const ExampleRange& batch) const {
+    input_->load(ctx, batch, false);
+    label_->load(ctx, batch, true);
+  }
 
-    // Write Json format
+  void loadBatch(
+      ExecutionContext<T>& ctx,
+      const Batch& batch,
+      int begin,
+      int end) const {
+    input_->load(ctx, batch.input, begin, end);
+    label_->load(ctx, batch.label, begin, end);
+  }
 
-    out << "{ ";
+  // TODO: this would not be completely correct after we perform multithreaded
+  // execution
+  bool writesLearningCurve(int iteration) const {
+    return iteration % learningCurveConfig().writeOutEvery == 0;
+  }
 
-    out << folly::format("\"iteration\": {}, ", iteration);
-    out << folly::format(
-        "\"loss\": {}, ", getTotalLoss(Vector{lossOp_->get()}(0)).trainingLoss);
+  void writeLearningCurve(int iteration) {
+    if (!writesLearningCurve(iteration)) {
+      return;
+    }
 
-    {
-      JsonArrayWriter writer("w.norm", out);
-      for (auto op : forwardPass_) {
-        if (dynamic_pointer_cast<RegularizerOperator>(op)) {
-          continue;
-        }
-        for (auto* w : op->getParameterList()) {
-          writer.write(w->l2Norm());
-        }
+    auto& record = learningCurveOutput_.begin();
+    // The loss, outputs and input gradients are those of the first shard;
+    // its parameter gradients hold the sum over all shards
+    auto& ctx = shardContexts_[0];
+
+    record.add("iteration", iteration);
+    // The learning rate this step applies and the wall time since training
+    // started, to compare schedules by time to accuracy
+    record.add("lr", optimizer_->learningRate());
+    record.add(
+        "seconds",
+        chrono::duration<double>(chrono::steady_clock::now() - trainStart_)
+            .count());
+    record.add(
+        "loss", getTotalLoss(VectorT<T>{lossOp_->get(ctx)}(0)).trainingLoss);
+    // Tensor allocations made by computeGradient() for this step
+    record.add(
+        "alloc.count", stepEnd_.allocations() - stepStart_.allocations());
+    record.add(
+        "alloc.system",
+        stepEnd_.systemAllocations - stepStart_.systemAllocations);
+    record.add(
+        "alloc.ms", (stepEnd_.allocateNanos - stepStart_.allocateNanos) / 1e6);
+
+    auto& wNorm = record.addArray("w.norm");
+    for (auto op : forwardPass_) {
+      if (dynamic_pointer_cast<RegularizerOperator<T>>(op)) {
+        continue;
+      }
+      for (auto* w : op->getParameterList()) {
+        wNorm.push_back(w->l2Norm());
       }
     }
 
-    {
-      out << " , ";
-      JsonArrayWriter writer("w.g.norm", out);
-      for (auto op : reverse(backwardPass_)) {
-        for (auto& g : op->parameterGradient()) {
-          writer.write(g.l2Norm());
-        }
+    auto& wgNorm = record.addArray("w.g.norm");
+    for (auto op : reverse(backwardPass_)) {
+      for (auto& g : op->parameterGradient(ctx)) {
+        wgNorm.push_back(g.l2Norm());
       }
     }
 
-    {
-      out << " , ";
-      JsonArrayWriter writer("x.g.norm", out);
-      for (auto op : reverse(backwardPass_)) {
-        for (auto& g : op->inputGradient()) {
-          writer.write(g.l2Norm());
-        }
-      }
+    auto& xgNorm = record.addArray("x.g.norm");
+    for (auto& norms : reverse(inputGradientNorms_)) {
+      xgNorm.insert(xgNorm.end(), norms.begin(), norms.end());
     }
 
-    {
-      out << " , ";
-      JsonArrayWriter writer("out.norm", out);
-      for (auto op : forwardPass_) {
-        if (dynamic_pointer_cast<RegularizerOperator>(op)) {
-          continue;
-        }
-        // writer.write(op->name());
-        // writer.write(op->get());
-        writer.write(op->get().l2Norm());
+    auto& outNorm = record.addArray("out.norm");
+    for (auto op : forwardPass_) {
+      if (dynamic_pointer_cast<RegularizerOperator<T>>(op)) {
+        continue;
       }
+      outNorm.push_back(op->get(ctx).l2Norm());
     }
 
-    out << "}" << endl;
+    // Formatted and written out on the writer's thread
+    learningCurveOutput_.commit();
   }
 
   void printTotalLoss(int i) {
@@ -331,6 +377,7 @@ class SGDTrainer {
 
     auto loss = runForwardPassAndComputeLoss(ExampleRange(examples_));
     cout << "i=" << i << " loss: " << getTotalLoss(loss) << endl;
+    printTensorStats();
 
     for (auto op : forwardPass_) {
       op->setDiagnostics(true);
@@ -340,7 +387,7 @@ class SGDTrainer {
   void printEvaluationResult(int i) {
     if (evaluator_ &&
         i % trainingConfig_.diagnosticsConfig.testErrorIterations == 0) {
-      auto model = make_shared<ForwardPassModel>(
+      auto model = make_shared<ForwardPassModel<T>>(
           input_, output_, trainingConfig_.evaluationBatchSize);
       cout << folly::format(
                   "i={} test error rate={}%", i, evaluator_(model) * 100)
@@ -350,7 +397,7 @@ class SGDTrainer {
 
   void addRegularizer() {
     if (trainingConfig_.regularizerConfig.policy == RegularizerConfig::L2) {
-      regularizer_ = make_shared<L2RegularizerOperator>(
+      regularizer_ = make_shared<L2RegularizerOperator<T>>(
           trainingConfig_.regularizerConfig.lambda);
     }
     if (!regularizer_) {
@@ -363,8 +410,9 @@ class SGDTrainer {
     // forwardPass_.push_back(regularizer_);
   }
 
-  BackPropOperatorList buildBackwardPass(const OperatorList& forwardPass) {
-    BackPropOperatorList ret;
+  BackPropOperatorList<T> buildBackwardPass(
+      const OperatorList<T>& forwardPass) {
+    BackPropOperatorList<T> ret;
 
     for (auto op : reverse(forwardPass)) {
       ret.push_back(op->getBackPropOperator());
@@ -393,108 +441,180 @@ class SGDTrainer {
   Float runForwardPassAndComputeLoss(ExampleRange batch) const {
     auto batches = batch.splitByBatchSize(trainingConfig_.evaluationBatchSize);
     // cout << "Threaded batch size: " << batches.size() << endl;
-    int T = batches.size();
+    int n = batches.size();
 
     lossOp_->setWeight(1.0 / batch.size());
-    vector<Float> losses(T, 0.0);
-    vector<TaskRunner::Task> tasks;
-    for (int i = 0; i < T; ++i) {
-      tasks.push_back([this, i, &batches, &losses]() {
-        loadBatch(batches[i]);
-        losses[i] = computeLoss();
-      });
-    }
-
-    TaskRunner::get().run(tasks);
+    vector<Float> losses(n, 0.0);
+    TaskRunner::get().parallelFor(0, n, 1, [&](int first, int last) {
+      auto ctx = evaluationContexts_.acquire();
+      for (int i = first; i < last; ++i) {
+        loadBatch(*ctx, batches[i]);
+        losses[i] = computeLoss(*ctx);
+      }
+    });
 
     return accumulate(losses.begin(), losses.end(), 0.0);
   }
 
-  Float computeLoss() const {
+  Float computeLoss(ExecutionContext<T>& ctx) const {
     // cout << "compute loss" << endl;
     for (auto op : forwardPass_) {
       // cout << "eval " << op->name() << endl;
-      op->compute();
+      op->compute(ctx);
     }
     // cout << "forward pass" << endl;
-    return Vector{lossOp_->get()}(0);
+    return VectorT<T>{lossOp_->get(ctx)}(0);
   }
 
   Loss getTotalLoss(Float loss) const {
     Float regularizerLoss = 0.0;
     if (regularizer_) {
-      regularizer_->compute();
-      regularizerLoss = Vector{regularizer_->get()}(0);
+      regularizer_->compute(regularizerContext_);
+      regularizerLoss = VectorT<T>{regularizer_->get(regularizerContext_)}(0);
     }
 
     return Loss{loss, regularizerLoss};
   }
 
-  // return gradient from each operator following the forward order
-  GradientList computeGradient(ExampleRange batch) const {
+  // return gradient from each operator following the forward order, then
+  // that of the regularizer. They point into the gradient buffers of the
+  // first shard context and the regularizer context and are valid until the
+  // next call. traceInputGradients fills inputGradientNorms_.
+  GradientRefs computeGradient(
+      const Batch& batch,
+      bool traceInputGradients = false) const {
     SCHECK(forwardPass_.size() == backwardPass_.size());
 
-    lossOp_->setWeight(1.0 / batch.size());
-
-    int T = TaskRunner::get().nThreads();
-    auto batches = batch.splitToNBatches(T);
-    T = batches.size();
-
-    vector<TaskRunner::Task> tasks;
-    tasks.reserve(T);
-    vector<GradientList> gradientsPerThread(
-        T, GradientList(forwardPass_.size()));
+    const int size = batch.examples.size();
+    lossOp_->setWeight(1.0 / size);
+
+    // Small mini-batches get fewer shards, and the threads that frees up
+    // parallelize the GEMMs and convolutions within each shard. Shard i
+    // takes its rows [i * per, (i + 1) * per) out of the batch; the last
+    // one also takes the remainder.
+    auto plan = TaskRunner::plan(size, kMinShardExamples);
+    const int n = min(plan.shards, size);
+    const int per = size / n;
+    if (static_cast<int>(shardContexts_.size()) < n) {
+      shardContexts_.resize(n);
+    }
 
-    for (int i = 0; i < T; ++i) {
-      tasks.push_back([this, i, &batches, &gradientsPerThread]() {
-        loadBatch(batches[i]);
+    TaskRunner::get().parallelFor(
+        0,
+        n,
+        1,
+        [&](int first, int last) {
+          TaskRunner::ThreadBudget budget{plan.threadsPerShard};
+          for (int i = first; i < last; ++i) {
+            auto& ctx = shardContexts_[i];
+            loadBatch(ctx, batch, i * per, i == n - 1 ? size : (i + 1) * per);
+
+            runForwardPass(ctx);
+
+            // backward pass
+            for (size_t b = 0; b < backwardPass_.size(); ++b) {
+              backwardPass_[b]->runBackProp(ctx);
+              if (i == 0 && traceInputGradients) {
+                traceInputGradient(b, ctx);
+              }
+            }
+          }
+        },
+        plan.shards);
 
-        runForwardPass();
+    reduceGradients(n);
 
-        // backward pass
-        int index = backwardPass_.size() - 1;
-        for (auto op : backwardPass_) {
-          op->runBackProp();
+    regularizerBackOp_->runBackProp(regularizerContext_);
+    // cout << "Regularizer gradient size: "
+    //      << regularizerBackOp_->parameterGradient().size() << endl;
 
-          // TODO: look into this copy
-          // (e.g. we can make a shallow shared copy;
-          // need to write a unit test to verify).
-          gradientsPerThread[i][index] = op->parameterGradient();
+    GradientRefs ret(forwardPass_.size() + 1);
+    for (size_t b = 0; b < backwardPass_.size(); ++b) {
+      ret[backwardPass_.size() - 1 - b] =
+          &backwardPass_[b]->parameterGradient(shardContexts_[0]);
+    }
+    ret.back() = &regularizerBackOp_->parameterGradient(regularizerContext_);
+    return ret;
+  }
 
-          // if (op->name() == "l2_regularizer_grad") {
-          //   cout << "compute gradient: " << gradients[index][0].data()[0]
-          //   << endl;
-          // }
-          --index;
-        }
-      });
+  // Right after backprop operator b ran: the memory plan may hand the storage
+  // of an input gradient to another tensor once the operator below consumed
+  // it
+  void traceInputGradient(size_t b, ExecutionContext<T>& ctx) const {
+    inputGradientNorms_.resize(backwardPass_.size());
+    auto& norms = inputGradientNorms_[b];
+    norms.clear();
+    for (auto& g : backwardPass_[b]->inputGradient(ctx)) {
+      norms.push_back(g.l2Norm());
     }
+  }
 
-    TaskRunner::get().run(tasks);
+  // Adds the parameter gradients of shards 1 .. n-1 into those of shard 0,
+  // which then hold the gradient of the whole mini-batch; with one shard
+  // there is nothing to do. The parameters are cut into slices of
+  // kReduceSlice elements and each task adds up one slice across all shards
+  // (a reduce-scatter without the gather).
+  void reduceGradients(int n) const {
+    // Elements per task: a slice of every shard stays in L2
+    constexpr int kReduceSlice = 1 << 13;
 
-    for (int i = 1; i < T; ++i) {
-      for (int j = 0; j < gradientsPerThread[0].size(); ++j) {
-        for (int k = 0; k < gradientsPerThread[0][j].size(); ++k) {
-          gradientsPerThread[0][j][k] += gradientsPerThread[i][j][k];
+    if (n <= 1) {
+      return;
+    }
+    struct Segment {
+      T* dst;
+      vector<const T*> srcs;
+      // Offset of the segment in the concatenation of all parameters
+      size_t begin;
+    };
+    vector<Segment> segments;
+    size_t total = 0;
+    for (auto& op : backwardPass_) {
+      auto& g0 = op->parameterGradient(shardContexts_[0]);
+      for (size_t k = 0; k < g0.size(); ++k) {
+        Segment segment{g0[k].data().begin(), {}, total};
+        for (int i = 1; i < n; ++i) {
+          auto& g = op->parameterGradient(shardContexts_[i])[k];
+          SCHECK(g.dims() == g0[k].dims());
+          segment.srcs.push_back(g.data().begin());
         }
+        total += g0[k].total();
+        segments.push_back(move(segment));
       }
     }
+    if (total == 0) {
+      return;
+    }
 
-    auto gradientList = std::move(gradientsPerThread[0]);
-    regularizerBackOp_->runBackProp();
-    // cout << "Regularizer gradient size: "
-    //      << regularizerBackOp_->parameterGradient().size() << endl;
-    gradientList.push_back(regularizerBackOp_->parameterGradient());
-    return gradientList;
+    TaskRunner::get().parallelFor(
+        0, static_cast<int>(total), kReduceSlice, [&](int first, int last) {
+          // The last segment starting at or before first
+          auto it = upper_bound(
+              segments.begin(),
+              segments.end(),
+              static_cast<size_t>(first),
+              [](size_t x, const Segment& s) { return x < s.begin; });
+          for (--it; first < last; ++it) {
+            size_t end = it + 1 == segments.end()
+                ? last
+                : min<size_t>((it + 1)->begin, last);
+            const size_t offset = first - it->begin;
+            const size_t len = end - first;
+            for (auto* src : it->srcs) {
+              kernels::add(it->dst + offset, src + offset, len);
+            }
+            first = end;
+          }
+        });
   }
 
-  void runForwardPass() const {
+  void runForwardPass(ExecutionContext<T>& ctx) const {
     for (auto op : forwardPass_) {
-      op->compute();
+      op->compute(ctx);
     }
   }
 
-  void verifyGradient(const ExampleRange& batch, const GradientList& g) const {
+  void verifyGradient(const ExampleRange& batch, const GradientRefs& g) const {
     const double eps = 1e-2;
     auto gDebug = computeGradientDebug(batch);
     SCHECK_MSG(
@@ -502,17 +622,18 @@ class SGDTrainer {
         folly::format("{} vs {}", g.size() == gDebug.size()).str());
 
     for (int i = 0; i < static_cast<int>(g.size()); ++i) {
-      SCHECK(g[i].size() == gDebug[i].size());
-      for (int j = 0; j < static_cast<int>(g[i].size()); ++j) {
-        // cout << "gradient: " << g[i][j] << endl;
+      auto& gi = *g[i];
+      SCHECK(gi.size() == gDebug[i].size());
+      for (int j = 0; j < static_cast<int>(gi.size()); ++j) {
+        // cout << "gradient: " << gi[j] << endl;
         // cout << "debug gradient: " << gDebug[i][j] << endl;
 
-        if (!g[i][j].equals(gDebug[i][j], eps)) {
+        if (!gi[j].equals(gDebug[i][j], eps)) {
           auto name = i < forwardPass_.size() ? forwardPass_[i]->name()
                                               : regularizer_->name();
           cout << folly::format("{} #{} gradient not equal:\n", name, j);
           if (trainingConfig_.diagnosticsConfig.gradientVerifyDetails) {
-            cout << "gradient: " << g[i][j] << endl;
+            cout << "gradient: " << gi[j] << endl;
             cout << "debug gradient: " << gDebug[i][j] << endl;
             SCHECK(false);
           }
@@ -527,15 +648,13 @@ class SGDTrainer {
     }
   }
 
-  GradientList computeGradientDebug(ExampleRange batch) const {
-    GradientList gradients;
+  GradientListT<T> computeGradientDebug(ExampleRange batch) const {
+    GradientListT<T> gradients;
     gradients.reserve(forwardPass_.size());
 
     for (auto op : forwardPass_) {
       gradients.push_back(op->computeGradientDebug([this, &batch]() {
         // TODO: This reloads the input for every forward pass
-        // This is necessary to ensure thread local inputs are accessed
-        // correctly
 
         // Note: this should not include the regularization term
         return runForwardPassAndComputeLoss(batch);
@@ -553,47 +672,91 @@ class SGDTrainer {
     return gradients;
   }
 
-  IInputOperator input_;
-  IOperator output_;
+  IInputOperator<T> input_;
+  IOperator<T> output_;
   ExampleList examples_;
   TrainingConfig trainingConfig_;
   // should never be used to influence trainer's behavior
   TestEvaluator evaluator_;
-  OutputFile learningCurveOutput_;
-
-  IInputOperator label_;
-  ILossOperator lossOp_;
-  IRegularizerOperator regularizer_;
-  OperatorList forwardPass_;
-  BackPropOperatorList backwardPass_;
-  IBackPropOperator regularizerBackOp_;
+  MetricsWriter learningCurveOutput_;
+
+  IInputOperator<T> label_;
+  ILossOperator<T> lossOp_;
+  IRegularizerOperator<T> regularizer_;
+  OperatorList<T> forwardPass_;
+  BackPropOperatorList<T> backwardPass_;
+  IBackPropOperator<T> regularizerBackOp_;
+  unique_ptr<Optimizer<T>> optimizer_;
+
+  // One per shard of computeGradient(), kept across mini-batches
+  mutable vector<ExecutionContext<T>> shardContexts_;
+  mutable ExecutionContextPool<T> evaluationContexts_;
+  // The regularizer is not part of the graph and runs on its own
+  mutable ExecutionContext<T> regularizerContext_;
+  // Of the input gradients of each backprop operator in the first shard; see
+  // traceInputGradient()
+  mutable vector<vector<double>> inputGradientNorms_;
+
+  TensorAllocator::Stats stepStart_{};
+  TensorAllocator::Stats stepEnd_{};
+  chrono::steady_clock::time_point trainStart_;
 };
 
-IModel Trainer::train(
+namespace {
+
+template <typename T>
+IModel trainIn(
     ExampleList examples,
     TrainingConfig trainingConfig,
     TestEvaluator evaluator) {
-  cout << trainingConfig << endl;
-
-  auto ops = GraphBuilder::buildMLP(
-      Tensor{examples, false}.dims()[1], 10, trainingConfig.modelArch);
-  ops = SGDTrainer(ops.first, ops.second, examples, trainingConfig, evaluator)
-            .train();
+  auto ops = GraphBuilder::buildMLP<T>(
+      Example::rows * Example::cols, N_CLASS, trainingConfig.modelArch);
+  ops =
+      SGDTrainer<T>(ops.first, ops.second, examples, trainingConfig, evaluator)
+          .train();
 
   cout << trainingConfig << endl;
 
-  auto model = make_shared<ForwardPassModel>(
+  auto model = make_shared<ForwardPassModel<T>>(
       ops.first, ops.second, trainingConfig.evaluationBatchSize);
-  if (trainingConfig.modelArch.readModelFrom != "") {
-    ifstream in(trainingConfig.modelArch.readModelFrom);
-    SCHECK(!in.fail());
-    model->read(in);
+  auto& readFrom = trainingConfig.modelArch.readModelFrom;
+  if (readFrom != "") {
+    model->load(readFrom);
   }
 
   if (trainingConfig.writeModelTo != "") {
-    ofstream out(trainingConfig.writeModelTo);
-    model->write(out);
+    if (trainingConfig.modelFormat == ModelFormat::Binary) {
+      model->writeCheckpoint(trainingConfig.writeModelTo);
+    } else {
+      ofstream out(trainingConfig.writeModelTo);
+      model->write(out);
+    }
   }
 
   return model;
 }
+
+} // namespace
+
+IModel Trainer::train(
+    ExampleList examples,
+    TrainingConfig trainingConfig,
+    TestEvaluator evaluator) {
+  // Finite differences are too noisy in fp32 to check gradients against
+  if (trainingConfig.diagnosticsConfig.verifyGradient &&
+      trainingConfig.precision == Precision::FP32) {
+    cout << "verifyGradient requires fp64; training in fp64" << endl;
+    trainingConfig.precision = Precision::FP64;
+  }
+
+  cout << trainingConfig << endl;
+
+  switch (trainingConfig.precision) {
+    case Precision::FP32:
+      return trainIn<float>(examples, trainingConfig, evaluator);
+    case Precision::FP64:
+      return trainIn<double>(examples, trainingConfig, evaluator);
+  }
+  SCHECK(false);
+  return nullptr;
+}